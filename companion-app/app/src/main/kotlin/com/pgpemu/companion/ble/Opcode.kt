@@ -19,4 +19,10 @@ object Opcode {
     const val TOGGLE_AUTOSPIN: Int = 0x10
     const val TOGGLE_AUTOCATCH: Int = 0x11
     const val GET_CLIENT_SUMMARY: Int = 0x12
+    const val SET_ENTROPY_SEED: Int = 0x13  // firmware built with CONFIG_PGPEMU_DEBUG_ENTROPY only
+    const val GET_HANDSHAKE_LATENCY: Int = 0x14
+    const val GET_NVS_STATS: Int = 0x15
+    const val DEVICE_STORE: Int = 0x16
+    const val GET_DEVICE_STATS: Int = 0x17
+    const val GET_METRICS: Int = 0x18
 }
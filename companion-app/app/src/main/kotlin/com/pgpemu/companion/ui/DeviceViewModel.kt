@@ -14,11 +14,10 @@ import kotlinx.coroutines.flow.update
 import kotlinx.coroutines.launch
 import javax.inject.Inject
 
-// ponytail: CONFIG_BT_ACL_CONNECTIONS is compile-time on the firmware side
-// (pgpemu-esp32/sdkconfig) with no opcode to read it at runtime; hardcode
-// here, bump both sides together if the firmware value ever changes.
+// Slot count until GET_GLOBAL_SETTINGS says otherwise: firmware reports its
+// MAX_CONNECTIONS (CONFIG_BT_ACL_CONNECTIONS) in payload byte 4, older builds
+// send 4 bytes and always had 4 slots.
 const val DEVICE_PROFILE_COUNT = 4
-const val MAX_CONNECTIONS_LIMIT = 4
 
 data class DeviceUiState(
     val connectionState: ConnectionState = ConnectionState.Idle,
@@ -50,6 +49,7 @@ data class ProfileState(
 
 data class SettingsState(
     val maxConnections: Int? = null,
+    val connectionSlots: Int = DEVICE_PROFILE_COUNT,
 )
 
 data class DiagnosticsState(
@@ -131,6 +131,7 @@ class DeviceViewModel @Inject constructor(
             _uiState.update { it.copy(isBusy = true, errorMessage = null) }
             runStep(Opcode.GET_GLOBAL_SETTINGS) { frame ->
                 val p = frame.payload
+                val slots = if (p.size > 4) p[4].toInt() and 0xFF else DEVICE_PROFILE_COUNT
                 _uiState.update {
                     it.copy(
                         status = it.status.copy(
@@ -138,7 +139,8 @@ class DeviceViewModel @Inject constructor(
                             advertisingEnabled = p[1] == 1.toByte(),
                             activeConnections = p[2].toInt() and 0xFF,
                         ),
-                        settings = it.settings.copy(maxConnections = p[3].toInt() and 0xFF),
+                        profiles = List(slots) { i -> it.profiles.getOrNull(i) ?: ProfileState(index = i) },
+                        settings = it.settings.copy(maxConnections = p[3].toInt() and 0xFF, connectionSlots = slots),
                     )
                 }
             }
@@ -149,7 +151,7 @@ class DeviceViewModel @Inject constructor(
                 val summaries = parseClientSummary(frame.payload)
                 _uiState.update { s ->
                     s.copy(profiles = s.profiles.mapIndexed { i, p ->
-                        val summary = summaries[i]
+                        val summary = summaries.getOrNull(i) ?: return@mapIndexed p
                         p.copy(
                             connected = summary.connected,
                             autospin = summary.autospin ?: p.autospin,
@@ -169,7 +171,7 @@ class DeviceViewModel @Inject constructor(
     }
 
     fun setMaxConnections(value: Int) {
-        val clamped = value.coerceIn(1, MAX_CONNECTIONS_LIMIT)
+        val clamped = value.coerceIn(1, _uiState.value.settings.connectionSlots)
         runCommand(Opcode.SET_MAX_CONNECTIONS, byteArrayOf(clamped.toByte())) {
             _uiState.update { it.copy(settings = it.settings.copy(maxConnections = clamped)) }
         }
@@ -231,7 +233,7 @@ class DeviceViewModel @Inject constructor(
                         val summaries = parseClientSummary(frame.payload)
                         _uiState.update { s ->
                             s.copy(profiles = s.profiles.mapIndexed { i, p ->
-                                val summary = summaries[i]
+                                val summary = summaries.getOrNull(i) ?: return@mapIndexed p
                                 p.copy(
                                     connected = summary.connected,
                                     caught = summary.caught,
@@ -282,10 +284,10 @@ private data class ClientSummary(
 private const val CLIENT_SUMMARY_RECORD_SIZE = 11
 
 // Decodes CONTROL_OP_GET_CLIENT_SUMMARY's fixed-layout binary payload —
-// DEVICE_PROFILE_COUNT records of CLIENT_SUMMARY_RECORD_SIZE bytes each,
+// one record of CLIENT_SUMMARY_RECORD_SIZE bytes per firmware slot,
 // see pgp_control.c's CONTROL_OP_GET_CLIENT_SUMMARY case for the layout.
 private fun parseClientSummary(payload: ByteArray): List<ClientSummary> =
-    (0 until DEVICE_PROFILE_COUNT).map { slot ->
+    (0 until payload.size / CLIENT_SUMMARY_RECORD_SIZE).map { slot ->
         val base = slot * CLIENT_SUMMARY_RECORD_SIZE
         fun u16(offset: Int) = (payload[base + offset].toInt() and 0xFF) or
             ((payload[base + offset + 1].toInt() and 0xFF) shl 8)
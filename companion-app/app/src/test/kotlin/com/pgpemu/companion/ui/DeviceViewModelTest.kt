@@ -116,6 +116,46 @@ class DeviceViewModelTest {
         assertEquals(true, state.profiles[2].autocatch)
     }
 
+    @Test
+    fun `refreshStatus sizes profiles from the slot count the firmware reports`() = runTest {
+        val repository = FakeBleControlRepository()
+        repository.stubResponse(
+            Opcode.GET_GLOBAL_SETTINGS,
+            Result.success(ResponseFrame(StatusCode.OK, Opcode.GET_GLOBAL_SETTINGS.toByte(), byteArrayOf(2, 1, 6, 8, 9))),
+        )
+        repository.stubResponse(
+            Opcode.GET_LED_STATE,
+            Result.success(ResponseFrame(StatusCode.OK, Opcode.GET_LED_STATE.toByte(), byteArrayOf(0))),
+        )
+        repository.stubResponse(
+            Opcode.GET_CLIENT_SUMMARY,
+            Result.success(
+                ResponseFrame(
+                    StatusCode.OK,
+                    Opcode.GET_CLIENT_SUMMARY.toByte(),
+                    (0 until 8).fold(ByteArray(0)) { acc, _ -> acc + emptyClientSummarySlot() } +
+                        clientSummarySlotBytes(connId = 9, hasSettings = true, autospin = true, autocatch = true),
+                ),
+            ),
+        )
+        val viewModel = DeviceViewModel(repository)
+
+        viewModel.refreshStatus()
+        dispatcher.scheduler.advanceUntilIdle()
+
+        val state = viewModel.uiState.value
+        assertEquals(9, state.settings.connectionSlots)
+        assertEquals(8, state.settings.maxConnections)
+        assertEquals(9, state.profiles.size)
+        assertEquals(8, state.profiles[8].index)
+        assertEquals(true, state.profiles[8].connected)
+        assertEquals(true, state.profiles[8].autocatch)
+
+        viewModel.setMaxConnections(12)
+        dispatcher.scheduler.advanceUntilIdle()
+        assertEquals(9, repository.sentCommands.last().second[0].toInt())
+    }
+
     @Test
     fun `toggleAdvertising sends ADVERTISE_START and updates state when turning on`() = runTest {
         val repository = FakeBleControlRepository()
@@ -81,7 +81,9 @@ bool reset_secrets() {
     }
 
     nvs_erase_all(handle);
-    nvs_commit(handle);
+    if (!nvs_commit_and_close(CONFIG_SECRETS_TAG, handle, namespace)) {
+        return false;
+    }
 
     ESP_LOGI(CONFIG_SECRETS_TAG, "deleted secrets");
 
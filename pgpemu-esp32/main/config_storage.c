@@ -1,6 +1,8 @@
 #include "config_storage.h"
 
 #include "config_secrets.h"
+#include "device_directory.h"
+#include "device_keys.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
@@ -9,29 +11,21 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "nvs_helper.h"
+#include "nvs_writer.h"
 #include "pgp_handshake_multi.h"
+#include "session_cache.h"
 #include "settings.h"
 
-#include <stdio.h>
 #include <string.h>
 
 // global settings keys
 static const char KEY_CONNECTION_COUNT[] = "maxcon";
 static const char KEY_LOG_LEVEL[] = "llevel";
 static const char KEY_ADVERTISING_ENABLED[] = "adv";
+static const char KEY_MAX_STORED_DEVICES[] = "maxdev";
 
-// device settings keys
-static const char KEY_AUTOCATCH[] = "catch";
-static const char KEY_AUTOSPIN[] = "spin";
-
-// FNV-1a hash constants
-static const uint64_t FNV1A_OFFSET_BASIS = 1469598103934665603ULL;  // FNV-1a 64-bit offset basis
-static const uint64_t FNV1A_PRIME = 1099511628211ULL;               // FNV-1a 64-bit prime
-static const int NVS_KEY_MAX_LEN = 15;                              // NVS key max length (15 chars + null)
-static const int DEVICE_KEY_BUFFER_SIZE = 64;                       // Buffer for concatenated key + BDA
-
-// Forward declaration
-char* make_device_key_for_option(const char* key, const esp_bd_addr_t bda, char* out);
+// last device_record_t.last_seen handed out, the records are under the per-phone keys of device_keys.h
+static const char KEY_RECORD_CLOCK[] = "seen";
 
 void init_settings_nvs_partition() {
     esp_err_t err = ESP_OK;
@@ -52,6 +46,7 @@ void read_stored_global_settings(bool use_mutex) {
     uint8_t log_level = 0;
     uint8_t connection_count = 0;
     uint8_t advertising_enabled = 1;
+    uint8_t max_stored_devices = DEVICE_STORE_DEFAULT_CAPACITY;
 
     if (use_mutex) {
         if (!mutex_acquire_blocking(global_settings.mutex)) {
@@ -74,19 +69,30 @@ void read_stored_global_settings(bool use_mutex) {
     }
     err = nvs_get_u8(global_settings_handle, KEY_CONNECTION_COUNT, &connection_count);
     if (nvs_read_check(CONFIG_STORAGE_TAG, err, KEY_CONNECTION_COUNT)) {
-        if (connection_count <= CONFIG_BT_ACL_CONNECTIONS && connection_count > 0) {
+        if (connection_count <= MAX_CONNECTIONS && connection_count > 0) {
             global_settings.target_active_connections = connection_count;
         } else {
             ESP_LOGE(CONFIG_STORAGE_TAG,
                 "invalid target active connections: %d (1-%d allowed)",
                 connection_count,
-                CONFIG_BT_ACL_CONNECTIONS);
+                MAX_CONNECTIONS);
         }
     }
     err = nvs_get_u8(global_settings_handle, KEY_ADVERTISING_ENABLED, &advertising_enabled);
     if (nvs_read_check(CONFIG_STORAGE_TAG, err, KEY_ADVERTISING_ENABLED)) {
         global_settings.advertising_enabled = advertising_enabled != 0;
     }
+    err = nvs_get_u8(global_settings_handle, KEY_MAX_STORED_DEVICES, &max_stored_devices);
+    if (nvs_read_check(CONFIG_STORAGE_TAG, err, KEY_MAX_STORED_DEVICES)) {
+        if (max_stored_devices <= DEVICE_DIRECTORY_SIZE && max_stored_devices > 0) {
+            global_settings.max_stored_devices = max_stored_devices;
+        } else {
+            ESP_LOGE(CONFIG_STORAGE_TAG,
+                "invalid max stored devices: %d (1-%d allowed)",
+                max_stored_devices,
+                DEVICE_DIRECTORY_SIZE);
+        }
+    }
 
     nvs_safe_close(global_settings_handle);
 
@@ -121,10 +127,6 @@ bool read_stored_device_settings(esp_bd_addr_t bda, DeviceSettings* out_settings
         return false;
     }
 
-    // Initialize default values
-    int8_t autocatch = 0;
-    int8_t autospin = 0;
-
     // Set defaults
     out_settings->autocatch = 1;
     out_settings->autospin = 1;
@@ -145,6 +147,24 @@ bool read_stored_device_settings(esp_bd_addr_t bda, DeviceSettings* out_settings
         return false;
     }
 
+    // seen since boot, RAM holds the same (or newer, unsaved) values
+    if (session_cache_get_settings(bda, &out_settings->autocatch, &out_settings->autospin)) {
+        mutex_release(out_settings->mutex);
+        ESP_LOGI(CONFIG_STORAGE_TAG, "device_settings read from cache");
+        return true;
+    }
+
+    device_keys_t keys;
+    get_device_keys(bda, &keys);
+
+    // never stored settings, the defaults it is
+    if (!device_directory_may_have(&keys, DEVICE_RECORD_HAS_SETTINGS)) {
+        session_cache_put_settings(bda, out_settings->autocatch, out_settings->autospin);
+        mutex_release(out_settings->mutex);
+        ESP_LOGI(CONFIG_STORAGE_TAG, "device_settings not stored, using defaults");
+        return true;
+    }
+
     // open config partition
     nvs_handle_t device_settings_handle = {};
     if (!nvs_open_readonly(CONFIG_STORAGE_TAG, "device_settings", &device_settings_handle)) {
@@ -152,25 +172,22 @@ bool read_stored_device_settings(esp_bd_addr_t bda, DeviceSettings* out_settings
         return false;  // Return false on error, but settings still has defaults
     }
 
-    // read bool settings
-    char key_out[NVS_KEY_MAX_LEN + 1];
-
-    make_device_key_for_option(KEY_AUTOCATCH, bda, key_out);
-    ESP_LOGD(CONFIG_STORAGE_TAG, "reading autocatch from key: %s", key_out);
-    esp_err_t err = nvs_get_i8(device_settings_handle, key_out, &autocatch);
-    if (nvs_read_check(CONFIG_STORAGE_TAG, err, KEY_AUTOCATCH)) {
-        out_settings->autocatch = (bool)autocatch;
+    device_record_t record;
+    bool legacy = false;
+    if (read_device_record(device_settings_handle, &keys, &record, &legacy) &&
+        (record.flags & DEVICE_RECORD_HAS_SETTINGS)) {
+        out_settings->autocatch = record.autocatch != 0;
+        out_settings->autospin = record.autospin != 0;
     }
-
-    make_device_key_for_option(KEY_AUTOSPIN, bda, key_out);
-    ESP_LOGD(CONFIG_STORAGE_TAG, "reading autospin from key: %s", key_out);
-    err = nvs_get_i8(device_settings_handle, key_out, &autospin);
-    if (nvs_read_check(CONFIG_STORAGE_TAG, err, KEY_AUTOSPIN)) {
-        out_settings->autospin = (bool)autospin;
+    memset(&record, 0, sizeof(record));
+    if (legacy) {
+        nvs_writer_touch(bda);
     }
 
     nvs_safe_close(device_settings_handle);
 
+    session_cache_put_settings(bda, out_settings->autocatch, out_settings->autospin);
+
     mutex_release(out_settings->mutex);
 
     ESP_LOGI(CONFIG_STORAGE_TAG, "device_settings read from nvs");
@@ -192,47 +209,19 @@ bool write_global_settings_to_nvs() {
     bool all_ok = true;
 
     esp_err_t err = nvs_set_u8(global_settings_handle, KEY_LOG_LEVEL, global_settings.log_level);
-    all_ok = all_ok && nvs_write_check(CONFIG_STORAGE_TAG, err, KEY_LOG_LEVEL);
+    all_ok = all_ok && nvs_handle_write_check(CONFIG_STORAGE_TAG, global_settings_handle, err, KEY_LOG_LEVEL);
     err = nvs_set_u8(global_settings_handle, KEY_CONNECTION_COUNT, global_settings.target_active_connections);
-    all_ok = all_ok && nvs_write_check(CONFIG_STORAGE_TAG, err, KEY_CONNECTION_COUNT);
+    all_ok = all_ok && nvs_handle_write_check(CONFIG_STORAGE_TAG, global_settings_handle, err, KEY_CONNECTION_COUNT);
     err = nvs_set_u8(global_settings_handle, KEY_ADVERTISING_ENABLED, global_settings.advertising_enabled ? 1 : 0);
-    all_ok = all_ok && nvs_write_check(CONFIG_STORAGE_TAG, err, KEY_ADVERTISING_ENABLED);
+    all_ok = all_ok && nvs_handle_write_check(CONFIG_STORAGE_TAG, global_settings_handle, err, KEY_ADVERTISING_ENABLED);
+    err = nvs_set_u8(global_settings_handle, KEY_MAX_STORED_DEVICES, global_settings.max_stored_devices);
+    all_ok = all_ok && nvs_handle_write_check(CONFIG_STORAGE_TAG, global_settings_handle, err, KEY_MAX_STORED_DEVICES);
 
     mutex_release(global_settings.mutex);
 
     return nvs_commit_and_close(CONFIG_STORAGE_TAG, global_settings_handle, "global_settings") && all_ok;
 }
 
-// concatenates the given two strings and hash them so it fits in the nvs key space (15 char).
-char* make_device_key_for_option(const char* key, const esp_bd_addr_t bda, char* out) {
-    // 1. Concatenate safely into a temp buffer
-    char buf[DEVICE_KEY_BUFFER_SIZE];
-    int len =
-        snprintf(buf, sizeof(buf), "%s_%02x%02x%02x%02x%02x%02x", key, bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
-    if (len < 0 || len >= DEVICE_KEY_BUFFER_SIZE) {
-        ESP_LOGE(CONFIG_STORAGE_TAG, "unable to concatenate key and bda for %s", key);
-        return out;
-    }
-
-    // 2. FNV-1a hash
-    uint64_t hash = FNV1A_OFFSET_BASIS;
-    for (const char* p = buf; *p; p++)
-        hash = (hash ^ (unsigned char)*p) * FNV1A_PRIME;
-
-    // 3. Convert to hex string, 15 chars max
-    // Manually convert hash to hex to avoid platform-specific issues with %llx
-    // Use only 60 bits (15 hex digits) to fit in NVS key limit
-    uint64_t hash_trunc = hash & 0x0FFFFFFFFFFFFFFFUL;
-    const char hex_chars[] = "0123456789abcdef";
-    for (int i = 14; i >= 0; i--) {
-        out[i] = hex_chars[hash_trunc & 0xF];
-        hash_trunc >>= 4;
-    }
-    out[15] = '\0';
-
-    return out;
-}
-
 bool write_devices_settings_to_nvs() {
     bool all_ok = true;
 
@@ -247,86 +236,171 @@ bool write_devices_settings_to_nvs() {
             continue;
         }
 
-        nvs_handle_t device_settings_handle = {};
-        if (!nvs_open_readwrite(CONFIG_STORAGE_TAG, "device_settings", &device_settings_handle)) {
-            ESP_LOGE(CONFIG_STORAGE_TAG, "[%d] failed to open NVS", entry->conn_id);
-            mutex_release(entry->settings->mutex);
-            all_ok = false;
-            continue;
-        }
-
-        char key_out[NVS_KEY_MAX_LEN + 1];
-
-        make_device_key_for_option(KEY_AUTOSPIN, entry->remote_bda, key_out);
-        ESP_LOGD(CONFIG_STORAGE_TAG, "[%d] writing autospin to key: %s", entry->conn_id, key_out);
-        esp_err_t err = nvs_set_i8(device_settings_handle, key_out, entry->settings->autospin);
-        if (err != ESP_OK) {
-            ESP_LOGW(CONFIG_STORAGE_TAG, "[%d] failed to set autospin: %d", entry->conn_id, err);
-            all_ok = false;
-        }
-
-        make_device_key_for_option(KEY_AUTOCATCH, entry->remote_bda, key_out);
-        ESP_LOGD(CONFIG_STORAGE_TAG, "[%d] writing autocatch to key: %s", entry->conn_id, key_out);
-        err = nvs_set_i8(device_settings_handle, key_out, entry->settings->autocatch);
-        if (err != ESP_OK) {
-            ESP_LOGW(CONFIG_STORAGE_TAG, "[%d] failed to set autocatch: %d", entry->conn_id, err);
-            all_ok = false;
-        }
+        bool autocatch = entry->settings->autocatch;
+        bool autospin = entry->settings->autospin;
+        session_cache_put_settings(entry->remote_bda, autocatch, autospin);
 
         // give it back in any of the following cases
         mutex_release(entry->settings->mutex);
 
-        if (!nvs_commit_and_close(CONFIG_STORAGE_TAG, device_settings_handle, "device_settings")) {
-            ESP_LOGE(CONFIG_STORAGE_TAG, "[%d] commit failed", entry->conn_id);
+        if (!nvs_writer_put_settings(entry->remote_bda, autocatch, autospin)) {
+            ESP_LOGE(CONFIG_STORAGE_TAG, "[%d] queueing device settings failed", entry->conn_id);
             all_ok = false;
-            continue;
         }
+    }
 
-        ESP_LOGI(CONFIG_STORAGE_TAG, "[%d] device settings persisted successfully", entry->conn_id);
+    // the caller reports the result, so don't leave it to the writer task
+    if (!nvs_writer_flush()) {
+        return false;
     }
 
+    ESP_LOGI(CONFIG_STORAGE_TAG, "device settings persisted");
     return all_ok;
 }
 
-// Session key persistence functions for device reconnection
-// These allow devices to reconnect without requiring passphrase re-entry
+static void init_device_record(device_record_t* record) {
+    memset(record, 0, sizeof(device_record_t));
+    record->version = DEVICE_RECORD_VERSION;
+    record->autocatch = 1;
+    record->autospin = 1;
+}
 
-bool persist_device_session_keys(esp_bd_addr_t bda, const uint8_t* session_key, const uint8_t* reconnect_challenge) {
-    if (!session_key || !reconnect_challenge) {
-        ESP_LOGE(CONFIG_STORAGE_TAG, "persist_device_session_keys: null pointers");
-        return false;
+static bool read_legacy_blob(nvs_handle_t handle, const device_keys_t* keys, device_key_t key, void* out, size_t len) {
+    size_t stored_len = len;
+    return nvs_get_blob(handle, keys->key[key], out, &stored_len) == ESP_OK && stored_len == len;
+}
+
+// reads the per-option keys older firmware wrote for the phone, returns true if there were any
+static bool read_legacy_device_keys(nvs_handle_t handle, const device_keys_t* keys, device_record_t* record) {
+    int8_t value = 0;
+    bool found = false;
+
+    if (nvs_get_i8(handle, keys->key[DEVICE_KEY_AUTOCATCH], &value) == ESP_OK) {
+        record->autocatch = value != 0;
+        record->flags |= DEVICE_RECORD_HAS_SETTINGS;
+        found = true;
+    }
+    if (nvs_get_i8(handle, keys->key[DEVICE_KEY_AUTOSPIN], &value) == ESP_OK) {
+        record->autospin = value != 0;
+        record->flags |= DEVICE_RECORD_HAS_SETTINGS;
+        found = true;
     }
 
-    nvs_handle_t device_settings_handle = {};
-    if (!nvs_open_readwrite(CONFIG_STORAGE_TAG, "device_settings", &device_settings_handle)) {
-        return false;
+    bool has_key = read_legacy_blob(handle, keys, DEVICE_KEY_SESSION_KEY, record->session_key, 16);
+    bool has_challenge =
+        read_legacy_blob(handle, keys, DEVICE_KEY_RECONNECT_CHALLENGE, record->reconnect_challenge, 32);
+    if (has_key && has_challenge) {
+        record->flags |= DEVICE_RECORD_HAS_SESSION;
+    } else {
+        // half a session is useless
+        memset(record->session_key, 0, sizeof(record->session_key));
+        memset(record->reconnect_challenge, 0, sizeof(record->reconnect_challenge));
     }
 
+    return found || has_key || has_challenge;
+}
+
+static bool erase_legacy_device_keys(nvs_handle_t handle, const device_keys_t* keys) {
     bool all_ok = true;
-    char key_out[NVS_KEY_MAX_LEN + 1];
+    int erased = 0;
+
+    // every key but the record
+    for (int i = DEVICE_KEY_RECORD + 1; i < DEVICE_KEY_COUNT; i++) {
+        esp_err_t err = nvs_erase_key(handle, keys->key[i]);
+        if (err == ESP_OK) {
+            erased++;
+        } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(CONFIG_STORAGE_TAG,
+                "failed to erase legacy key %s: %s",
+                device_key_name((device_key_t)i),
+                esp_err_to_name(err));
+            all_ok = false;
+        }
+    }
+    device_directory_legacy_erased(erased);
+
+    return all_ok;
+}
 
-    // Store session key
-    make_device_key_for_option("sesskey", bda, key_out);
-    esp_err_t err = nvs_set_blob(device_settings_handle, key_out, (const void*)session_key, 16);
-    if (!nvs_write_check(CONFIG_STORAGE_TAG, err, "session_key")) {
-        all_ok = false;
+bool read_device_record(nvs_handle_t handle, const device_keys_t* keys, device_record_t* out, bool* legacy_out) {
+    init_device_record(out);
+    *legacy_out = false;
+
+    size_t len = sizeof(device_record_t);
+    esp_err_t err = nvs_get_blob(handle, keys->key[DEVICE_KEY_RECORD], out, &len);
+    if (err == ESP_OK && len == sizeof(device_record_t) && out->version == DEVICE_RECORD_VERSION) {
+        return true;
     }
 
-    // Store reconnect challenge
-    make_device_key_for_option("rechall", bda, key_out);
-    err = nvs_set_blob(device_settings_handle, key_out, (const void*)reconnect_challenge, 32);
-    if (!nvs_write_check(CONFIG_STORAGE_TAG, err, "reconnect_challenge")) {
-        all_ok = false;
+    if (err == ESP_OK || err == ESP_ERR_NVS_INVALID_LENGTH) {
+        ESP_LOGW(CONFIG_STORAGE_TAG, "ignoring device record with unknown layout (%d bytes)", (int)len);
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        nvs_read_check(CONFIG_STORAGE_TAG, err, device_key_name(DEVICE_KEY_RECORD));
+    }
+    init_device_record(out);
+
+    // not written since the record format, older firmware may have left per-option keys
+    *legacy_out = read_legacy_device_keys(handle, keys, out);
+    return *legacy_out;
+}
+
+// last_seen stamps only have to be ordered, there is no RTC; guarded by the nvs writer's flush lock
+static uint32_t record_clock = 0;
+static bool record_clock_loaded = false;
+
+bool write_device_record(nvs_handle_t handle, const device_keys_t* keys, device_record_t* record, bool erase_legacy) {
+    if (!record_clock_loaded) {
+        esp_err_t err = nvs_get_u32(handle, KEY_RECORD_CLOCK, &record_clock);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            nvs_read_check(CONFIG_STORAGE_TAG, err, KEY_RECORD_CLOCK);
+        }
+        record_clock_loaded = true;
     }
 
-    if (!nvs_commit_and_close(CONFIG_STORAGE_TAG, device_settings_handle, "device_session_keys")) {
+    record->version = DEVICE_RECORD_VERSION;
+    record->last_seen = ++record_clock;
+
+    // a new phone beyond max_stored_devices replaces the least recently seen one
+    device_directory_make_room(handle, keys);
+
+    esp_err_t err = nvs_set_blob(handle, keys->key[DEVICE_KEY_RECORD], record, sizeof(device_record_t));
+    if (!nvs_handle_write_check(CONFIG_STORAGE_TAG, handle, err, device_key_name(DEVICE_KEY_RECORD))) {
         return false;
     }
+    device_directory_update(keys, record->flags);
 
-    if (all_ok) {
-        ESP_LOGI(CONFIG_STORAGE_TAG, "device session keys persisted");
+    // only once the record holds everything
+    if (erase_legacy) {
+        erase_legacy_device_keys(handle, keys);
     }
-    return all_ok;
+    return true;
+}
+
+bool save_device_record_clock(nvs_handle_t handle) {
+    if (!record_clock_loaded) {
+        return true;
+    }
+    esp_err_t err = nvs_set_u32(handle, KEY_RECORD_CLOCK, record_clock);
+    return nvs_handle_write_check(CONFIG_STORAGE_TAG, handle, err, KEY_RECORD_CLOCK);
+}
+
+// Session key persistence functions for device reconnection
+// These allow devices to reconnect without requiring passphrase re-entry
+
+bool persist_device_session_keys(esp_bd_addr_t bda, const uint8_t* session_key, const uint8_t* reconnect_challenge) {
+    if (!session_key || !reconnect_challenge) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "persist_device_session_keys: null pointers");
+        return false;
+    }
+
+    session_cache_put_session(bda, session_key, reconnect_challenge);
+
+    // written to flash by the nvs writer task, the handshake doesn't wait for it
+    return nvs_writer_put_session(bda, session_key, reconnect_challenge);
+}
+
+bool persist_device_seen(esp_bd_addr_t bda) {
+    return nvs_writer_seen(bda);
 }
 
 bool retrieve_device_session_keys(esp_bd_addr_t bda, uint8_t* session_key_out, uint8_t* reconnect_challenge_out) {
@@ -344,35 +418,46 @@ bool retrieve_device_session_keys(esp_bd_addr_t bda, uint8_t* session_key_out, u
         bda[4],
         bda[5]);
 
+    // changed recently, NVS doesn't have it yet
+    nvs_writer_op_t pending_op = nvs_writer_pending_session(bda, session_key_out, reconnect_challenge_out);
+    if (pending_op != NVS_WRITER_NONE) {
+        return pending_op == NVS_WRITER_PUT;
+    }
+
+    device_keys_t keys;
+    get_device_keys(bda, &keys);
+    if (!device_directory_may_have(&keys, DEVICE_RECORD_HAS_SESSION)) {
+        ESP_LOGD(CONFIG_STORAGE_TAG, "retrieve_device_session_keys: no session stored");
+        return false;
+    }
+
     nvs_handle_t device_settings_handle = {};
     if (!nvs_open_readonly(CONFIG_STORAGE_TAG, "device_settings", &device_settings_handle)) {
         ESP_LOGE(CONFIG_STORAGE_TAG, "retrieve_device_session_keys: failed to open NVS");
         return false;
     }
 
-    bool all_ok = true;
-    char key_out[NVS_KEY_MAX_LEN + 1];
-
-    // Retrieve session key
-    make_device_key_for_option("sesskey", bda, key_out);
-    if (!nvs_read_blob_checked(CONFIG_STORAGE_TAG, device_settings_handle, key_out, session_key_out, 16)) {
-        ESP_LOGW(CONFIG_STORAGE_TAG, "retrieve_device_session_keys: failed to retrieve session key");
-        all_ok = false;
-    }
-
-    // Retrieve reconnect challenge
-    make_device_key_for_option("rechall", bda, key_out);
-    if (!nvs_read_blob_checked(CONFIG_STORAGE_TAG, device_settings_handle, key_out, reconnect_challenge_out, 32)) {
-        ESP_LOGW(CONFIG_STORAGE_TAG, "retrieve_device_session_keys: failed to retrieve reconnect challenge");
-        all_ok = false;
+    device_record_t record;
+    bool legacy = false;
+    bool all_ok = read_device_record(device_settings_handle, &keys, &record, &legacy) &&
+                  (record.flags & DEVICE_RECORD_HAS_SESSION);
+    if (all_ok) {
+        memcpy(session_key_out, record.session_key, sizeof(record.session_key));
+        memcpy(reconnect_challenge_out, record.reconnect_challenge, sizeof(record.reconnect_challenge));
     }
+    memset(&record, 0, sizeof(record));
 
     nvs_safe_close(device_settings_handle);
+    if (legacy) {
+        nvs_writer_touch(bda);
+    }
     if (all_ok) {
+        session_cache_put_session(bda, session_key_out, reconnect_challenge_out);
         ESP_LOGI(CONFIG_STORAGE_TAG, "device session keys retrieved successfully");
     } else {
-        ESP_LOGE(CONFIG_STORAGE_TAG,
-            "retrieve_device_session_keys failed for mac=%02x:%02x:%02x:%02x:%02x:%02x",
+        // read errors are logged by read_device_record(), this is a phone without a stored session
+        ESP_LOGD(CONFIG_STORAGE_TAG,
+            "retrieve_device_session_keys: no session stored for mac=%02x:%02x:%02x:%02x:%02x:%02x",
             bda[0],
             bda[1],
             bda[2],
@@ -384,6 +469,18 @@ bool retrieve_device_session_keys(esp_bd_addr_t bda, uint8_t* session_key_out, u
 }
 
 bool has_cached_session(esp_bd_addr_t bda) {
+    nvs_writer_op_t pending_op = nvs_writer_pending_session(bda, NULL, NULL);
+    if (pending_op != NVS_WRITER_NONE) {
+        return pending_op == NVS_WRITER_PUT;
+    }
+
+    // unknown phones don't touch NVS
+    device_keys_t keys;
+    get_device_keys(bda, &keys);
+    if (!device_directory_may_have(&keys, DEVICE_RECORD_HAS_SESSION)) {
+        return false;
+    }
+
     nvs_handle_t device_settings_handle = {};
     if (!nvs_open_readonly(CONFIG_STORAGE_TAG, "device_settings", &device_settings_handle)) {
         ESP_LOGD(CONFIG_STORAGE_TAG,
@@ -397,16 +494,17 @@ bool has_cached_session(esp_bd_addr_t bda) {
         return false;
     }
 
-    char key_out[NVS_KEY_MAX_LEN + 1];
-    size_t required_size = 0;
-
-    // Check if session key exists with correct size
-    make_device_key_for_option("sesskey", bda, key_out);
-    esp_err_t err = nvs_get_blob(device_settings_handle, key_out, NULL, &required_size);
+    device_record_t record;
+    bool legacy = false;
+    bool found = read_device_record(device_settings_handle, &keys, &record, &legacy) &&
+                 (record.flags & DEVICE_RECORD_HAS_SESSION);
+    memset(&record, 0, sizeof(record));
 
     nvs_safe_close(device_settings_handle);
 
-    bool found = (err == ESP_OK && required_size == 16);
+    if (legacy) {
+        nvs_writer_touch(bda);
+    }
     ESP_LOGI(CONFIG_STORAGE_TAG,
         "has_cached_session: mac=%02x:%02x:%02x:%02x:%02x:%02x, found=%d",
         bda[0],
@@ -420,36 +518,6 @@ bool has_cached_session(esp_bd_addr_t bda) {
 }
 
 bool clear_device_session(esp_bd_addr_t bda) {
-    nvs_handle_t device_settings_handle = {};
-    if (!nvs_open_readwrite(CONFIG_STORAGE_TAG, "device_settings", &device_settings_handle)) {
-        return false;
-    }
-
-    bool all_ok = true;
-    char key_out[NVS_KEY_MAX_LEN + 1];
-
-    // Clear session key
-    make_device_key_for_option("sesskey", bda, key_out);
-    esp_err_t err = nvs_erase_key(device_settings_handle, key_out);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGW(CONFIG_STORAGE_TAG, "clear_device_session: failed to erase session_key");
-        all_ok = false;
-    }
-
-    // Clear reconnect challenge
-    make_device_key_for_option("rechall", bda, key_out);
-    err = nvs_erase_key(device_settings_handle, key_out);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGW(CONFIG_STORAGE_TAG, "clear_device_session: failed to erase reconnect_challenge");
-        all_ok = false;
-    }
-
-    if (!nvs_commit_and_close(CONFIG_STORAGE_TAG, device_settings_handle, "device_session")) {
-        return false;
-    }
-
-    if (all_ok) {
-        ESP_LOGI(CONFIG_STORAGE_TAG, "device session cleared");
-    }
-    return all_ok;
+    session_cache_invalidate(bda);
+    return nvs_writer_clear_session(bda);
 }
@@ -1,10 +1,13 @@
 #ifndef CONFIG_STORAGE_H
 #define CONFIG_STORAGE_H
 
+#include "device_keys.h"
 #include "esp_bt_defs.h"
+#include "nvs.h"
 #include "settings.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 void init_settings_nvs_partition();
 
@@ -20,16 +23,47 @@ bool write_global_settings_to_nvs();
 bool write_devices_settings_to_nvs();
 
 // Session key persistence for device reconnection
-// After successful handshake, persist the session keys to NVS
+// After successful handshake, persist the session keys to NVS (in the background, see nvs_writer.h)
 bool persist_device_session_keys(esp_bd_addr_t bda, const uint8_t* session_key, const uint8_t* reconnect_challenge);
 
-// On reconnection attempt, retrieve cached keys from NVS
+// On reconnection attempt, retrieve cached keys from NVS; false if none are stored (no separate
+// has_cached_session() check needed, that would read the record twice)
 bool retrieve_device_session_keys(esp_bd_addr_t bda, uint8_t* session_key_out, uint8_t* reconnect_challenge_out);
 
+// After a reconnect with stored keys, persist that the phone was seen (rate limited, in the background) so
+// it isn't the first record evicted after a reboot
+bool persist_device_seen(esp_bd_addr_t bda);
+
 // Check if device has cached session keys
 bool has_cached_session(esp_bd_addr_t bda);
 
-// Clear session keys on manual user request (optional)
+// Clear session keys on manual user request (optional), also in the background
 bool clear_device_session(esp_bd_addr_t bda);
 
+// everything stored about one phone, kept as a single blob under a key hashed from its BDA
+#define DEVICE_RECORD_VERSION 1
+#define DEVICE_RECORD_HAS_SESSION 0x01
+#define DEVICE_RECORD_HAS_SETTINGS 0x02
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t flags;  // DEVICE_RECORD_HAS_*
+    uint8_t autocatch;
+    uint8_t autospin;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+    uint32_t last_seen;  // increases with every record written, there is no wall clock
+    uint32_t sessions;   // handshakes that stored new session keys
+} device_record_t;
+
+// reads the record of the phone with keys (from get_device_keys()) from an open device_settings handle, falling
+// back to the per-option keys of older firmware (legacy_out is set then and the next write_device_record() should
+// erase them). Returns false if nothing is stored, out holds the defaults in that case.
+bool read_device_record(nvs_handle_t handle, const device_keys_t* keys, device_record_t* out, bool* legacy_out);
+
+// stamps last_seen and writes the record without committing, only called by nvs_writer_flush() which
+// commits a batch of records together with save_device_record_clock()
+bool write_device_record(nvs_handle_t handle, const device_keys_t* keys, device_record_t* record, bool erase_legacy);
+bool save_device_record_clock(nvs_handle_t handle);
+
 #endif /* CONFIG_STORAGE_H */
@@ -0,0 +1,12 @@
+#ifndef CONNECTION_LIMITS_H
+#define CONNECTION_LIMITS_H
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+// capacity of every per-connection table (client slots, stats, session cache/prefetch, control summaries),
+// one slot per ACL link the Bluedroid host allows; host builds pass CONFIG_BT_ACL_CONNECTIONS on the command line
+#define MAX_CONNECTIONS CONFIG_BT_ACL_CONNECTIONS
+
+#endif /* CONNECTION_LIMITS_H */
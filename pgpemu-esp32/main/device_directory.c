@@ -0,0 +1,358 @@
+#include "device_directory.h"
+
+#include "config_storage.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "log_tags.h"
+#include "nvs.h"
+#include "nvs_helper.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t fingerprint;  // the record key read as a number
+    uint32_t last_seen;    // device_record_t.last_seen at boot, then directory_clock whenever the phone is seen
+    uint8_t flags;         // DEVICE_RECORD_HAS_* of the stored record
+} device_directory_entry_t;
+
+// sorted by fingerprint, guarded by directory_lock
+static device_directory_entry_t directory[DEVICE_DIRECTORY_SIZE];
+static int directory_count = 0;
+static int capacity = DEVICE_STORE_DEFAULT_CAPACITY;
+// continues from the newest record's last_seen, so phones seen since boot are newer than any stored stamp
+static uint32_t directory_clock = 0;
+static uint32_t evictions = 0;
+// legacy keys still in NVS, their phone can't be told from the hashed key
+static int legacy_entries = 0;
+// a record isn't indexed, phones missing from the index may still have one
+static bool overflowed = false;
+static bool ready = false;
+
+static portMUX_TYPE directory_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// records older than the indexed ones a boot scan pass collects for erasing
+#define STALE_BATCH 16
+
+static uint64_t key_fingerprint(const char* key) {
+    return strtoull(key, NULL, 16);
+}
+
+// index of fingerprint or where it would be inserted, call with directory_lock held
+static int search_locked(uint64_t fingerprint, bool* found) {
+    int lo = 0, hi = directory_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (directory[mid].fingerprint < fingerprint) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = lo < directory_count && directory[lo].fingerprint == fingerprint;
+    return lo;
+}
+
+// call with directory_lock held
+static int oldest_locked() {
+    int oldest = 0;
+    for (int i = 1; i < directory_count; i++) {
+        if (directory[i].last_seen < directory[oldest].last_seen) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+// call with directory_lock held
+static void remove_locked(int i) {
+    memmove(&directory[i], &directory[i + 1], (directory_count - i - 1) * sizeof(device_directory_entry_t));
+    directory_count--;
+}
+
+// call with directory_lock held
+static void update_locked(uint64_t fingerprint, uint8_t flags, uint32_t last_seen) {
+    bool found = false;
+    int i = search_locked(fingerprint, &found);
+    if (found) {
+        directory[i].flags = flags;
+        directory[i].last_seen = last_seen;
+        return;
+    }
+
+    if (directory_count == DEVICE_DIRECTORY_SIZE) {
+        overflowed = true;
+        return;
+    }
+    memmove(&directory[i + 1], &directory[i], (directory_count - i) * sizeof(device_directory_entry_t));
+    directory[i].fingerprint = fingerprint;
+    directory[i].flags = flags;
+    directory[i].last_seen = last_seen;
+    directory_count++;
+}
+
+// Indexes a record found by the boot scan. With the index full the oldest record of the index and this one is
+// dropped; DEVICE_DIRECTORY_SIZE newer ones are indexed then, so it is beyond any capacity. Returns its
+// fingerprint or 0 if nothing was dropped. Call with directory_lock held.
+static uint64_t scan_record_locked(uint64_t fingerprint, uint8_t flags, uint32_t last_seen) {
+    if (last_seen > directory_clock) {
+        directory_clock = last_seen;
+    }
+    if (directory_count < DEVICE_DIRECTORY_SIZE) {
+        update_locked(fingerprint, flags, last_seen);
+        return 0;
+    }
+
+    int oldest = oldest_locked();
+    if (directory[oldest].last_seen >= last_seen) {
+        return fingerprint;
+    }
+    uint64_t dropped = directory[oldest].fingerprint;
+    remove_locked(oldest);
+    update_locked(fingerprint, flags, last_seen);
+    return dropped;
+}
+
+// one pass over the namespace, returns false if more records were dropped than stale could take
+static bool scan_records(nvs_handle_t handle, uint64_t* stale, int* stale_count, int* records, int* legacy) {
+    bool complete = true;
+    nvs_iterator_t it = NULL;
+    esp_err_t err = nvs_entry_find(NVS_DEFAULT_PART_NAME, "device_settings", NVS_TYPE_ANY, &it);
+    while (err == ESP_OK) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+
+        if (info.type == NVS_TYPE_BLOB) {
+            // records and the legacy session blobs both have hashed keys, only their size tells them apart
+            device_record_t record;
+            size_t len = sizeof(record);
+            esp_err_t read_err = nvs_get_blob(handle, info.key, &record, &len);
+            if (read_err == ESP_OK && len == sizeof(record) && record.version == DEVICE_RECORD_VERSION) {
+                taskENTER_CRITICAL(&directory_lock);
+                uint64_t dropped = scan_record_locked(key_fingerprint(info.key), record.flags, record.last_seen);
+                taskEXIT_CRITICAL(&directory_lock);
+                if (dropped && *stale_count < STALE_BATCH) {
+                    stale[(*stale_count)++] = dropped;
+                } else if (dropped) {
+                    complete = false;
+                }
+                (*records)++;
+            } else {
+                (*legacy)++;
+            }
+            memset(&record, 0, sizeof(record));
+        } else if (info.type == NVS_TYPE_I8) {
+            // legacy catch/spin, the record clock is the only other key
+            (*legacy)++;
+        }
+
+        err = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+    return complete;
+}
+
+// erases the record with fingerprint, it isn't indexed anymore
+static bool erase_record(nvs_handle_t handle, uint64_t fingerprint) {
+    char key[16];
+    device_key_from_fingerprint(fingerprint, key);
+    esp_err_t err = nvs_erase_key(handle, key);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return false;
+    }
+    if (!nvs_handle_write_check(CONFIG_STORAGE_TAG, handle, err, key)) {
+        // still stored but not indexed, the index can't rule phones out anymore
+        taskENTER_CRITICAL(&directory_lock);
+        overflowed = true;
+        taskEXIT_CRITICAL(&directory_lock);
+        return false;
+    }
+
+    taskENTER_CRITICAL(&directory_lock);
+    evictions++;
+    taskEXIT_CRITICAL(&directory_lock);
+    // the lifetime stats go with the record, they are under the same key
+    stats_erase_stored(key);
+    ESP_LOGD(CONFIG_STORAGE_TAG, "evicted device record %s", key);
+    return true;
+}
+
+// erases the least recently seen records until at most keep are indexed, returns how many were erased
+static int evict_down_to(nvs_handle_t handle, int keep) {
+    int evicted = 0;
+    for (;;) {
+        uint64_t fingerprint = 0;
+        taskENTER_CRITICAL(&directory_lock);
+        bool evict = directory_count > 0 && directory_count > keep;
+        if (evict) {
+            int oldest = oldest_locked();
+            fingerprint = directory[oldest].fingerprint;
+            remove_locked(oldest);
+        }
+        taskEXIT_CRITICAL(&directory_lock);
+
+        if (!evict) {
+            return evicted;
+        }
+        if (erase_record(handle, fingerprint)) {
+            evicted++;
+        }
+    }
+}
+
+void init_device_directory(int new_capacity) {
+    device_directory_set_capacity(new_capacity);
+
+    int records = 0, legacy = 0, evicted = 0;
+    bool complete = false;
+    // firmware without the cap may have left more records than the index holds, each pass erases a batch
+    // of the oldest until one pass indexes every record
+    while (!complete) {
+        uint64_t stale[STALE_BATCH];
+        int stale_count = 0;
+        records = 0;
+        legacy = 0;
+        taskENTER_CRITICAL(&directory_lock);
+        directory_count = 0;
+        directory_clock = 0;
+        taskEXIT_CRITICAL(&directory_lock);
+
+        nvs_handle_t handle = {};
+        if (!nvs_open_readonly(CONFIG_STORAGE_TAG, "device_settings", &handle)) {
+            // nothing was ever stored
+            complete = true;
+            break;
+        }
+        complete = scan_records(handle, stale, &stale_count, &records, &legacy);
+        nvs_safe_close(handle);
+
+        taskENTER_CRITICAL(&directory_lock);
+        int keep = capacity;
+        bool over_capacity = directory_count > keep;
+        taskEXIT_CRITICAL(&directory_lock);
+        if (stale_count == 0 && !over_capacity) {
+            break;
+        }
+
+        if (!nvs_open_readwrite(CONFIG_STORAGE_TAG, "device_settings", &handle)) {
+            break;
+        }
+        int pass_evicted = 0;
+        for (int i = 0; i < stale_count; i++) {
+            pass_evicted += erase_record(handle, stale[i]) ? 1 : 0;
+        }
+        pass_evicted += evict_down_to(handle, keep);
+        nvs_commit_and_close(CONFIG_STORAGE_TAG, handle, "device_directory");
+        evicted += pass_evicted;
+        records -= pass_evicted;
+
+        if (!complete && pass_evicted == 0) {
+            // erasing fails, keep the partial index
+            break;
+        }
+    }
+
+    taskENTER_CRITICAL(&directory_lock);
+    if (!complete) {
+        overflowed = true;
+    }
+    legacy_entries = legacy;
+    ready = true;
+    taskEXIT_CRITICAL(&directory_lock);
+
+    ESP_LOGI(CONFIG_STORAGE_TAG,
+        "device directory: %d records (capacity %d), %d evicted, %d legacy keys%s",
+        records,
+        capacity,
+        evicted,
+        legacy,
+        overflowed ? ", index incomplete" : "");
+}
+
+void device_directory_set_capacity(int new_capacity) {
+    if (new_capacity < 1) {
+        new_capacity = 1;
+    } else if (new_capacity > DEVICE_DIRECTORY_SIZE) {
+        new_capacity = DEVICE_DIRECTORY_SIZE;
+    }
+
+    taskENTER_CRITICAL(&directory_lock);
+    capacity = new_capacity;
+    taskEXIT_CRITICAL(&directory_lock);
+}
+
+bool device_directory_may_have(const device_keys_t* keys, uint8_t flag) {
+    taskENTER_CRITICAL(&directory_lock);
+    bool may_have = true;
+    if (ready && !overflowed && legacy_entries == 0) {
+        bool found = false;
+        int i = search_locked(keys->fingerprint, &found);
+        may_have = found && (directory[i].flags & flag);
+        if (found) {
+            directory[i].last_seen = ++directory_clock;
+        }
+    }
+    taskEXIT_CRITICAL(&directory_lock);
+
+    return may_have;
+}
+
+int device_directory_make_room(nvs_handle_t handle, const device_keys_t* keys) {
+    taskENTER_CRITICAL(&directory_lock);
+    bool found = false;
+    search_locked(keys->fingerprint, &found);
+    int keep = capacity - 1;
+    taskEXIT_CRITICAL(&directory_lock);
+
+    // rewriting a stored phone doesn't grow the store
+    if (found) {
+        return 0;
+    }
+
+    int evicted = evict_down_to(handle, keep);
+    if (evicted > 0) {
+        ESP_LOGI(CONFIG_STORAGE_TAG, "device store full, evicted %d least recently seen", evicted);
+    }
+    return evicted;
+}
+
+void device_directory_update(const device_keys_t* keys, uint8_t flags) {
+    taskENTER_CRITICAL(&directory_lock);
+    update_locked(keys->fingerprint, flags, ++directory_clock);
+    taskEXIT_CRITICAL(&directory_lock);
+}
+
+void device_directory_legacy_erased(int count) {
+    taskENTER_CRITICAL(&directory_lock);
+    legacy_entries -= count;
+    if (legacy_entries < 0) {
+        legacy_entries = 0;
+    }
+    taskEXIT_CRITICAL(&directory_lock);
+}
+
+size_t device_directory_serialize(uint8_t* buf, size_t buf_len) {
+    if (buf_len < DEVICE_STORE_STATS_LEN) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL(&directory_lock);
+    int stored = directory_count;
+    int cap = capacity;
+    bool exact = ready && !overflowed && legacy_entries == 0;
+    int legacy = legacy_entries > 0xffff ? 0xffff : legacy_entries;
+    uint32_t evicted = evictions;
+    taskEXIT_CRITICAL(&directory_lock);
+
+    buf[0] = (uint8_t)stored;
+    buf[1] = (uint8_t)cap;
+    buf[2] = DEVICE_DIRECTORY_SIZE;
+    buf[3] = exact ? 1 : 0;
+    buf[4] = legacy & 0xff;
+    buf[5] = legacy >> 8;
+    for (int i = 0; i < 4; i++) {
+        buf[6 + i] = (evicted >> (8 * i)) & 0xff;
+    }
+    return DEVICE_STORE_STATS_LEN;
+}
@@ -0,0 +1,48 @@
+#ifndef DEVICE_DIRECTORY_H
+#define DEVICE_DIRECTORY_H
+
+#include "device_keys.h"
+#include "nvs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// phones the index can hold, also the largest device store capacity
+#define DEVICE_DIRECTORY_SIZE 64
+// phones with a record kept in NVS unless global_settings.max_stored_devices says otherwise
+#define DEVICE_STORE_DEFAULT_CAPACITY 32
+
+// DEVICE_STORE response, little-endian:
+// [stored u8][capacity u8][largest capacity u8][exact u8][legacy keys u16][evictions since boot u32]
+#define DEVICE_STORE_STATS_LEN 10
+
+// RAM index of the device records in NVS, built once by iterating the device_settings namespace,
+// so phones that never stored anything don't cost an NVS lookup on connect. It also bounds the store:
+// beyond capacity records the least recently seen phones are erased, at boot and before a new phone's
+// first record is written.
+// Call after init_settings_nvs_partition() with global_settings.max_stored_devices, before that every phone
+// may have a record.
+void init_device_directory(int capacity);
+
+// takes effect with the next new phone stored (and at boot), capacity is clamped to 1..DEVICE_DIRECTORY_SIZE
+void device_directory_set_capacity(int capacity);
+
+// false only if the phone with keys certainly has no record with flag (DEVICE_RECORD_HAS_*) set,
+// an indexed phone counts as seen for the eviction order
+bool device_directory_may_have(const device_keys_t* keys, uint8_t flag);
+
+// called before the record of keys is written: if it would be a new record beyond capacity, the least
+// recently seen records are erased from handle (committed with the write). Returns how many were evicted.
+int device_directory_make_room(nvs_handle_t handle, const device_keys_t* keys);
+
+// keeps the index current, called with the flags of every record written
+void device_directory_update(const device_keys_t* keys, uint8_t flags);
+
+// called for every legacy key erased by the migration, the index is exact once none are left
+void device_directory_legacy_erased(int count);
+
+// writes the DEVICE_STORE response, returns its length or 0 if buf is too small
+size_t device_directory_serialize(uint8_t* buf, size_t buf_len);
+
+#endif /* DEVICE_DIRECTORY_H */
@@ -0,0 +1,151 @@
+#include "device_keys.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "log_tags.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// hashed into the keys, changing one orphans what is stored under it
+static const char* const KEY_NAMES[DEVICE_KEY_COUNT] = {
+    [DEVICE_KEY_RECORD] = "dev",
+    [DEVICE_KEY_AUTOCATCH] = "catch",
+    [DEVICE_KEY_AUTOSPIN] = "spin",
+    [DEVICE_KEY_SESSION_KEY] = "sesskey",
+    [DEVICE_KEY_RECONNECT_CHALLENGE] = "rechall",
+};
+
+// FNV-1a hash constants
+static const uint64_t FNV1A_OFFSET_BASIS = 1469598103934665603ULL;  // FNV-1a 64-bit offset basis
+static const uint64_t FNV1A_PRIME = 1099511628211ULL;               // FNV-1a 64-bit prime
+static const int DEVICE_KEY_BUFFER_SIZE = 64;                       // Buffer for concatenated key + BDA
+
+typedef struct {
+    bool used;
+    uint32_t last_used;  // value of use_clock at the last lookup, smallest is evicted first
+    device_keys_t keys;
+} device_keys_entry_t;
+
+// guarded by cache_lock, lookups copy out so an eviction can't change keys in use
+static device_keys_entry_t cache[DEVICE_KEYS_CACHE_SIZE];
+static uint32_t use_clock = 0;
+static uint32_t lookups = 0;
+static uint32_t derivations = 0;
+
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+const char* device_key_name(device_key_t key) {
+    return key < DEVICE_KEY_COUNT ? KEY_NAMES[key] : "?";
+}
+
+char* device_key_from_fingerprint(uint64_t fingerprint, char* out) {
+    // Manually convert hash to hex to avoid platform-specific issues with %llx
+    const char hex_chars[] = "0123456789abcdef";
+    for (int i = 14; i >= 0; i--) {
+        out[i] = hex_chars[fingerprint & 0xF];
+        fingerprint >>= 4;
+    }
+    out[15] = '\0';
+    return out;
+}
+
+// concatenates name and bda and hashes them so it fits in the nvs key space (15 char), returns the hash
+static uint64_t make_device_key(const char* name, const esp_bd_addr_t bda, char* out) {
+    // 1. Concatenate safely into a temp buffer
+    char buf[DEVICE_KEY_BUFFER_SIZE];
+    int len =
+        snprintf(buf, sizeof(buf), "%s_%02x%02x%02x%02x%02x%02x", name, bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+    if (len < 0 || len >= DEVICE_KEY_BUFFER_SIZE) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "unable to concatenate key and bda for %s", name);
+        out[0] = '\0';
+        return 0;
+    }
+
+    // 2. FNV-1a hash
+    uint64_t hash = FNV1A_OFFSET_BASIS;
+    for (const char* p = buf; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * FNV1A_PRIME;
+
+    // 3. Convert to hex string, 15 chars max
+    // Use only 60 bits (15 hex digits) to fit in NVS key limit
+    uint64_t hash_trunc = hash & 0x0FFFFFFFFFFFFFFFUL;
+    device_key_from_fingerprint(hash_trunc, out);
+    return hash_trunc;
+}
+
+void derive_device_keys(const esp_bd_addr_t bda, device_keys_t* out) {
+    memcpy(out->bda, bda, sizeof(esp_bd_addr_t));
+    for (int i = 0; i < DEVICE_KEY_COUNT; i++) {
+        uint64_t hash = make_device_key(KEY_NAMES[i], bda, out->key[i]);
+        if (i == DEVICE_KEY_RECORD) {
+            out->fingerprint = hash;
+        }
+    }
+}
+
+// call with cache_lock held
+static device_keys_entry_t* find_entry_locked(const esp_bd_addr_t bda) {
+    for (int i = 0; i < DEVICE_KEYS_CACHE_SIZE; i++) {
+        if (cache[i].used && memcmp(cache[i].keys.bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            cache[i].last_used = ++use_clock;
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// call with cache_lock held
+static void insert_locked(const device_keys_t* keys) {
+    device_keys_entry_t* entry = find_entry_locked(keys->bda);
+    if (!entry) {
+        // a free entry or the least recently used one
+        entry = &cache[0];
+        for (int i = 0; i < DEVICE_KEYS_CACHE_SIZE; i++) {
+            if (!cache[i].used) {
+                entry = &cache[i];
+                break;
+            }
+            if (cache[i].last_used < entry->last_used) {
+                entry = &cache[i];
+            }
+        }
+    }
+
+    entry->used = true;
+    entry->last_used = ++use_clock;
+    memcpy(&entry->keys, keys, sizeof(device_keys_t));
+}
+
+void get_device_keys(const esp_bd_addr_t bda, device_keys_t* out) {
+    taskENTER_CRITICAL(&cache_lock);
+    lookups++;
+    device_keys_entry_t* entry = find_entry_locked(bda);
+    if (entry) {
+        memcpy(out, &entry->keys, sizeof(device_keys_t));
+    }
+    taskEXIT_CRITICAL(&cache_lock);
+    if (entry) {
+        return;
+    }
+
+    // hashing stays outside the critical section, two tasks missing at once both derive the same keys
+    derive_device_keys(bda, out);
+
+    taskENTER_CRITICAL(&cache_lock);
+    derivations++;
+    insert_locked(out);
+    taskEXIT_CRITICAL(&cache_lock);
+}
+
+void prime_device_keys(const esp_bd_addr_t bda) {
+    device_keys_t keys;
+    get_device_keys(bda, &keys);
+}
+
+void get_device_keys_stats(uint32_t* lookups_out, uint32_t* derivations_out) {
+    taskENTER_CRITICAL(&cache_lock);
+    *lookups_out = lookups;
+    *derivations_out = derivations;
+    taskEXIT_CRITICAL(&cache_lock);
+}
@@ -0,0 +1,50 @@
+#ifndef DEVICE_KEYS_H
+#define DEVICE_KEYS_H
+
+#include "connection_limits.h"
+#include "esp_bt_defs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// phones whose keys are kept, like the session cache twice the connection count
+#define DEVICE_KEYS_CACHE_SIZE (2 * MAX_CONNECTIONS)
+
+// NVS keys stored per phone
+typedef enum {
+    DEVICE_KEY_RECORD,  // the device_record_t
+    // per-option keys of older firmware, only read to migrate them into the record
+    DEVICE_KEY_AUTOCATCH,
+    DEVICE_KEY_AUTOSPIN,
+    DEVICE_KEY_SESSION_KEY,
+    DEVICE_KEY_RECONNECT_CHALLENGE,
+    DEVICE_KEY_COUNT,
+} device_key_t;
+
+// every NVS key of one phone, each a 15 hex char FNV-1a hash of "<name>_<bda>"
+typedef struct {
+    esp_bd_addr_t bda;
+    uint64_t fingerprint;  // the record key read as a number, see device_directory.c
+    char key[DEVICE_KEY_COUNT][16];
+} device_keys_t;
+
+// option name hashed into the key, for log messages
+const char* device_key_name(device_key_t key);
+
+// the key a fingerprint was read from, out needs 16 bytes
+char* device_key_from_fingerprint(uint64_t fingerprint, char* out);
+
+// hashes all keys of bda, prefer get_device_keys()
+void derive_device_keys(const esp_bd_addr_t bda, device_keys_t* out);
+
+// Copies the keys of bda from a small cache of recently seen phones, deriving them on a miss so each
+// phone is hashed once while it keeps connecting instead of on every NVS access.
+void get_device_keys(const esp_bd_addr_t bda, device_keys_t* out);
+
+// derives the keys of a phone as soon as its BDA is known, ahead of its first NVS access
+void prime_device_keys(const esp_bd_addr_t bda);
+
+// cache lookups since boot and how many of them had to derive the keys
+void get_device_keys_stats(uint32_t* lookups_out, uint32_t* derivations_out);
+
+#endif /* DEVICE_KEYS_H */
@@ -0,0 +1,152 @@
+#include "entropy.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mutex_helpers.h"
+
+static SemaphoreHandle_t entropy_mutex = NULL;
+
+#define ENTROPY_LOCK() mutex_acquire_blocking(entropy_mutex)
+#define ENTROPY_UNLOCK() mutex_release(entropy_mutex)
+
+static void fill_hw(uint8_t* buf, size_t len) {
+    esp_fill_random(buf, len);
+}
+
+#else  // PC target
+
+#include <stdlib.h>
+#include <sys/random.h>
+
+// host tests and benchmarks are single threaded
+#define ENTROPY_LOCK() true
+#define ENTROPY_UNLOCK()
+
+static void fill_hw(uint8_t* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = getrandom(buf, len, 0);
+        if (n <= 0) {
+            // no kernel RNG, good enough for a simulation
+            for (size_t i = 0; i < len; i++) {
+                buf[i] = rand() & 0xff;
+            }
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+#endif
+
+// ring of unused random bytes, pool_pos == ENTROPY_POOL_SIZE means empty
+static uint8_t pool[ENTROPY_POOL_SIZE];
+static size_t pool_pos = ENTROPY_POOL_SIZE;
+
+static bool seeded = false;
+
+#ifdef ENTROPY_SEEDABLE
+static uint64_t seed_state = 0;
+
+// splitmix64, only used for the reproducible seeded mode
+static uint64_t seeded_next() {
+    uint64_t z = (seed_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+#endif
+
+static void fill_source(uint8_t* buf, size_t len) {
+#ifdef ENTROPY_SEEDABLE
+    if (!seeded) {
+        fill_hw(buf, len);
+        return;
+    }
+
+    while (len > 0) {
+        uint64_t r = seeded_next();
+        size_t n = len < sizeof(r) ? len : sizeof(r);
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = (r >> (8 * i)) & 0xff;
+        }
+        buf += n;
+        len -= n;
+    }
+#else
+    fill_hw(buf, len);
+#endif
+}
+
+void init_entropy() {
+#ifdef ESP_PLATFORM
+    if (!entropy_mutex) {
+        entropy_mutex = xSemaphoreCreateMutex();
+    }
+#endif
+}
+
+void entropy_fill(uint8_t* buf, size_t len) {
+    if (!ENTROPY_LOCK()) {
+        // not initialized yet, skip the pool
+        fill_source(buf, len);
+        return;
+    }
+
+    while (len > 0) {
+        if (pool_pos == ENTROPY_POOL_SIZE) {
+            fill_source(pool, ENTROPY_POOL_SIZE);
+            pool_pos = 0;
+        }
+
+        size_t n = ENTROPY_POOL_SIZE - pool_pos;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf, pool + pool_pos, n);
+        memset(pool + pool_pos, 0, n);  // handed out bytes don't stay in RAM
+        pool_pos += n;
+        buf += n;
+        len -= n;
+    }
+
+    ENTROPY_UNLOCK();
+}
+
+uint32_t entropy_word() {
+    uint8_t bytes[4];
+    entropy_fill(bytes, sizeof(bytes));
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+#ifdef ENTROPY_SEEDABLE
+void entropy_seed(uint32_t seed) {
+    bool locked = ENTROPY_LOCK();
+    seeded = true;
+    seed_state = seed;
+    memset(pool, 0, sizeof(pool));
+    pool_pos = ENTROPY_POOL_SIZE;
+    if (locked) {
+        ENTROPY_UNLOCK();
+    }
+}
+
+void entropy_unseed() {
+    bool locked = ENTROPY_LOCK();
+    seeded = false;
+    memset(pool, 0, sizeof(pool));
+    pool_pos = ENTROPY_POOL_SIZE;
+    if (locked) {
+        ENTROPY_UNLOCK();
+    }
+}
+#endif
+
+bool entropy_is_seeded() {
+    return seeded;
+}
@@ -0,0 +1,42 @@
+#ifndef ENTROPY_H
+#define ENTROPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+// seeding makes keys and nonces predictable, so firmware only builds it with CONFIG_PGPEMU_DEBUG_ENTROPY
+#if !defined(ESP_PLATFORM) || defined(CONFIG_PGPEMU_DEBUG_ENTROPY)
+#define ENTROPY_SEEDABLE 1
+#endif
+
+// random bytes are handed out from a ring that is refilled ENTROPY_POOL_SIZE bytes at a time
+#define ENTROPY_POOL_SIZE 128
+
+// creates the pool lock, call once at boot before any task asks for random data
+// (until then every request is filled directly from the RNG, bypassing the pool)
+void init_entropy();
+
+// fills buf with len random bytes
+void entropy_fill(uint8_t* buf, size_t len);
+
+// returns 32 random bits
+uint32_t entropy_word();
+
+#ifdef ENTROPY_SEEDABLE
+// switches to a deterministic stream derived from seed, so handshakes/tests/benchmarks can be
+// reproduced byte for byte; the pool is discarded so the stream starts right at the seed
+void entropy_seed(uint32_t seed);
+
+// back to the hardware RNG (esp_fill_random on the target, getrandom on PC)
+void entropy_unseed();
+#endif
+
+// false unless ENTROPY_SEEDABLE and entropy_seed() was called
+bool entropy_is_seeded();
+
+#endif /* ENTROPY_H */
@@ -0,0 +1,89 @@
+#include "histogram.h"
+
+#include <string.h>
+
+void histogram_reset(histogram_t* h) {
+    memset(h, 0, sizeof(histogram_t));
+}
+
+int histogram_bucket(uint32_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    // the top HISTOGRAM_SUB_BITS + 1 bits pick the bucket, the leading one the power of two
+    int shift = 31 - __builtin_clz(value) - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)(value >> shift) - HISTOGRAM_SUB_BUCKETS;
+}
+
+uint32_t histogram_bucket_upper(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return (uint32_t)bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t mantissa = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+    return (uint32_t)(((mantissa + 1) << shift) - 1);
+}
+
+void histogram_record(histogram_t* h, uint32_t value) {
+    if (h->count == 0 || value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+    h->count++;
+    h->sum += value;
+    h->buckets[histogram_bucket(value)]++;
+}
+
+void histogram_merge(histogram_t* into, const histogram_t* from) {
+    if (from->count == 0) {
+        return;
+    }
+    if (into->count == 0 || from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    into->count += from->count;
+    into->sum += from->sum;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        into->buckets[b] += from->buckets[b];
+    }
+}
+
+void histogram_percentiles(const histogram_t* h, const uint8_t* percents, int n, uint32_t* out) {
+    if (h->count == 0) {
+        memset(out, 0, n * sizeof(uint32_t));
+        return;
+    }
+
+    uint64_t seen = 0;
+    int b = 0;
+    for (int i = 0; i < n; i++) {
+        // rank of the sample, rounded up so p50 of two samples is the first one
+        uint64_t rank = ((uint64_t)h->count * percents[i] + 99) / 100;
+        if (rank == 0) {
+            rank = 1;
+        }
+        while (b < HISTOGRAM_BUCKETS && seen + h->buckets[b] < rank) {
+            seen += h->buckets[b++];
+        }
+
+        uint32_t value = b < HISTOGRAM_BUCKETS ? histogram_bucket_upper(b) : h->max;
+        if (value > h->max) {
+            value = h->max;
+        }
+        if (value < h->min) {
+            value = h->min;
+        }
+        out[i] = value;
+    }
+}
+
+uint32_t histogram_percentile(const histogram_t* h, uint8_t percent) {
+    uint32_t value;
+    histogram_percentiles(h, &percent, 1, &value);
+    return value;
+}
@@ -0,0 +1,37 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Log-linear buckets over the whole u32 range: values below HISTOGRAM_SUB_BUCKETS get a bucket each, every
+// power of two above is split into HISTOGRAM_SUB_BUCKETS equal buckets, so a bucket is at most 1/8 of its
+// values wide. Recording is a few shifts, nothing is allocated, callers do their own locking.
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((32 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    uint32_t count;
+    uint32_t min, max;
+    uint64_t sum;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+void histogram_reset(histogram_t* h);
+
+void histogram_record(histogram_t* h, uint32_t value);
+
+// adds the samples of from to into
+void histogram_merge(histogram_t* into, const histogram_t* from);
+
+// bucket value falls into and the largest value of a bucket
+int histogram_bucket(uint32_t value);
+uint32_t histogram_bucket_upper(int bucket);
+
+// Fills out[i] with the value percents[i] percent of the samples are at or below, as the upper bound of its
+// bucket clamped to min..max, in one pass; percents must be ascending. All 0 while h is empty.
+void histogram_percentiles(const histogram_t* h, const uint8_t* percents, int n, uint32_t* out);
+
+uint32_t histogram_percentile(const histogram_t* h, uint8_t percent);
+
+#endif /* HISTOGRAM_H */
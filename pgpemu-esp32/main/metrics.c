@@ -0,0 +1,79 @@
+#include "metrics.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "histogram.h"
+
+// guarded by metrics_lock, about 1 KB each
+static histogram_t metrics[METRIC_COUNT];
+static portMUX_TYPE metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const uint8_t REPORTED_PERCENTS[] = { 50, 90, 99 };
+
+void metrics_record(metric_t metric, uint32_t elapsed_us) {
+    if (metric >= METRIC_COUNT) {
+        return;
+    }
+    taskENTER_CRITICAL(&metrics_lock);
+    histogram_record(&metrics[metric], elapsed_us);
+    taskEXIT_CRITICAL(&metrics_lock);
+}
+
+void metrics_record_since(metric_t metric, int64_t start_us) {
+    int64_t elapsed = esp_timer_get_time() - start_us;
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+    metrics_record(metric, elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed);
+}
+
+void metrics_reset() {
+    taskENTER_CRITICAL(&metrics_lock);
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        histogram_reset(&metrics[m]);
+    }
+    taskEXIT_CRITICAL(&metrics_lock);
+}
+
+static size_t put_u32(uint8_t* buf, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+    return 4;
+}
+
+size_t metrics_serialize(uint8_t* buf, size_t buf_len) {
+    if (buf_len < METRICS_HEADER_LEN) {
+        return 0;
+    }
+
+    size_t offset = METRICS_HEADER_LEN;
+    uint8_t count = 0;
+    for (int m = 0; m < METRIC_COUNT && offset + METRICS_RECORD_LEN <= buf_len; m++) {
+        uint32_t samples, min, max;
+        uint32_t percentiles[sizeof(REPORTED_PERCENTS)];
+
+        // one walk over the buckets, copying the histogram out would take more stack than it saves
+        taskENTER_CRITICAL(&metrics_lock);
+        samples = metrics[m].count;
+        min = metrics[m].min;
+        max = metrics[m].max;
+        histogram_percentiles(&metrics[m], REPORTED_PERCENTS, sizeof(REPORTED_PERCENTS), percentiles);
+        taskEXIT_CRITICAL(&metrics_lock);
+
+        uint8_t* record = buf + offset;
+        size_t n = 0;
+        record[n++] = (uint8_t)m;
+        n += put_u32(record + n, samples);
+        n += put_u32(record + n, min);
+        for (size_t p = 0; p < sizeof(REPORTED_PERCENTS); p++) {
+            n += put_u32(record + n, percentiles[p]);
+        }
+        n += put_u32(record + n, max);
+        offset += n;
+        count++;
+    }
+
+    buf[0] = count;
+    return offset;
+}
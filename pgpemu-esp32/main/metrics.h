@@ -0,0 +1,32 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// latencies measured since boot, each in a histogram_t of microseconds
+typedef enum {
+    METRIC_HANDSHAKE,      // app subscribing to the certificate characteristic until its last answer
+    METRIC_RECONNECT,      // the same for a reconnect with a stored session key
+    METRIC_LED_TO_BUTTON,  // LED notification until the button press is sent, including the random delay
+    METRIC_NVS_COMMIT,     // nvs_commit() of any namespace
+    METRIC_COUNT,
+} metric_t;
+
+// GET_METRICS response, little-endian, times in us:
+// [metrics u8] then per metric [metric u8][count u32][min u32][p50 u32][p90 u32][p99 u32][max u32]
+#define METRICS_HEADER_LEN 1
+#define METRICS_RECORD_LEN 25
+
+// safe from any task, a few instructions under a spinlock
+void metrics_record(metric_t metric, uint32_t elapsed_us);
+
+// records the time since start_us (esp_timer_get_time()), saturated to u32
+void metrics_record_since(metric_t metric, int64_t start_us);
+
+void metrics_reset();
+
+// writes the GET_METRICS response, returns its length or 0 if buf can't hold the header
+size_t metrics_serialize(uint8_t* buf, size_t buf_len);
+
+#endif /* METRICS_H */
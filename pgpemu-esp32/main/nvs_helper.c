@@ -2,10 +2,124 @@
 
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "metrics.h"
 #include "nvs.h"
 
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
+
+// read-write handles that can be open at the same time and still be counted
+#define NVS_STATS_HANDLES 8
+
+enum {
+    NS_SLOT_FREE,
+    NS_SLOT_CLAIMED,
+    NS_SLOT_READY,
+};
+
+// lock-free, the writer task, the BT task and the settings task all write
+typedef struct {
+    atomic_int state;
+    char name[16];
+    atomic_uint writes;
+    atomic_uint write_errors;
+    atomic_uint commits;
+    atomic_uint commit_errors;
+} namespace_stats_t;
+
+static namespace_stats_t namespace_stats[NVS_STATS_NAMESPACES];
+// a slot is claimed and named inside it, so NS_SLOT_CLAIMED is only ever seen for the few cycles the other core
+// takes to copy the name
+static portMUX_TYPE claim_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct {
+    atomic_uint handle;  // 0 when free
+    int ns;              // namespace_stats slot, only used by the task that opened the handle
+} open_handles[NVS_STATS_HANDLES];
+
+static atomic_uint min_available = UINT_MAX;
+static atomic_bool low_space_warned = false;
+
+static int namespace_slot(const char* namespace) {
+    for (int i = 0; i < NVS_STATS_NAMESPACES; i++) {
+        namespace_stats_t* slot = &namespace_stats[i];
+        int state = atomic_load(&slot->state);
+        if (state == NS_SLOT_FREE) {
+            int expected = NS_SLOT_FREE;
+            taskENTER_CRITICAL(&claim_lock);
+            bool claimed = atomic_compare_exchange_strong(&slot->state, &expected, NS_SLOT_CLAIMED);
+            if (claimed) {
+                strncpy(slot->name, namespace, sizeof(slot->name) - 1);
+                atomic_store(&slot->state, NS_SLOT_READY);
+            }
+            taskEXIT_CRITICAL(&claim_lock);
+            if (claimed) {
+                return i;
+            }
+            state = expected;
+        }
+        // another task is naming the slot, possibly for this namespace; moving on would count it twice
+        while (state == NS_SLOT_CLAIMED) {
+            state = atomic_load(&slot->state);
+        }
+        if (strncmp(slot->name, namespace, sizeof(slot->name) - 1) == 0) {
+            return i;
+        }
+    }
+    return NVS_STATS_NAMESPACES - 1;
+}
+
+static void track_handle(nvs_handle_t handle, const char* namespace) {
+    int ns = namespace_slot(namespace);
+    for (int i = 0; i < NVS_STATS_HANDLES; i++) {
+        unsigned int expected = 0;
+        if (atomic_compare_exchange_strong(&open_handles[i].handle, &expected, (unsigned int)handle)) {
+            open_handles[i].ns = ns;
+            return;
+        }
+    }
+}
+
+// namespace slot of handle or -1, untrack also frees the entry
+static int tracked_namespace(nvs_handle_t handle, bool untrack) {
+    for (int i = 0; i < NVS_STATS_HANDLES; i++) {
+        if (atomic_load(&open_handles[i].handle) == (unsigned int)handle) {
+            int ns = open_handles[i].ns;
+            if (untrack) {
+                atomic_store(&open_handles[i].handle, 0);
+            }
+            return ns;
+        }
+    }
+    return -1;
+}
+
+static void check_free_space(const char* tag) {
+    nvs_stats_t stats;
+    if (nvs_get_stats(NULL, &stats) != ESP_OK) {
+        return;
+    }
+
+    unsigned int available = (unsigned int)stats.available_entries;
+    unsigned int lowest = atomic_load(&min_available);
+    while (available < lowest && !atomic_compare_exchange_weak(&min_available, &lowest, available)) {
+    }
+
+    if (available >= NVS_LOW_SPACE_ENTRIES) {
+        atomic_store(&low_space_warned, false);
+    } else if (!atomic_exchange(&low_space_warned, true)) {
+        ESP_LOGW(tag,
+            "nvs almost full: %u of %u entries available, %u used",
+            available,
+            (unsigned int)stats.total_entries,
+            (unsigned int)stats.used_entries);
+    }
+}
 
 bool nvs_read_check(const char* tag, esp_err_t err, const char* name) {
     switch (err) {
@@ -30,6 +144,15 @@ bool nvs_write_check(const char* tag, esp_err_t err, const char* name) {
     return false;
 }
 
+bool nvs_handle_write_check(const char* tag, nvs_handle_t handle, esp_err_t err, const char* name) {
+    int ns = tracked_namespace(handle, false);
+    if (ns >= 0) {
+        atomic_fetch_add(err == ESP_OK ? &namespace_stats[ns].writes : &namespace_stats[ns].write_errors, 1);
+    }
+
+    return nvs_write_check(tag, err, name);
+}
+
 bool nvs_open_readonly(const char* tag, const char* namespace, nvs_handle_t* out_handle) {
     if (!out_handle) {
         ESP_LOGE(tag, "nvs_open_readonly: out_handle is NULL");
@@ -65,11 +188,13 @@ bool nvs_open_readwrite(const char* tag, const char* namespace, nvs_handle_t* ou
         return false;          // Unreachable, but for clarity
     }
 
+    track_handle(*out_handle, namespace);
     return true;
 }
 
 void nvs_safe_close(nvs_handle_t handle) {
     if (handle != 0) {
+        tracked_namespace(handle, true);
         nvs_close(handle);
     }
 }
@@ -123,13 +248,82 @@ bool nvs_commit_and_close(const char* tag, nvs_handle_t handle, const char* key_
         return false;
     }
 
+    int ns = tracked_namespace(handle, true);
+    int64_t commit_start = esp_timer_get_time();
     esp_err_t err = nvs_commit(handle);
+    metrics_record_since(METRIC_NVS_COMMIT, commit_start);
     nvs_close(handle);
 
+    if (ns >= 0) {
+        atomic_fetch_add(err == ESP_OK ? &namespace_stats[ns].commits : &namespace_stats[ns].commit_errors, 1);
+    }
+
     if (err != ESP_OK) {
         ESP_LOGE(tag, "nvs_commit_and_close: failed to commit %s: %s", key_name, esp_err_to_name(err));
         return false;
     }
 
+    check_free_space(tag);
     return true;
 }
+
+static void put_u16(uint8_t* out, size_t value) {
+    uint16_t v = value > 0xffff ? 0xffff : (uint16_t)value;
+    out[0] = v & 0xff;
+    out[1] = v >> 8;
+}
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+}
+
+size_t nvs_stats_serialize(uint8_t* buf, size_t buf_len) {
+    if (buf_len < NVS_STATS_HEADER_LEN) {
+        return 0;
+    }
+
+    nvs_stats_t stats = { 0 };
+    nvs_get_stats(NULL, &stats);
+    unsigned int lowest = atomic_load(&min_available);
+
+    put_u16(buf, stats.used_entries);
+    put_u16(buf + 2, stats.free_entries);
+    put_u16(buf + 4, stats.available_entries);
+    put_u16(buf + 6, stats.total_entries);
+    put_u16(buf + 8, stats.namespace_count);
+    // lowest seen after a commit, or the current count if lower
+    put_u16(buf + 10, lowest < stats.available_entries ? lowest : stats.available_entries);
+    size_t offset = NVS_STATS_HEADER_LEN;
+
+    for (int i = 0; i < NVS_STATS_NAMESPACES; i++) {
+        namespace_stats_t* slot = &namespace_stats[i];
+        if (atomic_load(&slot->state) != NS_SLOT_READY) {
+            continue;
+        }
+        if (offset + NVS_STATS_RECORD_LEN > buf_len) {
+            break;
+        }
+
+        uint8_t* rec = buf + offset;
+        memset(rec, 0, 16);
+        memcpy(rec, slot->name, strnlen(slot->name, 16));
+        put_u32(rec + 16, atomic_load(&slot->writes));
+        put_u32(rec + 20, atomic_load(&slot->write_errors));
+        put_u32(rec + 24, atomic_load(&slot->commits));
+        put_u32(rec + 28, atomic_load(&slot->commit_errors));
+
+        size_t used = 0;
+        nvs_handle_t handle;
+        if (nvs_open(slot->name, NVS_READONLY, &handle) == ESP_OK) {
+            nvs_get_used_entry_count(handle, &used);
+            nvs_close(handle);
+        }
+        put_u16(rec + 32, used);
+        offset += NVS_STATS_RECORD_LEN;
+    }
+
+    return offset;
+}
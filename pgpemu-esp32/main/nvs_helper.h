@@ -6,6 +6,19 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+// namespaces with their own write/commit counters, once full the last one also counts the rest
+#define NVS_STATS_NAMESPACES 6
+// a commit logs a warning when fewer entries are available, one page
+#define NVS_LOW_SPACE_ENTRIES 126
+
+// GET_NVS_STATS response, little-endian:
+// header: [used u16][free u16][available u16][total u16][namespaces u16][lowest available since boot u16]
+// then per namespace written through nvs_open_readwrite:
+// [name 16 bytes, NUL padded][writes u32][write errors u32][commits u32][commit errors u32][used entries u16]
+#define NVS_STATS_HEADER_LEN 12
+#define NVS_STATS_RECORD_LEN 34
 
 /**
  * @brief Check result of NVS read operation and log warning/error if needed.
@@ -25,6 +38,16 @@ bool nvs_read_check(const char* tag, esp_err_t err, const char* name);
  */
 bool nvs_write_check(const char* tag, esp_err_t err, const char* name);
 
+/**
+ * @brief Check result of an NVS write on a handle and count it for the handle's namespace.
+ * @param tag Log tag for ESP-IDF logging
+ * @param handle Handle opened with nvs_open_readwrite()
+ * @param err Error code from NVS API
+ * @param name Name of the NVS key
+ * @return true if write was successful, false otherwise
+ */
+bool nvs_handle_write_check(const char* tag, nvs_handle_t handle, esp_err_t err, const char* name);
+
 /**
  * @brief Safely open NVS partition in readonly mode.
  * @param tag Log tag for ESP-IDF logging
@@ -45,6 +68,7 @@ bool nvs_open_readonly(const char* tag, const char* namespace, nvs_handle_t* out
  * @return true if opened successfully, false otherwise
  *
  * Panics on any error with ESP_ERROR_CHECK.
+ * Writes and commits on the handle are counted for the namespace.
  */
 bool nvs_open_readwrite(const char* tag, const char* namespace, nvs_handle_t* out_handle);
 
@@ -80,7 +104,16 @@ bool nvs_read_blob_checked(const char* tag,
  * @return true if committed successfully, false otherwise
  *
  * Always closes the handle, even if commit fails. Logs errors appropriately.
+ * Warns once when fewer than NVS_LOW_SPACE_ENTRIES entries are left afterwards.
  */
 bool nvs_commit_and_close(const char* tag, nvs_handle_t handle, const char* key_name);
 
+/**
+ * @brief Write the GET_NVS_STATS response (partition usage and per-namespace counters).
+ * @param buf Output buffer
+ * @param buf_len Size of buf
+ * @return Number of bytes written, 0 if buf can't hold the header
+ */
+size_t nvs_stats_serialize(uint8_t* buf, size_t buf_len);
+
 #endif /* NVS_HELPER_H */
\ No newline at end of file
@@ -0,0 +1,404 @@
+#include "nvs_writer.h"
+
+#include "config_storage.h"
+#include "device_keys.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "log_tags.h"
+#include "mutex_helpers.h"
+#include "nvs_helper.h"
+#include "pgp_handshake_multi.h"
+
+#include <string.h>
+
+// one pending change per phone, enough for every connected phone to change twice before a flush
+#define NVS_WRITER_SLOTS (2 * MAX_CONNECTIONS)
+// changes are collected this long after the first one and then committed together
+#define NVS_WRITER_DELAY_MS 2000
+// a reconnect rewrites its phone's record to move it up in the eviction order at most this often
+#define NVS_WRITER_SEEN_INTERVAL_MS (60 * 60 * 1000)
+
+typedef struct {
+    bool used;
+    // set by every change, cleared when the flush picks the entry up; an entry that is used but not dirty
+    // is being written right now and is dropped once that commit succeeded
+    bool dirty;
+    esp_bd_addr_t bda;
+    nvs_writer_op_t session_op;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+    bool has_settings;
+    bool autocatch, autospin;
+} nvs_writer_entry_t;
+
+typedef enum {
+    NVS_WRITER_MSG_KICK,   // a change was added, start the batch window
+    NVS_WRITER_MSG_FLUSH,  // the table is filling up, commit now
+} nvs_writer_msg_t;
+
+// pending changes, guarded by pending_mutex; readers look here before NVS
+static nvs_writer_entry_t pending[NVS_WRITER_SLOTS];
+static SemaphoreHandle_t pending_mutex = NULL;
+// only one flush at a time (writer task, a full table or shutdown)
+static SemaphoreHandle_t flush_mutex = NULL;
+static QueueHandle_t writer_queue = NULL;
+
+static uint32_t coalesced_changes = 0;
+
+// phones whose record nvs_writer_seen() rewrote lately, guarded by pending_mutex
+static struct {
+    bool used;
+    esp_bd_addr_t bda;
+    TickType_t at;
+} seen[NVS_WRITER_SLOTS];
+
+static void nvs_writer_task(void* pvParameters);
+
+static void nvs_writer_shutdown() {
+    nvs_writer_flush();
+}
+
+bool init_nvs_writer() {
+    pending_mutex = xSemaphoreCreateMutex();
+    flush_mutex = xSemaphoreCreateMutex();
+    if (!pending_mutex || !flush_mutex) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "%s creating mutex failed", __func__);
+        return false;
+    }
+
+    esp_err_t err = esp_register_shutdown_handler(nvs_writer_shutdown);
+    if (err != ESP_OK) {
+        ESP_LOGW(CONFIG_STORAGE_TAG, "%s registering shutdown handler failed: %s", __func__, esp_err_to_name(err));
+    }
+
+    writer_queue = xQueueCreate(4, sizeof(nvs_writer_msg_t));
+    if (!writer_queue) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "%s creating queue failed", __func__);
+        return false;
+    }
+
+    // below session_prefetch, reading keys for a connecting phone is more urgent than writing them
+    BaseType_t ret = xTaskCreate(nvs_writer_task, "nvs_writer", 3072, NULL, 5, NULL);
+    if (ret != pdPASS) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "%s creating task failed", __func__);
+        vQueueDelete(writer_queue);
+        writer_queue = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+// call with pending_mutex held
+static nvs_writer_entry_t* find_entry_locked(const esp_bd_addr_t bda) {
+    for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+        if (pending[i].used && memcmp(pending[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return &pending[i];
+        }
+    }
+    return NULL;
+}
+
+// call with pending_mutex held
+static int dirty_count_locked() {
+    int count = 0;
+    for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+        if (pending[i].used && pending[i].dirty) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// call with pending_mutex held, returns NULL if the table is full
+static nvs_writer_entry_t* get_or_add_entry_locked(const esp_bd_addr_t bda) {
+    nvs_writer_entry_t* entry = find_entry_locked(bda);
+    if (entry) {
+        if (entry->dirty) {
+            coalesced_changes++;
+        }
+        return entry;
+    }
+
+    for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+        if (!pending[i].used) {
+            memset(&pending[i], 0, sizeof(nvs_writer_entry_t));
+            pending[i].used = true;
+            memcpy(pending[i].bda, bda, sizeof(esp_bd_addr_t));
+            return &pending[i];
+        }
+    }
+    return NULL;
+}
+
+// merges what change sets into entry, call with pending_mutex held
+static void merge_change_locked(nvs_writer_entry_t* entry, const nvs_writer_entry_t* change) {
+    if (change->session_op != NVS_WRITER_NONE) {
+        entry->session_op = change->session_op;
+        memcpy(entry->session_key, change->session_key, sizeof(entry->session_key));
+        memcpy(entry->reconnect_challenge, change->reconnect_challenge, sizeof(entry->reconnect_challenge));
+    }
+    if (change->has_settings) {
+        entry->has_settings = true;
+        entry->autocatch = change->autocatch;
+        entry->autospin = change->autospin;
+    }
+    entry->dirty = true;
+}
+
+static bool queue_change(const nvs_writer_entry_t* change) {
+    if (!pending_mutex) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "nvs writer not initialized");
+        return false;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!mutex_acquire_blocking(pending_mutex)) {
+            return false;
+        }
+
+        nvs_writer_entry_t* entry = get_or_add_entry_locked(change->bda);
+        if (entry) {
+            merge_change_locked(entry, change);
+            bool half_full = dirty_count_locked() >= NVS_WRITER_SLOTS / 2;
+            mutex_release(pending_mutex);
+
+            if (!writer_queue) {
+                // no task, write it now
+                return nvs_writer_flush();
+            }
+            // a full queue already holds a kick
+            nvs_writer_msg_t msg = half_full ? NVS_WRITER_MSG_FLUSH : NVS_WRITER_MSG_KICK;
+            xQueueSend(writer_queue, &msg, 0);
+            return true;
+        }
+        mutex_release(pending_mutex);
+
+        // every slot waits for the flash, make room in this context
+        ESP_LOGW(CONFIG_STORAGE_TAG, "nvs writer table full, flushing synchronously");
+        if (!nvs_writer_flush()) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+bool nvs_writer_put_session(const esp_bd_addr_t bda, const uint8_t* session_key, const uint8_t* reconnect_challenge) {
+    nvs_writer_entry_t change = { .session_op = NVS_WRITER_PUT };
+    memcpy(change.bda, bda, sizeof(esp_bd_addr_t));
+    memcpy(change.session_key, session_key, sizeof(change.session_key));
+    memcpy(change.reconnect_challenge, reconnect_challenge, sizeof(change.reconnect_challenge));
+    bool ok = queue_change(&change);
+    memset(&change, 0, sizeof(change));
+    return ok;
+}
+
+bool nvs_writer_clear_session(const esp_bd_addr_t bda) {
+    nvs_writer_entry_t change = { .session_op = NVS_WRITER_CLEAR };
+    memcpy(change.bda, bda, sizeof(esp_bd_addr_t));
+    return queue_change(&change);
+}
+
+bool nvs_writer_put_settings(const esp_bd_addr_t bda, bool autocatch, bool autospin) {
+    nvs_writer_entry_t change = { .has_settings = true, .autocatch = autocatch, .autospin = autospin };
+    memcpy(change.bda, bda, sizeof(esp_bd_addr_t));
+    return queue_change(&change);
+}
+
+bool nvs_writer_touch(const esp_bd_addr_t bda) {
+    nvs_writer_entry_t change = { 0 };
+    memcpy(change.bda, bda, sizeof(esp_bd_addr_t));
+    return queue_change(&change);
+}
+
+bool nvs_writer_seen(const esp_bd_addr_t bda) {
+    if (!pending_mutex || !mutex_acquire_blocking(pending_mutex)) {
+        return false;
+    }
+
+    TickType_t now = xTaskGetTickCount();
+    int slot = -1, oldest = 0;
+    for (int i = 0; i < NVS_WRITER_SLOTS && slot < 0; i++) {
+        if (seen[i].used && memcmp(seen[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            slot = i;
+        } else if (!seen[i].used || (seen[oldest].used && now - seen[i].at > now - seen[oldest].at)) {
+            oldest = i;
+        }
+    }
+    bool due = slot < 0 || now - seen[slot].at >= pdMS_TO_TICKS(NVS_WRITER_SEEN_INTERVAL_MS);
+    if (slot < 0) {
+        // a free entry or the one rewritten longest ago
+        slot = oldest;
+    }
+    if (due) {
+        seen[slot].used = true;
+        memcpy(seen[slot].bda, bda, sizeof(esp_bd_addr_t));
+        seen[slot].at = now;
+    }
+    mutex_release(pending_mutex);
+
+    if (!due) {
+        return true;
+    }
+    return nvs_writer_touch(bda);
+}
+
+nvs_writer_op_t nvs_writer_pending_session(const esp_bd_addr_t bda,
+    uint8_t* session_key,
+    uint8_t* reconnect_challenge) {
+    if (!pending_mutex || !mutex_acquire_blocking(pending_mutex)) {
+        return NVS_WRITER_NONE;
+    }
+
+    nvs_writer_op_t op = NVS_WRITER_NONE;
+    const nvs_writer_entry_t* entry = find_entry_locked(bda);
+    if (entry) {
+        op = entry->session_op;
+        if (op == NVS_WRITER_PUT && session_key) {
+            memcpy(session_key, entry->session_key, sizeof(entry->session_key));
+        }
+        if (op == NVS_WRITER_PUT && reconnect_challenge) {
+            memcpy(reconnect_challenge, entry->reconnect_challenge, sizeof(entry->reconnect_challenge));
+        }
+    }
+
+    mutex_release(pending_mutex);
+    return op;
+}
+
+static void apply_change(device_record_t* record, const nvs_writer_entry_t* change) {
+    if (change->session_op == NVS_WRITER_PUT) {
+        memcpy(record->session_key, change->session_key, sizeof(record->session_key));
+        memcpy(record->reconnect_challenge, change->reconnect_challenge, sizeof(record->reconnect_challenge));
+        record->flags |= DEVICE_RECORD_HAS_SESSION;
+        record->sessions++;
+    } else if (change->session_op == NVS_WRITER_CLEAR) {
+        memset(record->session_key, 0, sizeof(record->session_key));
+        memset(record->reconnect_challenge, 0, sizeof(record->reconnect_challenge));
+        record->flags &= ~DEVICE_RECORD_HAS_SESSION;
+    }
+    if (change->has_settings) {
+        record->autocatch = change->autocatch;
+        record->autospin = change->autospin;
+        record->flags |= DEVICE_RECORD_HAS_SETTINGS;
+    }
+}
+
+bool nvs_writer_flush() {
+    // guarded by flush_mutex, too big for the stack of the calling task
+    static nvs_writer_entry_t batch[NVS_WRITER_SLOTS];
+
+    if (!flush_mutex || !mutex_acquire_blocking(flush_mutex)) {
+        return false;
+    }
+
+    int count = 0;
+    uint32_t coalesced = 0;
+    if (mutex_acquire_blocking(pending_mutex)) {
+        for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+            if (pending[i].used && pending[i].dirty) {
+                pending[i].dirty = false;
+                memcpy(&batch[count++], &pending[i], sizeof(nvs_writer_entry_t));
+            }
+        }
+        coalesced = coalesced_changes;
+        coalesced_changes = 0;
+        mutex_release(pending_mutex);
+    }
+
+    if (count == 0) {
+        mutex_release(flush_mutex);
+        return true;
+    }
+
+    bool committed = false;
+    nvs_handle_t handle = {};
+    if (nvs_open_readwrite(CONFIG_STORAGE_TAG, "device_settings", &handle)) {
+        device_record_t record;
+        device_keys_t keys;
+        for (int i = 0; i < count; i++) {
+            // read-modify-write, a change only touches part of the record
+            bool legacy = false;
+            get_device_keys(batch[i].bda, &keys);
+            bool stored = read_device_record(handle, &keys, &record, &legacy);
+            if (!stored && batch[i].session_op == NVS_WRITER_NONE && !batch[i].has_settings) {
+                // only touched, the record was evicted since; don't store an empty one
+                continue;
+            }
+            apply_change(&record, &batch[i]);
+            write_device_record(handle, &keys, &record, legacy);
+        }
+        memset(&record, 0, sizeof(record));
+        save_device_record_clock(handle);
+        committed = nvs_commit_and_close(CONFIG_STORAGE_TAG, handle, "device_records");
+    }
+    memset(batch, 0, sizeof(batch));
+
+    if (mutex_acquire_blocking(pending_mutex)) {
+        for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+            // entries changed again during the write stay dirty for the next flush
+            if (!pending[i].used || pending[i].dirty) {
+                continue;
+            }
+            if (committed) {
+                memset(&pending[i], 0, sizeof(nvs_writer_entry_t));
+            } else {
+                pending[i].dirty = true;
+            }
+        }
+        mutex_release(pending_mutex);
+    }
+
+    mutex_release(flush_mutex);
+
+    if (committed) {
+        ESP_LOGI(CONFIG_STORAGE_TAG, "nvs writer committed %d changes (%lu coalesced)", count, coalesced);
+    } else {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "nvs writer commit failed, %d changes kept for retry", count);
+    }
+    return committed;
+}
+
+static void nvs_writer_task(void* __attribute__((unused)) pvParameters) {
+    bool armed = false;
+    TickType_t deadline = 0;
+
+    ESP_LOGI(CONFIG_STORAGE_TAG, "nvs writer task start");
+
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (armed) {
+            TickType_t now = xTaskGetTickCount();
+            wait = (int32_t)(deadline - now) > 0 ? deadline - now : 0;
+        }
+
+        nvs_writer_msg_t msg;
+        if (xQueueReceive(writer_queue, &msg, wait) == pdTRUE && msg == NVS_WRITER_MSG_KICK) {
+            if (!armed) {
+                armed = true;
+                deadline = xTaskGetTickCount() + pdMS_TO_TICKS(NVS_WRITER_DELAY_MS);
+            }
+            continue;
+        }
+
+        // batch window over or flush requested
+        nvs_writer_flush();
+
+        armed = false;
+        if (mutex_acquire_blocking(pending_mutex)) {
+            // a failed commit is retried after another window
+            armed = dirty_count_locked() > 0;
+            mutex_release(pending_mutex);
+        }
+        if (armed) {
+            deadline = xTaskGetTickCount() + pdMS_TO_TICKS(NVS_WRITER_DELAY_MS);
+        }
+    }
+
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,42 @@
+#ifndef NVS_WRITER_H
+#define NVS_WRITER_H
+
+#include "esp_bt_defs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// a pending change of one phone's session keys
+typedef enum {
+    NVS_WRITER_NONE = 0,
+    NVS_WRITER_PUT,
+    NVS_WRITER_CLEAR,
+} nvs_writer_op_t;
+
+// starts the task which writes changes of the per-phone device records to NVS in the background, so the
+// handshake and the disconnect handler don't wait for flash; without it every change is written synchronously
+bool init_nvs_writer();
+
+// queue writing/erasing the session keys of bda, a newer change for the same bda replaces the pending one.
+// Returns false only if the change had to be written synchronously and that failed.
+bool nvs_writer_put_session(const esp_bd_addr_t bda, const uint8_t* session_key, const uint8_t* reconnect_challenge);
+bool nvs_writer_clear_session(const esp_bd_addr_t bda);
+bool nvs_writer_put_settings(const esp_bd_addr_t bda, bool autocatch, bool autospin);
+// rewrites the record of bda unchanged, which moves keys of older firmware into it and stamps last_seen;
+// nothing is written if bda has no record
+bool nvs_writer_touch(const esp_bd_addr_t bda);
+// bda reconnected: touches its record so the eviction order survives a reboot, at most once per
+// NVS_WRITER_SEEN_INTERVAL_MS per phone
+bool nvs_writer_seen(const esp_bd_addr_t bda);
+
+// the not yet committed change for bda, session_key (16 bytes) and reconnect_challenge (32 bytes)
+// are filled for NVS_WRITER_PUT, either may be NULL
+nvs_writer_op_t nvs_writer_pending_session(const esp_bd_addr_t bda,
+    uint8_t* session_key,
+    uint8_t* reconnect_challenge);
+
+// writes all pending changes with a single commit, runs in the caller's context and is also
+// registered as shutdown handler so nothing is lost on esp_restart()
+bool nvs_writer_flush();
+
+#endif /* NVS_WRITER_H */
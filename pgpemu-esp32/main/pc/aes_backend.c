@@ -0,0 +1,223 @@
+#ifndef ESP_PLATFORM
+
+#include "aes_backend.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AESNI 1
+#else
+#define HAVE_AESNI 0
+#endif
+
+typedef void (*encrypt_fn)(const struct aes_backend_ctx* ctx, const uint8_t* in, uint8_t* out);
+
+static void resolve_encrypt(const struct aes_backend_ctx* ctx, const uint8_t* in, uint8_t* out);
+
+// first call goes through resolve_encrypt() which picks AES_BACKEND_AUTO
+static encrypt_fn active_encrypt = resolve_encrypt;
+static aes_backend_t active_backend = AES_BACKEND_AUTO;
+
+/*** tiny-AES ***/
+
+static void tiny_encrypt(const struct aes_backend_ctx* ctx, const uint8_t* in, uint8_t* out) {
+    memmove(out, in, 16);
+    AES_ECB_encrypt((struct AES_ctx*)&ctx->tiny, out);
+}
+
+/*** T-table ***/
+
+static uint8_t te_sbox[256];
+static uint32_t te0[256];  // te1..te3 are byte rotations of te0
+static bool te_ready = false;
+
+#define ROTL8(x, n) ((uint8_t)(((x) << (n)) | ((x) >> (8 - (n)))))
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define GET_U32(p) \
+    (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | ((uint32_t)(p)[3]))
+#define PUT_U32(p, v)                 \
+    do {                              \
+        (p)[0] = (uint8_t)((v) >> 24); \
+        (p)[1] = (uint8_t)((v) >> 16); \
+        (p)[2] = (uint8_t)((v) >> 8);  \
+        (p)[3] = (uint8_t)(v);         \
+    } while (0)
+
+static uint8_t xtime(uint8_t x) {
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+}
+
+// derives the S-box by walking GF(2^8) with generator 3 and its inverse, then builds te0 from it
+static void ttable_init() {
+    uint8_t p = 1;
+    uint8_t q = 1;
+
+    do {
+        // p *= 3
+        p = p ^ xtime(p);
+        // q /= 3
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80) {
+            q ^= 0x09;
+        }
+        // affine transformation
+        te_sbox[p] = q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4) ^ 0x63;
+    } while (p != 1);
+    te_sbox[0] = 0x63;
+
+    for (int i = 0; i < 256; i++) {
+        uint8_t s = te_sbox[i];
+        uint8_t s2 = xtime(s);
+        te0[i] = ((uint32_t)s2 << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | (uint32_t)(s2 ^ s);
+    }
+
+    te_ready = true;
+}
+
+static void ttable_encrypt(const struct aes_backend_ctx* ctx, const uint8_t* in, uint8_t* out) {
+    const uint32_t* rk = ctx->ek;
+    uint32_t s0 = GET_U32(in) ^ rk[0];
+    uint32_t s1 = GET_U32(in + 4) ^ rk[1];
+    uint32_t s2 = GET_U32(in + 8) ^ rk[2];
+    uint32_t s3 = GET_U32(in + 12) ^ rk[3];
+    uint32_t t0, t1, t2, t3;
+
+    for (int round = 1; round < 10; round++) {
+        rk += 4;
+        t0 = te0[s0 >> 24] ^ ROTR32(te0[(s1 >> 16) & 0xff], 8) ^ ROTR32(te0[(s2 >> 8) & 0xff], 16) ^
+             ROTR32(te0[s3 & 0xff], 24) ^ rk[0];
+        t1 = te0[s1 >> 24] ^ ROTR32(te0[(s2 >> 16) & 0xff], 8) ^ ROTR32(te0[(s3 >> 8) & 0xff], 16) ^
+             ROTR32(te0[s0 & 0xff], 24) ^ rk[1];
+        t2 = te0[s2 >> 24] ^ ROTR32(te0[(s3 >> 16) & 0xff], 8) ^ ROTR32(te0[(s0 >> 8) & 0xff], 16) ^
+             ROTR32(te0[s1 & 0xff], 24) ^ rk[2];
+        t3 = te0[s3 >> 24] ^ ROTR32(te0[(s0 >> 16) & 0xff], 8) ^ ROTR32(te0[(s1 >> 8) & 0xff], 16) ^
+             ROTR32(te0[s2 & 0xff], 24) ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // last round has no MixColumns
+    rk += 4;
+    t0 = ((uint32_t)te_sbox[s0 >> 24] << 24) | ((uint32_t)te_sbox[(s1 >> 16) & 0xff] << 16) |
+         ((uint32_t)te_sbox[(s2 >> 8) & 0xff] << 8) | (uint32_t)te_sbox[s3 & 0xff];
+    t1 = ((uint32_t)te_sbox[s1 >> 24] << 24) | ((uint32_t)te_sbox[(s2 >> 16) & 0xff] << 16) |
+         ((uint32_t)te_sbox[(s3 >> 8) & 0xff] << 8) | (uint32_t)te_sbox[s0 & 0xff];
+    t2 = ((uint32_t)te_sbox[s2 >> 24] << 24) | ((uint32_t)te_sbox[(s3 >> 16) & 0xff] << 16) |
+         ((uint32_t)te_sbox[(s0 >> 8) & 0xff] << 8) | (uint32_t)te_sbox[s1 & 0xff];
+    t3 = ((uint32_t)te_sbox[s3 >> 24] << 24) | ((uint32_t)te_sbox[(s0 >> 16) & 0xff] << 16) |
+         ((uint32_t)te_sbox[(s1 >> 8) & 0xff] << 8) | (uint32_t)te_sbox[s2 & 0xff];
+
+    PUT_U32(out, t0 ^ rk[0]);
+    PUT_U32(out + 4, t1 ^ rk[1]);
+    PUT_U32(out + 8, t2 ^ rk[2]);
+    PUT_U32(out + 12, t3 ^ rk[3]);
+}
+
+/*** AES-NI ***/
+
+#if HAVE_AESNI
+__attribute__((target("aes,sse2"))) static void aesni_encrypt(
+    const struct aes_backend_ctx* ctx, const uint8_t* in, uint8_t* out) {
+    const __m128i* rk = (const __m128i*)ctx->tiny.RoundKey;
+
+    __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128(rk));
+    for (int round = 1; round < 10; round++) {
+        s = _mm_aesenc_si128(s, _mm_loadu_si128(rk + round));
+    }
+    s = _mm_aesenclast_si128(s, _mm_loadu_si128(rk + 10));
+    _mm_storeu_si128((__m128i*)out, s);
+}
+#endif
+
+/*** dispatch ***/
+
+void aes_backend_setkey(struct aes_backend_ctx* ctx, const uint8_t* key) {
+    AES_init_ctx(&ctx->tiny, key);
+    for (int i = 0; i < 44; i++) {
+        ctx->ek[i] = GET_U32(ctx->tiny.RoundKey + 4 * i);
+    }
+}
+
+void aes_backend_encrypt(const struct aes_backend_ctx* ctx, const uint8_t* in, uint8_t* out) {
+    active_encrypt(ctx, in, out);
+}
+
+bool aes_backend_supported(aes_backend_t backend) {
+    switch (backend) {
+    case AES_BACKEND_AUTO:
+    case AES_BACKEND_TINY:
+    case AES_BACKEND_TTABLE:
+        return true;
+    case AES_BACKEND_AESNI:
+#if HAVE_AESNI
+        return __builtin_cpu_supports("aes");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+bool aes_backend_select(aes_backend_t backend) {
+    if (backend == AES_BACKEND_AUTO) {
+        backend = aes_backend_supported(AES_BACKEND_AESNI) ? AES_BACKEND_AESNI : AES_BACKEND_TTABLE;
+    }
+    if (!aes_backend_supported(backend)) {
+        return false;
+    }
+
+    switch (backend) {
+    case AES_BACKEND_TINY:
+        active_encrypt = tiny_encrypt;
+        break;
+    case AES_BACKEND_TTABLE:
+        if (!te_ready) {
+            ttable_init();
+        }
+        active_encrypt = ttable_encrypt;
+        break;
+#if HAVE_AESNI
+    case AES_BACKEND_AESNI:
+        active_encrypt = aesni_encrypt;
+        break;
+#endif
+    default:
+        return false;
+    }
+
+    active_backend = backend;
+    return true;
+}
+
+aes_backend_t aes_backend_active() {
+    if (active_backend == AES_BACKEND_AUTO) {
+        aes_backend_select(AES_BACKEND_AUTO);
+    }
+    return active_backend;
+}
+
+const char* aes_backend_name(aes_backend_t backend) {
+    switch (backend) {
+    case AES_BACKEND_AUTO:
+        return "auto";
+    case AES_BACKEND_TINY:
+        return "tiny";
+    case AES_BACKEND_TTABLE:
+        return "ttable";
+    case AES_BACKEND_AESNI:
+        return "aesni";
+    }
+    return "unknown";
+}
+
+static void resolve_encrypt(const struct aes_backend_ctx* ctx, const uint8_t* in, uint8_t* out) {
+    aes_backend_select(AES_BACKEND_AUTO);
+    active_encrypt(ctx, in, out);
+}
+
+#endif  // ESP_PLATFORM
@@ -0,0 +1,44 @@
+#ifndef _AES_BACKEND_H_
+#define _AES_BACKEND_H_
+
+#ifndef ESP_PLATFORM
+
+// AES-128 block encryption for the PC build with interchangeable implementations.
+// All backends produce the same bytes as tiny-AES (pc/aes.c), the firmware uses the
+// esp_aes hardware instead (see pgp_cert.h).
+
+#include "aes.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    AES_BACKEND_AUTO = 0,  // fastest one this CPU supports
+    AES_BACKEND_TINY,      // byte oriented reference (pc/aes.c)
+    AES_BACKEND_TTABLE,    // 32 bit lookup tables
+    AES_BACKEND_AESNI,     // x86 AES instructions
+} aes_backend_t;
+
+struct aes_backend_ctx {
+    struct AES_ctx tiny;  // FIPS-197 key schedule as bytes, used by the tiny-AES and AES-NI backends
+    uint32_t ek[44];      // same schedule as big endian words for the T-table backend
+};
+
+// Expands a 128 bit key for every backend, so the active backend can be switched at any time.
+void aes_backend_setkey(struct aes_backend_ctx* ctx, const uint8_t* key);
+
+// Encrypts one 16 byte block with the active backend, in and out may be the same buffer.
+void aes_backend_encrypt(const struct aes_backend_ctx* ctx, const uint8_t* in, uint8_t* out);
+
+// Switches the active backend. AES_BACKEND_AUTO picks AES-NI when the CPU has it, T-table otherwise.
+// Returns false (and keeps the current backend) if the requested one isn't supported.
+// Not thread safe, select before starting threads which encrypt.
+bool aes_backend_select(aes_backend_t backend);
+
+bool aes_backend_supported(aes_backend_t backend);
+aes_backend_t aes_backend_active();
+const char* aes_backend_name(aes_backend_t backend);
+
+#endif  // ESP_PLATFORM
+
+#endif  // _AES_BACKEND_H_
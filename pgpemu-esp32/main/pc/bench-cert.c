@@ -0,0 +1,322 @@
+#ifndef ESP_PLATFORM
+
+// Micro-benchmarks for the certificate engine (pgp_cert.c) on PC.
+//
+//   ./bench-cert [-n iterations] [-b auto|tiny|ttable|aesni] [--json] [--baseline file.json] [--threshold percent]
+//
+// Every operation is run `iterations` times, timed in samples of BENCH_BATCH calls so the clock
+// overhead doesn't dominate the short ones. ns/op and ops/sec are over the whole run, p50/p99 over
+// the per-sample averages. With --baseline the results are compared with an earlier --json run and
+// the exit code is 1 if any operation got slower than threshold percent (default 10).
+
+#include "../pgp_cert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_BATCH 16
+#define DEFAULT_ITERATIONS 100000
+#define DEFAULT_THRESHOLD 10.0
+
+typedef struct {
+    AES_Context ctx;
+    uint8_t mac[6];
+    uint8_t key[16];
+    uint8_t nonce[16];
+    uint8_t data[80];
+    uint8_t out[80];
+    uint8_t reconnect_challenge[32];
+    struct challenge_data chal_0;
+    struct next_challenge next;
+} bench_state_t;
+
+typedef struct {
+    const char* name;
+    void (*run)(bench_state_t* state);
+} bench_op_t;
+
+typedef struct {
+    const char* name;
+    double ns_per_op;
+    double ops_per_sec;
+    double p50_ns;
+    double p99_ns;
+} bench_result_t;
+
+static void op_generate_chal_0(bench_state_t* s) {
+    generate_chal_0(s->mac, s->data, s->nonce, s->key, &s->ctx, s->nonce, &s->chal_0);
+}
+
+static void op_generate_next_chal(bench_state_t* s) {
+    generate_next_chal(0, &s->ctx, s->nonce, &s->next);
+}
+
+static void op_decrypt_next(bench_state_t* s) {
+    decrypt_next((const uint8_t*)&s->next, &s->ctx, s->out);
+}
+
+static void op_generate_reconnect_response(bench_state_t* s) {
+    generate_reconnect_response(&s->ctx, s->reconnect_challenge, s->out);
+}
+
+static void op_aes_hash_80(bench_state_t* s) {
+    aes_hash(&s->ctx, s->nonce, s->data, 80, s->out);
+}
+
+static void op_aes_ctr_80(bench_state_t* s) {
+    aes_ctr(&s->ctx, s->nonce, s->data, 80, s->out);
+}
+
+static const bench_op_t bench_ops[] = {
+    { "generate_chal_0", op_generate_chal_0 },
+    { "generate_next_chal", op_generate_next_chal },
+    { "decrypt_next", op_decrypt_next },
+    { "generate_reconnect_response", op_generate_reconnect_response },
+    { "aes_hash_80", op_aes_hash_80 },
+    { "aes_ctr_80", op_aes_ctr_80 },
+};
+
+#define BENCH_OP_COUNT (sizeof(bench_ops) / sizeof(bench_ops[0]))
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static void run_op(const bench_op_t* op, bench_state_t* state, int iterations, double* samples, bench_result_t* result) {
+    int sample_count = iterations / BENCH_BATCH;
+
+    // warm up caches and branch predictors
+    for (int i = 0; i < BENCH_BATCH * 4; i++) {
+        op->run(state);
+    }
+
+    double total = 0;
+    for (int i = 0; i < sample_count; i++) {
+        double start = now_ns();
+        for (int j = 0; j < BENCH_BATCH; j++) {
+            op->run(state);
+        }
+        double elapsed = now_ns() - start;
+        samples[i] = elapsed / BENCH_BATCH;
+        total += elapsed;
+    }
+
+    qsort(samples, sample_count, sizeof(double), compare_double);
+
+    result->name = op->name;
+    result->ns_per_op = total / (sample_count * BENCH_BATCH);
+    result->ops_per_sec = 1e9 / result->ns_per_op;
+    result->p50_ns = samples[sample_count / 2];
+    result->p99_ns = samples[(sample_count * 99) / 100];
+}
+
+static void print_text(const bench_result_t* results, int iterations) {
+    printf("aes backend: %s, %d iterations per op\n", aes_backend_name(aes_backend_active()), iterations);
+    printf("%-28s %12s %14s %12s %12s\n", "op", "ns/op", "ops/sec", "p50 ns", "p99 ns");
+    for (size_t i = 0; i < BENCH_OP_COUNT; i++) {
+        printf("%-28s %12.1f %14.0f %12.1f %12.1f\n",
+            results[i].name,
+            results[i].ns_per_op,
+            results[i].ops_per_sec,
+            results[i].p50_ns,
+            results[i].p99_ns);
+    }
+}
+
+// one result per line so --baseline can read it back without a JSON library
+static void print_json(const bench_result_t* results, int iterations) {
+    printf("{\n");
+    printf("  \"aes_backend\": \"%s\",\n", aes_backend_name(aes_backend_active()));
+    printf("  \"iterations\": %d,\n", iterations);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < BENCH_OP_COUNT; i++) {
+        printf("    {\"name\": \"%s\", \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, \"p50_ns\": %.1f, \"p99_ns\": %.1f}%s\n",
+            results[i].name,
+            results[i].ns_per_op,
+            results[i].ops_per_sec,
+            results[i].p50_ns,
+            results[i].p99_ns,
+            i + 1 < BENCH_OP_COUNT ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+// looks up ns_per_op of name in a file written by --json, returns < 0 if missing
+static double baseline_ns_per_op(const char* json, const char* name) {
+    char needle[64];
+    snprintf(needle, sizeof(needle), "\"name\": \"%s\"", name);
+
+    const char* entry = strstr(json, needle);
+    if (!entry) {
+        return -1;
+    }
+    const char* field = strstr(entry, "\"ns_per_op\":");
+    if (!field) {
+        return -1;
+    }
+    return strtod(field + strlen("\"ns_per_op\":"), NULL);
+}
+
+static char* read_file(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char* buf = malloc(len + 1);
+    if (buf && fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        buf = NULL;
+    }
+    if (buf) {
+        buf[len] = 0;
+    }
+    fclose(f);
+    return buf;
+}
+
+// returns the number of operations that regressed past threshold percent
+static int compare_baseline(const bench_result_t* results, const char* path, double threshold) {
+    char* json = read_file(path);
+    if (!json) {
+        fprintf(stderr, "can't read baseline %s\n", path);
+        return -1;
+    }
+
+    int regressions = 0;
+    fprintf(stderr, "%-28s %12s %12s %9s\n", "op", "baseline", "now", "change");
+    for (size_t i = 0; i < BENCH_OP_COUNT; i++) {
+        double base = baseline_ns_per_op(json, results[i].name);
+        if (base <= 0) {
+            fprintf(stderr, "%-28s %12s %12.1f\n", results[i].name, "-", results[i].ns_per_op);
+            continue;
+        }
+
+        double change = (results[i].ns_per_op - base) * 100.0 / base;
+        bool regressed = change > threshold;
+        fprintf(stderr,
+            "%-28s %12.1f %12.1f %+8.1f%%%s\n",
+            results[i].name,
+            base,
+            results[i].ns_per_op,
+            change,
+            regressed ? "  REGRESSION" : "");
+        if (regressed) {
+            regressions++;
+        }
+    }
+
+    free(json);
+    return regressions;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [-n iterations] [-b auto|tiny|ttable|aesni] [--json] [--baseline file.json] [--threshold percent]\n",
+        prog);
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = DEFAULT_ITERATIONS;
+    double threshold = DEFAULT_THRESHOLD;
+    const char* baseline = NULL;
+    bool json = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            aes_backend_t backend;
+            if (strcmp(name, "auto") == 0) {
+                backend = AES_BACKEND_AUTO;
+            } else if (strcmp(name, "tiny") == 0) {
+                backend = AES_BACKEND_TINY;
+            } else if (strcmp(name, "ttable") == 0) {
+                backend = AES_BACKEND_TTABLE;
+            } else if (strcmp(name, "aesni") == 0) {
+                backend = AES_BACKEND_AESNI;
+            } else {
+                fprintf(stderr, "unknown aes backend %s\n", name);
+                usage(argv[0]);
+                return 2;
+            }
+            if (!aes_backend_select(backend)) {
+                fprintf(stderr, "aes backend %s not supported\n", name);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (iterations < BENCH_BATCH) {
+        iterations = BENCH_BATCH;
+    }
+
+    set_cert_debug_dumps(false);
+    init_device_key_ctx();
+
+    bench_state_t state;
+    memset(&state, 0, sizeof(state));
+    memset(state.key, 0x43, 16);
+    memset(state.nonce, 0x42, 16);
+    memset(state.data, 0x41, sizeof(state.data));
+    memset(state.reconnect_challenge, 0x46, sizeof(state.reconnect_challenge));
+    memcpy(state.mac, (const uint8_t[]){ 0x98, 0xb6, 0xe9, 0x11, 0xe1, 0x46 }, 6);
+    aes_setkey(&state.ctx, state.key);
+    generate_next_chal(0, &state.ctx, state.nonce, &state.next);  // something valid for decrypt_next
+
+    double* samples = malloc(sizeof(double) * (iterations / BENCH_BATCH));
+    if (!samples) {
+        return 2;
+    }
+
+    bench_result_t results[BENCH_OP_COUNT];
+    for (size_t i = 0; i < BENCH_OP_COUNT; i++) {
+        run_op(&bench_ops[i], &state, iterations, samples, &results[i]);
+    }
+    free(samples);
+
+    if (json) {
+        print_json(results, iterations);
+    } else {
+        print_text(results, iterations);
+    }
+
+    if (baseline) {
+        int regressions = compare_baseline(results, baseline, threshold);
+        if (regressions < 0) {
+            return 2;
+        }
+        if (regressions > 0) {
+            fprintf(stderr, "%d op(s) slower than baseline by more than %.1f%%\n", regressions, threshold);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#endif
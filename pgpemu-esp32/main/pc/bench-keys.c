@@ -0,0 +1,174 @@
+// Throughput of the per-phone NVS key derivation (device_keys.c) on PC.
+//
+// Compares hashing a key on every use, as config_storage.c did before the key cache, with the cached
+// key sets: one connect cycle (settings read, session lookup, reconnect, write-behind flush) used the
+// record key LEGACY_CYCLE_KEYS times and now does one cache lookup per step after the prime at connect.
+// -p phones take turns, more phones than DEVICE_KEYS_CACHE_SIZE show the cost of misses.
+//
+//   make -f Makefile.test bench-keys && ./bench-keys -n 1000000 -p 8
+
+#include "device_keys.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// record key uses of one cycle before: 2 for the settings, 2 each for has_cached_session() and
+// retrieve_device_session_keys() (directory fingerprint and read), 3 for the flush (read, write, directory)
+#define LEGACY_CYCLE_KEYS 9
+// get_device_keys() calls of one cycle now, one per step
+#define CYCLE_LOOKUPS 4
+
+static volatile uint8_t sink;
+
+// make_device_key_for_option() as it was in config_storage.c, also checks the cache derives the same keys
+static char* legacy_key(const char* name, const esp_bd_addr_t bda, char* out) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s_%02x%02x%02x%02x%02x%02x", name, bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+
+    uint64_t hash = 1469598103934665603ULL;
+    for (const char* p = buf; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+
+    uint64_t hash_trunc = hash & 0x0FFFFFFFFFFFFFFFUL;
+    const char hex_chars[] = "0123456789abcdef";
+    for (int i = 14; i >= 0; i--) {
+        out[i] = hex_chars[hash_trunc & 0xF];
+        hash_trunc >>= 4;
+    }
+    out[15] = '\0';
+    return out;
+}
+
+static void make_bda(int n, esp_bd_addr_t out) {
+    uint8_t bda[6] = { 0x5c, 0xe5, 0x0c, 0x12, (uint8_t)(n >> 8), (uint8_t)n };
+    memcpy(out, bda, sizeof(esp_bd_addr_t));
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char* name, double elapsed_ns, int ops) {
+    double ns_per_op = elapsed_ns / ops;
+    printf("%-14s %10.1f %14.0f\n", name, ns_per_op, 1e9 / ns_per_op);
+}
+
+static bool check_keys(int phones) {
+    for (int n = 0; n < phones; n++) {
+        esp_bd_addr_t bda;
+        make_bda(n, bda);
+        device_keys_t keys;
+        get_device_keys(bda, &keys);
+
+        for (int k = 0; k < DEVICE_KEY_COUNT; k++) {
+            char expected[16];
+            legacy_key(device_key_name((device_key_t)k), bda, expected);
+            if (strcmp(keys.key[k], expected) != 0) {
+                fprintf(stderr,
+                    "phone %d: key %s is %s, stored data is under %s\n",
+                    n,
+                    device_key_name((device_key_t)k),
+                    keys.key[k],
+                    expected);
+                return false;
+            }
+        }
+        if (keys.fingerprint != strtoull(keys.key[DEVICE_KEY_RECORD], NULL, 16)) {
+            fprintf(stderr, "phone %d: fingerprint doesn't match the record key\n", n);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int iterations = 1000000, phones = 8;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'p':
+            phones = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-p phones]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (iterations < 1 || phones < 1 || phones > 0xffff) {
+        fprintf(stderr, "invalid arguments\n");
+        return 2;
+    }
+
+    if (!check_keys(phones)) {
+        return 1;
+    }
+
+    esp_bd_addr_t* bdas = malloc(phones * sizeof(esp_bd_addr_t));
+    for (int n = 0; n < phones; n++) {
+        make_bda(n, bdas[n]);
+    }
+
+    printf("%d iterations, %d phones, %d cached\n\n", iterations, phones, DEVICE_KEYS_CACHE_SIZE);
+    printf("%-14s %10s %14s\n", "op", "ns/op", "ops/sec");
+
+    char key[16];
+    double start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        sink ^= legacy_key("dev", bdas[i % phones], key)[0];
+    }
+    report("key (before)", now_ns() - start, iterations);
+
+    device_keys_t keys;
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        derive_device_keys(bdas[i % phones], &keys);
+        sink ^= keys.key[DEVICE_KEY_RECORD][0];
+    }
+    report("derive set", now_ns() - start, iterations);
+
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        get_device_keys(bdas[i % phones], &keys);
+        sink ^= keys.key[DEVICE_KEY_RECORD][0];
+    }
+    report("lookup", now_ns() - start, iterations);
+
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        for (int k = 0; k < LEGACY_CYCLE_KEYS; k++) {
+            sink ^= legacy_key("dev", bdas[i % phones], key)[0];
+        }
+    }
+    report("cycle (before)", now_ns() - start, iterations);
+
+    uint32_t lookups_before, derivations_before;
+    get_device_keys_stats(&lookups_before, &derivations_before);
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        prime_device_keys(bdas[i % phones]);
+        for (int k = 0; k < CYCLE_LOOKUPS; k++) {
+            get_device_keys(bdas[i % phones], &keys);
+            sink ^= keys.key[DEVICE_KEY_RECORD][0];
+        }
+    }
+    report("cycle", now_ns() - start, iterations);
+
+    uint32_t lookups, derivations;
+    get_device_keys_stats(&lookups, &derivations);
+    printf("\ncycle: %u lookups, %u derived (%.1f%% hits)\n",
+        (unsigned)(lookups - lookups_before),
+        (unsigned)(derivations - derivations_before),
+        100.0 * (1.0 - (double)(derivations - derivations_before) / (lookups - lookups_before)));
+
+    free(bdas);
+    return 0;
+}
@@ -0,0 +1,204 @@
+// Flash cost of storing reconnect sessions on the host NVS emulator.
+//
+// Compares the old per-key layout (session key and reconnect challenge as two blobs, committed on
+// every handshake) with the device record written by the write-behind task (one 60 byte record per
+// phone and the record clock, one commit per batch). Key names are simplified, the value sizes and
+// the write pattern match config_storage.c.
+//
+//   make -f Makefile.test bench-nvs && ./bench-nvs -p 8 -n 1000 -b 4
+
+#include "nvs.h"
+#include "nvs_emu.h"
+#include "nvs_flash.h"
+#include "nvs_helper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char TAG[] = "bench-nvs";
+static const char NAMESPACE[] = "device_settings";
+
+// same size as device_record_t in config_storage.h
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t flags;
+    int8_t autocatch;
+    int8_t autospin;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+    uint32_t last_seen;
+    uint32_t sessions;
+} record_t;
+
+static void random_bytes(uint8_t* out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (uint8_t)rand();
+    }
+}
+
+static bool legacy_session(int phone) {
+    char key_name[16], chal_name[16];
+    snprintf(key_name, sizeof(key_name), "sk%02x", phone);
+    snprintf(chal_name, sizeof(chal_name), "rc%02x", phone);
+
+    uint8_t key[16], chal[32];
+    random_bytes(key, sizeof(key));
+    random_bytes(chal, sizeof(chal));
+
+    nvs_handle_t handle;
+    if (!nvs_open_readwrite(TAG, NAMESPACE, &handle)) {
+        return false;
+    }
+    bool ok = nvs_write_check(TAG, nvs_set_blob(handle, key_name, key, sizeof(key)), key_name);
+    ok = ok && nvs_write_check(TAG, nvs_set_blob(handle, chal_name, chal, sizeof(chal)), chal_name);
+    return nvs_commit_and_close(TAG, handle, "session") && ok;
+}
+
+static bool record_batch(int first_phone, int count, int phones, uint32_t* clock) {
+    nvs_handle_t handle;
+    if (!nvs_open_readwrite(TAG, NAMESPACE, &handle)) {
+        return false;
+    }
+
+    bool ok = true;
+    (*clock)++;
+    for (int i = 0; i < count && ok; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "dev%02x", (first_phone + i) % phones);
+
+        // read-modify-write like apply_change in nvs_writer.c
+        record_t record;
+        size_t len = sizeof(record);
+        if (nvs_get_blob(handle, name, &record, &len) != ESP_OK || len != sizeof(record)) {
+            memset(&record, 0, sizeof(record));
+            record.version = 1;
+        }
+        record.flags |= 0x01;
+        random_bytes(record.session_key, sizeof(record.session_key));
+        random_bytes(record.reconnect_challenge, sizeof(record.reconnect_challenge));
+        record.last_seen = *clock;
+        record.sessions++;
+        ok = nvs_write_check(TAG, nvs_set_blob(handle, name, &record, sizeof(record)), name);
+    }
+    ok = ok && nvs_write_check(TAG, nvs_set_u32(handle, "seen", *clock), "seen");
+    return nvs_commit_and_close(TAG, handle, "records") && ok;
+}
+
+static void report(const char* layout, int sectors, int sessions) {
+    nvs_emu_stats_t stats;
+    nvs_emu_get_stats(&stats);
+
+    uint32_t max_erases = 0;
+    for (int s = 0; s < sectors; s++) {
+        uint32_t erases, programs;
+        if (nvs_emu_sector_cycles(s, &erases, &programs) && erases > max_erases) {
+            max_erases = erases;
+        }
+    }
+    nvs_stats_t nvs_stats;
+    nvs_get_stats(NULL, &nvs_stats);
+
+    printf("%-8s %8u %8u %9u %7u %7u %10u %10.1f %6u\n",
+        layout,
+        (unsigned)stats.sets,
+        (unsigned)stats.commits,
+        (unsigned)stats.programs,
+        (unsigned)stats.erases,
+        (unsigned)max_erases,
+        (unsigned)(sessions ? stats.bytes_programmed / sessions : 0),
+        stats.simulated_us / 1000.0,
+        (unsigned)nvs_stats.used_entries);
+}
+
+static bool fresh(const char* path, int sectors) {
+    unlink(path);
+    if (nvs_emu_mount(path, sectors) != ESP_OK || nvs_flash_init() != ESP_OK) {
+        fprintf(stderr, "cannot mount %s\n", path);
+        return false;
+    }
+    nvs_emu_set_latency(&NVS_EMU_LATENCY_SPI_NOR);
+    nvs_emu_reset_stats();
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int phones = 8, sessions = 1000, batch = 4, sectors = NVS_EMU_DEFAULT_SECTORS;
+    const char* path = "bench-nvs.bin";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:b:s:f:")) != -1) {
+        switch (opt) {
+        case 'p':
+            phones = atoi(optarg);
+            break;
+        case 'n':
+            sessions = atoi(optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 's':
+            sectors = atoi(optarg);
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        default:
+            fprintf(stderr,
+                "usage: %s [-p phones] [-n sessions per phone] [-b phones per flush] [-s sectors] [-f file]\n",
+                argv[0]);
+            return 2;
+        }
+    }
+    if (phones < 1 || phones > 255 || sessions < 1 || batch < 1 || batch > phones) {
+        fprintf(stderr, "invalid arguments\n");
+        return 2;
+    }
+
+    printf("%d phones, %d sessions each, %d phones per flush, %d sectors, SPI NOR timings\n\n",
+        phones,
+        sessions,
+        batch,
+        sectors);
+    printf("%-8s %8s %8s %9s %7s %7s %10s %10s %6s\n",
+        "layout",
+        "sets",
+        "commits",
+        "programs",
+        "erases",
+        "max/sec",
+        "B/session",
+        "flash ms",
+        "used");
+
+    int total = phones * sessions;
+    srand(1);
+    if (!fresh(path, sectors)) {
+        return 1;
+    }
+    for (int n = 0; n < total; n++) {
+        if (!legacy_session(n % phones)) {
+            return 1;
+        }
+    }
+    report("keys", sectors, total);
+
+    srand(1);
+    if (!fresh(path, sectors)) {
+        return 1;
+    }
+    uint32_t clock = 0;
+    for (int n = 0; n < total; n += batch) {
+        int count = total - n < batch ? total - n : batch;
+        if (!record_batch(n, count, phones, &clock)) {
+            return 1;
+        }
+    }
+    report("record", sectors, total);
+
+    nvs_emu_unmount();
+    unlink(path);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #ifndef ESP_PLATFORM
 
+#include "../entropy.h"
 #include "../pgp_cert.h"
 #include "../secrets.h"
 
@@ -8,6 +9,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#define BENCH_ITERATIONS 20000
 
 // length must be 378 bytes
 void test_decrypt_chal_0(const uint8_t* indata) {
@@ -114,8 +118,27 @@ void test_generate_chal_0() {
 
     memset(outer_nonce, 0x44, 16);
 
-    generate_chal_0(mac, the_challenge, main_nonce, main_key, outer_nonce, &output);
+    AES_Context main_ctx;
+    aes_setkey(&main_ctx, main_key);
+    generate_chal_0(mac, the_challenge, main_nonce, main_key, &main_ctx, outer_nonce, &output);
     test_decrypt_chal_0((uint8_t*)&output);  // test that this works using known data
+
+    // every byte is written in place, whatever the buffer held before
+    struct challenge_data dirty;
+    memset(&dirty, 0xff, sizeof(dirty));
+    generate_chal_0(mac, the_challenge, main_nonce, main_key, &main_ctx, outer_nonce, &dirty);
+    assert(memcmp(&dirty, &output, sizeof(output)) == 0);
+
+    // dynamic part + stamped template is the whole certificate (that's how the cert pool hands them out)
+    memset(&dirty, 0xff, sizeof(dirty));
+    memcpy(&dirty, &output, CHAL_0_DYNAMIC_LEN);
+    chal_0_stamp_static(mac, &dirty);
+    assert(memcmp(&dirty, &output, sizeof(output)) == 0);
+
+    // a buffer stamped once only needs the dynamic part per handshake, the tail is left alone
+    memset(&dirty, 0xff, CHAL_0_DYNAMIC_LEN);
+    generate_chal_0_dynamic(mac, the_challenge, main_nonce, main_key, &main_ctx, outer_nonce, &dirty);
+    assert(memcmp(&dirty, &output, sizeof(output)) == 0);
 }
 
 void test_generate_chal_1() {
@@ -126,14 +149,243 @@ void test_generate_chal_1() {
     memset(main_key, 0x43, 16);
     memset(nonce, 0x42, 16);
 
-    generate_next_chal(0, main_key, nonce, &output);
+    AES_Context ctx;
+    aes_setkey(&ctx, main_key);
+    generate_next_chal(0, &ctx, nonce, &output);
     printf("Test decrypt challenge 1");
     test_decrypt_chal_next((uint8_t*)&output, main_key);
 }
 
+// the fused CCM pass has to produce exactly what the separate aes_ctr/aes_hash/encrypt_block passes produce
+void test_ccm_matches_two_pass() {
+    printf("--------------- fused ccm vs two pass ------------\n");
+
+    uint8_t key[16];
+    uint8_t nonce[16];
+    uint8_t data[80];
+    uint8_t ctr_out[80], ccm_out[80], plain[80];
+    uint8_t hash[16], tag_ref[16], ccm_tag[16], dec_tag[16];
+    AES_Context ctx;
+
+    for (int round = 0; round < 100; round++) {
+        randomize_buffer(key, 16);
+        randomize_buffer(nonce, 16);
+        randomize_buffer(data, sizeof(data));
+        aes_setkey(&ctx, key);
+
+        for (int count = 16; count <= 80; count += 16) {
+            aes_ctr(&ctx, nonce, data, count, ctr_out);
+            aes_hash(&ctx, nonce, data, count, hash);
+            encrypt_block(&ctx, hash, nonce, tag_ref);
+
+            aes_ccm_encrypt(&ctx, nonce, data, count, ccm_out, ccm_tag);
+            assert(memcmp(ccm_out, ctr_out, count) == 0);
+            assert(memcmp(ccm_tag, tag_ref, 16) == 0);
+
+            aes_ccm_decrypt(&ctx, nonce, ccm_out, count, plain, dec_tag);
+            assert(memcmp(plain, data, count) == 0);
+            assert(memcmp(dec_tag, tag_ref, 16) == 0);
+        }
+    }
+    printf("fused ccm matches two pass for 16..80 bytes\n");
+}
+
+// a seeded entropy pool has to give the same bytes (and so the same handshake) on every run
+void test_entropy_seeded() {
+    printf("--------------- seeded entropy ------------\n");
+
+    uint8_t first[200], second[200];
+    struct challenge_data chal_a, chal_b;
+    uint8_t mac[] = { 0x98, 0xb6, 0xe9, 0x11, 0xe1, 0x46 };
+    AES_Context ctx;
+
+    for (int run = 0; run < 2; run++) {
+        struct challenge_data* chal = run == 0 ? &chal_a : &chal_b;
+        uint8_t* bytes = run == 0 ? first : second;
+        uint8_t the_challenge[16], main_nonce[16], session_key[16], outer_nonce[16];
+
+        entropy_seed(1234);
+        assert(entropy_is_seeded());
+        // odd sizes so the pool wraps in the middle of a request
+        randomize_buffer(bytes, 7);
+        randomize_buffer(bytes + 7, 193);
+
+        randomize_buffer(the_challenge, 16);
+        randomize_buffer(main_nonce, 16);
+        randomize_buffer(session_key, 16);
+        randomize_buffer(outer_nonce, 16);
+        aes_setkey(&ctx, session_key);
+        generate_chal_0(mac, the_challenge, main_nonce, session_key, &ctx, outer_nonce, chal);
+    }
+    assert(memcmp(first, second, sizeof(first)) == 0);
+    assert(memcmp(&chal_a, &chal_b, sizeof(chal_a)) == 0);
+
+    entropy_seed(1235);
+    randomize_buffer(second, sizeof(second));
+    assert(memcmp(first, second, sizeof(first)) != 0);
+
+    entropy_unseed();
+    assert(!entropy_is_seeded());
+    randomize_buffer(first, sizeof(first));
+    randomize_buffer(second, sizeof(second));
+    assert(memcmp(first, second, sizeof(first)) != 0);
+
+    uint32_t words = 0;
+    for (int i = 0; i < 64; i++) {
+        words |= entropy_word();
+    }
+    assert(words != 0);
+
+    printf("seeded runs are reproducible\n");
+}
+
+// every host AES backend has to match the tiny-AES reference and FIPS-197 appendix C.1
+void test_aes_backends() {
+    printf("--------------- aes backends ------------\n");
+
+    const uint8_t fips_key[16] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+    };
+    const uint8_t fips_plain[16] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+    };
+    const uint8_t fips_cipher[16] = {
+        0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+    };
+    const aes_backend_t backends[] = { AES_BACKEND_TINY, AES_BACKEND_TTABLE, AES_BACKEND_AESNI };
+
+    for (int b = 0; b < 3; b++) {
+        if (!aes_backend_select(backends[b])) {
+            printf("%-8s not supported on this CPU\n", aes_backend_name(backends[b]));
+            continue;
+        }
+
+        AES_Context ctx;
+        uint8_t out[16];
+        aes_setkey(&ctx, fips_key);
+        pgp_aes_encrypt(&ctx, fips_plain, out);
+        assert(memcmp(out, fips_cipher, 16) == 0);
+
+        for (int i = 0; i < 1000; i++) {
+            uint8_t key[16], block[16], ref[16];
+            randomize_buffer(key, 16);
+            randomize_buffer(block, 16);
+            aes_setkey(&ctx, key);
+
+            memcpy(ref, block, 16);
+            AES_ECB_encrypt(&ctx.tiny, ref);
+            pgp_aes_encrypt(&ctx, block, out);
+            assert(memcmp(out, ref, 16) == 0);
+
+            // in place
+            pgp_aes_encrypt(&ctx, block, block);
+            assert(memcmp(block, ref, 16) == 0);
+        }
+        printf("%-8s matches tiny-AES\n", aes_backend_name(backends[b]));
+    }
+
+    aes_backend_select(AES_BACKEND_AUTO);
+}
+
+static double elapsed_us(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+// Runs the crypto of one full handshake (challenge 0, next challenge, 2x decrypt_next)
+// plus one reconnect response, the way pgp_handshake.c drives it.
+// rekey_every_step re-expands the session and device keys before each step like the
+// firmware did before the schedules were cached per connection.
+static void run_handshake(bool rekey_every_step, const uint8_t* session_key, AES_Context* ctx) {
+    struct challenge_data chal_0;
+    struct next_challenge next;
+    uint8_t nonce[16];
+    uint8_t out[16];
+    uint8_t reconnect_challenge[32];
+    uint8_t mac[] = { 0x98, 0xb6, 0xe9, 0x11, 0xe1, 0x46 };
+
+    memset(nonce, 0x42, 16);
+    memset(reconnect_challenge, 0x46, 32);
+
+    aes_setkey(ctx, session_key);
+    if (rekey_every_step) {
+        init_device_key_ctx();
+    }
+    generate_chal_0(mac, nonce, nonce, session_key, ctx, nonce, &chal_0);
+
+    if (rekey_every_step) {
+        aes_setkey(ctx, session_key);
+    }
+    generate_next_chal(0, ctx, nonce, &next);
+
+    for (int i = 0; i < 2; i++) {
+        if (rekey_every_step) {
+            aes_setkey(ctx, session_key);
+        }
+        decrypt_next((uint8_t*)&next, ctx, out);
+    }
+
+    if (rekey_every_step) {
+        aes_setkey(ctx, session_key);
+    }
+    generate_reconnect_response(ctx, reconnect_challenge, out);
+}
+
+void bench_handshake() {
+    printf("--------------- handshake benchmark ------------\n");
+
+    uint8_t session_key[16];
+    memset(session_key, 0x43, 16);
+    AES_Context ctx;
+    struct timespec start, end;
+
+    set_cert_debug_dumps(false);
+    init_device_key_ctx();
+
+    // warm up caches so the first mode isn't penalized
+    for (int i = 0; i < BENCH_ITERATIONS / 10; i++) {
+        run_handshake(false, session_key, &ctx);
+    }
+
+    const char* labels[] = { "re-key every step", "cached key schedules" };
+    double per_handshake[2];
+    for (int mode = 0; mode < 2; mode++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCH_ITERATIONS; i++) {
+            run_handshake(mode == 0, session_key, &ctx);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        per_handshake[mode] = elapsed_us(&start, &end) / BENCH_ITERATIONS;
+        printf("%-22s %8.2f us/handshake (%d iterations)\n", labels[mode], per_handshake[mode], BENCH_ITERATIONS);
+    }
+    printf("speedup: %.2fx\n", per_handshake[0] / per_handshake[1]);
+
+    const aes_backend_t backends[] = { AES_BACKEND_TINY, AES_BACKEND_TTABLE, AES_BACKEND_AESNI };
+    for (int b = 0; b < 3; b++) {
+        if (!aes_backend_select(backends[b])) {
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCH_ITERATIONS; i++) {
+            run_handshake(false, session_key, &ctx);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("aes backend %-10s %8.2f us/handshake\n",
+            aes_backend_name(backends[b]),
+            elapsed_us(&start, &end) / BENCH_ITERATIONS);
+    }
+    aes_backend_select(AES_BACKEND_AUTO);
+
+    set_cert_debug_dumps(true);
+}
+
 int test() {
     test_generate_chal_0();  // test generate and print output
     test_generate_chal_1();
+    test_entropy_seeded();
+    test_aes_backends();
+    test_ccm_matches_two_pass();
+    bench_handshake();
 
     return 0;
 }
@@ -150,7 +402,9 @@ int main(int argc, char* argv[]) {
     uint8_t reconnect_challenge[32];
     memset(reconnect_challenge, 0x46, 32);
     uint8_t temp[16];
-    generate_reconnect_response(main_key, reconnect_challenge, temp);
+    AES_Context ctx;
+    aes_setkey(&ctx, main_key);
+    generate_reconnect_response(&ctx, reconnect_challenge, temp);
     hexdump("Reconnect ", temp, 16);
     assert(memcmp(temp, expected, 16) == 0);
 
@@ -0,0 +1,11 @@
+#ifndef ESP_BT_DEFS_H
+#define ESP_BT_DEFS_H
+
+// host stand-in for ESP-IDF's esp_bt_defs.h
+
+#include <stdint.h>
+
+#define ESP_BD_ADDR_LEN 6
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+
+#endif /* ESP_BT_DEFS_H */
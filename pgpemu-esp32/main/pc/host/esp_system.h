@@ -0,0 +1,8 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+// host stand-in for ESP-IDF's esp_system.h
+
+#include "esp_err.h"
+
+#endif /* ESP_SYSTEM_H */
@@ -0,0 +1,11 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+// host stand-in for ESP-IDF's esp_timer.h, only the clock
+
+#include <stdint.h>
+
+// microseconds of CLOCK_MONOTONIC
+int64_t esp_timer_get_time();
+
+#endif /* ESP_TIMER_H */
@@ -0,0 +1,13 @@
+#ifndef NVS_FLASH_H
+#define NVS_FLASH_H
+
+// host stand-in for ESP-IDF's nvs_flash.h, backed by the emulator in nvs_emu.c
+
+#include "esp_err.h"
+
+// mounts the emulator file (NVS_EMU_FILE or nvs_emu.bin, NVS_EMU_SECTORS sectors) unless nvs_emu_mount() ran
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+esp_err_t nvs_flash_deinit(void);
+
+#endif /* NVS_FLASH_H */
@@ -0,0 +1,478 @@
+// Tests for the host NVS emulator (nvs_emu.c) and the firmware code running on it:
+// nvs_helper.c and config_secrets.c are built unchanged against the shims in pc/host.
+//
+//   make -f Makefile.test nvs-emu-test && ./nvs-emu-test [flash file]
+
+#include "config_secrets.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_emu.h"
+#include "nvs_flash.h"
+#include "nvs_helper.h"
+#include "secrets.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// normally from secrets.c, filled by read_secrets()
+char PGP_CLONE_NAME[16];
+uint8_t PGP_MAC[6];
+uint8_t PGP_DEVICE_KEY[16];
+uint8_t PGP_BLOB[256];
+
+static const char* flash_file = "nvs-emu-test.bin";
+
+// fresh erased flash with the given size, initialized
+static void fresh_flash(int sectors) {
+    unlink(flash_file);
+    assert(nvs_emu_mount(flash_file, sectors) == ESP_OK);
+    assert(nvs_flash_init() == ESP_OK);
+    nvs_emu_clear_faults();
+    nvs_emu_reset_stats();
+}
+
+void test_set_get() {
+    printf("\n=== Test: Set and Get ===\n");
+    fresh_flash(NVS_EMU_DEFAULT_SECTORS);
+
+    nvs_handle_t handle;
+    assert(nvs_open("ro_missing", NVS_READONLY, &handle) == ESP_ERR_NVS_NOT_FOUND);
+    assert(nvs_open("test", NVS_READWRITE, &handle) == ESP_OK);
+
+    assert(nvs_set_i8(handle, "i8", -5) == ESP_OK);
+    assert(nvs_set_u32(handle, "u32", 0xdeadbeef) == ESP_OK);
+    assert(nvs_set_u64(handle, "u64", 0x0123456789abcdefULL) == ESP_OK);
+    assert(nvs_set_str(handle, "str", "pgpemu") == ESP_OK);
+    uint8_t blob[300];
+    for (size_t i = 0; i < sizeof(blob); i++) {
+        blob[i] = (uint8_t)(i * 7);
+    }
+    assert(nvs_set_blob(handle, "blob", blob, sizeof(blob)) == ESP_OK);
+    assert(nvs_set_u8(handle, "this_key_is_too_long", 1) == ESP_ERR_NVS_KEY_TOO_LONG);
+    assert(nvs_commit(handle) == ESP_OK);
+
+    int8_t i8 = 0;
+    uint32_t u32 = 0;
+    uint64_t u64 = 0;
+    assert(nvs_get_i8(handle, "i8", &i8) == ESP_OK && i8 == -5);
+    assert(nvs_get_u32(handle, "u32", &u32) == ESP_OK && u32 == 0xdeadbeef);
+    assert(nvs_get_u64(handle, "u64", &u64) == ESP_OK && u64 == 0x0123456789abcdefULL);
+    assert(nvs_get_u32(handle, "i8", &u32) == ESP_ERR_NVS_TYPE_MISMATCH);
+    assert(nvs_get_u8(handle, "missing", (uint8_t*)&i8) == ESP_ERR_NVS_NOT_FOUND);
+    printf("✓ Primitive types round trip\n");
+
+    char str[16];
+    size_t len = 0;
+    assert(nvs_get_str(handle, "str", NULL, &len) == ESP_OK && len == 7);
+    len = 3;
+    assert(nvs_get_str(handle, "str", str, &len) == ESP_ERR_NVS_INVALID_LENGTH);
+    len = sizeof(str);
+    assert(nvs_get_str(handle, "str", str, &len) == ESP_OK && strcmp(str, "pgpemu") == 0);
+
+    uint8_t out[300];
+    len = sizeof(out);
+    assert(nvs_get_blob(handle, "blob", out, &len) == ESP_OK && len == sizeof(blob));
+    assert(memcmp(out, blob, sizeof(blob)) == 0);
+    printf("✓ Strings and blobs round trip with length checks\n");
+
+    nvs_close(handle);
+    assert(nvs_open("test", NVS_READONLY, &handle) == ESP_OK);
+    assert(nvs_set_i8(handle, "i8", 1) == ESP_ERR_NVS_READ_ONLY);
+    nvs_close(handle);
+    assert(nvs_set_i8(handle, "i8", 1) == ESP_ERR_NVS_INVALID_HANDLE);
+    printf("✓ Read-only and closed handles are refused\n");
+}
+
+void test_overwrite_and_persist() {
+    printf("\n=== Test: Overwrite and Persist ===\n");
+    fresh_flash(NVS_EMU_DEFAULT_SECTORS);
+
+    nvs_handle_t handle;
+    assert(nvs_open("test", NVS_READWRITE, &handle) == ESP_OK);
+    assert(nvs_set_u32(handle, "counter", 1) == ESP_OK);
+
+    nvs_emu_stats_t before, after;
+    nvs_emu_get_stats(&before);
+    assert(nvs_set_u32(handle, "counter", 1) == ESP_OK);
+    nvs_emu_get_stats(&after);
+    assert(after.skipped_sets == before.skipped_sets + 1);
+    assert(after.programs == before.programs);
+    printf("✓ Writing the same value doesn't touch flash\n");
+
+    size_t used_before = 0, used_after = 0;
+    assert(nvs_get_used_entry_count(handle, &used_before) == ESP_OK);
+    assert(nvs_set_u32(handle, "counter", 2) == ESP_OK);
+    assert(nvs_get_used_entry_count(handle, &used_after) == ESP_OK);
+    assert(used_before == used_after);
+    printf("✓ Overwrite erases the old copy\n");
+
+    uint8_t blob[60];
+    memset(blob, 0xa5, sizeof(blob));
+    assert(nvs_set_blob(handle, "record", blob, sizeof(blob)) == ESP_OK);
+    nvs_close(handle);
+
+    assert(nvs_emu_remount() == ESP_OK);
+    assert(nvs_open("test", NVS_READONLY, &handle) == ESP_OK);
+    uint32_t counter = 0;
+    assert(nvs_get_u32(handle, "counter", &counter) == ESP_OK && counter == 2);
+    uint8_t out[60];
+    size_t len = sizeof(out);
+    assert(nvs_get_blob(handle, "record", out, &len) == ESP_OK && memcmp(out, blob, sizeof(blob)) == 0);
+    nvs_close(handle);
+    printf("✓ Values survive a remount\n");
+}
+
+void test_gc_and_wear() {
+    printf("\n=== Test: Page Collection and Wear ===\n");
+    fresh_flash(4);
+
+    nvs_handle_t handle;
+    assert(nvs_open("test", NVS_READWRITE, &handle) == ESP_OK);
+    for (uint32_t i = 0; i < 5000; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "k%u", (unsigned)(i % 10));
+        assert(nvs_set_u32(handle, key, i) == ESP_OK);
+    }
+    for (uint32_t i = 0; i < 10; i++) {
+        char key[8];
+        uint32_t value = 0;
+        snprintf(key, sizeof(key), "k%u", (unsigned)i);
+        assert(nvs_get_u32(handle, key, &value) == ESP_OK && value == 4990 + i);
+    }
+    nvs_close(handle);
+
+    nvs_emu_stats_t stats;
+    nvs_emu_get_stats(&stats);
+    assert(stats.gc_runs > 0);
+    assert(stats.bit_violations == 0);
+    printf("✓ 5000 writes over 4 sectors, %u page collections, no bit flipped back\n", (unsigned)stats.gc_runs);
+
+    // like ESP-IDF the page holding the namespace entry is left alone, the others take turns
+    uint32_t min_erases = UINT32_MAX, max_erases = 0;
+    for (int s = 0; s < 4; s++) {
+        uint32_t erases, programs;
+        assert(nvs_emu_sector_cycles(s, &erases, &programs));
+        if (erases > 0) {
+            min_erases = erases < min_erases ? erases : min_erases;
+            max_erases = erases > max_erases ? erases : max_erases;
+        }
+    }
+    assert(max_erases - min_erases <= 1);
+    printf("✓ Erases rotate over the rewritten pages: %u..%u per sector\n", (unsigned)min_erases, (unsigned)max_erases);
+
+    assert(nvs_emu_remount() == ESP_OK);
+    uint32_t erases, programs;
+    assert(nvs_emu_sector_cycles(1, &erases, &programs) && erases == max_erases);
+    printf("✓ Cycle counts are kept in the flash file\n");
+}
+
+void test_out_of_space() {
+    printf("\n=== Test: Out of Space ===\n");
+    fresh_flash(3);
+
+    nvs_handle_t handle;
+    assert(nvs_open("test", NVS_READWRITE, &handle) == ESP_OK);
+    esp_err_t err = ESP_OK;
+    int stored = 0;
+    while (err == ESP_OK) {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", stored);
+        err = nvs_set_u32(handle, key, (uint32_t)stored);
+        if (err == ESP_OK) {
+            stored++;
+        }
+    }
+    assert(err == ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+
+    nvs_stats_t stats;
+    assert(nvs_get_stats(NULL, &stats) == ESP_OK);
+    assert(stats.total_entries == 3 * 126);
+    assert(stats.available_entries < 126);
+    assert(stats.namespace_count == 1);
+    printf("✓ %d values fill two pages, the spare page stays free\n", stored);
+
+    assert(nvs_erase_key(handle, "k0") == ESP_OK);
+    assert(nvs_set_u32(handle, "k0", 7) == ESP_OK);
+    nvs_close(handle);
+    printf("✓ Erasing a value makes room again\n");
+}
+
+// last value stored per key before the power cut, and the one being written when it hit
+static void check_power_cut(int sectors, int cut_after) {
+    fresh_flash(sectors);
+    uint32_t last[5] = { 0 };
+    int inflight_key = -1;
+    uint32_t inflight = 0;
+
+    nvs_handle_t handle;
+    assert(nvs_open("test", NVS_READWRITE, &handle) == ESP_OK);
+    for (int i = 0; i < 5; i++) {
+        char key[4] = { 'k', (char)('0' + i), 0 };
+        assert(nvs_set_u32(handle, key, 0) == ESP_OK);
+    }
+    nvs_emu_cut_power(cut_after);
+    for (uint32_t n = 1; n < 600; n++) {
+        int i = (int)(n % 5);
+        char key[4] = { 'k', (char)('0' + i), 0 };
+        if (nvs_set_u32(handle, key, n) != ESP_OK) {
+            inflight_key = i;
+            inflight = n;
+            break;
+        }
+        last[i] = n;
+    }
+
+    assert(nvs_emu_remount() == ESP_OK);
+    assert(nvs_open("test", NVS_READONLY, &handle) == ESP_OK);
+    for (int i = 0; i < 5; i++) {
+        char key[4] = { 'k', (char)('0' + i), 0 };
+        uint32_t value = UINT32_MAX;
+        assert(nvs_get_u32(handle, key, &value) == ESP_OK);
+        assert(value == last[i] || (i == inflight_key && value == inflight));
+    }
+    size_t used = 0;
+    assert(nvs_get_used_entry_count(handle, &used) == ESP_OK && used == 5);
+    nvs_close(handle);
+
+    nvs_emu_stats_t stats;
+    nvs_emu_get_stats(&stats);
+    assert(stats.bit_violations == 0);
+}
+
+void test_power_cut_recovery() {
+    printf("\n=== Test: Power Cut Recovery ===\n");
+
+    for (int cut = 0; cut < 40; cut++) {
+        check_power_cut(NVS_EMU_DEFAULT_SECTORS, cut);
+    }
+    printf("✓ Cut during a plain write: old or new value, never both or neither\n");
+
+    // 3 sectors collect a page every ~120 writes, hit every step of it
+    for (int cut = 0; cut < 1400; cut += 3) {
+        check_power_cut(3, cut);
+    }
+    printf("✓ Cut during page collection is finished at mount\n");
+}
+
+void test_helper_fault_injection() {
+    printf("\n=== Test: nvs_helper With Injected Faults ===\n");
+    fresh_flash(NVS_EMU_DEFAULT_SECTORS);
+
+    nvs_handle_t handle = 0;
+    assert(!nvs_open_readonly("test", "missing", &handle) && handle == 0);
+    assert(nvs_open_readwrite("test", "helper", &handle) && handle != 0);
+
+    uint8_t blob[16];
+    memset(blob, 0x42, sizeof(blob));
+    assert(nvs_write_check("test", nvs_set_blob(handle, "key", blob, sizeof(blob)), "key"));
+    assert(nvs_commit_and_close("test", handle, "key"));
+    printf("✓ Open, write and commit through the helpers\n");
+
+    assert(nvs_open_readonly("test", "helper", &handle));
+    uint8_t out[16];
+    assert(nvs_read_blob_checked("test", handle, "key", out, sizeof(out)));
+    assert(!nvs_read_blob_checked("test", handle, "key", out, 8));
+    assert(!nvs_read_blob_checked("test", handle, "nope", out, sizeof(out)));
+
+    nvs_emu_fail(NVS_EMU_OP_GET, 1, ESP_ERR_NVS_INVALID_STATE);
+    assert(!nvs_read_blob_checked("test", handle, "key", out, sizeof(out)));
+    nvs_emu_clear_faults();
+    nvs_safe_close(handle);
+    printf("✓ Blob size mismatch, missing key and a failing read are reported\n");
+
+    assert(nvs_open_readwrite("test", "helper", &handle));
+    nvs_emu_fail(NVS_EMU_OP_COMMIT, 0, ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    assert(!nvs_commit_and_close("test", handle, "key"));
+    assert(nvs_commit(handle) == ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    nvs_emu_clear_faults();
+    assert(nvs_commit(handle) == ESP_ERR_NVS_INVALID_HANDLE);
+    printf("✓ A failing commit still closes the handle\n");
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+void test_helper_counters() {
+    printf("\n=== Test: nvs_helper Namespace Counters ===\n");
+    fresh_flash(3);
+
+    nvs_handle_t handle;
+    assert(nvs_open_readwrite("test", "counted", &handle));
+    assert(nvs_handle_write_check("test", handle, nvs_set_u32(handle, "a", 1), "a"));
+    assert(nvs_handle_write_check("test", handle, nvs_set_u32(handle, "b", 2), "b"));
+    nvs_emu_fail(NVS_EMU_OP_SET, 0, ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    assert(!nvs_handle_write_check("test", handle, nvs_set_u32(handle, "c", 3), "c"));
+    nvs_emu_clear_faults();
+    assert(nvs_commit_and_close("test", handle, "counted"));
+
+    assert(nvs_open_readwrite("test", "counted", &handle));
+    nvs_emu_fail(NVS_EMU_OP_COMMIT, 0, ESP_ERR_NVS_INVALID_STATE);
+    assert(!nvs_commit_and_close("test", handle, "counted"));
+    nvs_emu_clear_faults();
+
+    uint8_t buf[NVS_STATS_HEADER_LEN + NVS_STATS_NAMESPACES * NVS_STATS_RECORD_LEN];
+    size_t len = nvs_stats_serialize(buf, sizeof(buf));
+    assert(len >= NVS_STATS_HEADER_LEN + NVS_STATS_RECORD_LEN);
+    assert((len - NVS_STATS_HEADER_LEN) % NVS_STATS_RECORD_LEN == 0);
+    // namespace entry and two values
+    assert(get_u16(buf) == 3);
+    assert(get_u16(buf + 2) == 3 * 126 - 3);
+    assert(get_u16(buf + 6) == 3 * 126);
+    assert(get_u16(buf + 8) == 1);
+    printf("✓ Header reports partition usage\n");
+
+    const uint8_t* rec = NULL;
+    for (size_t offset = NVS_STATS_HEADER_LEN; offset < len; offset += NVS_STATS_RECORD_LEN) {
+        if (strcmp((const char*)buf + offset, "counted") == 0) {
+            rec = buf + offset;
+        }
+    }
+    assert(rec != NULL);
+    assert(get_u32(rec + 16) == 2 && get_u32(rec + 20) == 1);
+    assert(get_u32(rec + 24) == 1 && get_u32(rec + 28) == 1);
+    assert(get_u16(rec + 32) == 2);
+    printf("✓ Writes, commits and their failures counted per namespace\n");
+
+    // fill up to the last page, every commit checks what's left
+    assert(nvs_open_readwrite("test", "counted", &handle));
+    for (uint32_t i = 0; i < 150; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "f%u", (unsigned)i);
+        assert(nvs_handle_write_check("test", handle, nvs_set_u32(handle, key, i), key));
+    }
+    assert(nvs_commit_and_close("test", handle, "counted"));
+    assert(nvs_open_readwrite("test", "counted", &handle));
+    for (uint32_t i = 0; i < 150; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "f%u", (unsigned)i);
+        assert(nvs_erase_key(handle, key) == ESP_OK);
+    }
+    assert(nvs_commit_and_close("test", handle, "counted"));
+
+    len = nvs_stats_serialize(buf, sizeof(buf));
+    assert(get_u16(buf + 4) > NVS_LOW_SPACE_ENTRIES);
+    assert(get_u16(buf + 10) < NVS_LOW_SPACE_ENTRIES);
+    assert(nvs_stats_serialize(buf, NVS_STATS_HEADER_LEN - 1) == 0);
+    printf("✓ Lowest available count since boot is kept after space is freed\n");
+}
+
+void test_config_secrets() {
+    printf("\n=== Test: config_secrets on the Emulator ===\n");
+    fresh_flash(NVS_EMU_DEFAULT_SECTORS);
+
+    assert(!read_secrets(PGP_CLONE_NAME, PGP_MAC, PGP_DEVICE_KEY, PGP_BLOB));
+    printf("✓ No secrets on a blank flash\n");
+
+    // what flashing secrets.csv would store
+    nvs_handle_t handle;
+    uint8_t mac[6] = { 0x7c, 0xbb, 0x8a, 0x01, 0x02, 0x03 };
+    uint8_t key[16], blob[256];
+    memset(key, 0x11, sizeof(key));
+    memset(blob, 0x22, sizeof(blob));
+    assert(nvs_open("pgpsecret", NVS_READWRITE, &handle) == ESP_OK);
+    assert(nvs_set_str(handle, "name", "EmuPGP") == ESP_OK);
+    assert(nvs_set_blob(handle, "mac", mac, sizeof(mac)) == ESP_OK);
+    assert(nvs_set_blob(handle, "dkey", key, sizeof(key)) == ESP_OK);
+    assert(nvs_set_blob(handle, "blob", blob, sizeof(blob)) == ESP_OK);
+    nvs_close(handle);
+
+    assert(read_secrets(PGP_CLONE_NAME, PGP_MAC, PGP_DEVICE_KEY, PGP_BLOB));
+    assert(strcmp(PGP_CLONE_NAME, "EmuPGP") == 0);
+    assert(memcmp(PGP_MAC, mac, sizeof(mac)) == 0);
+    assert(memcmp(PGP_DEVICE_KEY, key, sizeof(key)) == 0);
+    assert(memcmp(PGP_BLOB, blob, sizeof(blob)) == 0);
+    show_secrets();
+    printf("✓ read_secrets loads all four values\n");
+
+    assert(reset_secrets());
+    assert(!read_secrets(PGP_CLONE_NAME, PGP_MAC, PGP_DEVICE_KEY, PGP_BLOB));
+    printf("✓ reset_secrets erases them\n");
+}
+
+void test_iterator_and_latency() {
+    printf("\n=== Test: Iterator, Stats and Latency ===\n");
+    fresh_flash(NVS_EMU_DEFAULT_SECTORS);
+
+    nvs_handle_t handle;
+    assert(nvs_open("device_settings", NVS_READWRITE, &handle) == ESP_OK);
+    assert(nvs_set_i8(handle, "a", 1) == ESP_OK);
+    assert(nvs_set_u32(handle, "seen", 1) == ESP_OK);
+    uint8_t record[60] = { 1 };
+    assert(nvs_set_blob(handle, "b", record, sizeof(record)) == ESP_OK);
+    nvs_close(handle);
+    assert(nvs_open("other", NVS_READWRITE, &handle) == ESP_OK);
+    assert(nvs_set_i8(handle, "a", 1) == ESP_OK);
+    nvs_close(handle);
+
+    int found = 0, blobs = 0;
+    nvs_iterator_t it = NULL;
+    esp_err_t err = nvs_entry_find(NVS_DEFAULT_PART_NAME, "device_settings", NVS_TYPE_ANY, &it);
+    while (err == ESP_OK) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        assert(strcmp(info.namespace_name, "device_settings") == 0);
+        found++;
+        blobs += info.type == NVS_TYPE_BLOB;
+        err = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+    assert(found == 3 && blobs == 1);
+    assert(nvs_entry_find(NVS_DEFAULT_PART_NAME, "missing", NVS_TYPE_ANY, &it) == ESP_ERR_NVS_NOT_FOUND);
+    printf("✓ Iterator walks one namespace\n");
+
+    nvs_stats_t stats;
+    assert(nvs_get_stats(NVS_DEFAULT_PART_NAME, &stats) == ESP_OK);
+    // 2 namespaces, 3 single entries, a 60 byte blob takes 3
+    assert(stats.used_entries == 2 + 3 + 3);
+    assert(stats.namespace_count == 2);
+    printf("✓ nvs_get_stats counts entries and namespaces\n");
+
+    nvs_emu_set_latency(&NVS_EMU_LATENCY_SPI_NOR);
+    nvs_emu_reset_stats();
+    assert(nvs_open("other", NVS_READWRITE, &handle) == ESP_OK);
+    assert(nvs_set_i8(handle, "a", 2) == ESP_OK);
+    nvs_close(handle);
+    nvs_emu_stats_t emu_stats;
+    nvs_emu_get_stats(&emu_stats);
+    assert(emu_stats.simulated_us == emu_stats.programs * NVS_EMU_LATENCY_SPI_NOR.program_us);
+    nvs_emu_latency_t none = { 0 };
+    nvs_emu_set_latency(&none);
+    printf("✓ Latency model adds %llu us for one overwrite\n", (unsigned long long)emu_stats.simulated_us);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        flash_file = argv[1];
+    }
+    esp_log_host_level = ESP_LOG_NONE;
+
+    printf("========================================\n");
+    printf("NVS Emulator Tests\n");
+    printf("========================================\n");
+
+    test_set_get();
+    test_overwrite_and_persist();
+    test_gc_and_wear();
+    test_out_of_space();
+    test_power_cut_recovery();
+    test_helper_fault_injection();
+    test_helper_counters();
+    test_config_secrets();
+    test_iterator_and_latency();
+
+    nvs_emu_unmount();
+    unlink(flash_file);
+
+    printf("\n========================================\n");
+    printf("✓ All NVS emulator tests passed!\n");
+    printf("========================================\n");
+
+    return 0;
+}
@@ -0,0 +1,1324 @@
+#include "nvs_emu.h"
+
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// page layout as in ESP-IDF: header, entry state bitmap, entries
+#define ENTRY_SIZE 32
+#define ENTRY_COUNT 126
+#define BITMAP_OFFSET 32
+#define ENTRY_OFFSET 64
+
+#define PAGE_UNINIT 0xffffffffu
+#define PAGE_ACTIVE 0xfffffffeu
+#define PAGE_FULL 0xfffffffcu
+#define PAGE_FREEING 0xfffffff8u
+#define PAGE_VERSION 0xfe
+
+#define ENTRY_EMPTY 3
+#define ENTRY_WRITTEN 2
+#define ENTRY_ERASED 0
+
+// namespace names are items in namespace 0, their value is the namespace index
+#define NS_NAMESPACES 0
+#define NS_MAX 254
+#define MAX_HANDLES 16
+#define MAX_VALUE_SIZE ((ENTRY_COUNT - 1) * ENTRY_SIZE)
+
+#define TRAILER_MAGIC 0x554d4553u
+
+typedef struct {
+    uint32_t state;
+    uint32_t seq;
+    uint8_t version;
+    uint8_t reserved[19];
+    uint32_t crc;  // over seq, version and reserved
+} page_header_t;
+
+typedef struct {
+    uint8_t ns;
+    uint8_t type;
+    uint8_t span;   // entries including this one
+    uint8_t chunk;  // always 0xff, no blob chunks
+    uint32_t crc;   // over everything but itself
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t data[8];  // primitive value, or size (2 bytes) and crc of the data entries (at 4)
+} item_t;
+
+typedef struct {
+    uint32_t state;
+    uint32_t seq;
+    int next_free;  // first entry after the last one in use
+    int used;
+    int erased;
+    uint32_t freed_at;  // free pages are reused oldest first, like the ESP-IDF free page list
+} page_info_t;
+
+typedef struct {
+    int page;
+    int index;
+} item_pos_t;
+
+struct nvs_opaque_iterator_t {
+    item_pos_t pos;
+    uint8_t ns;  // 0 for all namespaces
+    nvs_type_t type;
+};
+
+const nvs_emu_latency_t NVS_EMU_LATENCY_SPI_NOR = { .read_us = 2, .program_us = 60, .erase_us = 45000 };
+
+static struct {
+    char path[256];
+    int fd;
+    uint8_t* flash;
+    size_t map_size;
+    int sectors;
+    uint32_t* erase_cycles;  // in the trailer after the last sector
+    uint32_t* program_cycles;
+    bool mapped;
+    bool initialized;
+} emu = { .fd = -1 };
+
+static page_info_t pages[NVS_EMU_MAX_SECTORS];
+static int active_page = -1;
+static uint32_t last_seq = 0;
+static uint32_t free_clock = 0;
+
+static struct {
+    bool used;
+    uint8_t ns;
+    bool readonly;
+} handles[MAX_HANDLES];
+
+static nvs_emu_stats_t stats;
+static nvs_emu_latency_t latency;
+
+static struct {
+    int after;  // calls left before failing, -1 when off
+    esp_err_t err;
+} faults[NVS_EMU_OP_COUNT] = { { -1, 0 }, { -1, 0 }, { -1, 0 }, { -1, 0 }, { -1, 0 } };
+
+static int power_budget = -1;
+static bool power_lost = false;
+
+// --- flash ---
+
+static uint8_t* sector_ptr(int page) {
+    return emu.flash + (size_t)page * NVS_EMU_SECTOR_SIZE;
+}
+
+static size_t entry_offset(int page, int index) {
+    return (size_t)page * NVS_EMU_SECTOR_SIZE + ENTRY_OFFSET + (size_t)index * ENTRY_SIZE;
+}
+
+static void spend(uint32_t us) {
+    stats.simulated_us += us;
+    if (latency.sleep && us > 0) {
+        struct timespec ts = { us / 1000000, (long)(us % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static bool power_step() {
+    if (power_lost) {
+        return false;
+    }
+    if (power_budget == 0) {
+        power_lost = true;
+        return false;
+    }
+    if (power_budget > 0) {
+        power_budget--;
+    }
+    return true;
+}
+
+// NOR flash: programming can only clear bits
+static bool flash_program(size_t offset, const void* data, size_t len) {
+    if (!power_step()) {
+        return false;
+    }
+
+    uint8_t* dst = emu.flash + offset;
+    const uint8_t* src = data;
+    for (size_t i = 0; i < len; i++) {
+        if ((dst[i] & src[i]) != src[i]) {
+            stats.bit_violations++;
+        }
+        dst[i] &= src[i];
+    }
+
+    emu.program_cycles[offset / NVS_EMU_SECTOR_SIZE]++;
+    stats.programs++;
+    stats.bytes_programmed += len;
+    spend(latency.program_us);
+    return true;
+}
+
+static bool flash_erase(int page) {
+    if (!power_step()) {
+        return false;
+    }
+
+    memset(sector_ptr(page), 0xff, NVS_EMU_SECTOR_SIZE);
+    emu.erase_cycles[page]++;
+    stats.erases++;
+    spend(latency.erase_us);
+    return true;
+}
+
+// --- pages and entries ---
+
+static int entry_state(int page, int index) {
+    uint8_t bits = sector_ptr(page)[BITMAP_OFFSET + index / 4];
+    return (bits >> ((index % 4) * 2)) & 3;
+}
+
+static bool set_entry_state(int page, int index, int state) {
+    size_t offset = (size_t)page * NVS_EMU_SECTOR_SIZE + BITMAP_OFFSET + index / 4;
+    int shift = (index % 4) * 2;
+    uint8_t bits = (emu.flash[offset] & ~(3 << shift)) | (state << shift);
+    return flash_program(offset, &bits, 1);
+}
+
+static void read_item(int page, int index, item_t* item) {
+    memcpy(item, emu.flash + entry_offset(page, index), sizeof(item_t));
+}
+
+static bool entry_blank(int page, int index) {
+    const uint8_t* p = emu.flash + entry_offset(page, index);
+    for (int i = 0; i < ENTRY_SIZE; i++) {
+        if (p[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t item_crc(const item_t* item) {
+    const uint8_t* raw = (const uint8_t*)item;
+    uint32_t crc = esp_rom_crc32_le(0xffffffff, raw, 4);
+    return esp_rom_crc32_le(crc, raw + 8, sizeof(item_t) - 8);
+}
+
+static uint32_t header_crc(const page_header_t* header) {
+    const uint8_t* raw = (const uint8_t*)header;
+    return esp_rom_crc32_le(0xffffffff, raw + 4, offsetof(page_header_t, crc) - 4);
+}
+
+static bool is_variable(uint8_t type) {
+    return type == NVS_TYPE_STR || type == NVS_TYPE_BLOB;
+}
+
+static uint16_t item_size(const item_t* item) {
+    uint16_t size;
+    memcpy(&size, item->data, sizeof(size));
+    return size;
+}
+
+static uint32_t item_data_crc(const item_t* item) {
+    uint32_t crc;
+    memcpy(&crc, item->data + 4, sizeof(crc));
+    return crc;
+}
+
+static bool set_page_state(int page, uint32_t state) {
+    if (!flash_program((size_t)page * NVS_EMU_SECTOR_SIZE, &state, sizeof(state))) {
+        return false;
+    }
+    pages[page].state = state;
+    return true;
+}
+
+static bool init_page(int page) {
+    page_header_t header;
+    memset(&header, 0xff, sizeof(header));
+    header.state = PAGE_ACTIVE;
+    header.seq = ++last_seq;
+    header.version = PAGE_VERSION;
+    header.crc = header_crc(&header);
+    if (!flash_program((size_t)page * NVS_EMU_SECTOR_SIZE, &header, sizeof(header))) {
+        return false;
+    }
+
+    pages[page] = (page_info_t){ .state = PAGE_ACTIVE, .seq = header.seq };
+    return true;
+}
+
+static void page_freed(int page) {
+    pages[page] = (page_info_t){ .state = PAGE_UNINIT, .freed_at = ++free_clock };
+}
+
+static bool erase_entries(int page, int index, int span) {
+    for (int i = 0; i < span; i++) {
+        if (!set_entry_state(page, index + i, ENTRY_ERASED)) {
+            return false;
+        }
+    }
+    pages[page].used -= span;
+    pages[page].erased += span;
+    return true;
+}
+
+// programs span raw entries at the end of page and marks them written, the head last
+static bool append_entries(int page, const uint8_t* raw, int span) {
+    int index = pages[page].next_free;
+    if (!flash_program(entry_offset(page, index), raw, (size_t)span * ENTRY_SIZE)) {
+        return false;
+    }
+    pages[page].next_free += span;
+
+    for (int i = span - 1; i >= 0; i--) {
+        if (!set_entry_state(page, index + i, ENTRY_WRITTEN)) {
+            return false;
+        }
+    }
+    pages[page].used += span;
+    stats.item_writes++;
+    return true;
+}
+
+static int count_pages(uint32_t state) {
+    int count = 0;
+    for (int p = 0; p < emu.sectors; p++) {
+        if (pages[p].state == state) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// moves the written items of a full page into the spare page and erases it
+static esp_err_t collect_page(int victim, int spare) {
+    if (!set_page_state(victim, PAGE_FREEING) || !init_page(spare)) {
+        return ESP_FAIL;
+    }
+
+    for (int i = 0; i < ENTRY_COUNT;) {
+        if (entry_state(victim, i) != ENTRY_WRITTEN) {
+            i++;
+            continue;
+        }
+        item_t item;
+        read_item(victim, i, &item);
+        if (!append_entries(spare, emu.flash + entry_offset(victim, i), item.span)) {
+            return ESP_FAIL;
+        }
+        i += item.span;
+    }
+
+    if (!flash_erase(victim)) {
+        return ESP_FAIL;
+    }
+    page_freed(victim);
+    active_page = spare;
+    stats.gc_runs++;
+    return ESP_OK;
+}
+
+// one uninitialized page is always kept as the spare for collect_page
+static esp_err_t request_new_page() {
+    int free_page = -1;
+    for (int p = 0; p < emu.sectors; p++) {
+        if (pages[p].state == PAGE_UNINIT && (free_page < 0 || pages[p].freed_at < pages[free_page].freed_at)) {
+            free_page = p;
+        }
+    }
+    if (free_page < 0) {
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+
+    if (count_pages(PAGE_UNINIT) > 1) {
+        if (!init_page(free_page)) {
+            return ESP_FAIL;
+        }
+        active_page = free_page;
+        return ESP_OK;
+    }
+
+    // most erased entries, the oldest page on a tie
+    int victim = -1;
+    for (int p = 0; p < emu.sectors; p++) {
+        if (pages[p].state != PAGE_FULL) {
+            continue;
+        }
+        if (victim < 0 || pages[p].erased > pages[victim].erased ||
+            (pages[p].erased == pages[victim].erased && pages[p].seq < pages[victim].seq)) {
+            victim = p;
+        }
+    }
+    if (victim < 0 || pages[victim].erased == 0) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    return collect_page(victim, free_page);
+}
+
+static esp_err_t ensure_room(int span) {
+    while (active_page < 0 || pages[active_page].next_free + span > ENTRY_COUNT) {
+        if (active_page >= 0) {
+            if (!set_page_state(active_page, PAGE_FULL)) {
+                return ESP_FAIL;
+            }
+            active_page = -1;
+        }
+        esp_err_t err = request_new_page();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+// --- items ---
+
+static bool next_item(item_pos_t* pos, uint8_t ns, item_t* item) {
+    for (; pos->page < emu.sectors; pos->page++, pos->index = 0) {
+        uint32_t state = pages[pos->page].state;
+        if (state != PAGE_ACTIVE && state != PAGE_FULL) {
+            continue;
+        }
+        while (pos->index < pages[pos->page].next_free) {
+            if (entry_state(pos->page, pos->index) != ENTRY_WRITTEN) {
+                pos->index++;
+                continue;
+            }
+            read_item(pos->page, pos->index, item);
+            if (ns == 0xff || item->ns == ns) {
+                return true;
+            }
+            pos->index += item->span;
+        }
+    }
+    return false;
+}
+
+static void skip_item(item_pos_t* pos, const item_t* item) {
+    pos->index += item->span;
+}
+
+static bool find_item(uint8_t ns, const char* key, item_pos_t* out, item_t* item) {
+    item_pos_t pos = { 0, 0 };
+    while (next_item(&pos, ns, item)) {
+        if (strncmp(item->key, key, NVS_KEY_NAME_MAX_SIZE) == 0) {
+            *out = pos;
+            return true;
+        }
+        skip_item(&pos, item);
+    }
+    return false;
+}
+
+static bool same_value(const item_pos_t* pos, const item_t* old, const item_t* item, const void* data) {
+    if (old->type != item->type || old->span != item->span || memcmp(old->data, item->data, sizeof(old->data))) {
+        return false;
+    }
+    if (!is_variable(item->type)) {
+        return true;
+    }
+    return memcmp(emu.flash + entry_offset(pos->page, pos->index + 1), data, item_size(item)) == 0;
+}
+
+// writes the new item before erasing the old one, like ESP-IDF
+static esp_err_t write_item(uint8_t ns, uint8_t type, const char* key, const void* data, size_t size) {
+    uint8_t raw[ENTRY_COUNT * ENTRY_SIZE];
+    item_t item;
+    memset(raw, 0xff, sizeof(raw));
+    memset(&item, 0xff, sizeof(item));
+    item.ns = ns;
+    item.type = type;
+    item.span = 1;
+    memset(item.key, 0, sizeof(item.key));
+    strncpy(item.key, key, sizeof(item.key) - 1);
+
+    if (is_variable(type)) {
+        if (size > MAX_VALUE_SIZE) {
+            return ESP_ERR_NVS_VALUE_TOO_LONG;
+        }
+        memcpy(raw + ENTRY_SIZE, data, size);
+        uint16_t size16 = (uint16_t)size;
+        uint32_t data_crc = esp_rom_crc32_le(0xffffffff, data, size);
+        memcpy(item.data, &size16, sizeof(size16));
+        memcpy(item.data + 4, &data_crc, sizeof(data_crc));
+        item.span = 1 + (size + ENTRY_SIZE - 1) / ENTRY_SIZE;
+    } else {
+        memcpy(item.data, data, size);
+    }
+    item.crc = item_crc(&item);
+    memcpy(raw, &item, sizeof(item));
+
+    item_pos_t pos;
+    item_t old;
+    bool found = find_item(ns, key, &pos, &old);
+    if (found && same_value(&pos, &old, &item, data)) {
+        stats.skipped_sets++;
+        return ESP_OK;
+    }
+
+    esp_err_t err = ensure_room(item.span);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // a page collection may have moved the old copy
+    found = find_item(ns, key, &pos, &old);
+
+    if (!append_entries(active_page, raw, item.span)) {
+        return ESP_FAIL;
+    }
+    if (found && !erase_entries(pos.page, pos.index, old.span)) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// --- mount ---
+
+static bool item_valid(int page, int index, const item_t* item) {
+    if (item->span == 0 || index + item->span > ENTRY_COUNT || item->crc != item_crc(item)) {
+        return false;
+    }
+    for (int i = 1; i < item->span; i++) {
+        if (entry_state(page, index + i) != ENTRY_WRITTEN) {
+            return false;
+        }
+    }
+    if (is_variable(item->type)) {
+        uint16_t size = item_size(item);
+        if (size > (item->span - 1) * ENTRY_SIZE) {
+            return false;
+        }
+        const uint8_t* data = emu.flash + entry_offset(page, index + 1);
+        return esp_rom_crc32_le(0xffffffff, data, size) == item_data_crc(item);
+    }
+    return true;
+}
+
+static bool erase_torn(int page, int index, int span) {
+    for (int i = 0; i < span; i++) {
+        if (!set_entry_state(page, index + i, ENTRY_ERASED)) {
+            return false;
+        }
+    }
+    pages[page].erased += span;
+    stats.recovered_entries += span;
+    return true;
+}
+
+static esp_err_t load_page(int page) {
+    page_header_t header;
+    memcpy(&header, sector_ptr(page), sizeof(header));
+    pages[page] = (page_info_t){ .state = header.state, .seq = header.seq };
+
+    bool known = header.state == PAGE_ACTIVE || header.state == PAGE_FULL || header.state == PAGE_FREEING;
+    bool blank = true;
+    for (int i = 0; i < NVS_EMU_SECTOR_SIZE && blank; i++) {
+        blank = sector_ptr(page)[i] == 0xff;
+    }
+    if (header.state == PAGE_UNINIT && blank) {
+        return ESP_OK;
+    }
+    if (!known || header.version != PAGE_VERSION || header.crc != header_crc(&header)) {
+        // a torn page header, only ever written on an empty page
+        if (!flash_erase(page)) {
+            return ESP_FAIL;
+        }
+        page_freed(page);
+        return ESP_OK;
+    }
+    if (header.seq > last_seq) {
+        last_seq = header.seq;
+    }
+
+    for (int i = 0; i < ENTRY_COUNT;) {
+        int state = entry_state(page, i);
+        if (state == ENTRY_EMPTY) {
+            // programmed but never marked written
+            if (!entry_blank(page, i)) {
+                if (!erase_torn(page, i, 1)) {
+                    return ESP_FAIL;
+                }
+                pages[page].next_free = i + 1;
+            }
+            i++;
+            continue;
+        }
+
+        pages[page].next_free = i + 1;
+        if (state != ENTRY_WRITTEN) {
+            pages[page].erased++;
+            i++;
+            continue;
+        }
+
+        item_t item;
+        read_item(page, i, &item);
+        if (!item_valid(page, i, &item)) {
+            if (!erase_torn(page, i, 1)) {
+                return ESP_FAIL;
+            }
+            i++;
+            continue;
+        }
+        pages[page].used += item.span;
+        pages[page].next_free = i + item.span;
+        i += item.span;
+    }
+    return ESP_OK;
+}
+
+// newer copy wins: not on the page being freed, then higher page sequence, then later on the page
+static bool newer(const item_pos_t* a, const item_pos_t* b) {
+    bool a_freeing = pages[a->page].state == PAGE_FREEING;
+    bool b_freeing = pages[b->page].state == PAGE_FREEING;
+    if (a_freeing != b_freeing) {
+        return b_freeing;
+    }
+    if (pages[a->page].seq != pages[b->page].seq) {
+        return pages[a->page].seq > pages[b->page].seq;
+    }
+    return a->index > b->index;
+}
+
+static bool next_any_item(item_pos_t* pos, item_t* item) {
+    for (; pos->page < emu.sectors; pos->page++, pos->index = 0) {
+        uint32_t state = pages[pos->page].state;
+        if (state != PAGE_ACTIVE && state != PAGE_FULL && state != PAGE_FREEING) {
+            continue;
+        }
+        while (pos->index < pages[pos->page].next_free) {
+            if (entry_state(pos->page, pos->index) == ENTRY_WRITTEN) {
+                read_item(pos->page, pos->index, item);
+                return true;
+            }
+            pos->index++;
+        }
+    }
+    return false;
+}
+
+// power lost between writing a new copy and erasing the old one leaves both
+static esp_err_t drop_duplicates() {
+    item_pos_t a = { 0, 0 };
+    item_t item_a;
+    while (next_any_item(&a, &item_a)) {
+        item_pos_t b = a;
+        item_t item_b;
+        b.index += item_a.span;
+        bool a_erased = false;
+        while (!a_erased && next_any_item(&b, &item_b)) {
+            if (item_a.ns == item_b.ns && strncmp(item_a.key, item_b.key, NVS_KEY_NAME_MAX_SIZE) == 0) {
+                if (newer(&a, &b)) {
+                    if (!erase_entries(b.page, b.index, item_b.span)) {
+                        return ESP_FAIL;
+                    }
+                } else {
+                    if (!erase_entries(a.page, a.index, item_a.span)) {
+                        return ESP_FAIL;
+                    }
+                    a_erased = true;
+                }
+            }
+            b.index += item_b.span;
+        }
+        a.index += item_a.span;
+    }
+    return ESP_OK;
+}
+
+// finishes a page collection cut short by a power loss
+static esp_err_t finish_freeing(int freeing) {
+    if (active_page < 0) {
+        int spare = -1;
+        for (int p = 0; p < emu.sectors && spare < 0; p++) {
+            if (pages[p].state == PAGE_UNINIT) {
+                spare = p;
+            }
+        }
+        if (spare < 0 || !init_page(spare)) {
+            return ESP_FAIL;
+        }
+        active_page = spare;
+    }
+
+    for (int i = 0; i < ENTRY_COUNT;) {
+        if (entry_state(freeing, i) != ENTRY_WRITTEN) {
+            i++;
+            continue;
+        }
+        item_t item;
+        read_item(freeing, i, &item);
+        if (pages[active_page].next_free + item.span > ENTRY_COUNT) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        if (!append_entries(active_page, emu.flash + entry_offset(freeing, i), item.span)) {
+            return ESP_FAIL;
+        }
+        i += item.span;
+    }
+
+    if (!flash_erase(freeing)) {
+        return ESP_FAIL;
+    }
+    page_freed(freeing);
+    return ESP_OK;
+}
+
+static esp_err_t load_pages() {
+    active_page = -1;
+    last_seq = 0;
+    for (int p = 0; p < emu.sectors; p++) {
+        esp_err_t err = load_page(p);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    // only the newest active page stays active
+    for (int p = 0; p < emu.sectors; p++) {
+        if (pages[p].state != PAGE_ACTIVE) {
+            continue;
+        }
+        if (active_page < 0 || pages[p].seq > pages[active_page].seq) {
+            if (active_page >= 0 && !set_page_state(active_page, PAGE_FULL)) {
+                return ESP_FAIL;
+            }
+            active_page = p;
+        } else if (!set_page_state(p, PAGE_FULL)) {
+            return ESP_FAIL;
+        }
+    }
+
+    esp_err_t err = drop_duplicates();
+    for (int p = 0; p < emu.sectors && err == ESP_OK; p++) {
+        if (pages[p].state == PAGE_FREEING) {
+            err = finish_freeing(p);
+        }
+    }
+    return err;
+}
+
+// --- mapping ---
+
+esp_err_t nvs_emu_mount(const char* path, int sectors) {
+    if (emu.mapped) {
+        nvs_emu_unmount();
+    }
+    if (sectors < 2 || sectors > NVS_EMU_MAX_SECTORS || strlen(path) >= sizeof(emu.path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return ESP_FAIL;
+    }
+
+    size_t flash_size = (size_t)sectors * NVS_EMU_SECTOR_SIZE;
+    size_t map_size = flash_size + (2 + 2 * (size_t)sectors) * sizeof(uint32_t);
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || (size_t)st.st_size != map_size;
+    if (fresh && ftruncate(fd, (off_t)map_size) != 0) {
+        close(fd);
+        return ESP_FAIL;
+    }
+
+    uint8_t* flash = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (flash == MAP_FAILED) {
+        close(fd);
+        return ESP_FAIL;
+    }
+
+    uint32_t* trailer = (uint32_t*)(flash + flash_size);
+    if (fresh || trailer[0] != TRAILER_MAGIC || trailer[1] != (uint32_t)sectors) {
+        memset(flash, 0xff, flash_size);
+        memset(trailer, 0, map_size - flash_size);
+        trailer[0] = TRAILER_MAGIC;
+        trailer[1] = (uint32_t)sectors;
+    }
+
+    // a mount is a power up
+    power_budget = -1;
+    power_lost = false;
+
+    strcpy(emu.path, path);
+    emu.fd = fd;
+    emu.flash = flash;
+    emu.map_size = map_size;
+    emu.sectors = sectors;
+    emu.erase_cycles = trailer + 2;
+    emu.program_cycles = trailer + 2 + sectors;
+    emu.mapped = true;
+    emu.initialized = false;
+    return ESP_OK;
+}
+
+void nvs_emu_unmount() {
+    if (!emu.mapped) {
+        return;
+    }
+    memset(handles, 0, sizeof(handles));
+    msync(emu.flash, emu.map_size, MS_SYNC);
+    munmap(emu.flash, emu.map_size);
+    close(emu.fd);
+    emu.fd = -1;
+    emu.flash = NULL;
+    emu.mapped = false;
+    emu.initialized = false;
+}
+
+esp_err_t nvs_emu_remount() {
+    char path[sizeof(emu.path)];
+    int sectors = emu.sectors;
+    strcpy(path, emu.path);
+
+    esp_err_t err = nvs_emu_mount(path, sectors);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return nvs_flash_init();
+}
+
+void nvs_emu_get_stats(nvs_emu_stats_t* out) {
+    *out = stats;
+}
+
+void nvs_emu_reset_stats() {
+    memset(&stats, 0, sizeof(stats));
+    if (emu.mapped) {
+        memset(emu.erase_cycles, 0, 2 * (size_t)emu.sectors * sizeof(uint32_t));
+    }
+}
+
+bool nvs_emu_sector_cycles(int sector, uint32_t* erases, uint32_t* programs) {
+    if (!emu.mapped || sector < 0 || sector >= emu.sectors) {
+        return false;
+    }
+    *erases = emu.erase_cycles[sector];
+    *programs = emu.program_cycles[sector];
+    return true;
+}
+
+void nvs_emu_set_latency(const nvs_emu_latency_t* new_latency) {
+    latency = *new_latency;
+}
+
+void nvs_emu_fail(nvs_emu_op_t op, int after, esp_err_t err) {
+    faults[op].after = after;
+    faults[op].err = err;
+}
+
+void nvs_emu_clear_faults() {
+    for (int i = 0; i < NVS_EMU_OP_COUNT; i++) {
+        faults[i].after = -1;
+    }
+    power_budget = -1;
+}
+
+void nvs_emu_cut_power(int after_flash_ops) {
+    power_budget = after_flash_ops;
+}
+
+static esp_err_t check_ready(nvs_emu_op_t op) {
+    if (power_lost) {
+        return ESP_FAIL;
+    }
+    if (!emu.initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (faults[op].after == 0) {
+        return faults[op].err;
+    }
+    if (faults[op].after > 0) {
+        faults[op].after--;
+    }
+    return ESP_OK;
+}
+
+// --- nvs_flash.h ---
+
+esp_err_t nvs_flash_init(void) {
+    if (emu.initialized) {
+        return ESP_OK;
+    }
+    if (!emu.mapped) {
+        const char* path = getenv("NVS_EMU_FILE");
+        const char* sectors = getenv("NVS_EMU_SECTORS");
+        esp_err_t err = nvs_emu_mount(path ? path : "nvs_emu.bin", sectors ? atoi(sectors) : NVS_EMU_DEFAULT_SECTORS);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    if (power_lost) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = load_pages();
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (count_pages(PAGE_UNINIT) == 0) {
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+
+    memset(handles, 0, sizeof(handles));
+    emu.initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    if (!emu.mapped) {
+        return ESP_ERR_NVS_PART_NOT_FOUND;
+    }
+    nvs_flash_deinit();
+    for (int p = 0; p < emu.sectors; p++) {
+        if (!flash_erase(p)) {
+            return ESP_FAIL;
+        }
+        page_freed(p);
+    }
+    active_page = -1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_deinit(void) {
+    if (!emu.initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    memset(handles, 0, sizeof(handles));
+    emu.initialized = false;
+    return ESP_OK;
+}
+
+// --- nvs.h ---
+
+static esp_err_t check_name(const char* name) {
+    if (!name || !name[0]) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t get_handle(nvs_handle_t handle, bool write, uint8_t* ns) {
+    if (handle == 0 || handle > MAX_HANDLES || !handles[handle - 1].used) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (write && handles[handle - 1].readonly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    *ns = handles[handle - 1].ns;
+    return ESP_OK;
+}
+
+static bool namespace_name(uint8_t ns, char* out) {
+    item_pos_t pos = { 0, 0 };
+    item_t item;
+    while (next_item(&pos, NS_NAMESPACES, &item)) {
+        if (item.data[0] == ns) {
+            memcpy(out, item.key, NVS_KEY_NAME_MAX_SIZE);
+            return true;
+        }
+        skip_item(&pos, &item);
+    }
+    return false;
+}
+
+static esp_err_t find_namespace(const char* name, bool create, uint8_t* out) {
+    item_pos_t pos;
+    item_t item;
+    if (find_item(NS_NAMESPACES, name, &pos, &item)) {
+        *out = item.data[0];
+        return ESP_OK;
+    }
+    if (!create) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    bool taken[NS_MAX + 1] = { false };
+    pos = (item_pos_t){ 0, 0 };
+    while (next_item(&pos, NS_NAMESPACES, &item)) {
+        taken[item.data[0]] = true;
+        skip_item(&pos, &item);
+    }
+    for (int ns = 1; ns <= NS_MAX; ns++) {
+        if (!taken[ns]) {
+            uint8_t value = (uint8_t)ns;
+            *out = value;
+            return write_item(NS_NAMESPACES, NVS_TYPE_U8, name, &value, sizeof(value));
+        }
+    }
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    esp_err_t err = check_ready(NVS_EMU_OP_OPEN);
+    if (err == ESP_OK) {
+        err = check_name(namespace_name);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    int slot = 0;
+    while (slot < MAX_HANDLES && handles[slot].used) {
+        slot++;
+    }
+    if (slot == MAX_HANDLES) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t ns = 0;
+    err = find_namespace(namespace_name, open_mode == NVS_READWRITE, &ns);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    handles[slot].used = true;
+    handles[slot].ns = ns;
+    handles[slot].readonly = open_mode == NVS_READONLY;
+    *out_handle = (nvs_handle_t)(slot + 1);
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    if (handle > 0 && handle <= MAX_HANDLES) {
+        handles[handle - 1].used = false;
+    }
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    uint8_t ns;
+    esp_err_t err = check_ready(NVS_EMU_OP_COMMIT);
+    if (err == ESP_OK) {
+        err = get_handle(handle, false, &ns);
+    }
+    if (err == ESP_OK) {
+        // like ESP-IDF every set is already on flash
+        stats.commits++;
+    }
+    return err;
+}
+
+static esp_err_t set_value(nvs_handle_t handle, const char* key, nvs_type_t type, const void* data, size_t size) {
+    uint8_t ns;
+    esp_err_t err = check_ready(NVS_EMU_OP_SET);
+    if (err == ESP_OK) {
+        err = get_handle(handle, true, &ns);
+    }
+    if (err == ESP_OK) {
+        err = check_name(key);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    stats.sets++;
+    return write_item(ns, type, key, data, size);
+}
+
+static esp_err_t get_value(nvs_handle_t handle, const char* key, nvs_type_t type, item_pos_t* pos, item_t* item) {
+    uint8_t ns;
+    esp_err_t err = check_ready(NVS_EMU_OP_GET);
+    if (err == ESP_OK) {
+        err = get_handle(handle, false, &ns);
+    }
+    if (err == ESP_OK) {
+        err = check_name(key);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (!find_item(ns, key, pos, item)) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (item->type != type) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    spend(latency.read_us * item->span);
+    return ESP_OK;
+}
+
+static esp_err_t get_primitive(nvs_handle_t handle, const char* key, nvs_type_t type, void* out, size_t size) {
+    item_pos_t pos;
+    item_t item;
+    esp_err_t err = get_value(handle, key, type, &pos, &item);
+    if (err == ESP_OK) {
+        memcpy(out, item.data, size);
+    }
+    return err;
+}
+
+static esp_err_t get_variable(nvs_handle_t handle, const char* key, nvs_type_t type, void* out, size_t* length) {
+    if (!length) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    item_pos_t pos;
+    item_t item;
+    esp_err_t err = get_value(handle, key, type, &pos, &item);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t size = item_size(&item);
+    if (!out) {
+        *length = size;
+        return ESP_OK;
+    }
+    if (*length < size) {
+        *length = size;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out, emu.flash + entry_offset(pos.page, pos.index + 1), size);
+    *length = size;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value) {
+    return set_value(handle, key, NVS_TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i8(nvs_handle_t handle, const char* key, int8_t value) {
+    return set_value(handle, key, NVS_TYPE_I8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char* key, uint16_t value) {
+    return set_value(handle, key, NVS_TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value) {
+    return set_value(handle, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value) {
+    return set_value(handle, key, NVS_TYPE_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char* key, uint64_t value) {
+    return set_value(handle, key, NVS_TYPE_U64, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value) {
+    if (!value) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return set_value(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    if (!value && length > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return set_value(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out_value) {
+    return get_primitive(handle, key, NVS_TYPE_U8, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_get_i8(nvs_handle_t handle, const char* key, int8_t* out_value) {
+    return get_primitive(handle, key, NVS_TYPE_I8, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char* key, uint16_t* out_value) {
+    return get_primitive(handle, key, NVS_TYPE_U16, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value) {
+    return get_primitive(handle, key, NVS_TYPE_U32, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out_value) {
+    return get_primitive(handle, key, NVS_TYPE_I32, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char* key, uint64_t* out_value) {
+    return get_primitive(handle, key, NVS_TYPE_U64, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length) {
+    return get_variable(handle, key, NVS_TYPE_STR, out_value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    return get_variable(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    uint8_t ns;
+    esp_err_t err = check_ready(NVS_EMU_OP_ERASE);
+    if (err == ESP_OK) {
+        err = get_handle(handle, true, &ns);
+    }
+    if (err == ESP_OK) {
+        err = check_name(key);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    item_pos_t pos;
+    item_t item;
+    if (!find_item(ns, key, &pos, &item)) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return erase_entries(pos.page, pos.index, item.span) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    uint8_t ns;
+    esp_err_t err = check_ready(NVS_EMU_OP_ERASE);
+    if (err == ESP_OK) {
+        err = get_handle(handle, true, &ns);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    item_pos_t pos = { 0, 0 };
+    item_t item;
+    while (next_item(&pos, ns, &item)) {
+        if (!erase_entries(pos.page, pos.index, item.span)) {
+            return ESP_FAIL;
+        }
+        skip_item(&pos, &item);
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats) {
+    if (!nvs_stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (part_name && strcmp(part_name, NVS_DEFAULT_PART_NAME) != 0) {
+        return ESP_ERR_NVS_PART_NOT_FOUND;
+    }
+    if (!emu.initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    memset(nvs_stats, 0, sizeof(*nvs_stats));
+    nvs_stats->total_entries = (size_t)emu.sectors * ENTRY_COUNT;
+    for (int p = 0; p < emu.sectors; p++) {
+        nvs_stats->used_entries += pages[p].used;
+    }
+    nvs_stats->free_entries = nvs_stats->total_entries - nvs_stats->used_entries;
+    // the spare page can't be filled
+    nvs_stats->available_entries =
+        nvs_stats->free_entries > ENTRY_COUNT ? nvs_stats->free_entries - ENTRY_COUNT : 0;
+
+    item_pos_t pos = { 0, 0 };
+    item_t item;
+    while (next_item(&pos, NS_NAMESPACES, &item)) {
+        nvs_stats->namespace_count++;
+        skip_item(&pos, &item);
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_used_entry_count(nvs_handle_t handle, size_t* used_entries) {
+    uint8_t ns;
+    esp_err_t err = get_handle(handle, false, &ns);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    *used_entries = 0;
+    item_pos_t pos = { 0, 0 };
+    item_t item;
+    while (next_item(&pos, ns, &item)) {
+        *used_entries += item.span;
+        skip_item(&pos, &item);
+    }
+    return ESP_OK;
+}
+
+static bool iterator_match(struct nvs_opaque_iterator_t* it) {
+    item_t item;
+    while (next_item(&it->pos, 0xff, &item)) {
+        bool ns_match = it->ns ? item.ns == it->ns : item.ns != NS_NAMESPACES;
+        if (ns_match && (it->type == NVS_TYPE_ANY || item.type == it->type)) {
+            return true;
+        }
+        skip_item(&it->pos, &item);
+    }
+    return false;
+}
+
+esp_err_t nvs_entry_find(const char* part_name,
+    const char* namespace_name,
+    nvs_type_t type,
+    nvs_iterator_t* output_iterator) {
+    if (!output_iterator) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *output_iterator = NULL;
+    if (part_name && strcmp(part_name, NVS_DEFAULT_PART_NAME) != 0) {
+        return ESP_ERR_NVS_PART_NOT_FOUND;
+    }
+    if (!emu.initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    uint8_t ns = 0;
+    if (namespace_name && find_namespace(namespace_name, false, &ns) != ESP_OK) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    struct nvs_opaque_iterator_t* it = calloc(1, sizeof(*it));
+    if (!it) {
+        return ESP_ERR_NO_MEM;
+    }
+    it->ns = ns;
+    it->type = type;
+    if (!iterator_match(it)) {
+        free(it);
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *output_iterator = it;
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_next(nvs_iterator_t* iterator) {
+    if (!iterator || !*iterator) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    item_t item;
+    read_item((*iterator)->pos.page, (*iterator)->pos.index, &item);
+    skip_item(&(*iterator)->pos, &item);
+    if (!iterator_match(*iterator)) {
+        free(*iterator);
+        *iterator = NULL;
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_info(const nvs_iterator_t iterator, nvs_entry_info_t* out_info) {
+    if (!iterator || !out_info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    item_t item;
+    read_item(iterator->pos.page, iterator->pos.index, &item);
+    memset(out_info, 0, sizeof(*out_info));
+    namespace_name(item.ns, out_info->namespace_name);
+    memcpy(out_info->key, item.key, sizeof(out_info->key));
+    out_info->type = (nvs_type_t)item.type;
+    return ESP_OK;
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator) {
+    free(iterator);
+}
@@ -0,0 +1,86 @@
+#ifndef NVS_EMU_H
+#define NVS_EMU_H
+
+// Host NVS emulator behind the nvs.h/nvs_flash.h shims in pc/host.
+//
+// The flash is a file mapped into memory, so its content survives between runs. The layout follows
+// ESP-IDF: 4 KB pages with a header, a 2 bit state per entry and 126 entries of 32 bytes; values are
+// written before the old copy is erased, a full page is compacted into the one spare page, bits can
+// only be cleared until the sector is erased. Strings and blobs are kept in one span on one page
+// (ESP-IDF splits large blobs into chunks), so a value can hold up to 4000 bytes.
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NVS_EMU_SECTOR_SIZE 4096
+#define NVS_EMU_MAX_SECTORS 256
+// same as the nvs partition in partitions.csv
+#define NVS_EMU_DEFAULT_SECTORS 32
+
+typedef struct {
+    uint32_t sets;               // nvs_set_* calls
+    uint32_t skipped_sets;       // same value already stored, nothing written (as in ESP-IDF)
+    uint32_t commits;            // nvs_commit calls
+    uint32_t item_writes;        // items written, GC copies included
+    uint32_t programs;           // flash program operations: entries, entry states, page headers
+    uint32_t bytes_programmed;   // bytes in those operations
+    uint32_t erases;             // sector erases
+    uint32_t gc_runs;            // pages compacted into the spare page
+    uint32_t bit_violations;     // programs that wanted a 0 bit back to 1, always 0 unless the emulator is broken
+    uint32_t recovered_entries;  // torn or corrupt entries erased when mounting
+    uint64_t simulated_us;       // flash time from the latency model
+} nvs_emu_stats_t;
+
+// simulated flash timings, all zero by default
+typedef struct {
+    uint32_t read_us;     // per entry read by nvs_get_*
+    uint32_t program_us;  // per program operation
+    uint32_t erase_us;    // per sector erase
+    bool sleep;           // also sleep that long, for wall clock benchmarks
+} nvs_emu_latency_t;
+
+// rough SPI NOR flash figures
+extern const nvs_emu_latency_t NVS_EMU_LATENCY_SPI_NOR;
+
+typedef enum {
+    NVS_EMU_OP_OPEN,
+    NVS_EMU_OP_SET,
+    NVS_EMU_OP_GET,
+    NVS_EMU_OP_ERASE,
+    NVS_EMU_OP_COMMIT,
+    NVS_EMU_OP_COUNT,
+} nvs_emu_op_t;
+
+// Maps path as a flash of sectors 4 KB sectors, a new file or one of another size starts erased.
+// nvs_flash_init() still has to be called, it mounts NVS_EMU_FILE (default nvs_emu.bin) with
+// NVS_EMU_SECTORS sectors by itself if this wasn't called.
+esp_err_t nvs_emu_mount(const char* path, int sectors);
+
+// closes all handles and unmaps the file
+void nvs_emu_unmount();
+
+// unmount, mount the same file again and nvs_flash_init(), like a reboot; clears a power cut
+esp_err_t nvs_emu_remount();
+
+void nvs_emu_get_stats(nvs_emu_stats_t* out);
+
+// zeroes the counters and the per sector cycle counts
+void nvs_emu_reset_stats();
+
+// lifetime erase and program cycles of one sector, kept in the file after the flash
+bool nvs_emu_sector_cycles(int sector, uint32_t* erases, uint32_t* programs);
+
+void nvs_emu_set_latency(const nvs_emu_latency_t* latency);
+
+// the next after calls of op succeed, every one after that fails with err
+void nvs_emu_fail(nvs_emu_op_t op, int after, esp_err_t err);
+
+void nvs_emu_clear_faults();
+
+// after that many more flash operations the flash stops changing and every call fails with ESP_FAIL,
+// nvs_emu_remount() brings it back with whatever made it to flash
+void nvs_emu_cut_power(int after_flash_ops);
+
+#endif /* NVS_EMU_H */
@@ -0,0 +1,444 @@
+#ifndef ESP_PLATFORM
+
+// Multi-phone stress test on PC: drives several simulated phones through connect, full handshake or
+// reconnect, LED traffic and disconnect against a device side that has MAX_CONNECTIONS slots.
+//
+//   ./stress-phones [-p phones] [-n cycles] [-l led_writes] [-s seed]
+//
+// Every phone runs `cycles` connections of `led_writes` LED writes each. Steps of all phones are
+// interleaved in random order (seeded, so a run can be repeated), phones that find every slot taken
+// retry later like a phone waiting for the device to advertise again. Both sides run the real
+// certificate engine and check each other's answers, the device side is timed separately so its
+// per-phone cost can be compared with the time budget of the ESP32.
+//
+// Exit code is 1 if a handshake didn't verify or a phone never got a slot although there were
+// enough of them.
+
+#include "../entropy.h"
+#include "../pgp_cert.h"
+#include "../secrets.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// same capacity the firmware derives its per-connection tables from, Makefile.test passes the
+// value from sdkconfig
+#ifndef CONFIG_BT_ACL_CONNECTIONS
+#define CONFIG_BT_ACL_CONNECTIONS 9
+#endif
+#define MAX_CONNECTIONS CONFIG_BT_ACL_CONNECTIONS
+
+#define MAX_PHONES 64
+#define DEFAULT_PHONES 8
+#define DEFAULT_CYCLES 200
+#define DEFAULT_LED_WRITES 20
+
+// one in this many connections the phone has lost its keys (app data cleared) and pairs again
+#define FORGET_ONE_IN 4
+
+typedef enum {
+    PHONE_OFF = 0,
+    PHONE_CHAL_0,          // device sent chal_0
+    PHONE_NEXT_CHAL,       // device sent the next challenge
+    PHONE_APP_RESPONSE,    // device decrypted the phone's challenge
+    PHONE_RECONNECT,       // device sent the reconnect challenge
+    PHONE_RECONNECT_CHAL,  // phone sent its reconnect challenge
+    PHONE_ESTABLISHED,
+} phone_state_t;
+
+// device side, one per slot like client_state_t
+typedef struct {
+    bool used;
+    uint16_t conn_id;
+    int phone;
+    AES_Context session_ctx;
+    uint8_t session_key[16];
+    uint8_t the_challenge[16];
+    struct challenge_data chal_0;
+    struct next_challenge next;
+    uint8_t response[16];
+    uint8_t led_writes;
+} device_slot_t;
+
+// device side session cache, by phone instead of BDA
+typedef struct {
+    bool valid;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+} device_session_t;
+
+typedef struct {
+    phone_state_t state;
+    uint16_t conn_id;
+
+    // what the phone's app keeps
+    bool has_keys;
+    AES_Context ctx;
+    uint8_t key[16];
+    uint8_t app_challenge[16];
+    uint8_t reconnect_challenge[32];
+    int led_writes;
+
+    // results
+    int cycles;
+    int full_handshakes;
+    int reconnects;
+    int led_total;
+    int rejected;
+    int failures;
+    double full_device_ns;
+    double reconnect_device_ns;
+    double led_device_ns;
+    double finished_s;  // since the start of the run, for the phone's own throughput
+} phone_t;
+
+static device_slot_t slots[MAX_CONNECTIONS];
+static device_session_t sessions[MAX_PHONES];
+static phone_t phones[MAX_PHONES];
+static AES_Context phone_device_key_ctx;
+static uint16_t next_conn_id = 0;
+static int led_writes_per_session = DEFAULT_LED_WRITES;
+
+static const uint8_t bt_mac[] = { 0x98, 0xb6, 0xe9, 0x11, 0xe1, 0x46 };
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static device_slot_t* device_find_slot(uint16_t conn_id) {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (slots[i].used && slots[i].conn_id == conn_id) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+// device: CONNECT_EVT + notify enable, returns the slot or -1 when every slot is taken
+static int device_connect(int phone, uint16_t conn_id, bool* reconnect) {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (slots[i].used) {
+            continue;
+        }
+        device_slot_t* s = &slots[i];
+        memset(s, 0, sizeof(*s));
+        s->used = true;
+        s->conn_id = conn_id;
+        s->phone = phone;
+
+        *reconnect = sessions[phone].valid;
+        if (*reconnect) {
+            memcpy(s->session_key, sessions[phone].session_key, 16);
+            aes_setkey(&s->session_ctx, s->session_key);
+        } else {
+            uint8_t main_nonce[16];
+            uint8_t outer_nonce[16];
+            randomize_buffer(s->the_challenge, 16);
+            randomize_buffer(main_nonce, 16);
+            randomize_buffer(s->session_key, 16);
+            randomize_buffer(outer_nonce, 16);
+            aes_setkey(&s->session_ctx, s->session_key);
+            generate_chal_0(
+                bt_mac, s->the_challenge, main_nonce, s->session_key, &s->session_ctx, outer_nonce, &s->chal_0);
+        }
+        return i;
+    }
+    return -1;
+}
+
+static void device_disconnect(device_slot_t* s) {
+    aes_freekey(&s->session_ctx);
+    memset(s, 0, sizeof(*s));
+}
+
+// phone: reads chal_0, recovers the challenge with the device key and the session key it carries
+static void phone_read_chal_0(phone_t* p, const struct challenge_data* chal_0, uint8_t* challenge_out) {
+    struct main_challenge_data main_data;
+    aes_ctr(&phone_device_key_ctx, chal_0->nonce, chal_0->encrypted_main_challenge, 80, (uint8_t*)&main_data);
+
+    memcpy(p->key, main_data.key, 16);
+    aes_setkey(&p->ctx, p->key);
+    aes_ctr(&p->ctx, main_data.nonce, main_data.encrypted_challenge, 16, challenge_out);
+}
+
+// runs one step of phone i, the device's share of it goes into the phone's *_device_ns
+static void step_phone(int i) {
+    phone_t* p = &phones[i];
+    device_slot_t* s = p->state == PHONE_OFF ? NULL : device_find_slot(p->conn_id);
+    double start;
+
+    switch (p->state) {
+    case PHONE_OFF: {
+        if (p->has_keys && entropy_word() % FORGET_ONE_IN == 0) {
+            p->has_keys = false;
+            sessions[i].valid = false;
+            aes_freekey(&p->ctx);
+        }
+
+        bool reconnect = false;
+        uint16_t conn_id = next_conn_id++;
+        start = now_ns();
+        int slot = device_connect(i, conn_id, &reconnect);
+        double elapsed = now_ns() - start;
+        if (slot < 0) {
+            p->rejected++;
+            return;
+        }
+        p->conn_id = conn_id;
+        p->led_writes = 0;
+        if (reconnect) {
+            p->reconnect_device_ns += elapsed;
+            p->state = PHONE_RECONNECT;
+        } else {
+            p->full_device_ns += elapsed;
+            p->state = PHONE_CHAL_0;
+        }
+        break;
+    }
+    case PHONE_CHAL_0: {
+        uint8_t recovered[16];
+        phone_read_chal_0(p, &s->chal_0, recovered);
+        if (memcmp(recovered, s->the_challenge, 16) != 0) {
+            p->failures++;
+        }
+
+        // device: handle_chal_0_reply
+        start = now_ns();
+        uint8_t nonce[16];
+        randomize_buffer(nonce, 16);
+        generate_next_chal(0, &s->session_ctx, nonce, &s->next);
+        p->full_device_ns += now_ns() - start;
+        p->state = PHONE_NEXT_CHAL;
+        break;
+    }
+    case PHONE_NEXT_CHAL: {
+        uint8_t plain[16];
+        if (!decrypt_next((const uint8_t*)&s->next, &p->ctx, plain) || plain[0] != 0xaa) {
+            p->failures++;
+        }
+
+        // phone's own challenge, the device has to give it back decrypted
+        uint8_t nonce[16];
+        struct next_challenge app_chal;
+        randomize_buffer(p->app_challenge, 16);
+        randomize_buffer(nonce, 16);
+        generate_next_chal(p->app_challenge, &p->ctx, nonce, &app_chal);
+
+        // device: handle_next_chal
+        start = now_ns();
+        if (!decrypt_next((const uint8_t*)&app_chal, &s->session_ctx, s->response)) {
+            p->failures++;
+        }
+        p->full_device_ns += now_ns() - start;
+        p->state = PHONE_APP_RESPONSE;
+        break;
+    }
+    case PHONE_APP_RESPONSE: {
+        if (memcmp(s->response, p->app_challenge, 16) != 0) {
+            p->failures++;
+        }
+
+        uint8_t ack[16] = { 0 };
+        uint8_t nonce[16];
+        struct next_challenge app_ack;
+        randomize_buffer(nonce, 16);
+        generate_next_chal(ack, &p->ctx, nonce, &app_ack);
+
+        // device: handle_app_response, keeps the session for the next reconnect
+        start = now_ns();
+        uint8_t plain[16];
+        if (!decrypt_next((const uint8_t*)&app_ack, &s->session_ctx, plain)) {
+            p->failures++;
+        }
+        sessions[i].valid = true;
+        memcpy(sessions[i].session_key, s->session_key, 16);
+        randomize_buffer(sessions[i].reconnect_challenge, 32);
+        p->full_device_ns += now_ns() - start;
+
+        p->has_keys = true;
+        p->full_handshakes++;
+        p->state = PHONE_ESTABLISHED;
+        break;
+    }
+    case PHONE_RECONNECT: {
+        // phone answers the reconnect challenge and sends its own
+        if (!p->has_keys) {
+            p->failures++;
+        }
+        randomize_buffer(p->reconnect_challenge, 32);
+
+        // device: handle_reconnect + handle_reconnect_chal
+        start = now_ns();
+        generate_reconnect_response(&s->session_ctx, p->reconnect_challenge, s->response);
+        p->reconnect_device_ns += now_ns() - start;
+        p->state = PHONE_RECONNECT_CHAL;
+        break;
+    }
+    case PHONE_RECONNECT_CHAL: {
+        uint8_t expected[16];
+        generate_reconnect_response(&p->ctx, p->reconnect_challenge, expected);
+        if (memcmp(expected, s->response, 16) != 0) {
+            p->failures++;
+        }
+        p->reconnects++;
+        p->state = PHONE_ESTABLISHED;
+        break;
+    }
+    case PHONE_ESTABLISHED: {
+        if (p->led_writes == led_writes_per_session) {
+            device_disconnect(s);
+            p->cycles++;
+            p->state = PHONE_OFF;
+            break;
+        }
+
+        // one LED pattern write: 4 byte header and 3 bytes per pattern
+        uint8_t led[4 + 3 * 8];
+        memset(led, 0, sizeof(led));
+        led[3] = 1 + entropy_word() % 8;
+        entropy_fill(led + 4, 3 * led[3]);
+
+        // device: slot lookup and pattern walk like handle_led_notify_from_app
+        start = now_ns();
+        device_slot_t* found = device_find_slot(p->conn_id);
+        int duration = 0;
+        for (int k = 0; k < (led[3] & 0x1f); k++) {
+            duration += led[4 + 3 * k];
+        }
+        if (found) {
+            found->led_writes += duration > 0;
+        }
+        p->led_device_ns += now_ns() - start;
+
+        p->led_writes++;
+        p->led_total++;
+        break;
+    }
+    }
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-p phones] [-n cycles] [-l led_writes] [-s seed]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    int phone_count = DEFAULT_PHONES;
+    int cycles = DEFAULT_CYCLES;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            phone_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            cycles = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            led_writes_per_session = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 0);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (phone_count < 1 || phone_count > MAX_PHONES || cycles < 1 || led_writes_per_session < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    set_cert_debug_dumps(false);
+    entropy_seed(seed);
+    init_device_key_ctx();
+    aes_setkey(&phone_device_key_ctx, PGP_DEVICE_KEY);
+
+    printf("%d phones, %d slots (MAX_CONNECTIONS), %d cycles of %d LED writes each, seed %u\n",
+        phone_count,
+        MAX_CONNECTIONS,
+        cycles,
+        led_writes_per_session,
+        seed);
+
+    double start = now_ns();
+    int done = 0;
+    while (done < phone_count) {
+        int i = entropy_word() % phone_count;
+        if (phones[i].cycles == cycles) {
+            continue;
+        }
+        step_phone(i);
+        if (phones[i].cycles == cycles) {
+            phones[i].finished_s = (now_ns() - start) / 1e9;
+            done++;
+        }
+    }
+    double wall_s = (now_ns() - start) / 1e9;
+
+    printf("%-6s %7s %6s %6s %8s %8s %9s %12s %12s %10s %10s\n",
+        "phone",
+        "cycles",
+        "full",
+        "recon",
+        "led",
+        "rejected",
+        "failures",
+        "full us/hs",
+        "recon us/hs",
+        "hs/s",
+        "led/s");
+    int failures = 0;
+    int starved = 0;
+    int min_rejected = -1, max_rejected = 0;
+    for (int i = 0; i < phone_count; i++) {
+        phone_t* p = &phones[i];
+        printf("%-6d %7d %6d %6d %8d %8d %9d %12.2f %12.2f %10.0f %10.0f\n",
+            i,
+            p->cycles,
+            p->full_handshakes,
+            p->reconnects,
+            p->led_total,
+            p->rejected,
+            p->failures,
+            p->full_handshakes ? p->full_device_ns / 1e3 / p->full_handshakes : 0,
+            p->reconnects ? p->reconnect_device_ns / 1e3 / p->reconnects : 0,
+            (p->full_handshakes + p->reconnects) / p->finished_s,
+            p->led_total / p->finished_s);
+        failures += p->failures;
+        if (p->full_handshakes + p->reconnects == 0) {
+            starved++;
+        }
+        if (min_rejected < 0 || p->rejected < min_rejected) {
+            min_rejected = p->rejected;
+        }
+        if (p->rejected > max_rejected) {
+            max_rejected = p->rejected;
+        }
+    }
+
+    int total_hs = 0, total_led = 0;
+    for (int i = 0; i < phone_count; i++) {
+        total_hs += phones[i].full_handshakes + phones[i].reconnects;
+        total_led += phones[i].led_total;
+    }
+    printf("total: %.3f s, %.0f handshakes/s, %.0f LED writes/s, rejected connects %d..%d per phone\n",
+        wall_s,
+        total_hs / wall_s,
+        total_led / wall_s,
+        min_rejected,
+        max_rejected);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d handshake step(s) didn't verify\n", failures);
+        return 1;
+    }
+    if (phone_count <= MAX_CONNECTIONS && (starved > 0 || max_rejected > 0)) {
+        fprintf(stderr, "%d phone(s) starved with enough slots for everyone\n", starved);
+        return 1;
+    }
+    return 0;
+}
+
+#endif
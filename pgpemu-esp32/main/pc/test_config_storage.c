@@ -1,5 +1,5 @@
 // Unit tests for config_storage module (PC build)
-// Tests device key hashing, session persistence functions
+// Tests device key hashing, session persistence functions, the per-device record and its legacy migration
 #ifndef ESP_PLATFORM
 
 #include <assert.h>
@@ -220,6 +220,228 @@ void test_null_pointer_handling() {
     printf("✓ Buffer size validation works\n");
 }
 
+// Mock NVS namespace: hashed key -> value bytes
+#define MOCK_NVS_ENTRIES 32
+
+typedef struct {
+    bool used;
+    char key[16];
+    uint8_t value[64];
+    size_t len;
+} mock_nvs_entry_t;
+
+static mock_nvs_entry_t mock_nvs[MOCK_NVS_ENTRIES];
+
+static mock_nvs_entry_t* mock_nvs_find(const char* key) {
+    for (int i = 0; i < MOCK_NVS_ENTRIES; i++) {
+        if (mock_nvs[i].used && strcmp(mock_nvs[i].key, key) == 0) {
+            return &mock_nvs[i];
+        }
+    }
+    return NULL;
+}
+
+static void mock_nvs_set(const char* key, const void* value, size_t len) {
+    mock_nvs_entry_t* entry = mock_nvs_find(key);
+    for (int i = 0; !entry && i < MOCK_NVS_ENTRIES; i++) {
+        if (!mock_nvs[i].used) {
+            entry = &mock_nvs[i];
+        }
+    }
+    entry->used = true;
+    strcpy(entry->key, key);
+    memcpy(entry->value, value, len);
+    entry->len = len;
+}
+
+static esp_err_t mock_nvs_get(const char* key, void* out, size_t len) {
+    mock_nvs_entry_t* entry = mock_nvs_find(key);
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (entry->len != len) {
+        return ESP_FAIL;
+    }
+    memcpy(out, entry->value, len);
+    return ESP_OK;
+}
+
+static int mock_nvs_count() {
+    int count = 0;
+    for (int i = 0; i < MOCK_NVS_ENTRIES; i++) {
+        count += mock_nvs[i].used;
+    }
+    return count;
+}
+
+// Mirrors device_record_t and the record read/write of config_storage.c
+#define DEVICE_RECORD_VERSION 1
+#define DEVICE_RECORD_HAS_SESSION 0x01
+#define DEVICE_RECORD_HAS_SETTINGS 0x02
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t flags;
+    uint8_t autocatch;
+    uint8_t autospin;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+    uint32_t last_seen;
+    uint32_t sessions;
+} device_record_t;
+
+static uint32_t record_clock = 0;
+
+static void init_device_record(device_record_t* record) {
+    memset(record, 0, sizeof(device_record_t));
+    record->version = DEVICE_RECORD_VERSION;
+    record->autocatch = 1;
+    record->autospin = 1;
+}
+
+static bool read_legacy_device_keys(const esp_bd_addr_t bda, device_record_t* record) {
+    char key_out[16];
+    int8_t value = 0;
+    bool found = false;
+
+    make_device_key_for_option("catch", bda, key_out);
+    if (mock_nvs_get(key_out, &value, 1) == ESP_OK) {
+        record->autocatch = value != 0;
+        record->flags |= DEVICE_RECORD_HAS_SETTINGS;
+        found = true;
+    }
+    make_device_key_for_option("spin", bda, key_out);
+    if (mock_nvs_get(key_out, &value, 1) == ESP_OK) {
+        record->autospin = value != 0;
+        record->flags |= DEVICE_RECORD_HAS_SETTINGS;
+        found = true;
+    }
+
+    make_device_key_for_option("sesskey", bda, key_out);
+    bool has_key = mock_nvs_get(key_out, record->session_key, 16) == ESP_OK;
+    make_device_key_for_option("rechall", bda, key_out);
+    bool has_challenge = mock_nvs_get(key_out, record->reconnect_challenge, 32) == ESP_OK;
+    if (has_key && has_challenge) {
+        record->flags |= DEVICE_RECORD_HAS_SESSION;
+    } else {
+        memset(record->session_key, 0, sizeof(record->session_key));
+        memset(record->reconnect_challenge, 0, sizeof(record->reconnect_challenge));
+    }
+
+    return found || has_key || has_challenge;
+}
+
+static bool read_device_record(const esp_bd_addr_t bda, device_record_t* out, bool* legacy_out) {
+    init_device_record(out);
+    *legacy_out = false;
+
+    char key_out[16];
+    make_device_key_for_option("dev", bda, key_out);
+    if (mock_nvs_get(key_out, out, sizeof(device_record_t)) == ESP_OK && out->version == DEVICE_RECORD_VERSION) {
+        return true;
+    }
+    init_device_record(out);
+
+    *legacy_out = read_legacy_device_keys(bda, out);
+    return *legacy_out;
+}
+
+static void write_device_record(const esp_bd_addr_t bda, device_record_t* record, bool erase_legacy) {
+    record->version = DEVICE_RECORD_VERSION;
+    record->last_seen = ++record_clock;
+
+    char key_out[16];
+    make_device_key_for_option("dev", bda, key_out);
+    mock_nvs_set(key_out, record, sizeof(device_record_t));
+
+    if (erase_legacy) {
+        const char* keys[] = { "catch", "spin", "sesskey", "rechall" };
+        for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+            make_device_key_for_option(keys[i], bda, key_out);
+            mock_nvs_entry_t* entry = mock_nvs_find(key_out);
+            if (entry) {
+                memset(entry, 0, sizeof(mock_nvs_entry_t));
+            }
+        }
+    }
+}
+
+// Test the packed layout, it is stored as is and must not change without a version bump
+void test_device_record_layout() {
+    printf("\n=== Test: Device Record Layout ===\n");
+
+    assert(sizeof(device_record_t) == 60);
+    assert(offsetof(device_record_t, session_key) == 4);
+    assert(offsetof(device_record_t, reconnect_challenge) == 20);
+    assert(offsetof(device_record_t, last_seen) == 52);
+    assert(offsetof(device_record_t, sessions) == 56);
+    printf("✓ Record is 60 packed bytes, one blob per phone\n");
+
+    char record_key[16], option_key[16];
+    esp_bd_addr_t bda = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+    make_device_key_for_option("dev", bda, record_key);
+    make_device_key_for_option("sesskey", bda, option_key);
+    assert(strlen(record_key) == 15);
+    assert(strcmp(record_key, option_key) != 0);
+    printf("✓ Record key is a 15 char hash distinct from the legacy keys\n");
+}
+
+// Test reading per-option keys of older firmware and moving them into the record
+void test_legacy_migration() {
+    printf("\n=== Test: Legacy Key Migration ===\n");
+    memset(mock_nvs, 0, sizeof(mock_nvs));
+    record_clock = 0;
+
+    esp_bd_addr_t bda = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x01 };
+    uint8_t session_key[16], reconnect_challenge[32];
+    memset(session_key, 0x5a, sizeof(session_key));
+    memset(reconnect_challenge, 0xa5, sizeof(reconnect_challenge));
+    int8_t autocatch = 0, autospin = 1;
+
+    char key_out[16];
+    make_device_key_for_option("catch", bda, key_out);
+    mock_nvs_set(key_out, &autocatch, 1);
+    make_device_key_for_option("spin", bda, key_out);
+    mock_nvs_set(key_out, &autospin, 1);
+    make_device_key_for_option("sesskey", bda, key_out);
+    mock_nvs_set(key_out, session_key, 16);
+    make_device_key_for_option("rechall", bda, key_out);
+    mock_nvs_set(key_out, reconnect_challenge, 32);
+    assert(mock_nvs_count() == 4);
+
+    device_record_t record;
+    bool legacy = false;
+    assert(read_device_record(bda, &record, &legacy));
+    assert(legacy);
+    assert(record.flags == (DEVICE_RECORD_HAS_SESSION | DEVICE_RECORD_HAS_SETTINGS));
+    assert(record.autocatch == 0 && record.autospin == 1);
+    assert(memcmp(record.session_key, session_key, 16) == 0);
+    assert(memcmp(record.reconnect_challenge, reconnect_challenge, 32) == 0);
+    printf("✓ Legacy keys read into one record\n");
+
+    write_device_record(bda, &record, legacy);
+    assert(mock_nvs_count() == 1);
+    assert(read_device_record(bda, &record, &legacy));
+    assert(!legacy);
+    assert(record.last_seen == 1);
+    assert(memcmp(record.session_key, session_key, 16) == 0);
+    printf("✓ Four legacy entries replaced by one record\n");
+
+    esp_bd_addr_t other = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x02 };
+    make_device_key_for_option("sesskey", other, key_out);
+    mock_nvs_set(key_out, session_key, 16);
+    assert(read_device_record(other, &record, &legacy));
+    assert(legacy);
+    assert(record.flags == 0);
+    assert(record.autocatch == 1 && record.autospin == 1);
+    printf("✓ Half a legacy session isn't migrated, settings default to on\n");
+
+    esp_bd_addr_t unknown = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x03 };
+    assert(!read_device_record(unknown, &record, &legacy));
+    assert(!legacy);
+    printf("✓ Unknown phone has no record\n");
+}
+
 // Run all tests
 int main() {
     printf("========================================\n");
@@ -232,6 +454,8 @@ int main() {
     test_bda_validation();
     test_invalid_probability_handling();
     test_null_pointer_handling();
+    test_device_record_layout();
+    test_legacy_migration();
 
     printf("\n========================================\n");
     printf("✓ All config_storage tests passed!\n");
@@ -0,0 +1,411 @@
+// Unit tests for the boot-time device directory (PC build)
+// Tests the sorted fingerprint index, lookups by flag, overflow, legacy key handling and LRU eviction
+#ifndef ESP_PLATFORM
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned char esp_bd_addr_t[6];
+
+#define DEVICE_RECORD_HAS_SESSION 0x01
+#define DEVICE_RECORD_HAS_SETTINGS 0x02
+
+// record key as in config_storage.c: FNV-1a of "dev_<bda>", 15 hex chars
+static char* device_record_key(const esp_bd_addr_t bda, char* out) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "dev_%02x%02x%02x%02x%02x%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+
+    uint64_t hash = 1469598103934665603ULL;
+    for (const char* p = buf; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+
+    uint64_t hash_trunc = hash & 0x0FFFFFFFFFFFFFFFUL;
+    const char hex_chars[] = "0123456789abcdef";
+    for (int i = 14; i >= 0; i--) {
+        out[i] = hex_chars[hash_trunc & 0xF];
+        hash_trunc >>= 4;
+    }
+    out[15] = '\0';
+    return out;
+}
+
+// Mirrors device_directory.c, without the lock
+#define DEVICE_DIRECTORY_SIZE 64
+#define DEVICE_STORE_DEFAULT_CAPACITY 32
+
+typedef struct {
+    uint64_t fingerprint;
+    uint32_t last_seen;
+    uint8_t flags;
+} device_directory_entry_t;
+
+static device_directory_entry_t directory[DEVICE_DIRECTORY_SIZE];
+static int directory_count = 0;
+static int capacity = DEVICE_STORE_DEFAULT_CAPACITY;
+static uint32_t directory_clock = 0;
+static uint32_t evictions = 0;
+static int legacy_entries = 0;
+static bool overflowed = false;
+static bool ready = false;
+
+// records "in NVS", erase_record() removes them
+#define MAX_STORED 256
+static uint64_t stored[MAX_STORED];
+static int stored_count = 0;
+
+static void reset_directory() {
+    memset(directory, 0, sizeof(directory));
+    directory_count = 0;
+    capacity = DEVICE_STORE_DEFAULT_CAPACITY;
+    directory_clock = 0;
+    evictions = 0;
+    legacy_entries = 0;
+    overflowed = false;
+    ready = true;
+    stored_count = 0;
+}
+
+static uint64_t key_fingerprint(const char* key) {
+    return strtoull(key, NULL, 16);
+}
+
+static uint64_t bda_fingerprint(const esp_bd_addr_t bda) {
+    char key[16];
+    return key_fingerprint(device_record_key(bda, key));
+}
+
+static int search_locked(uint64_t fingerprint, bool* found) {
+    int lo = 0, hi = directory_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (directory[mid].fingerprint < fingerprint) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = lo < directory_count && directory[lo].fingerprint == fingerprint;
+    return lo;
+}
+
+static int oldest_locked() {
+    int oldest = 0;
+    for (int i = 1; i < directory_count; i++) {
+        if (directory[i].last_seen < directory[oldest].last_seen) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+static void remove_locked(int i) {
+    memmove(&directory[i], &directory[i + 1], (directory_count - i - 1) * sizeof(device_directory_entry_t));
+    directory_count--;
+}
+
+static void update_locked(uint64_t fingerprint, uint8_t flags, uint32_t last_seen) {
+    bool found = false;
+    int i = search_locked(fingerprint, &found);
+    if (found) {
+        directory[i].flags = flags;
+        directory[i].last_seen = last_seen;
+        return;
+    }
+
+    if (directory_count == DEVICE_DIRECTORY_SIZE) {
+        overflowed = true;
+        return;
+    }
+    memmove(&directory[i + 1], &directory[i], (directory_count - i) * sizeof(device_directory_entry_t));
+    directory[i].fingerprint = fingerprint;
+    directory[i].flags = flags;
+    directory[i].last_seen = last_seen;
+    directory_count++;
+}
+
+static uint64_t scan_record_locked(uint64_t fingerprint, uint8_t flags, uint32_t last_seen) {
+    if (last_seen > directory_clock) {
+        directory_clock = last_seen;
+    }
+    if (directory_count < DEVICE_DIRECTORY_SIZE) {
+        update_locked(fingerprint, flags, last_seen);
+        return 0;
+    }
+
+    int oldest = oldest_locked();
+    if (directory[oldest].last_seen >= last_seen) {
+        return fingerprint;
+    }
+    uint64_t dropped = directory[oldest].fingerprint;
+    remove_locked(oldest);
+    update_locked(fingerprint, flags, last_seen);
+    return dropped;
+}
+
+static bool is_stored(uint64_t fingerprint) {
+    for (int i = 0; i < stored_count; i++) {
+        if (stored[i] == fingerprint) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void store(uint64_t fingerprint) {
+    if (!is_stored(fingerprint)) {
+        stored[stored_count++] = fingerprint;
+    }
+}
+
+static bool erase_record(uint64_t fingerprint) {
+    for (int i = 0; i < stored_count; i++) {
+        if (stored[i] == fingerprint) {
+            stored[i] = stored[--stored_count];
+            evictions++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int evict_down_to(int keep) {
+    int evicted = 0;
+    while (directory_count > 0 && directory_count > keep) {
+        int oldest = oldest_locked();
+        uint64_t fingerprint = directory[oldest].fingerprint;
+        remove_locked(oldest);
+        if (erase_record(fingerprint)) {
+            evicted++;
+        }
+    }
+    return evicted;
+}
+
+static bool device_directory_may_have(const esp_bd_addr_t bda, uint8_t flag) {
+    uint64_t fingerprint = bda_fingerprint(bda);
+    bool may_have = true;
+    if (ready && !overflowed && legacy_entries == 0) {
+        bool found = false;
+        int i = search_locked(fingerprint, &found);
+        may_have = found && (directory[i].flags & flag);
+        if (found) {
+            directory[i].last_seen = ++directory_clock;
+        }
+    }
+    return may_have;
+}
+
+static int device_directory_make_room(const esp_bd_addr_t bda) {
+    bool found = false;
+    search_locked(bda_fingerprint(bda), &found);
+    if (found) {
+        return 0;
+    }
+    return evict_down_to(capacity - 1);
+}
+
+static void device_directory_update(const esp_bd_addr_t bda, uint8_t flags) {
+    update_locked(bda_fingerprint(bda), flags, ++directory_clock);
+}
+
+// write_device_record() as far as the directory is concerned
+static void write_record(const esp_bd_addr_t bda, uint8_t flags) {
+    device_directory_make_room(bda);
+    store(bda_fingerprint(bda));
+    device_directory_update(bda, flags);
+}
+
+static void device_directory_legacy_erased(int count) {
+    legacy_entries -= count;
+    if (legacy_entries < 0) {
+        legacy_entries = 0;
+    }
+}
+
+static void make_bda(int n, esp_bd_addr_t out) {
+    uint8_t bda[6] = { 0x10, 0x20, 0x30, 0x40, (uint8_t)(n >> 8), (uint8_t)n };
+    memcpy(out, bda, sizeof(esp_bd_addr_t));
+}
+
+void test_fingerprint_matches_key() {
+    printf("\n=== Test: Fingerprint of the Record Key ===\n");
+
+    esp_bd_addr_t bda;
+    make_bda(1, bda);
+    char key[16];
+    device_record_key(bda, key);
+    assert(strlen(key) == 15);
+    assert(key_fingerprint(key) == bda_fingerprint(bda));
+    assert(key_fingerprint(key) < (1ULL << 60));
+    printf("✓ Key iterated from NVS and key computed from the BDA give the same fingerprint\n");
+}
+
+void test_sorted_lookup() {
+    printf("\n=== Test: Sorted Index Lookup ===\n");
+    reset_directory();
+
+    esp_bd_addr_t bda;
+    for (int n = 0; n < 20; n++) {
+        make_bda(n, bda);
+        device_directory_update(bda, n % 2 ? DEVICE_RECORD_HAS_SESSION : DEVICE_RECORD_HAS_SETTINGS);
+    }
+    assert(directory_count == 20);
+    for (int i = 1; i < directory_count; i++) {
+        assert(directory[i - 1].fingerprint < directory[i].fingerprint);
+    }
+    printf("✓ 20 records kept sorted\n");
+
+    for (int n = 0; n < 20; n++) {
+        make_bda(n, bda);
+        assert(device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION) == (n % 2 == 1));
+        assert(device_directory_may_have(bda, DEVICE_RECORD_HAS_SETTINGS) == (n % 2 == 0));
+    }
+    printf("✓ Flags looked up per phone\n");
+
+    make_bda(500, bda);
+    assert(!device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    assert(!device_directory_may_have(bda, DEVICE_RECORD_HAS_SETTINGS));
+    printf("✓ Unknown phone is ruled out\n");
+
+    make_bda(1, bda);
+    device_directory_update(bda, DEVICE_RECORD_HAS_SETTINGS);
+    assert(directory_count == 20);
+    assert(!device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    printf("✓ Clearing a session updates the entry in place\n");
+}
+
+void test_not_ready_or_incomplete() {
+    printf("\n=== Test: Incomplete Index Rules Nothing Out ===\n");
+    reset_directory();
+
+    esp_bd_addr_t bda;
+    make_bda(7, bda);
+    ready = false;
+    assert(device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    printf("✓ Before the boot scan every phone may have a record\n");
+
+    reset_directory();
+    legacy_entries = 3;
+    assert(device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    device_directory_legacy_erased(2);
+    assert(device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    device_directory_legacy_erased(2);
+    assert(legacy_entries == 0);
+    assert(!device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    printf("✓ Legacy keys keep NVS lookups until all are migrated\n");
+
+    reset_directory();
+    for (int n = 0; n < DEVICE_DIRECTORY_SIZE; n++) {
+        make_bda(n, bda);
+        device_directory_update(bda, DEVICE_RECORD_HAS_SESSION);
+    }
+    assert(!overflowed);
+    make_bda(DEVICE_DIRECTORY_SIZE, bda);
+    device_directory_update(bda, DEVICE_RECORD_HAS_SESSION);
+    assert(overflowed);
+    assert(directory_count == DEVICE_DIRECTORY_SIZE);
+    make_bda(1000, bda);
+    assert(device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    printf("✓ A full index falls back to NVS lookups\n");
+}
+
+void test_capacity_eviction() {
+    printf("\n=== Test: Least Recently Seen Phone Evicted at Capacity ===\n");
+    reset_directory();
+    capacity = 4;
+
+    esp_bd_addr_t bda;
+    for (int n = 0; n < 4; n++) {
+        make_bda(n, bda);
+        write_record(bda, DEVICE_RECORD_HAS_SESSION);
+    }
+    assert(directory_count == 4 && stored_count == 4 && evictions == 0);
+    printf("✓ Store fills up to its capacity\n");
+
+    // phone 0 connects again, phone 1 is now the least recently seen
+    make_bda(0, bda);
+    assert(device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    make_bda(1, bda);
+    write_record(bda, DEVICE_RECORD_HAS_SESSION);
+    assert(evictions == 0);
+    printf("✓ Rewriting a stored phone evicts nothing\n");
+
+    make_bda(10, bda);
+    write_record(bda, DEVICE_RECORD_HAS_SESSION);
+    assert(directory_count == 4 && stored_count == 4 && evictions == 1);
+    make_bda(2, bda);
+    assert(!is_stored(bda_fingerprint(bda)));
+    assert(!device_directory_may_have(bda, DEVICE_RECORD_HAS_SESSION));
+    make_bda(0, bda);
+    assert(is_stored(bda_fingerprint(bda)));
+    printf("✓ New phone replaces the least recently seen one\n");
+
+    // lowering the capacity trims with the next new phone
+    capacity = 2;
+    make_bda(11, bda);
+    write_record(bda, DEVICE_RECORD_HAS_SESSION);
+    assert(directory_count == 2 && stored_count == 2 && evictions == 4);
+    printf("✓ Lower capacity takes effect with the next new phone\n");
+}
+
+void test_boot_scan_keeps_newest() {
+    printf("\n=== Test: Boot Scan Keeps the Newest Records ===\n");
+    reset_directory();
+
+    // an older store with more records than the index, found in hash order
+    int total = DEVICE_DIRECTORY_SIZE + 30;
+    uint64_t dropped[64];
+    int dropped_count = 0;
+    for (int n = 0; n < total; n++) {
+        uint32_t last_seen = (uint32_t)((n * 37) % total) + 1;
+        uint64_t fingerprint = 1000 + (uint64_t)n;
+        store(fingerprint);
+        uint64_t drop = scan_record_locked(fingerprint, DEVICE_RECORD_HAS_SESSION, last_seen);
+        if (drop) {
+            dropped[dropped_count++] = drop;
+        }
+    }
+    assert(directory_count == DEVICE_DIRECTORY_SIZE);
+    assert(dropped_count == total - DEVICE_DIRECTORY_SIZE);
+    assert(directory_clock == (uint32_t)total);
+    for (int i = 0; i < directory_count; i++) {
+        assert(directory[i].last_seen > (uint32_t)(total - DEVICE_DIRECTORY_SIZE));
+    }
+    printf("✓ Index holds the %d most recently seen, %d older ones dropped\n", DEVICE_DIRECTORY_SIZE, dropped_count);
+
+    for (int i = 0; i < dropped_count; i++) {
+        assert(erase_record(dropped[i]));
+    }
+    evict_down_to(capacity);
+    assert(directory_count == capacity && stored_count == capacity);
+    assert(evictions == (uint32_t)(total - capacity));
+    for (int i = 0; i < directory_count; i++) {
+        assert(directory[i].last_seen > (uint32_t)(total - capacity));
+    }
+    printf("✓ Store trimmed to the %d newest records\n", capacity);
+}
+
+int main() {
+    printf("========================================\n");
+    printf("Device Directory Unit Tests\n");
+    printf("========================================\n");
+
+    test_fingerprint_matches_key();
+    test_sorted_lookup();
+    test_not_ready_or_incomplete();
+    test_capacity_eviction();
+    test_boot_scan_keeps_newest();
+
+    printf("\n========================================\n");
+    printf("✓ All device directory tests passed!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,154 @@
+// Unit tests for the per-phone NVS key cache (PC build)
+// Tests that cached key sets match the keys stored data is under, priming and LRU eviction, against
+// device_keys.c on the host shims
+#ifndef ESP_PLATFORM
+
+#include "../device_keys.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// make_device_key_for_option() of older firmware, what existing NVS data is stored under
+static char* legacy_key(const char* key, const esp_bd_addr_t bda, char* out) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s_%02x%02x%02x%02x%02x%02x", key, bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+
+    uint64_t hash = 1469598103934665603ULL;
+    for (const char* p = buf; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+
+    uint64_t hash_trunc = hash & 0x0FFFFFFFFFFFFFFFUL;
+    const char hex_chars[] = "0123456789abcdef";
+    for (int i = 14; i >= 0; i--) {
+        out[i] = hex_chars[hash_trunc & 0xF];
+        hash_trunc >>= 4;
+    }
+    out[15] = '\0';
+    return out;
+}
+
+// cache counters between the last two take_stats() calls
+static uint32_t lookups = 0;
+static uint32_t derivations = 0;
+
+static void take_stats() {
+    static uint32_t lookups_before = 0, derivations_before = 0;
+    uint32_t lookups_now, derivations_now;
+    get_device_keys_stats(&lookups_now, &derivations_now);
+    lookups = lookups_now - lookups_before;
+    derivations = derivations_now - derivations_before;
+    lookups_before = lookups_now;
+    derivations_before = derivations_now;
+}
+
+static void make_bda(int n, esp_bd_addr_t out) {
+    uint8_t bda[6] = { 0x10, 0x20, 0x30, 0x40, (uint8_t)(n >> 8), (uint8_t)n };
+    memcpy(out, bda, sizeof(esp_bd_addr_t));
+}
+
+void test_keys_match_stored_names() {
+    printf("\n=== Test: Key Set Matches Stored Keys ===\n");
+
+    esp_bd_addr_t bda;
+    make_bda(1, bda);
+    device_keys_t keys;
+    get_device_keys(bda, &keys);
+
+    char expected[16];
+    for (int i = 0; i < DEVICE_KEY_COUNT; i++) {
+        assert(strcmp(keys.key[i], legacy_key(device_key_name((device_key_t)i), bda, expected)) == 0);
+        assert(strlen(keys.key[i]) == 15);
+    }
+    printf("✓ Every key equals the per-use hash older firmware stored under\n");
+
+    assert(keys.fingerprint == strtoull(keys.key[DEVICE_KEY_RECORD], NULL, 16));
+    printf("✓ Fingerprint is the record key read as a number\n");
+
+    for (int i = 1; i < DEVICE_KEY_COUNT; i++) {
+        assert(strcmp(keys.key[0], keys.key[i]) != 0);
+    }
+    printf("✓ Keys of one phone are distinct\n");
+}
+
+void test_prime_then_hit() {
+    printf("\n=== Test: Keys Derived Once Per Phone ===\n");
+
+    esp_bd_addr_t bda;
+    make_bda(2, bda);
+    take_stats();
+    prime_device_keys(bda);
+    take_stats();
+    assert(derivations == 1);
+
+    // settings read, session lookup, reconnect and flush of one connection
+    device_keys_t keys;
+    for (int i = 0; i < 4; i++) {
+        get_device_keys(bda, &keys);
+    }
+    take_stats();
+    assert(lookups == 4);
+    assert(derivations == 0);
+    assert(memcmp(keys.bda, bda, sizeof(esp_bd_addr_t)) == 0);
+    printf("✓ A connect cycle after the prime hashes nothing\n");
+}
+
+void test_lru_eviction() {
+    printf("\n=== Test: Least Recently Used Phone Evicted ===\n");
+
+    // new phones push out everything the earlier tests cached
+    esp_bd_addr_t bda;
+    device_keys_t keys;
+    take_stats();
+    for (int n = 0; n < DEVICE_KEYS_CACHE_SIZE; n++) {
+        make_bda(1000 + n, bda);
+        prime_device_keys(bda);
+    }
+    take_stats();
+    assert(derivations == DEVICE_KEYS_CACHE_SIZE);
+
+    // phone 0 reconnects, phone 1 is now the oldest
+    make_bda(1000, bda);
+    get_device_keys(bda, &keys);
+    make_bda(2000, bda);
+    prime_device_keys(bda);
+    take_stats();
+    assert(derivations == 1);
+
+    make_bda(1000, bda);
+    get_device_keys(bda, &keys);
+    take_stats();
+    assert(derivations == 0);
+    printf("✓ Recently used phone stays cached\n");
+
+    make_bda(1001, bda);
+    get_device_keys(bda, &keys);
+    take_stats();
+    assert(derivations == 1);
+
+    char expected[16];
+    assert(strcmp(keys.key[DEVICE_KEY_SESSION_KEY], legacy_key("sesskey", bda, expected)) == 0);
+    printf("✓ Evicted phone is derived again with the same keys\n");
+}
+
+int main() {
+    printf("========================================\n");
+    printf("Device Keys Unit Tests\n");
+    printf("========================================\n");
+
+    test_keys_match_stored_names();
+    test_prime_then_hit();
+    test_lru_eviction();
+
+    printf("\n========================================\n");
+    printf("✓ All device keys tests passed!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,284 @@
+// Unit tests for the handle-indexed GATT write dispatch (PC build)
+// Tests registration and lookup, rebasing, names by handle, invalid handles and which writes get answered
+#ifndef ESP_PLATFORM
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Mirrors pgp_gatts_dispatch.c, with the GATT parameters reduced to what the handlers use
+#define BATTERY_LAST_IDX 4
+#define LED_BUTTON_LAST_IDX 12
+#define CERT_LAST_IDX 8
+#define CONTROL_LAST_IDX 6
+#define GATTS_DISPATCH_ATTRS (BATTERY_LAST_IDX + LED_BUTTON_LAST_IDX + CERT_LAST_IDX + CONTROL_LAST_IDX)
+
+typedef enum {
+    GATTS_SVC_NONE,
+    GATTS_SVC_BATTERY,
+    GATTS_SVC_LED_BUTTON,
+    GATTS_SVC_CERT,
+    GATTS_SVC_CONTROL,
+    GATTS_SVC_COUNT,
+} gatts_service_t;
+
+typedef struct {
+    uint16_t conn_id;
+    uint16_t handle;
+} write_param_t;
+
+typedef bool (*gatts_write_handler_t)(const write_param_t* param);
+
+typedef struct {
+    uint8_t service;
+    uint8_t index;
+    gatts_write_handler_t on_write;
+} gatts_attr_t;
+
+static gatts_attr_t attrs[GATTS_DISPATCH_ATTRS];
+static uint16_t base = 0;
+static uint16_t end = 0;
+static int register_errors = 0;
+
+static void rebase(uint16_t handle) {
+    if (base == 0) {
+        base = end = handle;
+        return;
+    }
+    if (handle >= base || end - handle > GATTS_DISPATCH_ATTRS) {
+        return;
+    }
+    int shift = base - handle;
+    memmove(&attrs[shift], &attrs[0], (end - base) * sizeof(gatts_attr_t));
+    memset(&attrs[0], 0, shift * sizeof(gatts_attr_t));
+    base = handle;
+}
+
+static void gatts_dispatch_register(gatts_service_t service,
+    const uint16_t* handles,
+    int count,
+    const gatts_write_handler_t* handlers) {
+    uint16_t lowest = 0;
+    for (int i = 0; i < count; i++) {
+        if (handles[i] != 0 && (lowest == 0 || handles[i] < lowest)) {
+            lowest = handles[i];
+        }
+    }
+    if (lowest != 0) {
+        rebase(lowest);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (handles[i] == 0 || handles[i] < base || handles[i] - base >= GATTS_DISPATCH_ATTRS) {
+            register_errors++;
+            continue;
+        }
+        gatts_attr_t* attr = &attrs[handles[i] - base];
+        attr->service = service;
+        attr->index = i;
+        attr->on_write = handlers ? handlers[i] : NULL;
+        if (handles[i] >= end) {
+            end = handles[i] + 1;
+        }
+    }
+}
+
+static const gatts_attr_t* gatts_dispatch_lookup(uint16_t handle) {
+    if (handle < base || handle - base >= GATTS_DISPATCH_ATTRS || attrs[handle - base].service == GATTS_SVC_NONE) {
+        return NULL;
+    }
+    return &attrs[handle - base];
+}
+
+// Mirrors pgp_gatts_debug.c
+static const char* battery_char_names[] = { "BATTERY_SVC", "CHAR_BATTERY_LEVEL", "CHAR_BATTERY_LEVEL_VAL" };
+static const char* cert_char_names[] = { "CERT_SVC", "CHAR_CENTRAL_TO_SFIDA", "CHAR_CENTRAL_TO_SFIDA_VAL" };
+static const char* UNKNOWN_HANDLE_NAME = "<UNKNOWN HANDLE NAME>";
+
+#define CHAR_NAMES(names) { names, sizeof(names) / sizeof(names[0]) }
+
+static const struct {
+    const char** names;
+    int count;
+} service_char_names[GATTS_SVC_COUNT] = {
+    [GATTS_SVC_BATTERY] = CHAR_NAMES(battery_char_names),
+    [GATTS_SVC_CERT] = CHAR_NAMES(cert_char_names),
+};
+
+static const char* char_name_from_handle(uint16_t handle) {
+    const gatts_attr_t* attr = gatts_dispatch_lookup(handle);
+    if (!attr || attr->index >= service_char_names[attr->service].count) {
+        return UNKNOWN_HANDLE_NAME;
+    }
+    return service_char_names[attr->service].names[attr->index];
+}
+
+// Mirrors the ESP_GATTS_WRITE_EVT path of pgp_gatts.c: returns whether the write is answered
+static int unhandled_writes = 0;
+static int unknown_writes = 0;
+static int outside_writes = 0;
+
+static bool dispatch_write(const write_param_t* param) {
+    const gatts_attr_t* attr = gatts_dispatch_lookup(param->handle);
+    if (attr && attr->on_write) {
+        if (!attr->on_write(param)) {
+            return false;
+        }
+    } else if (attr) {
+        unhandled_writes++;
+    } else if (param->handle < base || param->handle - base >= GATTS_DISPATCH_ATTRS) {
+        outside_writes++;
+    } else {
+        unknown_writes++;
+    }
+    return true;
+}
+
+static int cert_writes = 0;
+static int led_writes = 0;
+static uint16_t last_conn_id = 0xffff;
+
+static bool on_cert_write(const write_param_t* param) {
+    cert_writes++;
+    last_conn_id = param->conn_id;
+    return true;
+}
+
+static bool on_led_write(const write_param_t* param) {
+    led_writes++;
+    last_conn_id = param->conn_id;
+    return false;
+}
+
+static void reset_dispatch() {
+    memset(attrs, 0, sizeof(attrs));
+    base = end = 0;
+    register_errors = unhandled_writes = unknown_writes = outside_writes = 0;
+    cert_writes = led_writes = 0;
+    last_conn_id = 0xffff;
+}
+
+void test_register_lookup() {
+    printf("\n=== Test: Register And Lookup ===\n");
+    reset_dispatch();
+
+    const uint16_t battery_handles[] = { 40, 41, 42 };
+    const uint16_t cert_handles[] = { 50, 51, 52 };
+    const gatts_write_handler_t cert_handlers[] = { NULL, NULL, on_cert_write };
+    gatts_dispatch_register(GATTS_SVC_BATTERY, battery_handles, 3, NULL);
+    gatts_dispatch_register(GATTS_SVC_CERT, cert_handles, 3, cert_handlers);
+
+    const gatts_attr_t* attr = gatts_dispatch_lookup(42);
+    assert(attr && attr->service == GATTS_SVC_BATTERY && attr->index == 2 && attr->on_write == NULL);
+    attr = gatts_dispatch_lookup(52);
+    assert(attr && attr->service == GATTS_SVC_CERT && attr->index == 2 && attr->on_write == on_cert_write);
+    assert(gatts_dispatch_lookup(50)->on_write == NULL);
+    printf("✓ Every registered handle maps to its service, index and handler\n");
+
+    assert(base == 40);
+    assert(gatts_dispatch_lookup(0) == NULL && gatts_dispatch_lookup(39) == NULL && gatts_dispatch_lookup(43) == NULL);
+    assert(gatts_dispatch_lookup(40 + GATTS_DISPATCH_ATTRS) == NULL && gatts_dispatch_lookup(0xffff) == NULL);
+    printf("✓ Unregistered and out of range handles find nothing\n");
+
+    assert(strcmp(char_name_from_handle(41), "CHAR_BATTERY_LEVEL") == 0);
+    assert(strcmp(char_name_from_handle(52), "CHAR_CENTRAL_TO_SFIDA_VAL") == 0);
+    assert(char_name_from_handle(43) == UNKNOWN_HANDLE_NAME && char_name_from_handle(0xffff) == UNKNOWN_HANDLE_NAME);
+    printf("✓ Names come from the same lookup\n");
+}
+
+void test_invalid_handles() {
+    printf("\n=== Test: Invalid Handles ===\n");
+    reset_dispatch();
+
+    const uint16_t handles[] = { 0, 60 + GATTS_DISPATCH_ATTRS, 60 };
+    const gatts_write_handler_t handlers[] = { on_cert_write, on_cert_write, on_led_write };
+    gatts_dispatch_register(GATTS_SVC_LED_BUTTON, handles, 3, handlers);
+    assert(register_errors == 2);
+    assert(gatts_dispatch_lookup(0) == NULL);
+    assert(gatts_dispatch_lookup(60)->index == 2 && gatts_dispatch_lookup(60)->on_write == on_led_write);
+    printf("✓ Handles 0 and past the table are skipped, the rest still registered\n");
+
+    // a service far below the registered ones can't be moved in without dropping them
+    const uint16_t low_handles[] = { 10, 11 };
+    gatts_dispatch_register(GATTS_SVC_BATTERY, low_handles, 2, NULL);
+    assert(register_errors == 4 && base == 60);
+    assert(gatts_dispatch_lookup(10) == NULL && gatts_dispatch_lookup(60)->service == GATTS_SVC_LED_BUTTON);
+    printf("✓ Handles that don't fit below the table are skipped\n");
+
+    // an index past the name table gets no name instead of reading past it
+    assert(char_name_from_handle(60) == UNKNOWN_HANDLE_NAME);
+    printf("✓ A service without names reports the unknown name\n");
+}
+
+void test_rebase() {
+    printf("\n=== Test: Lower Handles Registered Later ===\n");
+    reset_dispatch();
+
+    const uint16_t cert_handles[] = { 50, 51, 52 };
+    const gatts_write_handler_t cert_handlers[] = { NULL, NULL, on_cert_write };
+    const uint16_t battery_handles[] = { 40, 41, 42 };
+    gatts_dispatch_register(GATTS_SVC_CERT, cert_handles, 3, cert_handlers);
+    assert(base == 50);
+    gatts_dispatch_register(GATTS_SVC_BATTERY, battery_handles, 3, NULL);
+    assert(base == 40 && register_errors == 0);
+    printf("✓ The table moves down to the lowest handle\n");
+
+    const gatts_attr_t* attr = gatts_dispatch_lookup(52);
+    assert(attr && attr->service == GATTS_SVC_CERT && attr->index == 2 && attr->on_write == on_cert_write);
+    attr = gatts_dispatch_lookup(40);
+    assert(attr && attr->service == GATTS_SVC_BATTERY && attr->index == 0);
+    assert(gatts_dispatch_lookup(45) == NULL);
+    printf("✓ Handles registered before keep their attributes\n");
+}
+
+void test_dispatch_write() {
+    printf("\n=== Test: Dispatch Writes ===\n");
+    reset_dispatch();
+
+    const uint16_t cert_handles[] = { 50, 51, 52 };
+    const gatts_write_handler_t cert_handlers[] = { NULL, NULL, on_cert_write };
+    const uint16_t led_handles[] = { 60, 61 };
+    const gatts_write_handler_t led_handlers[] = { NULL, on_led_write };
+    gatts_dispatch_register(GATTS_SVC_CERT, cert_handles, 3, cert_handlers);
+    gatts_dispatch_register(GATTS_SVC_LED_BUTTON, led_handles, 2, led_handlers);
+
+    write_param_t param = { .conn_id = 2, .handle = 52 };
+    assert(dispatch_write(&param) && cert_writes == 1 && last_conn_id == 2);
+    printf("✓ A handled write reaches its handler and is answered\n");
+
+    param.handle = 61;
+    param.conn_id = 3;
+    assert(!dispatch_write(&param) && led_writes == 1 && last_conn_id == 3);
+    printf("✓ A handler can suppress the response\n");
+
+    param.handle = 51;
+    assert(dispatch_write(&param) && unhandled_writes == 1 && cert_writes == 1);
+    param.handle = 55;
+    assert(dispatch_write(&param) && unknown_writes == 1 && outside_writes == 0);
+    param.handle = 99;
+    assert(dispatch_write(&param) && outside_writes == 1);
+    param.handle = 49;
+    assert(dispatch_write(&param) && outside_writes == 2);
+    printf("✓ Writes without a handler, to unknown handles or outside the table are counted and answered\n");
+}
+
+int main() {
+    printf("========================================\n");
+    printf("GATT Write Dispatch Unit Tests\n");
+    printf("========================================\n");
+
+    test_register_lookup();
+    test_invalid_handles();
+    test_rebase();
+    test_dispatch_write();
+
+    printf("\n========================================\n");
+    printf("✓ All GATT write dispatch tests passed!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+#endif
@@ -3,16 +3,19 @@
 #ifndef ESP_PLATFORM
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Mock ESP/FreeRTOS types and functions
 #define ESP_OK 0
 #define ESP_FAIL -1
-#define CONFIG_BT_ACL_CONNECTIONS 4
+#define CONFIG_BT_ACL_CONNECTIONS 9
 #define portMAX_DELAY 0xFFFFFFFF
 #define portTICK_PERIOD_MS 1
 
@@ -74,41 +77,202 @@ uint8_t get_setting_uint8(uint8_t* var) {
 }
 
 // Connection management structures and implementation
-static const size_t CERT_BUFFER_LEN = 378;
+#define HANDSHAKE_BUFFER_POOL_SIZE 2
+#define CHAL_0_DYNAMIC_LEN 116  // offsetof(struct challenge_data, bt_addr)
 
 typedef struct {
-    uint16_t conn_id;
-    esp_bd_addr_t remote_bda;
-    DeviceSettings* settings;
-    int cert_state;
-    bool has_reconnect_key;
-    bool notify;
+    bool chal_0_tail_ready;
     uint8_t cert_buffer[378];
     uint8_t state_0_nonce[16];
     uint8_t the_challenge[16];
     uint8_t main_nonce[16];
     uint8_t outer_nonce[16];
+} handshake_buffer_t;
+
+typedef struct {
+    uint16_t conn_id;
+    int cert_state;
+    bool has_reconnect_key;
+    bool notify;
+    DeviceSettings* settings;
+    handshake_buffer_t* handshake;
+    esp_bd_addr_t remote_bda;
     uint8_t session_key[16];
     uint8_t reconnect_challenge[32];
     TickType_t handshake_start, reconnection_at, connection_start, connection_end;
     bool auth_succeeded;
     bool counted_as_active;
+    uint8_t trace_len;
+    int64_t state_entered_us;
+    int64_t reaped_at_us;
 } client_state_t;
 
-static int active_connections = 0;
+// Mirrors pgp_handshake_multi.c's lock-free counter, target_active_connections and the count
+// advertise_for_connections() was last called with stand in for the settings/GAP modules
+static atomic_int active_connections = 0;
+static int target_active_connections = CONFIG_BT_ACL_CONNECTIONS;
+static int last_advertise_decision = -1;
+
+static void advertise_for_connections(int active) {
+    last_advertise_decision = active;
+}
+
+static bool connection_reserve(int target, int* active_out) {
+    int current = atomic_load(&active_connections);
+    do {
+        if (current >= target) {
+            *active_out = current;
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&active_connections, &current, current + 1));
+
+    *active_out = current + 1;
+    return true;
+}
+
+static void connection_release() {
+    int current = atomic_load(&active_connections);
+    do {
+        if (current <= 0) {
+            return;
+        }
+    } while (!atomic_compare_exchange_weak(&active_connections, &current, current - 1));
+}
 #define MAX_CONNECTIONS CONFIG_BT_ACL_CONNECTIONS
 static uint16_t conn_id_map[MAX_CONNECTIONS] = { 0 };
 static client_state_t client_states[MAX_CONNECTIONS] = { 0 };
 
+// Mirrors pgp_handshake_multi.c's conn_id/BDA lookup indexes (index_lock is a no-op here)
+#define CONN_INDEX_SIZE 32
+#define BDA_INDEX_SIZE 32
+static int8_t conn_index[CONN_INDEX_SIZE];
+static int8_t bda_index[BDA_INDEX_SIZE];
+static bool bda_known[MAX_CONNECTIONS];
+
+static unsigned bda_hash(const uint8_t* bda) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(esp_bd_addr_t); i++) {
+        h = (h ^ bda[i]) * 16777619u;
+    }
+    return h % BDA_INDEX_SIZE;
+}
+
+static void rebuild_indexes_locked() {
+    memset(conn_index, -1, sizeof(conn_index));
+    memset(bda_index, -1, sizeof(bda_index));
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conn_id_map[i] == 0xffff) {
+            continue;
+        }
+
+        int8_t* bucket = &conn_index[conn_id_map[i] % CONN_INDEX_SIZE];
+        if (*bucket < 0) {
+            *bucket = i;
+        }
+
+        if (bda_known[i]) {
+            unsigned h = bda_hash(client_states[i].remote_bda);
+            while (bda_index[h] >= 0) {
+                h = (h + 1) % BDA_INDEX_SIZE;
+            }
+            bda_index[h] = i;
+        }
+    }
+}
+
+static int find_slot_locked(uint16_t conn_id) {
+    int slot = conn_index[conn_id % CONN_INDEX_SIZE];
+    if (slot >= 0 && conn_id_map[slot] == conn_id) {
+        return slot;
+    }
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conn_id_map[i] == conn_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Mirrors pgp_handshake_multi.c's shared handshake buffer pool
+static handshake_buffer_t handshake_buffers[HANDSHAKE_BUFFER_POOL_SIZE];
+static bool handshake_buffer_used[HANDSHAKE_BUFFER_POOL_SIZE];
+static uint32_t handshake_buffer_exhausted = 0;
+
+static void handshake_buffer_wipe(handshake_buffer_t* buffer) {
+    if (!buffer->chal_0_tail_ready) {
+        memset(buffer, 0, sizeof(handshake_buffer_t));
+        return;
+    }
+    memset(buffer->cert_buffer, 0, CHAL_0_DYNAMIC_LEN);
+    memset(buffer->state_0_nonce, 0, sizeof(handshake_buffer_t) - offsetof(handshake_buffer_t, state_0_nonce));
+}
+
+bool handshake_buffer_checkout(client_state_t* client_state) {
+    if (client_state->handshake) {
+        return true;
+    }
+
+    handshake_buffer_t* buffer = NULL;
+    for (int i = 0; i < HANDSHAKE_BUFFER_POOL_SIZE; i++) {
+        if (!handshake_buffer_used[i]) {
+            handshake_buffer_used[i] = true;
+            buffer = &handshake_buffers[i];
+            break;
+        }
+    }
+    if (!buffer) {
+        handshake_buffer_exhausted++;
+        buffer = malloc(sizeof(handshake_buffer_t));
+        if (!buffer) {
+            return false;
+        }
+        buffer->chal_0_tail_ready = false;
+    }
+
+    handshake_buffer_wipe(buffer);
+    client_state->handshake = buffer;
+    return true;
+}
+
+void handshake_buffer_release(client_state_t* client_state) {
+    handshake_buffer_t* buffer = client_state->handshake;
+    if (!buffer) {
+        return;
+    }
+    client_state->handshake = NULL;
+
+    int i = buffer - handshake_buffers;
+    if (i >= 0 && i < HANDSHAKE_BUFFER_POOL_SIZE) {
+        handshake_buffer_wipe(buffer);
+        handshake_buffer_used[i] = false;
+    } else {
+        memset(buffer, 0, sizeof(handshake_buffer_t));
+        free(buffer);
+    }
+}
+
+static int handshake_buffers_in_use() {
+    int used = 0;
+    for (int i = 0; i < HANDSHAKE_BUFFER_POOL_SIZE; i++) {
+        used += handshake_buffer_used[i];
+    }
+    return used;
+}
+
 void init_handshake_multi() {
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         conn_id_map[i] = 0xffff;
     }
-    active_connections = 0;
+    memset(bda_known, 0, sizeof(bda_known));
+    rebuild_indexes_locked();
+    atomic_store(&active_connections, 0);
+    target_active_connections = MAX_CONNECTIONS;
+    last_advertise_decision = -1;
 }
 
 int get_active_connections() {
-    return active_connections;
+    return atomic_load(&active_connections);
 }
 
 int get_max_connections() {
@@ -116,12 +280,8 @@ int get_max_connections() {
 }
 
 client_state_t* get_client_state_entry(uint16_t conn_id) {
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (conn_id_map[i] == conn_id) {
-            return &client_states[i];
-        }
-    }
-    return NULL;
+    int slot = find_slot_locked(conn_id);
+    return slot >= 0 ? &client_states[slot] : NULL;
 }
 
 client_state_t* get_client_state_entry_by_idx(int i) {
@@ -132,10 +292,13 @@ client_state_t* get_client_state_entry_by_idx(int i) {
 }
 
 client_state_t* get_client_state_entry_by_bda(esp_bd_addr_t bda) {
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    unsigned h = bda_hash(bda);
+    for (int probe = 0; probe < BDA_INDEX_SIZE && bda_index[h] >= 0; probe++) {
+        int i = bda_index[h];
         if (conn_id_map[i] != 0xffff && memcmp(client_states[i].remote_bda, bda, sizeof(esp_bd_addr_t)) == 0) {
             return &client_states[i];
         }
+        h = (h + 1) % BDA_INDEX_SIZE;
     }
     return NULL;
 }
@@ -150,19 +313,20 @@ bool should_remove_bond_on_auth_fail(client_state_t* entry) {
 
 client_state_t* get_or_create_client_state_entry(uint16_t conn_id) {
     // Check if exists
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (conn_id_map[i] == conn_id) {
-            return &client_states[i];
-        }
+    client_state_t* entry = get_client_state_entry(conn_id);
+    if (entry) {
+        return entry;
     }
 
     // Look for empty slot
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         if (conn_id_map[i] == 0xffff) {
-            conn_id_map[i] = conn_id;
             memset(&client_states[i], 0, sizeof(client_state_t));
             client_states[i].conn_id = conn_id;
             client_states[i].handshake_start = xTaskGetTickCount();
+            conn_id_map[i] = conn_id;
+            bda_known[i] = false;
+            rebuild_indexes_locked();
             return &client_states[i];
         }
     }
@@ -170,24 +334,47 @@ client_state_t* get_or_create_client_state_entry(uint16_t conn_id) {
     return NULL;
 }
 
+void set_remote_bda(uint16_t conn_id, esp_bd_addr_t remote_bda) {
+    client_state_t* entry = get_or_create_client_state_entry(conn_id);
+    if (!entry) {
+        return;
+    }
+    memcpy(entry->remote_bda, remote_bda, sizeof(esp_bd_addr_t));
+    bda_known[entry - client_states] = true;
+    rebuild_indexes_locked();
+}
+
 static void delete_client_state_entry(client_state_t* entry) {
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         if (conn_id_map[i] == entry->conn_id) {
             conn_id_map[i] = 0xffff;
+            bda_known[i] = false;
         }
     }
+    rebuild_indexes_locked();
+    handshake_buffer_release(entry);
     memset(entry, 0, sizeof(client_state_t));
 }
 
-void connection_start(uint16_t conn_id) {
+bool connection_start(uint16_t conn_id) {
     client_state_t* entry = get_client_state_entry(conn_id);
     if (!entry) {
-        return;
+        return false;
     }
 
-    active_connections++;
-    entry->counted_as_active = true;
+    int active = 0;
+    if (!entry->counted_as_active) {
+        if (!connection_reserve(target_active_connections, &active)) {
+            advertise_for_connections(active);
+            return false;
+        }
+        entry->counted_as_active = true;
+    } else {
+        active = get_active_connections();
+    }
     entry->connection_start = xTaskGetTickCount();
+    advertise_for_connections(active);
+    return true;
 }
 
 // connection_stop() only decrements active_connections when the entry was actually
@@ -200,9 +387,7 @@ void connection_stop(uint16_t conn_id) {
     }
 
     if (entry->counted_as_active) {
-        active_connections--;
-        if (active_connections < 0)
-            active_connections = 0;
+        connection_release();
         entry->counted_as_active = false;
     }
 
@@ -220,8 +405,8 @@ void test_init_handshake_multi() {
     assert(get_active_connections() == 0);
     printf("✓ Active connections initialized to 0\n");
 
-    assert(get_max_connections() == 4);
-    printf("✓ Max connections is 4\n");
+    assert(get_max_connections() == MAX_CONNECTIONS);
+    printf("✓ Max connections is %d\n", MAX_CONNECTIONS);
 
     // All slots should be empty
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
@@ -343,11 +528,11 @@ void test_max_connections_limit() {
 
     init_handshake_multi();
 
-    // Try to create 5 connections (max is 4)
-    for (int i = 0; i < 5; i++) {
+    // Try to create one connection more than there are slots
+    for (int i = 0; i < MAX_CONNECTIONS + 1; i++) {
         client_state_t* entry = get_or_create_client_state_entry(0x0001 + i);
 
-        if (i < 4) {
+        if (i < MAX_CONNECTIONS) {
             assert(entry != NULL);
             printf("✓ Connection %d created successfully\n", i + 1);
         } else {
@@ -447,6 +632,57 @@ void test_lookup_consistency() {
     printf("✓ Lookup by conn_id and by index are consistent\n");
 }
 
+// Test the conn_id/BDA indexes stay in sync with conn_id_map through create/delete
+void test_indexed_lookup() {
+    printf("\n=== Test: Indexed Lookup ===\n");
+
+    init_handshake_multi();
+
+    // 0x0001 and 0x0021 share a conn_index bucket
+    uint16_t conn_ids[] = { 0x0001, 0x0021, 0x0002, 0x0100 };
+    esp_bd_addr_t bdas[4] = {
+        { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60 },
+        { 0x10, 0x20, 0x30, 0x40, 0x50, 0x61 },
+        { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff },
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    };
+
+    for (int i = 0; i < 4; i++) {
+        set_remote_bda(conn_ids[i], bdas[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        client_state_t* entry = get_client_state_entry(conn_ids[i]);
+        assert(entry != NULL && entry->conn_id == conn_ids[i]);
+        assert(get_client_state_entry_by_bda(bdas[i]) == entry);
+    }
+    printf("✓ Every conn_id and BDA resolves to its own slot, including bucket collisions\n");
+
+    assert(get_client_state_entry(0x0041) == NULL);
+    esp_bd_addr_t unknown = { 0x10, 0x20, 0x30, 0x40, 0x50, 0x62 };
+    assert(get_client_state_entry_by_bda(unknown) == NULL);
+    printf("✓ Unknown conn_id/BDA in a used bucket returns NULL\n");
+
+    // freeing the indexed entry of a shared bucket must not hide the other one
+    connection_stop(0x0001);
+    assert(get_client_state_entry(0x0001) == NULL);
+    assert(get_client_state_entry_by_bda(bdas[0]) == NULL);
+    assert(get_client_state_entry(0x0021) != NULL);
+    assert(get_client_state_entry_by_bda(bdas[1]) == get_client_state_entry(0x0021));
+    printf("✓ Deleting a slot unindexes it and keeps the colliding one reachable\n");
+
+    // a new BDA on the same connection replaces the old one
+    set_remote_bda(0x0002, unknown);
+    assert(get_client_state_entry_by_bda(bdas[2]) == NULL);
+    assert(get_client_state_entry_by_bda(unknown) == get_client_state_entry(0x0002));
+    printf("✓ Updating the BDA moves its index entry\n");
+
+    // the freed slot is reused and indexed again
+    set_remote_bda(0x0003, bdas[0]);
+    assert(get_client_state_entry(0x0003) != NULL);
+    assert(get_client_state_entry_by_bda(bdas[0]) == get_client_state_entry(0x0003));
+    printf("✓ Reused slot is reachable by its new conn_id and BDA\n");
+}
+
 // Test auth-failure bond removal decision (regression test for the BLE scan-timeout bug:
 // removing the bond on every failed auth stole the advertising slot from an already-live
 // connection experiencing a transient hiccup).
@@ -457,8 +693,9 @@ void test_auth_fail_bond_removal_decision() {
     uint16_t conn_id = 0x0001;
     esp_bd_addr_t bda = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
 
-    client_state_t* entry = get_or_create_client_state_entry(conn_id);
-    memcpy(entry->remote_bda, bda, sizeof(esp_bd_addr_t));
+    // same path as ESP_GATTS_CONNECT_EVT, which indexes the BDA
+    set_remote_bda(conn_id, bda);
+    client_state_t* entry = get_client_state_entry(conn_id);
 
     // Fresh connection, never authenticated: a failure here is a genuine stale-bond
     // re-pair, so the bond must be removed.
@@ -510,7 +747,285 @@ void test_stop_incomplete_handshake_does_not_undercount() {
     printf("✓ Stopping a completed handshake still decrements active_connections\n");
 }
 
+// More phones pairing at once than the pool holds: the extra one gets a heap buffer, and every
+// buffer goes back to the pool when the handshake finishes or the phone disconnects mid-handshake.
+void test_handshake_buffer_pool() {
+    printf("\n=== Test: Shared Handshake Buffer Pool ===\n");
+
+    init_handshake_multi();
+    handshake_buffer_exhausted = 0;
+
+    client_state_t* entries[HANDSHAKE_BUFFER_POOL_SIZE + 1];
+    for (int i = 0; i < HANDSHAKE_BUFFER_POOL_SIZE + 1; i++) {
+        entries[i] = get_or_create_client_state_entry(0x0010 + i);
+        assert(entries[i] != NULL);
+        assert(entries[i]->handshake == NULL);
+        assert(handshake_buffer_checkout(entries[i]));
+        assert(entries[i]->handshake != NULL);
+    }
+    assert(handshake_buffers_in_use() == HANDSHAKE_BUFFER_POOL_SIZE);
+    assert(handshake_buffer_exhausted == 1);
+    printf("✓ Pool hands out %d buffers, the next checkout falls back to the heap\n", HANDSHAKE_BUFFER_POOL_SIZE);
+
+    assert(entries[0]->handshake != entries[1]->handshake);
+    handshake_buffer_t* first = entries[0]->handshake;
+    assert(handshake_buffer_checkout(entries[0]));
+    assert(entries[0]->handshake == first);
+    printf("✓ Checking out twice keeps the same buffer\n");
+
+    // handshake finished (ESTABLISHED)
+    entries[0]->handshake->cert_buffer[0] = 0xaa;
+    entries[0]->handshake->cert_buffer[CHAL_0_DYNAMIC_LEN - 1] = 0xab;
+    entries[0]->handshake->cert_buffer[CHAL_0_DYNAMIC_LEN] = 0x5a;  // stamped bt_addr/blob tail
+    entries[0]->handshake->the_challenge[0] = 0xac;
+    entries[0]->handshake->chal_0_tail_ready = true;
+    handshake_buffer_release(entries[0]);
+    assert(entries[0]->handshake == NULL);
+    assert(handshake_buffers_in_use() == HANDSHAKE_BUFFER_POOL_SIZE - 1);
+    assert(first->cert_buffer[0] == 0 && first->cert_buffer[CHAL_0_DYNAMIC_LEN - 1] == 0);
+    assert(first->the_challenge[0] == 0);
+    printf("✓ Released buffer is wiped and back in the pool\n");
+
+    assert(first->chal_0_tail_ready && first->cert_buffer[CHAL_0_DYNAMIC_LEN] == 0x5a);
+    printf("✓ A pooled buffer keeps its stamped challenge 0 tail for the next handshake\n");
+
+    // phones disconnecting mid-handshake return their buffers, the heap one is freed
+    delete_client_state_entry(entries[1]);
+    delete_client_state_entry(entries[2]);
+    assert(handshake_buffers_in_use() == 0);
+    printf("✓ Disconnect returns pooled and heap buffers\n");
+
+    client_state_t* again = get_or_create_client_state_entry(0x0020);
+    assert(handshake_buffer_checkout(again));
+    assert(handshake_buffer_exhausted == 1);
+    delete_client_state_entry(again);
+    delete_client_state_entry(entries[0]);
+    printf("✓ Pool is reusable after release\n");
+}
+
+// Admission: once target_active_connections phones are counted the next one is refused without
+// being counted, and the advertising decision is made on the count the reservation saw.
+void test_connection_admission() {
+    printf("\n=== Test: Connection Admission at Target ===\n");
+
+    init_handshake_multi();
+    target_active_connections = 2;
+
+    for (uint16_t conn_id = 1; conn_id <= 3; conn_id++) {
+        get_or_create_client_state_entry(conn_id);
+    }
+
+    assert(connection_start(1));
+    assert(last_advertise_decision == 1);
+    assert(connection_start(2));
+    assert(last_advertise_decision == 2);
+    printf("✓ Phones up to the target are counted, advertising decided on 1 then 2\n");
+
+    assert(!connection_start(3));
+    assert(get_active_connections() == 2);
+    assert(!get_client_state_entry(3)->counted_as_active);
+    assert(last_advertise_decision == 2);
+    printf("✓ Third phone refused and not counted\n");
+
+    // a refused phone disconnects without touching the count
+    connection_stop(3);
+    assert(get_active_connections() == 2);
+
+    // starting an already counted connection again doesn't count it twice
+    assert(connection_start(2));
+    assert(get_active_connections() == 2);
+    printf("✓ Refused disconnect and repeated start keep the count\n");
+
+    connection_stop(1);
+    assert(get_active_connections() == 1);
+    get_or_create_client_state_entry(4);
+    assert(connection_start(4));
+    assert(get_active_connections() == 2);
+    printf("✓ A freed place can be taken again\n");
+
+    connection_stop(2);
+    connection_stop(4);
+    assert(get_active_connections() == 0);
+}
+
+#define RESERVE_THREADS 8
+#define RESERVE_ROUNDS 100000
+#define RESERVE_TARGET 2
+
+static atomic_int reserve_max_seen = 0;
+
+static void* reserve_worker(void* arg) {
+    (void)arg;
+    for (int i = 0; i < RESERVE_ROUNDS; i++) {
+        int active = 0;
+        if (connection_reserve(RESERVE_TARGET, &active)) {
+            int seen = atomic_load(&reserve_max_seen);
+            while (active > seen && !atomic_compare_exchange_weak(&reserve_max_seen, &seen, active)) {
+            }
+            connection_release();
+        }
+    }
+    return NULL;
+}
+
+// Many tasks connecting/disconnecting at once never push the count past the target or below 0
+void test_concurrent_reservations() {
+    printf("\n=== Test: Concurrent Reservations ===\n");
+
+    init_handshake_multi();
+
+    pthread_t threads[RESERVE_THREADS];
+    for (int i = 0; i < RESERVE_THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, reserve_worker, NULL) == 0);
+    }
+    for (int i = 0; i < RESERVE_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    assert(atomic_load(&reserve_max_seen) <= RESERVE_TARGET);
+    assert(get_active_connections() == 0);
+    printf("✓ %d threads x %d reserve/release: max %d active (target %d), back to 0\n",
+        RESERVE_THREADS,
+        RESERVE_ROUNDS,
+        atomic_load(&reserve_max_seen),
+        RESERVE_TARGET);
+}
+
 // Run all tests
+// Mirrors the handshake reaper in pgp_handshake_multi.c, states and timeouts as in cert_transitions
+enum { REAP_CHAL_0, REAP_NEXT_CHAL, REAP_APP_RESPONSE, REAP_ESTABLISHED = 6, REAP_STATE_COUNT };
+static const uint32_t reap_timeouts_ms[REAP_STATE_COUNT] = { 15000, 5000, 5000, 5000, 5000, 5000, 0 };
+#define HANDSHAKE_REAP_FACTOR 2
+#define HANDSHAKE_REAP_GRACE_MS 3000
+
+static uint32_t reaped_by_state[REAP_STATE_COUNT];
+static int reap_disconnects = 0;
+static uint16_t reap_requested[MAX_CONNECTIONS];
+static int reap_collect_wakes = 0;
+
+// timer side: only marks slots, freeing them is left to handshake_reaper_collect() on the reaper task
+static void handshake_reaper(int64_t now) {
+    bool collect = false;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        uint16_t conn_id = conn_id_map[i];
+        client_state_t* entry = &client_states[i];
+        int state = entry->cert_state;
+        if (conn_id == 0xffff || entry->trace_len == 0 || state == REAP_ESTABLISHED) {
+            continue;
+        }
+
+        if (entry->reaped_at_us != 0) {
+            if ((now - entry->reaped_at_us) / 1000 > HANDSHAKE_REAP_GRACE_MS) {
+                reap_requested[i] = conn_id;
+                collect = true;
+            }
+            continue;
+        }
+
+        uint32_t timeout_ms = reap_timeouts_ms[state];
+        int64_t waited_ms = (now - entry->state_entered_us) / 1000;
+        if (timeout_ms == 0 || waited_ms <= (int64_t)timeout_ms * HANDSHAKE_REAP_FACTOR) {
+            continue;
+        }
+
+        reaped_by_state[state]++;
+        entry->reaped_at_us = now;
+        reap_disconnects++;
+    }
+    if (collect) {
+        reap_collect_wakes++;
+    }
+}
+
+// reaper task side, woken by the timer's notification
+static void handshake_reaper_collect() {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        uint16_t conn_id = reap_requested[i];
+        reap_requested[i] = 0xffff;
+        if (conn_id != 0xffff && conn_id_map[i] == conn_id && client_states[i].reaped_at_us != 0) {
+            connection_stop(conn_id);
+        }
+    }
+}
+
+void test_handshake_reaper() {
+    printf("\n=== Test: Handshake Reaper ===\n");
+
+    init_handshake_multi();
+    target_active_connections = CONFIG_BT_ACL_CONNECTIONS;
+    memset(reaped_by_state, 0, sizeof(reaped_by_state));
+    memset(reap_requested, 0xff, sizeof(reap_requested));
+    reap_disconnects = 0;
+    reap_collect_wakes = 0;
+
+    const int64_t t0 = 1000000;
+    client_state_t* stuck = get_or_create_client_state_entry(1);
+    stuck->trace_len = 2;
+    stuck->cert_state = REAP_NEXT_CHAL;
+    stuck->state_entered_us = t0;
+
+    client_state_t* slow = get_or_create_client_state_entry(2);
+    slow->trace_len = 1;
+    slow->cert_state = REAP_CHAL_0;
+    slow->state_entered_us = t0;
+
+    client_state_t* done = get_or_create_client_state_entry(3);
+    done->trace_len = 4;
+    done->cert_state = REAP_ESTABLISHED;
+    done->state_entered_us = t0;
+    assert(connection_start(3));
+
+    // e.g. the companion app, connected without a handshake
+    client_state_t* idle = get_or_create_client_state_entry(4);
+    idle->state_entered_us = 0;
+
+    handshake_reaper(t0 + 10000 * 1000);
+    assert(reap_disconnects == 0);
+    printf("✓ Nothing reaped within twice the state timeout\n");
+
+    handshake_reaper(t0 + 10001 * 1000);
+    assert(reap_disconnects == 1);
+    assert(reaped_by_state[REAP_NEXT_CHAL] == 1);
+    assert(stuck->reaped_at_us == t0 + 10001 * 1000);
+    printf("✓ Stalled next_chal reaped, chal_0 still has time\n");
+
+    // already reaped handshakes aren't disconnected again while waiting for DISCONNECT_EVT
+    handshake_reaper(t0 + 12000 * 1000);
+    assert(reap_disconnects == 1);
+    assert(get_client_state_entry(1) == stuck);
+    printf("✓ Reaped handshake waits for its disconnect\n");
+
+    handshake_reaper(t0 + 13002 * 1000);
+    assert(get_client_state_entry(1) == stuck && reap_collect_wakes == 1);
+    printf("✓ The timer only requests freeing the slot\n");
+
+    handshake_reaper_collect();
+    assert(get_client_state_entry(1) == NULL);
+    assert(get_client_state_entry(3) == done);
+    assert(get_client_state_entry(4) == idle);
+    assert(get_active_connections() == 1);
+    printf("✓ Slot freed after the grace period, established and idle slots kept\n");
+
+    handshake_reaper(t0 + 30001 * 1000);
+    assert(reap_disconnects == 2);
+    assert(reaped_by_state[REAP_CHAL_0] == 1);
+    assert(reaped_by_state[REAP_ESTABLISHED] == 0);
+    printf("✓ Reaps counted per state\n");
+
+    // the app restarts the handshake between the request and the reaper task getting to it
+    handshake_reaper(t0 + 33002 * 1000);
+    assert(reap_collect_wakes == 2);
+    slow->reaped_at_us = 0;
+    handshake_reaper_collect();
+    assert(get_client_state_entry(2) == slow);
+    printf("✓ A handshake restarted since the request keeps its slot\n");
+
+    connection_stop(2);
+    connection_stop(3);
+    connection_stop(4);
+    assert(get_active_connections() == 0);
+}
+
 int main() {
     printf("========================================\n");
     printf("Handshake Multi Connection Tests\n");
@@ -524,8 +1039,13 @@ int main() {
     test_connection_state_transitions();
     test_device_settings_linkage();
     test_lookup_consistency();
+    test_indexed_lookup();
     test_auth_fail_bond_removal_decision();
     test_stop_incomplete_handshake_does_not_undercount();
+    test_handshake_buffer_pool();
+    test_connection_admission();
+    test_concurrent_reservations();
+    test_handshake_reaper();
 
     printf("\n========================================\n");
     printf("✓ All handshake_multi tests passed!\n");
@@ -0,0 +1,140 @@
+// Unit tests for the log-linear latency histogram (PC build)
+// Tests bucket boundaries and width, percentiles against exact ones, merge and reset
+#ifndef ESP_PLATFORM
+
+#include "../histogram.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static histogram_t h, other;
+
+void test_buckets() {
+    printf("\n=== Test: Bucket Boundaries ===\n");
+
+    assert(HISTOGRAM_BUCKETS == 240);
+    for (uint32_t v = 0; v < HISTOGRAM_SUB_BUCKETS; v++) {
+        assert(histogram_bucket(v) == (int)v);
+    }
+    assert(histogram_bucket(8) == 8 && histogram_bucket(15) == 15);
+    assert(histogram_bucket(16) == 16 && histogram_bucket(17) == 16 && histogram_bucket(18) == 17);
+    assert(histogram_bucket(UINT32_MAX) == HISTOGRAM_BUCKETS - 1);
+    assert(histogram_bucket_upper(HISTOGRAM_BUCKETS - 1) == UINT32_MAX);
+    printf("✓ Small values are exact, the u32 range ends in the last bucket\n");
+
+    // buckets are contiguous: every bucket starts right after the previous one ends
+    for (int b = 1; b < HISTOGRAM_BUCKETS; b++) {
+        uint32_t lower = histogram_bucket_upper(b - 1) + 1;
+        assert(histogram_bucket(lower) == b);
+        assert(histogram_bucket(histogram_bucket_upper(b)) == b);
+        // at most 1/8 of the values in it wide
+        assert((uint64_t)(histogram_bucket_upper(b) - lower) * HISTOGRAM_SUB_BUCKETS <= lower);
+    }
+    printf("✓ Buckets are contiguous and at most 12.5%% wide\n");
+}
+
+void test_percentiles() {
+    printf("\n=== Test: Percentiles Against Exact Values ===\n");
+    histogram_reset(&h);
+
+    enum { SAMPLES = 10000 };
+    static uint32_t samples[SAMPLES];
+    srand(42);
+    for (int i = 0; i < SAMPLES; i++) {
+        // a handshake-like spread: 200 ms to 2 s with a slow tail
+        samples[i] = 200000 + (uint32_t)(rand() % 1800000);
+        if (i % 50 == 0) {
+            samples[i] *= 5;
+        }
+        histogram_record(&h, samples[i]);
+    }
+    qsort(samples, SAMPLES, sizeof(uint32_t), compare_u32);
+
+    const uint8_t percents[] = { 50, 90, 99 };
+    uint32_t out[3];
+    histogram_percentiles(&h, percents, 3, out);
+    for (int i = 0; i < 3; i++) {
+        uint32_t exact = samples[(SAMPLES * percents[i] + 99) / 100 - 1];
+        assert(out[i] >= exact);
+        assert((uint64_t)(out[i] - exact) * HISTOGRAM_SUB_BUCKETS <= exact);
+        assert(out[i] == histogram_percentile(&h, percents[i]));
+    }
+    printf("✓ p50/p90/p99 are at most 12.5%% above the exact ones, one pass equals three\n");
+
+    assert(histogram_percentile(&h, 100) == h.max);
+    assert(histogram_percentile(&h, 0) >= h.min);
+    printf("✓ p100 is the largest sample\n");
+}
+
+void test_small_counts() {
+    printf("\n=== Test: Empty And Tiny Histograms ===\n");
+    histogram_reset(&h);
+
+    assert(histogram_percentile(&h, 50) == 0);
+    printf("✓ An empty histogram reports 0\n");
+
+    histogram_record(&h, 1000);
+    assert(histogram_percentile(&h, 50) == 1000 && histogram_percentile(&h, 99) == 1000);
+    printf("✓ A single sample is every percentile, clamped to min..max\n");
+
+    histogram_record(&h, 3000000);
+    assert(histogram_percentile(&h, 50) >= 1000 && histogram_percentile(&h, 50) <= 1000 + 1000 / 8);
+    assert(histogram_percentile(&h, 90) == 3000000);
+    printf("✓ p50 of two samples is in the bucket of the first, p90 the second\n");
+}
+
+void test_merge_reset() {
+    printf("\n=== Test: Merge And Reset ===\n");
+    histogram_reset(&h);
+    histogram_reset(&other);
+
+    for (uint32_t v = 1; v <= 100; v++) {
+        histogram_record(&h, v * 10);
+    }
+    for (uint32_t v = 101; v <= 200; v++) {
+        histogram_record(&other, v * 10);
+    }
+    histogram_merge(&h, &other);
+    assert(h.count == 200 && h.min == 10 && h.max == 2000);
+    assert(h.sum == 10ULL * 200 * 201 / 2);
+    assert(histogram_percentile(&h, 50) >= 1000 && histogram_percentile(&h, 50) <= 1000 + 1000 / 8);
+    printf("✓ Merged counts, bounds and percentiles cover both halves\n");
+
+    histogram_reset(&other);
+    histogram_merge(&h, &other);
+    assert(h.count == 200 && h.min == 10);
+    histogram_merge(&other, &h);
+    assert(other.count == 200 && other.min == 10 && other.max == 2000);
+    printf("✓ Merging an empty histogram changes nothing, into an empty one copies\n");
+
+    histogram_reset(&h);
+    assert(h.count == 0 && h.max == 0 && histogram_percentile(&h, 99) == 0);
+    printf("✓ Reset starts over\n");
+}
+
+int main() {
+    printf("========================================\n");
+    printf("Histogram Unit Tests\n");
+    printf("========================================\n");
+
+    test_buckets();
+    test_percentiles();
+    test_small_counts();
+    test_merge_reset();
+
+    printf("\n========================================\n");
+    printf("✓ All histogram tests passed!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+#endif
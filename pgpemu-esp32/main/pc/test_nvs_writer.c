@@ -0,0 +1,577 @@
+// Unit tests for the write-behind NVS writer (PC build)
+// Tests per-phone coalescing of session and settings changes, batched commits, reads of pending changes,
+// retry after a failed commit and the rate limited rewrite on reconnect
+#ifndef ESP_PLATFORM
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CONFIG_BT_ACL_CONNECTIONS 9
+#define MAX_CONNECTIONS CONFIG_BT_ACL_CONNECTIONS
+
+typedef unsigned char esp_bd_addr_t[6];
+
+typedef enum {
+    NVS_WRITER_NONE = 0,
+    NVS_WRITER_PUT,
+    NVS_WRITER_CLEAR,
+} nvs_writer_op_t;
+
+// Mock NVS: one record per phone, commits counted, commits can be made to fail
+#define MOCK_NVS_SIZE 32
+
+typedef struct {
+    bool used;
+    esp_bd_addr_t bda;
+    bool has_session;
+    uint8_t session_key[16];
+    bool autocatch, autospin;
+    uint32_t sessions;
+    uint32_t last_seen;
+} mock_record_t;
+
+static mock_record_t nvs_store[MOCK_NVS_SIZE];
+static uint32_t record_clock = 0;
+static int nvs_commits = 0;
+static int nvs_writes = 0;
+static bool nvs_fail_commit = false;
+
+static mock_record_t* nvs_find(const esp_bd_addr_t bda) {
+    for (int i = 0; i < MOCK_NVS_SIZE; i++) {
+        if (nvs_store[i].used && memcmp(nvs_store[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return &nvs_store[i];
+        }
+    }
+    return NULL;
+}
+
+static mock_record_t* nvs_find_or_add(const esp_bd_addr_t bda) {
+    mock_record_t* record = nvs_find(bda);
+    for (int i = 0; !record && i < MOCK_NVS_SIZE; i++) {
+        if (!nvs_store[i].used) {
+            record = &nvs_store[i];
+            record->used = true;
+            record->autocatch = record->autospin = true;
+            memcpy(record->bda, bda, sizeof(esp_bd_addr_t));
+        }
+    }
+    return record;
+}
+
+// Mirrors nvs_writer.c, without the mutexes, queue and task
+#define NVS_WRITER_SLOTS (2 * MAX_CONNECTIONS)
+#define NVS_WRITER_SEEN_INTERVAL_MS (60 * 60 * 1000)
+
+typedef struct {
+    bool used;
+    bool dirty;
+    esp_bd_addr_t bda;
+    nvs_writer_op_t session_op;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+    bool has_settings;
+    bool autocatch, autospin;
+} nvs_writer_entry_t;
+
+static nvs_writer_entry_t pending[NVS_WRITER_SLOTS];
+static uint32_t coalesced_changes = 0;
+static int kicks = 0;
+static int flush_requests = 0;
+
+// the tick count in ms
+static uint32_t now_ms = 0;
+
+static struct {
+    bool used;
+    esp_bd_addr_t bda;
+    uint32_t at;
+} seen[NVS_WRITER_SLOTS];
+
+static void reset_writer() {
+    memset(pending, 0, sizeof(pending));
+    memset(seen, 0, sizeof(seen));
+    memset(nvs_store, 0, sizeof(nvs_store));
+    record_clock = 0;
+    now_ms = 0;
+    coalesced_changes = 0;
+    kicks = flush_requests = 0;
+    nvs_commits = nvs_writes = 0;
+    nvs_fail_commit = false;
+}
+
+static nvs_writer_entry_t* find_entry_locked(const esp_bd_addr_t bda) {
+    for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+        if (pending[i].used && memcmp(pending[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return &pending[i];
+        }
+    }
+    return NULL;
+}
+
+static int dirty_count_locked() {
+    int count = 0;
+    for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+        if (pending[i].used && pending[i].dirty) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static nvs_writer_entry_t* get_or_add_entry_locked(const esp_bd_addr_t bda) {
+    nvs_writer_entry_t* entry = find_entry_locked(bda);
+    if (entry) {
+        if (entry->dirty) {
+            coalesced_changes++;
+        }
+        return entry;
+    }
+
+    for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+        if (!pending[i].used) {
+            memset(&pending[i], 0, sizeof(nvs_writer_entry_t));
+            pending[i].used = true;
+            memcpy(pending[i].bda, bda, sizeof(esp_bd_addr_t));
+            return &pending[i];
+        }
+    }
+    return NULL;
+}
+
+// the two halves of nvs_writer_flush(), split so a change can land while the batch is being written
+static int flush_begin(nvs_writer_entry_t* batch) {
+    int count = 0;
+    for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+        if (pending[i].used && pending[i].dirty) {
+            pending[i].dirty = false;
+            memcpy(&batch[count++], &pending[i], sizeof(nvs_writer_entry_t));
+        }
+    }
+    coalesced_changes = 0;
+    return count;
+}
+
+static bool flush_end(nvs_writer_entry_t* batch, int count) {
+    if (count == 0) {
+        return true;
+    }
+
+    // read-modify-write of each device record, as apply_change() does
+    for (int i = 0; i < count; i++) {
+        if (!nvs_find(batch[i].bda) && batch[i].session_op == NVS_WRITER_NONE && !batch[i].has_settings) {
+            continue;
+        }
+        mock_record_t* record = nvs_find_or_add(batch[i].bda);
+        if (batch[i].session_op == NVS_WRITER_PUT) {
+            record->has_session = true;
+            memcpy(record->session_key, batch[i].session_key, 16);
+            record->sessions++;
+        } else if (batch[i].session_op == NVS_WRITER_CLEAR) {
+            record->has_session = false;
+            memset(record->session_key, 0, 16);
+        }
+        if (batch[i].has_settings) {
+            record->autocatch = batch[i].autocatch;
+            record->autospin = batch[i].autospin;
+        }
+        record->last_seen = ++record_clock;
+        nvs_writes++;
+    }
+    bool committed = !nvs_fail_commit;
+    if (committed) {
+        nvs_commits++;
+    }
+
+    for (int i = 0; i < NVS_WRITER_SLOTS; i++) {
+        if (!pending[i].used || pending[i].dirty) {
+            continue;
+        }
+        if (committed) {
+            memset(&pending[i], 0, sizeof(nvs_writer_entry_t));
+        } else {
+            pending[i].dirty = true;
+        }
+    }
+    return committed;
+}
+
+static bool nvs_writer_flush() {
+    static nvs_writer_entry_t batch[NVS_WRITER_SLOTS];
+    return flush_end(batch, flush_begin(batch));
+}
+
+static void merge_change_locked(nvs_writer_entry_t* entry, const nvs_writer_entry_t* change) {
+    if (change->session_op != NVS_WRITER_NONE) {
+        entry->session_op = change->session_op;
+        memcpy(entry->session_key, change->session_key, sizeof(entry->session_key));
+        memcpy(entry->reconnect_challenge, change->reconnect_challenge, sizeof(entry->reconnect_challenge));
+    }
+    if (change->has_settings) {
+        entry->has_settings = true;
+        entry->autocatch = change->autocatch;
+        entry->autospin = change->autospin;
+    }
+    entry->dirty = true;
+}
+
+static bool queue_change(const nvs_writer_entry_t* change) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        nvs_writer_entry_t* entry = get_or_add_entry_locked(change->bda);
+        if (entry) {
+            merge_change_locked(entry, change);
+            if (dirty_count_locked() >= NVS_WRITER_SLOTS / 2) {
+                flush_requests++;
+            } else {
+                kicks++;
+            }
+            return true;
+        }
+
+        if (!nvs_writer_flush()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool nvs_writer_put_session(const esp_bd_addr_t bda, const uint8_t* session_key) {
+    nvs_writer_entry_t change = { .session_op = NVS_WRITER_PUT };
+    memcpy(change.bda, bda, sizeof(esp_bd_addr_t));
+    memcpy(change.session_key, session_key, sizeof(change.session_key));
+    return queue_change(&change);
+}
+
+static bool nvs_writer_clear_session(const esp_bd_addr_t bda) {
+    nvs_writer_entry_t change = { .session_op = NVS_WRITER_CLEAR };
+    memcpy(change.bda, bda, sizeof(esp_bd_addr_t));
+    return queue_change(&change);
+}
+
+static bool nvs_writer_put_settings(const esp_bd_addr_t bda, bool autocatch, bool autospin) {
+    nvs_writer_entry_t change = { .has_settings = true, .autocatch = autocatch, .autospin = autospin };
+    memcpy(change.bda, bda, sizeof(esp_bd_addr_t));
+    return queue_change(&change);
+}
+
+static bool nvs_writer_touch(const esp_bd_addr_t bda) {
+    nvs_writer_entry_t change = { 0 };
+    memcpy(change.bda, bda, sizeof(esp_bd_addr_t));
+    return queue_change(&change);
+}
+
+static bool nvs_writer_seen(const esp_bd_addr_t bda) {
+    uint32_t now = now_ms;
+    int slot = -1, oldest = 0;
+    for (int i = 0; i < NVS_WRITER_SLOTS && slot < 0; i++) {
+        if (seen[i].used && memcmp(seen[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            slot = i;
+        } else if (!seen[i].used || (seen[oldest].used && now - seen[i].at > now - seen[oldest].at)) {
+            oldest = i;
+        }
+    }
+    bool due = slot < 0 || now - seen[slot].at >= NVS_WRITER_SEEN_INTERVAL_MS;
+    if (slot < 0) {
+        slot = oldest;
+    }
+    if (due) {
+        seen[slot].used = true;
+        memcpy(seen[slot].bda, bda, sizeof(esp_bd_addr_t));
+        seen[slot].at = now;
+    }
+
+    if (!due) {
+        return true;
+    }
+    return nvs_writer_touch(bda);
+}
+
+static nvs_writer_op_t nvs_writer_pending_session(const esp_bd_addr_t bda, uint8_t* session_key) {
+    const nvs_writer_entry_t* entry = find_entry_locked(bda);
+    if (!entry) {
+        return NVS_WRITER_NONE;
+    }
+    if (entry->session_op == NVS_WRITER_PUT && session_key) {
+        memcpy(session_key, entry->session_key, sizeof(entry->session_key));
+    }
+    return entry->session_op;
+}
+
+// Mirrors has_cached_session(): pending changes win over NVS
+static bool has_cached_session(const esp_bd_addr_t bda) {
+    nvs_writer_op_t pending_op = nvs_writer_pending_session(bda, NULL);
+    if (pending_op != NVS_WRITER_NONE) {
+        return pending_op == NVS_WRITER_PUT;
+    }
+    mock_record_t* record = nvs_find(bda);
+    return record && record->has_session;
+}
+
+static void make_bda(uint8_t n, esp_bd_addr_t out) {
+    uint8_t bda[6] = { 0x11, 0x22, 0x33, 0x44, 0x55, n };
+    memcpy(out, bda, sizeof(esp_bd_addr_t));
+}
+
+static void make_key(uint8_t n, uint8_t* key) {
+    memset(key, n, 16);
+}
+
+void test_coalescing() {
+    printf("\n=== Test: Coalescing per Phone ===\n");
+    reset_writer();
+
+    esp_bd_addr_t bda;
+    make_bda(1, bda);
+    uint8_t key[16];
+    for (uint8_t n = 1; n <= 5; n++) {
+        make_key(n, key);
+        assert(nvs_writer_put_session(bda, key));
+    }
+    assert(dirty_count_locked() == 1);
+    assert(coalesced_changes == 4);
+    assert(nvs_writes == 0);
+    printf("✓ Five changes of one phone occupy one slot, nothing written yet\n");
+
+    assert(nvs_writer_flush());
+    assert(nvs_writes == 1);
+    assert(nvs_commits == 1);
+    make_key(5, key);
+    assert(memcmp(nvs_find(bda)->session_key, key, 16) == 0);
+    assert(find_entry_locked(bda) == NULL);
+    printf("✓ Only the newest key reaches NVS, slot freed after the commit\n");
+
+    assert(nvs_writer_flush());
+    assert(nvs_commits == 1);
+    printf("✓ Flushing an empty table doesn't commit\n");
+
+    assert(nvs_writer_clear_session(bda));
+    make_key(6, key);
+    assert(nvs_writer_put_session(bda, key));
+    assert(nvs_writer_clear_session(bda));
+    assert(nvs_writer_flush());
+    assert(!nvs_find(bda)->has_session);
+    assert(nvs_find(bda)->sessions == 1);
+    assert(nvs_writes == 2);
+    printf("✓ clear, put, clear ends as one record write without session\n");
+}
+
+void test_settings_and_session_merge() {
+    printf("\n=== Test: Settings and Session in One Record Write ===\n");
+    reset_writer();
+
+    esp_bd_addr_t bda;
+    make_bda(2, bda);
+    uint8_t key[16];
+    make_key(9, key);
+    assert(nvs_writer_put_settings(bda, false, true));
+    assert(nvs_writer_put_session(bda, key));
+    assert(nvs_writer_put_settings(bda, true, false));
+    assert(dirty_count_locked() == 1);
+    assert(nvs_writer_flush());
+
+    mock_record_t* record = nvs_find(bda);
+    assert(nvs_writes == 1);
+    assert(record->has_session && memcmp(record->session_key, key, 16) == 0);
+    assert(record->autocatch == true && record->autospin == false);
+    printf("✓ Newest settings and the session key land in one write\n");
+
+    assert(nvs_writer_put_settings(bda, false, false));
+    assert(nvs_writer_flush());
+    assert(record->has_session && record->sessions == 1);
+    assert(record->autocatch == false);
+    printf("✓ A settings change keeps the stored session\n");
+}
+
+void test_batched_commit() {
+    printf("\n=== Test: One Commit per Batch ===\n");
+    reset_writer();
+
+    uint8_t key[16];
+    esp_bd_addr_t bda;
+    for (uint8_t n = 0; n < 4; n++) {
+        make_bda(n, bda);
+        make_key(n, key);
+        assert(nvs_writer_put_session(bda, key));
+    }
+    assert(kicks == 4);
+    assert(flush_requests == 0);
+    assert(nvs_writer_flush());
+    assert(nvs_writes == 4);
+    assert(nvs_commits == 1);
+    printf("✓ Four phones written with a single commit\n");
+
+    reset_writer();
+    for (uint8_t n = 0; n < NVS_WRITER_SLOTS / 2; n++) {
+        make_bda(n, bda);
+        make_key(n, key);
+        assert(nvs_writer_put_session(bda, key));
+    }
+    assert(flush_requests == 1);
+    printf("✓ A half full table asks the task to flush early\n");
+
+    for (uint8_t n = NVS_WRITER_SLOTS / 2; n < NVS_WRITER_SLOTS + 1; n++) {
+        make_bda(n, bda);
+        make_key(n, key);
+        assert(nvs_writer_put_session(bda, key));
+    }
+    assert(nvs_commits == 1);
+    assert(dirty_count_locked() == 1);
+    for (uint8_t n = 0; n < NVS_WRITER_SLOTS + 1; n++) {
+        make_bda(n, bda);
+        assert(has_cached_session(bda));
+    }
+    printf("✓ A full table is flushed synchronously, nothing lost\n");
+}
+
+void test_pending_reads() {
+    printf("\n=== Test: Reads See Pending Changes ===\n");
+    reset_writer();
+
+    esp_bd_addr_t bda;
+    make_bda(7, bda);
+    uint8_t key[16], out[16];
+    make_key(7, key);
+    assert(!has_cached_session(bda));
+
+    assert(nvs_writer_put_session(bda, key));
+    assert(has_cached_session(bda));
+    assert(nvs_writer_pending_session(bda, out) == NVS_WRITER_PUT);
+    assert(nvs_writer_put_settings(bda, true, true));
+    assert(nvs_writer_pending_session(bda, out) == NVS_WRITER_PUT);
+    assert(memcmp(out, key, 16) == 0);
+    printf("✓ Uncommitted keys are found\n");
+
+    assert(nvs_writer_flush());
+    assert(nvs_writer_clear_session(bda));
+    assert(nvs_find(bda)->has_session);
+    assert(!has_cached_session(bda));
+    printf("✓ A pending clear hides the keys still in NVS\n");
+}
+
+void test_change_during_flush() {
+    printf("\n=== Test: Change While a Batch Is Written ===\n");
+    reset_writer();
+
+    static nvs_writer_entry_t batch[NVS_WRITER_SLOTS];
+    esp_bd_addr_t bda;
+    make_bda(3, bda);
+    uint8_t key[16], out[16];
+    make_key(1, key);
+    assert(nvs_writer_put_session(bda, key));
+
+    int count = flush_begin(batch);
+    assert(count == 1);
+    assert(nvs_writer_pending_session(bda, out) == NVS_WRITER_PUT);
+    printf("✓ Entry being written is still visible to readers\n");
+
+    make_key(2, key);
+    assert(nvs_writer_put_session(bda, key));
+    assert(flush_end(batch, count));
+    assert(find_entry_locked(bda) != NULL);
+    assert(dirty_count_locked() == 1);
+    printf("✓ Newer change survives the commit of the older one\n");
+
+    assert(nvs_writer_flush());
+    assert(memcmp(nvs_find(bda)->session_key, key, 16) == 0);
+    assert(nvs_commits == 2);
+    printf("✓ And is written by the next flush\n");
+}
+
+void test_failed_commit() {
+    printf("\n=== Test: Failed Commit Is Retried ===\n");
+    reset_writer();
+
+    esp_bd_addr_t bda;
+    make_bda(4, bda);
+    uint8_t key[16];
+    make_key(4, key);
+    assert(nvs_writer_put_session(bda, key));
+
+    nvs_fail_commit = true;
+    assert(!nvs_writer_flush());
+    assert(dirty_count_locked() == 1);
+    printf("✓ Changes stay pending after a failed commit\n");
+
+    nvs_fail_commit = false;
+    assert(nvs_writer_flush());
+    assert(dirty_count_locked() == 0);
+    assert(nvs_commits == 1);
+    printf("✓ Retry commits them\n");
+}
+
+void test_reconnect_seen() {
+    printf("\n=== Test: Reconnects Keep the Eviction Order ===\n");
+    reset_writer();
+
+    esp_bd_addr_t daily, paired;
+    make_bda(1, daily);
+    make_bda(2, paired);
+    uint8_t key[16];
+    make_key(1, key);
+    assert(nvs_writer_put_session(daily, key));
+    assert(nvs_writer_put_session(paired, key));
+    assert(nvs_writer_flush());
+    assert(nvs_find(daily)->last_seen < nvs_find(paired)->last_seen);
+
+    now_ms = 1000;
+    assert(nvs_writer_seen(daily));
+    assert(nvs_writer_flush());
+    assert(nvs_find(daily)->last_seen > nvs_find(paired)->last_seen);
+    assert(nvs_find(daily)->has_session && nvs_find(daily)->sessions == 1);
+    printf("✓ A reconnect moves the phone's record up, its data unchanged\n");
+
+    int writes = nvs_writes;
+    now_ms += NVS_WRITER_SEEN_INTERVAL_MS - 1;
+    assert(nvs_writer_seen(daily));
+    assert(find_entry_locked(daily) == NULL);
+    assert(nvs_writer_flush() && nvs_writes == writes);
+    now_ms += 1;
+    assert(nvs_writer_seen(daily));
+    assert(nvs_writer_flush() && nvs_writes == writes + 1);
+    printf("✓ At most one rewrite per phone and interval\n");
+
+    // more phones than entries, the one seen longest ago is forgotten first
+    for (uint8_t n = 10; n < 10 + NVS_WRITER_SLOTS; n++) {
+        esp_bd_addr_t bda;
+        make_bda(n, bda);
+        now_ms++;
+        assert(nvs_writer_seen(bda));
+    }
+    assert(nvs_writer_flush());
+    writes = nvs_writes;
+    assert(nvs_writer_seen(daily));
+    assert(nvs_writer_flush() && nvs_writes == writes + 1);
+    printf("✓ Phones pushed out of the table are rewritten again\n");
+
+    esp_bd_addr_t unknown;
+    make_bda(99, unknown);
+    assert(nvs_writer_seen(unknown));
+    assert(nvs_writer_flush());
+    assert(nvs_find(unknown) == NULL);
+    printf("✓ A phone without a record doesn't get an empty one\n");
+}
+
+int main() {
+    printf("========================================\n");
+    printf("NVS Writer Unit Tests\n");
+    printf("========================================\n");
+
+    test_coalescing();
+    test_settings_and_session_merge();
+    test_batched_commit();
+    test_pending_reads();
+    test_change_during_flush();
+    test_failed_commit();
+    test_reconnect_seen();
+
+    printf("\n========================================\n");
+    printf("✓ All nvs writer tests passed!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+#endif
@@ -29,6 +29,12 @@ typedef enum {
     CONTROL_OP_TOGGLE_AUTOSPIN = 0x10,
     CONTROL_OP_TOGGLE_AUTOCATCH = 0x11,
     CONTROL_OP_GET_CLIENT_SUMMARY = 0x12,
+    CONTROL_OP_SET_ENTROPY_SEED = 0x13,
+    CONTROL_OP_GET_HANDSHAKE_LATENCY = 0x14,
+    CONTROL_OP_GET_NVS_STATS = 0x15,
+    CONTROL_OP_DEVICE_STORE = 0x16,
+    CONTROL_OP_GET_DEVICE_STATS = 0x17,
+    CONTROL_OP_GET_METRICS = 0x18,
 } control_opcode_t;
 
 // Mirrors pgp_control.h's status table
@@ -98,15 +104,21 @@ static void test_opcode_constants() {
         CONTROL_OP_SET_MAX_CONNECTIONS,
         CONTROL_OP_TOGGLE_AUTOSPIN,
         CONTROL_OP_TOGGLE_AUTOCATCH,
-        CONTROL_OP_GET_CLIENT_SUMMARY };
+        CONTROL_OP_GET_CLIENT_SUMMARY,
+        CONTROL_OP_SET_ENTROPY_SEED,
+        CONTROL_OP_GET_HANDSHAKE_LATENCY,
+        CONTROL_OP_GET_NVS_STATS,
+        CONTROL_OP_DEVICE_STORE,
+        CONTROL_OP_GET_DEVICE_STATS,
+        CONTROL_OP_GET_METRICS };
     size_t count = sizeof(opcodes) / sizeof(opcodes[0]);
-    assert(count == 0x12);
-    printf("✓ Table has 18 opcodes (0x01-0x12)\n");
+    assert(count == 0x18);
+    printf("✓ Table has 24 opcodes (0x01-0x18)\n");
 
     for (size_t i = 0; i < count; i++) {
         assert((uint8_t)opcodes[i] == (uint8_t)(i + 1));
     }
-    printf("✓ Opcodes are 0x01..0x12, no gaps\n");
+    printf("✓ Opcodes are 0x01..0x18, no gaps\n");
 
     for (size_t i = 0; i < count; i++) {
         for (size_t j = i + 1; j < count; j++) {
@@ -257,6 +269,170 @@ static void test_client_summary_record_layout() {
     printf("✓ conn_id is little-endian (low byte first)\n");
 }
 
+// Mirrors pgp_handshake.c's latency buckets (ms upper bounds, last bucket is everything above)
+#define LATENCY_BUCKETS 15
+static const uint32_t latency_bucket_ms[LATENCY_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000
+};
+
+// Mirrors state_latency_p95_ms(): upper bound of the bucket holding the 95th percentile, clamped to max
+static uint32_t latency_p95_ms(const uint32_t* buckets, uint32_t count, uint32_t max_ms) {
+    uint32_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        seen += buckets[b];
+        if ((uint64_t)seen * 100 >= (uint64_t)count * 95) {
+            return latency_bucket_ms[b] < max_ms ? latency_bucket_ms[b] : max_ms;
+        }
+    }
+    return max_ms;
+}
+
+// Mirrors one GET_HANDSHAKE_LATENCY record: [state][count u32][min][avg][p95][max] (u16 ms, LE)
+static void encode_latency_record(uint8_t state,
+    uint32_t count,
+    uint16_t min_ms,
+    uint16_t avg_ms,
+    uint16_t p95_ms,
+    uint16_t max_ms,
+    uint8_t* out) {
+    out[0] = state;
+    out[1] = count & 0xff;
+    out[2] = (count >> 8) & 0xff;
+    out[3] = (count >> 16) & 0xff;
+    out[4] = (count >> 24) & 0xff;
+    out[5] = min_ms & 0xff;
+    out[6] = min_ms >> 8;
+    out[7] = avg_ms & 0xff;
+    out[8] = avg_ms >> 8;
+    out[9] = p95_ms & 0xff;
+    out[10] = p95_ms >> 8;
+    out[11] = max_ms & 0xff;
+    out[12] = max_ms >> 8;
+}
+
+static void test_handshake_latency_record() {
+    printf("\n=== Test: GET_HANDSHAKE_LATENCY Record Layout ===\n");
+
+    uint8_t rec[13];
+    encode_latency_record(3, 0x01020304, 12, 340, 500, 0x1388, rec);
+    uint8_t expected[13] = { 0x03, 0x04, 0x03, 0x02, 0x01, 12, 0, 0x54, 0x01, 0xf4, 0x01, 0x88, 0x13 };
+    assert(memcmp(rec, expected, sizeof(expected)) == 0);
+    printf("✓ Record is 13 bytes, count u32 and times u16 little-endian\n");
+
+    // 6 waiting states (CHAL_0..RECONNECT_ACK) fit easily in one response
+    assert(6 * sizeof(rec) <= CONTROL_MAX_RESPONSE_PAYLOAD);
+    printf("✓ All states fit in one response\n");
+
+    // 19 fast samples (<= 50 ms) and one slow one: p95 stays in the fast bucket
+    uint32_t buckets[LATENCY_BUCKETS] = { 0 };
+    buckets[5] = 19;
+    buckets[12] = 1;
+    assert(latency_p95_ms(buckets, 20, 9000) == 50);
+    printf("✓ p95 ignores a single outlier in 20 samples\n");
+
+    // with two slow samples out of 20 the 95th percentile is in the slow bucket
+    buckets[5] = 18;
+    buckets[12] = 2;
+    assert(latency_p95_ms(buckets, 20, 9000) == 9000);
+    printf("✓ p95 is clamped to the largest sample\n");
+
+    // everything above 20 s lands in the overflow bucket and reports max
+    memset(buckets, 0, sizeof(buckets));
+    buckets[LATENCY_BUCKETS - 1] = 4;
+    assert(latency_p95_ms(buckets, 4, 31000) == 31000);
+    printf("✓ Overflow bucket reports max\n");
+}
+
+// Mirrors nvs_helper.h's GET_NVS_STATS layout
+#define NVS_STATS_NAMESPACES 6
+#define NVS_STATS_HEADER_LEN 12
+#define NVS_STATS_RECORD_LEN 34
+
+static void test_nvs_stats_layout() {
+    printf("\n=== Test: GET_NVS_STATS Layout ===\n");
+
+    // header: six u16 counts, record: 16 byte name, four u32 counters, u16 used entries
+    assert(NVS_STATS_HEADER_LEN == 6 * 2);
+    assert(NVS_STATS_RECORD_LEN == 16 + 4 * 4 + 2);
+    printf("✓ Header is 12 bytes, records 34 bytes\n");
+
+    assert(NVS_STATS_HEADER_LEN + NVS_STATS_NAMESPACES * NVS_STATS_RECORD_LEN <= CONTROL_MAX_RESPONSE_PAYLOAD);
+    printf("✓ Every counted namespace fits in one response\n");
+
+    // 32 sectors of 126 entries don't overflow a u16
+    assert(32 * 126 <= 0xffff);
+    printf("✓ Entry counts of the 128 KB partition fit u16\n");
+}
+
+// Mirrors device_directory.h's DEVICE_STORE layout
+#define DEVICE_DIRECTORY_SIZE 64
+#define DEVICE_STORE_STATS_LEN 10
+
+static void test_device_store_layout() {
+    printf("\n=== Test: DEVICE_STORE Layout ===\n");
+
+    // stored, capacity, largest capacity, exact flag, u16 legacy keys, u32 evictions
+    assert(DEVICE_STORE_STATS_LEN == 4 + 2 + 4);
+    assert(DEVICE_STORE_STATS_LEN <= CONTROL_MAX_RESPONSE_PAYLOAD);
+    printf("✓ Response is 10 bytes\n");
+
+    // capacities are sent and reported as one byte
+    assert(DEVICE_DIRECTORY_SIZE <= 0xff);
+    printf("✓ Capacity fits u8\n");
+}
+
+// Mirrors stats.h's GET_DEVICE_STATS layout
+#define STATS_SLOTS (2 * 9)
+#define STATS_HEADER_LEN 2
+#define STATS_RECORD_LEN 53
+
+static void test_device_stats_layout() {
+    printf("\n=== Test: GET_DEVICE_STATS Layout ===\n");
+
+    // bda, u16 conn_id, flags, 4 session u32, 5 lifetime u32, 4 u16 rates
+    assert(STATS_RECORD_LEN == 6 + 2 + 1 + 4 * 4 + 5 * 4 + 4 * 2);
+    printf("✓ Records are 53 bytes\n");
+
+    // phones are paged with the first index, every phone is reached in two requests
+    int per_response = (CONTROL_MAX_RESPONSE_PAYLOAD - STATS_HEADER_LEN) / STATS_RECORD_LEN;
+    assert(per_response == 9);
+    assert(2 * per_response >= STATS_SLOTS);
+    assert(STATS_SLOTS <= 0xff);
+    printf("✓ 9 phones per response, the table in two pages\n");
+}
+
+// Mirrors metrics.h's GET_METRICS layout
+#define METRIC_COUNT 4
+#define METRICS_HEADER_LEN 1
+#define METRICS_RECORD_LEN 25
+
+static void encode_metric_record(uint8_t metric, const uint32_t* values, uint8_t* out) {
+    out[0] = metric;
+    for (int v = 0; v < 6; v++) {
+        for (int i = 0; i < 4; i++) {
+            out[1 + 4 * v + i] = (uint8_t)(values[v] >> (8 * i));
+        }
+    }
+}
+
+static void test_metrics_layout() {
+    printf("\n=== Test: GET_METRICS Layout ===\n");
+
+    // metric, then count, min, p50, p90, p99, max as u32 microseconds
+    assert(METRICS_RECORD_LEN == 1 + 6 * 4);
+    assert(METRICS_HEADER_LEN + METRIC_COUNT * METRICS_RECORD_LEN <= CONTROL_MAX_RESPONSE_PAYLOAD);
+    printf("✓ Records are 25 bytes, every metric fits in one response\n");
+
+    uint8_t rec[METRICS_RECORD_LEN];
+    const uint32_t values[6] = { 7, 180000, 950000, 1400000, 0x01020304, 0xfffffffe };
+    encode_metric_record(2, values, rec);
+    assert(rec[0] == 2);
+    assert(rec[1] == 7 && rec[2] == 0 && rec[3] == 0 && rec[4] == 0);
+    assert(rec[17] == 0x04 && rec[18] == 0x03 && rec[19] == 0x02 && rec[20] == 0x01);
+    assert(rec[21] == 0xfe && rec[24] == 0xff);
+    printf("✓ Values are u32 little-endian, over an hour fits\n");
+}
+
 int main() {
     printf("========================================\n");
     printf("Control Service Protocol Unit Tests\n");
@@ -268,6 +444,11 @@ int main() {
     test_build_frame_truncation();
     test_parse_request();
     test_client_summary_record_layout();
+    test_handshake_latency_record();
+    test_nvs_stats_layout();
+    test_device_store_layout();
+    test_device_stats_layout();
+    test_metrics_layout();
 
     printf("\n========================================\n");
     printf("✓ All control protocol tests passed!\n");
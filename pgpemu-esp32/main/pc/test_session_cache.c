@@ -0,0 +1,229 @@
+// Unit tests for the in-RAM session cache (PC build)
+// Tests LRU eviction, session invalidation and the session/settings split
+#ifndef ESP_PLATFORM
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CONFIG_BT_ACL_CONNECTIONS 4
+
+typedef unsigned char esp_bd_addr_t[6];
+
+// Mirrors session_cache.c, without the mutex
+#define SESSION_CACHE_SIZE (2 * CONFIG_BT_ACL_CONNECTIONS)
+
+typedef struct {
+    bool used;
+    uint32_t last_used;
+    esp_bd_addr_t bda;
+
+    bool has_session;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+
+    bool has_settings;
+    bool autocatch, autospin;
+} session_cache_entry_t;
+
+static session_cache_entry_t cache[SESSION_CACHE_SIZE];
+static uint32_t use_clock = 0;
+
+static void reset_cache() {
+    memset(cache, 0, sizeof(cache));
+    use_clock = 0;
+}
+
+static session_cache_entry_t* find_entry(const esp_bd_addr_t bda) {
+    for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+        if (cache[i].used && memcmp(cache[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            cache[i].last_used = ++use_clock;
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+static session_cache_entry_t* find_or_evict_entry(const esp_bd_addr_t bda) {
+    session_cache_entry_t* entry = find_entry(bda);
+    if (entry) {
+        return entry;
+    }
+
+    entry = &cache[0];
+    for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+        if (!cache[i].used) {
+            entry = &cache[i];
+            break;
+        }
+        if (cache[i].last_used < entry->last_used) {
+            entry = &cache[i];
+        }
+    }
+
+    memset(entry, 0, sizeof(session_cache_entry_t));
+    entry->used = true;
+    entry->last_used = ++use_clock;
+    memcpy(entry->bda, bda, sizeof(esp_bd_addr_t));
+    return entry;
+}
+
+static void session_cache_put_session(const esp_bd_addr_t bda, const uint8_t* key, const uint8_t* challenge) {
+    session_cache_entry_t* entry = find_or_evict_entry(bda);
+    memcpy(entry->session_key, key, sizeof(entry->session_key));
+    memcpy(entry->reconnect_challenge, challenge, sizeof(entry->reconnect_challenge));
+    entry->has_session = true;
+}
+
+static bool session_cache_get_session(const esp_bd_addr_t bda, uint8_t* key_out, uint8_t* challenge_out) {
+    session_cache_entry_t* entry = find_entry(bda);
+    if (!entry || !entry->has_session) {
+        return false;
+    }
+    memcpy(key_out, entry->session_key, sizeof(entry->session_key));
+    memcpy(challenge_out, entry->reconnect_challenge, sizeof(entry->reconnect_challenge));
+    return true;
+}
+
+static void session_cache_invalidate(const esp_bd_addr_t bda) {
+    session_cache_entry_t* entry = find_entry(bda);
+    if (entry) {
+        entry->has_session = false;
+        memset(entry->session_key, 0, sizeof(entry->session_key));
+        memset(entry->reconnect_challenge, 0, sizeof(entry->reconnect_challenge));
+    }
+}
+
+static void session_cache_put_settings(const esp_bd_addr_t bda, bool autocatch, bool autospin) {
+    session_cache_entry_t* entry = find_or_evict_entry(bda);
+    entry->autocatch = autocatch;
+    entry->autospin = autospin;
+    entry->has_settings = true;
+}
+
+static bool session_cache_get_settings(const esp_bd_addr_t bda, bool* autocatch_out, bool* autospin_out) {
+    session_cache_entry_t* entry = find_entry(bda);
+    if (!entry || !entry->has_settings) {
+        return false;
+    }
+    *autocatch_out = entry->autocatch;
+    *autospin_out = entry->autospin;
+    return true;
+}
+
+static void make_bda(uint8_t n, esp_bd_addr_t out) {
+    uint8_t bda[6] = { 0xc0, 0x11, 0x22, 0x33, 0x44, n };
+    memcpy(out, bda, sizeof(esp_bd_addr_t));
+}
+
+static void test_put_get() {
+    printf("\n=== Test: Put/Get Session ===\n");
+    reset_cache();
+
+    esp_bd_addr_t bda;
+    make_bda(1, bda);
+    uint8_t key[16], challenge[32], key_out[16], challenge_out[32];
+    memset(key, 0xaa, sizeof(key));
+    memset(challenge, 0xbb, sizeof(challenge));
+
+    assert(!session_cache_get_session(bda, key_out, challenge_out));
+    printf("✓ Unknown phone misses\n");
+
+    session_cache_put_session(bda, key, challenge);
+    assert(session_cache_get_session(bda, key_out, challenge_out));
+    assert(memcmp(key, key_out, 16) == 0 && memcmp(challenge, challenge_out, 32) == 0);
+    printf("✓ Cached session keys come back unchanged\n");
+
+    // a new handshake overwrites the keys in place
+    memset(key, 0xcc, sizeof(key));
+    session_cache_put_session(bda, key, challenge);
+    assert(session_cache_get_session(bda, key_out, challenge_out));
+    assert(key_out[0] == 0xcc);
+    int used = 0;
+    for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+        used += cache[i].used;
+    }
+    assert(used == 1);
+    printf("✓ Same phone reuses its entry\n");
+}
+
+static void test_lru_eviction() {
+    printf("\n=== Test: LRU Eviction ===\n");
+    reset_cache();
+
+    uint8_t key[16] = { 0 }, challenge[32] = { 0 }, key_out[16], challenge_out[32];
+    esp_bd_addr_t bda;
+
+    for (uint8_t n = 0; n < SESSION_CACHE_SIZE; n++) {
+        make_bda(n, bda);
+        key[0] = n;
+        session_cache_put_session(bda, key, challenge);
+    }
+
+    // touch phone 0 so phone 1 is the least recently used
+    make_bda(0, bda);
+    assert(session_cache_get_session(bda, key_out, challenge_out));
+
+    make_bda(100, bda);
+    session_cache_put_session(bda, key, challenge);
+
+    make_bda(1, bda);
+    assert(!session_cache_get_session(bda, key_out, challenge_out));
+    printf("✓ Least recently used phone is evicted when full\n");
+
+    make_bda(0, bda);
+    assert(session_cache_get_session(bda, key_out, challenge_out) && key_out[0] == 0);
+    for (uint8_t n = 2; n < SESSION_CACHE_SIZE; n++) {
+        make_bda(n, bda);
+        assert(session_cache_get_session(bda, key_out, challenge_out) && key_out[0] == n);
+    }
+    printf("✓ Recently used phones survive\n");
+}
+
+static void test_invalidate_keeps_settings() {
+    printf("\n=== Test: Invalidate ===\n");
+    reset_cache();
+
+    esp_bd_addr_t bda;
+    make_bda(7, bda);
+    uint8_t key[16] = { 1 }, challenge[32] = { 2 }, key_out[16], challenge_out[32];
+    bool autocatch = true, autospin = true;
+
+    session_cache_put_session(bda, key, challenge);
+    session_cache_put_settings(bda, false, true);
+
+    session_cache_invalidate(bda);
+    assert(!session_cache_get_session(bda, key_out, challenge_out));
+    printf("✓ clear_device_session() drops the cached keys\n");
+
+    assert(session_cache_get_settings(bda, &autocatch, &autospin));
+    assert(autocatch == false && autospin == true);
+    printf("✓ Device settings stay cached\n");
+
+    esp_bd_addr_t other;
+    make_bda(8, other);
+    session_cache_invalidate(other);
+    assert(!session_cache_get_settings(other, &autocatch, &autospin));
+    printf("✓ Invalidating an unknown phone is a no-op\n");
+}
+
+int main() {
+    printf("========================================\n");
+    printf("Session Cache Unit Tests\n");
+    printf("========================================\n");
+
+    test_put_get();
+    test_lru_eviction();
+    test_invalidate_keeps_settings();
+
+    printf("\n========================================\n");
+    printf("✓ All session cache tests passed!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+#endif
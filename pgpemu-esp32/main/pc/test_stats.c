@@ -0,0 +1,428 @@
+// Unit tests for the per-phone statistics (PC build)
+// Tests that counts follow the phone and not the reused conn_id, survive failed flushes and restarts,
+// and the per hour rates
+#ifndef ESP_PLATFORM
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef unsigned char esp_bd_addr_t[6];
+
+// Mirrors stats.c without the lock and the task, ticks are ms and NVS is an array of records
+#define STATS_SLOTS 4
+#define STATS_NO_CONN 0xffff
+#define STORED_MAX 8
+
+typedef struct {
+    uint32_t caught;
+    uint32_t fled;
+    uint32_t spin;
+} Stats;
+
+typedef struct {
+    uint8_t version;
+    uint8_t reserved[3];
+    Stats stats;
+    uint32_t sessions;
+    uint32_t seconds;
+} stats_record_t;
+
+typedef struct {
+    bool used;
+    bool loaded;
+    bool dirty;
+    uint16_t conn_id;
+    uint32_t last_used;
+    esp_bd_addr_t bda;
+    uint32_t session_start;
+    uint32_t accounted_at;
+    uint32_t session_seconds;
+    Stats session;
+    stats_record_t stored;
+    stats_record_t unsaved;
+} stats_entry_t;
+
+static stats_entry_t entries[STATS_SLOTS];
+static uint32_t use_clock = 0;
+static uint32_t now_ms = 0;
+
+static struct {
+    esp_bd_addr_t bda;
+    stats_record_t record;
+} nvs[STORED_MAX];
+static int nvs_len = 0;
+static bool nvs_fail = false;
+
+static stats_record_t* nvs_find(const esp_bd_addr_t bda, bool add) {
+    for (int i = 0; i < nvs_len; i++) {
+        if (memcmp(nvs[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return &nvs[i].record;
+        }
+    }
+    if (!add || nvs_len == STORED_MAX) {
+        return NULL;
+    }
+    memcpy(nvs[nvs_len].bda, bda, sizeof(esp_bd_addr_t));
+    memset(&nvs[nvs_len].record, 0, sizeof(stats_record_t));
+    return &nvs[nvs_len++].record;
+}
+
+static void add_record(stats_record_t* to, const stats_record_t* from) {
+    to->stats.caught += from->stats.caught;
+    to->stats.fled += from->stats.fled;
+    to->stats.spin += from->stats.spin;
+    to->sessions += from->sessions;
+    to->seconds += from->seconds;
+}
+
+static void account_time(stats_entry_t* entry) {
+    if (entry->conn_id == STATS_NO_CONN) {
+        return;
+    }
+    uint32_t seconds = (now_ms - entry->accounted_at) / 1000;
+    if (seconds > 0) {
+        entry->unsaved.seconds += seconds;
+        entry->accounted_at += seconds * 1000;
+        entry->dirty = true;
+    }
+}
+
+static stats_entry_t* find_by_conn(uint16_t conn_id) {
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (entries[i].used && entries[i].conn_id == conn_id) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static stats_entry_t* find_by_bda(const esp_bd_addr_t bda) {
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (entries[i].used && memcmp(entries[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void end_session(stats_entry_t* entry) {
+    account_time(entry);
+    entry->session_seconds = (now_ms - entry->session_start) / 1000;
+    entry->conn_id = STATS_NO_CONN;
+}
+
+static stats_entry_t* take_entry(const esp_bd_addr_t bda) {
+    stats_entry_t* entry = find_by_bda(bda);
+    if (entry) {
+        return entry;
+    }
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (!entries[i].used) {
+            entry = &entries[i];
+            break;
+        }
+        if (entries[i].conn_id != STATS_NO_CONN || entries[i].dirty) {
+            continue;
+        }
+        if (!entry || entries[i].last_used < entry->last_used) {
+            entry = &entries[i];
+        }
+    }
+    if (entry) {
+        memset(entry, 0, sizeof(stats_entry_t));
+        entry->used = true;
+        entry->conn_id = STATS_NO_CONN;
+        memcpy(entry->bda, bda, sizeof(esp_bd_addr_t));
+    }
+    return entry;
+}
+
+static bool session_start(const esp_bd_addr_t bda, uint16_t conn_id) {
+    stats_entry_t* stale = find_by_conn(conn_id);
+    if (stale) {
+        end_session(stale);
+    }
+    stats_entry_t* entry = take_entry(bda);
+    if (!entry) {
+        return false;
+    }
+    if (entry->conn_id != STATS_NO_CONN) {
+        end_session(entry);
+    }
+    entry->conn_id = conn_id;
+    entry->last_used = ++use_clock;
+    entry->session_start = now_ms;
+    entry->accounted_at = now_ms;
+    entry->session_seconds = 0;
+    entry->session = (Stats){ 0 };
+    entry->unsaved.sessions++;
+    entry->dirty = true;
+    return true;
+}
+
+static void session_end(uint16_t conn_id) {
+    stats_entry_t* entry = find_by_conn(conn_id);
+    if (entry) {
+        end_session(entry);
+    }
+}
+
+static void increment_caught(uint16_t conn_id) {
+    stats_entry_t* entry = find_by_conn(conn_id);
+    if (entry) {
+        entry->session.caught++;
+        entry->unsaved.stats.caught++;
+        entry->dirty = true;
+    }
+}
+
+static void increment_spin(uint16_t conn_id) {
+    stats_entry_t* entry = find_by_conn(conn_id);
+    if (entry) {
+        entry->session.spin++;
+        entry->unsaved.stats.spin++;
+        entry->dirty = true;
+    }
+}
+
+// snapshot, read-modify-write of every phone, then stored or back into unsaved
+static bool flush() {
+    stats_record_t delta[STATS_SLOTS];
+    bool taken[STATS_SLOTS] = { false };
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (!entries[i].used) {
+            continue;
+        }
+        account_time(&entries[i]);
+        if (!entries[i].dirty && entries[i].loaded) {
+            continue;
+        }
+        taken[i] = true;
+        delta[i] = entries[i].unsaved;
+        entries[i].unsaved = (stats_record_t){ 0 };
+        entries[i].dirty = false;
+    }
+
+    bool committed = !nvs_fail;
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (!taken[i]) {
+            continue;
+        }
+        if (!committed) {
+            add_record(&entries[i].unsaved, &delta[i]);
+            entries[i].dirty = true;
+            continue;
+        }
+        stats_record_t* stored = nvs_find(entries[i].bda, true);
+        add_record(stored, &delta[i]);
+        stored->version = 1;
+        entries[i].stored = *stored;
+        entries[i].loaded = true;
+    }
+    return committed;
+}
+
+static stats_record_t lifetime(const esp_bd_addr_t bda) {
+    stats_entry_t* entry = find_by_bda(bda);
+    stats_record_t total = entry->stored;
+    add_record(&total, &entry->unsaved);
+    if (entry->conn_id != STATS_NO_CONN) {
+        total.seconds += (now_ms - entry->accounted_at) / 1000;
+    }
+    return total;
+}
+
+static uint16_t stats_rate_per_hour_x10(uint32_t count, uint32_t seconds) {
+    if (seconds == 0) {
+        return 0;
+    }
+    uint64_t rate = (uint64_t)count * 36000 / seconds;
+    return rate > 0xffff ? 0xffff : (uint16_t)rate;
+}
+
+static void reset_ram() {
+    memset(entries, 0, sizeof(entries));
+    use_clock = 0;
+}
+
+static void reset_all() {
+    reset_ram();
+    memset(nvs, 0, sizeof(nvs));
+    nvs_len = 0;
+    nvs_fail = false;
+    now_ms = 0;
+}
+
+static void make_bda(int n, esp_bd_addr_t out) {
+    uint8_t bda[6] = { 0x10, 0x20, 0x30, 0x40, 0x50, (uint8_t)n };
+    memcpy(out, bda, sizeof(esp_bd_addr_t));
+}
+
+void test_conn_id_reuse() {
+    printf("\n=== Test: Reused conn_id Counts For The New Phone ===\n");
+    reset_all();
+
+    esp_bd_addr_t a, b;
+    make_bda(1, a);
+    make_bda(2, b);
+
+    assert(session_start(a, 0));
+    for (int i = 0; i < 3; i++) {
+        increment_caught(0);
+    }
+    session_end(0);
+    increment_caught(0);
+    assert(find_by_bda(a)->session.caught == 3);
+    printf("✓ Counts after the disconnect are dropped, not given to the old phone\n");
+
+    assert(session_start(b, 0));
+    increment_caught(0);
+    increment_spin(0);
+    assert(find_by_bda(a)->session.caught == 3);
+    assert(find_by_bda(b)->session.caught == 1);
+    assert(find_by_bda(b)->session.spin == 1);
+    printf("✓ Phone B on the same conn_id starts at zero, phone A keeps its counts\n");
+
+    // a missed disconnect: A comes back on conn 0 while B still holds it
+    assert(session_start(a, 0));
+    assert(find_by_bda(b)->conn_id == STATS_NO_CONN);
+    assert(find_by_bda(a)->session.caught == 0);
+    assert(lifetime(a).stats.caught == 3);
+    assert(lifetime(a).sessions == 2);
+    printf("✓ A new session unbinds the stale one and resets only the session counts\n");
+}
+
+void test_flush_failure_keeps_counts() {
+    printf("\n=== Test: Failed Flush Keeps Counts ===\n");
+    reset_all();
+
+    esp_bd_addr_t a;
+    make_bda(1, a);
+    assert(session_start(a, 4));
+    increment_caught(4);
+    increment_caught(4);
+    assert(flush());
+    assert(nvs_find(a, false)->stats.caught == 2);
+
+    increment_caught(4);
+    nvs_fail = true;
+    assert(!flush());
+    increment_caught(4);
+    assert(lifetime(a).stats.caught == 4);
+    printf("✓ Counts of a failed flush are back in unsaved with the new ones\n");
+
+    nvs_fail = false;
+    assert(flush());
+    assert(nvs_find(a, false)->stats.caught == 4);
+    assert(flush());
+    assert(nvs_find(a, false)->stats.caught == 4);
+    assert(nvs_find(a, false)->sessions == 1);
+    printf("✓ The retry commits each count once, an idle flush adds nothing\n");
+}
+
+void test_restart_keeps_lifetime() {
+    printf("\n=== Test: Lifetime Totals Survive A Restart ===\n");
+    reset_all();
+
+    esp_bd_addr_t a;
+    make_bda(1, a);
+    assert(session_start(a, 0));
+    for (int i = 0; i < 5; i++) {
+        increment_spin(0);
+    }
+    now_ms += 600 * 1000;
+    session_end(0);
+    assert(flush());
+
+    reset_ram();
+    now_ms = 0;
+    assert(session_start(a, 2));
+    assert(!find_by_bda(a)->loaded);
+    assert(flush());
+    assert(find_by_bda(a)->loaded);
+    increment_spin(2);
+    stats_record_t total = lifetime(a);
+    assert(total.stats.spin == 6);
+    assert(total.sessions == 2);
+    assert(total.seconds == 600);
+    printf("✓ The next boot loads 5 spins, 1 session and 600 s and counts on\n");
+}
+
+void test_connected_time() {
+    printf("\n=== Test: Connected Time Counted Once ===\n");
+    reset_all();
+
+    esp_bd_addr_t a;
+    make_bda(1, a);
+    assert(session_start(a, 1));
+    now_ms += 1500;
+    assert(flush());
+    now_ms += 1500;
+    assert(flush());
+    now_ms += 200;
+    session_end(1);
+    assert(flush());
+    assert(nvs_find(a, false)->seconds == 3);
+    assert(find_by_bda(a)->session_seconds == 3);
+    printf("✓ Whole seconds move at each flush, fractions carry over\n");
+}
+
+void test_eviction_waits_for_flush() {
+    printf("\n=== Test: Unflushed Phones Are Not Evicted ===\n");
+    reset_all();
+
+    esp_bd_addr_t bda;
+    for (int n = 0; n < STATS_SLOTS; n++) {
+        make_bda(n, bda);
+        assert(session_start(bda, n));
+        increment_caught(n);
+        session_end(n);
+    }
+    make_bda(100, bda);
+    assert(!session_start(bda, 0));
+    printf("✓ A full table of unflushed phones refuses a new one\n");
+
+    assert(flush());
+    assert(session_start(bda, 0));
+    make_bda(0, bda);
+    assert(find_by_bda(bda) == NULL);
+    assert(nvs_find(bda, false)->stats.caught == 1);
+    printf("✓ After the flush the least recently used phone makes room, its counts are in NVS\n");
+}
+
+void test_rates() {
+    printf("\n=== Test: Rates Per Hour ===\n");
+
+    assert(stats_rate_per_hour_x10(12, 1800) == 240);
+    assert(stats_rate_per_hour_x10(1, 7200) == 5);
+    printf("✓ 12 in 30 min is 24.0/h, 1 in 2 h is 0.5/h\n");
+
+    assert(stats_rate_per_hour_x10(5, 0) == 0);
+    assert(stats_rate_per_hour_x10(0xffffffff, 1) == 0xffff);
+    printf("✓ No connected time gives 0, huge rates saturate\n");
+}
+
+int main() {
+    printf("========================================\n");
+    printf("Stats Unit Tests\n");
+    printf("========================================\n");
+
+    test_conn_id_reuse();
+    test_flush_failure_keeps_counts();
+    test_restart_keeps_lifetime();
+    test_connected_time();
+    test_eviction_waits_for_flush();
+    test_rates();
+
+    printf("\n========================================\n");
+    printf("✓ All stats tests passed!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+#endif
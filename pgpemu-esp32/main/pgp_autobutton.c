@@ -1,13 +1,14 @@
 #include "pgp_autobutton.h"
 
+#include "entropy.h"
 #include "esp_bt.h"
 #include "esp_gatts_api.h"
 #include "esp_log.h"
-#include "esp_random.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
 #include "log_tags.h"
+#include "metrics.h"
 #include "pgp_gatts.h"
 #include "pgp_handshake_multi.h"
 
@@ -44,8 +45,8 @@ static void autobutton_task(void* __attribute__((unused)) pvParameters) {
             // according to u/EeveesGalore's docs (https://i.imgur.com/7oWjMNu.png) button is
             // sampled every 50 ms byte 0 = samples0,1 (2=LSBit) byte 1 = samples2-9 (10=LSBit)
             // randomize at which sample the button press starts and ends (min. diff 200 ms)
-            int press_start = esp_random() % 6;  // start at sample 0-5
-            int press_last = press_start + 4 + esp_random() % (10 - press_start - 4);
+            int press_start = entropy_word() % 6;  // start at sample 0-5
+            int press_last = press_start + 4 + entropy_word() % (10 - press_start - 4);
             //               ^--min value--^                  ^-min distance to 10-^
             int press_duration = press_last - press_start + 1;
 
@@ -80,6 +81,7 @@ static void autobutton_task(void* __attribute__((unused)) pvParameters) {
                 sizeof(notify_data),
                 notify_data,
                 false);
+            metrics_record_since(METRIC_LED_TO_BUTTON, item.queued_us);
         }
     }
 
@@ -12,6 +12,8 @@ typedef struct {
 
     // delay after which button is pressed
     int delay;
+    // esp_timer_get_time() when the LED notification was handled
+    int64_t queued_us;
 } button_queue_item_t;
 
 extern QueueHandle_t button_queue;
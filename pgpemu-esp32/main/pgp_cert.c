@@ -1,6 +1,7 @@
 /*** encryption and certification ***/
 #include "pgp_cert.h"
 
+#include "entropy.h"
 #include "secrets.h"
 
 #include <stdio.h>
@@ -23,26 +24,51 @@ void aes_setkey(AES_Context* ctx, const uint8_t* key) {
     esp_aes_setkey(ctx, key, 128);
 }
 
+void aes_freekey(AES_Context* ctx) {
+    esp_aes_free(ctx);
+}
+
 #else  // PC target (build cert-test)
 
-#include "pc/aes.h"
+#include "pc/aes_backend.h"
 
 #include <assert.h>
 #include <stdint.h>
 
 void pgp_aes_encrypt(AES_Context* ctx, const uint8_t* inp, uint8_t* out) {
-    memcpy(out, inp, 16);
-    AES_ECB_encrypt(ctx, out);
+    aes_backend_encrypt(ctx, inp, out);
 }
 
 void aes_setkey(AES_Context* ctx, const uint8_t* key) {
-    AES_init_ctx(ctx, key);
+    aes_backend_setkey(ctx, key);
+}
+
+void aes_freekey(AES_Context* ctx) {
+    memset(ctx, 0, sizeof(AES_Context));
+}
+
+static bool cert_debug_dumps = true;
+
+void set_cert_debug_dumps(bool enabled) {
+    cert_debug_dumps = enabled;
 }
 
 #endif
 
 uint8_t flash_data[10] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
+// PGP_DEVICE_KEY never changes after boot, so its schedule is expanded once
+static AES_Context device_key_ctx;
+static bool device_key_ctx_ready = false;
+
+void init_device_key_ctx() {
+    if (device_key_ctx_ready) {
+        aes_freekey(&device_key_ctx);
+    }
+    aes_setkey(&device_key_ctx, PGP_DEVICE_KEY);
+    device_key_ctx_ready = true;
+}
+
 #ifdef ESP_PLATFORM
 static
 #endif
@@ -53,6 +79,9 @@ static
         ESP_LOG_BUFFER_HEX(CERT_TAG, data, len);
     }
 #else
+    if (!cert_debug_dumps) {
+        return;
+    }
     if (msg) {
         printf("%s", msg);
     }
@@ -148,57 +177,156 @@ void aes_ctr(AES_Context* ctx, const uint8_t* nonce, const uint8_t* data, int co
     }
 }
 
+// xor of two 16 byte blocks as 32 bit words, memcpy keeps it legal for the unaligned packed struct fields
+static inline void xor_block(uint8_t* output, const uint8_t* a, const uint8_t* b) {
+    uint32_t wa[4];
+    uint32_t wb[4];
+    memcpy(wa, a, 16);
+    memcpy(wb, b, 16);
+    wa[0] ^= wb[0];
+    wa[1] ^= wb[1];
+    wa[2] ^= wb[2];
+    wa[3] ^= wb[3];
+    memcpy(output, wa, 16);
+}
+
+// one walk over the data for both the counter mode keystream and the CBC-MAC of the plaintext,
+// output/tag are bit-identical to aes_ctr() + encrypt_block(aes_hash()) on the plaintext
+static void aes_ccm(AES_Context* ctx,
+    const uint8_t* nonce,
+    const uint8_t* data,
+    int count,
+    bool decrypt,
+    uint8_t* output,
+    uint8_t* tag) {
+    uint8_t ctr[16];
+    uint8_t keystream[16];
+    uint8_t mac[16];
+    uint8_t mac_in[16];
+    uint8_t plain[16];
+
+    init_nonce_hash(nonce, count, mac_in);
+    pgp_aes_encrypt(ctx, mac_in, mac);
+
+    init_nonce_ctr(nonce, ctr);
+    uint8_t tag_mask[16];
+    pgp_aes_encrypt(ctx, ctr, tag_mask);  // counter 0 encrypts the tag
+
+    int blocks = count / 16;
+    for (int i = 0; i < blocks; i++) {
+        inc_ctr(ctr);
+        pgp_aes_encrypt(ctx, ctr, keystream);
+
+        // the MAC always covers the plaintext, copy it first in case output aliases data
+        if (decrypt) {
+            xor_block(plain, data, keystream);
+            memcpy(output, plain, 16);
+        } else {
+            memcpy(plain, data, 16);
+            xor_block(output, plain, keystream);
+        }
+
+        xor_block(mac_in, mac, plain);
+        pgp_aes_encrypt(ctx, mac_in, mac);
+
+        data += 16;
+        output += 16;
+    }
+
+    xor_block(tag, mac, tag_mask);
+}
+
+void aes_ccm_encrypt(
+    AES_Context* ctx, const uint8_t* nonce, const uint8_t* data, int count, uint8_t* output, uint8_t* tag) {
+    aes_ccm(ctx, nonce, data, count, false, output, tag);
+}
+
+void aes_ccm_decrypt(
+    AES_Context* ctx, const uint8_t* nonce, const uint8_t* data, int count, uint8_t* output, uint8_t* tag) {
+    aes_ccm(ctx, nonce, data, count, true, output, tag);
+}
+
 void randomize_buffer(uint8_t* buf, size_t len) {
-    for (int i = 0; i < len; i++) {
-        // random quality is not important
-        buf[i] = GEN_RANDOM() & 0xff;
+    entropy_fill(buf, len);
+}
+
+// parts of challenge 0 which only depend on the mac and the secrets, built once per boot
+static struct main_challenge_data main_data_template;
+static uint8_t revmac_template[6];
+static uint8_t chal_0_template_mac[6];
+static bool chal_0_template_ready = false;
+
+void init_chal_0_template(const uint8_t* mac) {
+    // mac will be reversed
+    for (int i = 0; i < 6; i++) {
+        revmac_template[i] = mac[5 - i];
+    }
+
+    memset(&main_data_template, 0, sizeof(main_data_template));
+    memcpy(main_data_template.bt_addr, revmac_template, 6);
+    memcpy(main_data_template.flash_data, flash_data, 10);
+
+    memcpy(chal_0_template_mac, mac, 6);
+    chal_0_template_ready = true;
+}
+
+void chal_0_stamp_static(const uint8_t* mac, struct challenge_data* output) {
+    if (!chal_0_template_ready || memcmp(chal_0_template_mac, mac, 6) != 0) {
+        init_chal_0_template(mac);
     }
+    memcpy(output->bt_addr, revmac_template, sizeof(output->bt_addr));
+    // straight from PGP_BLOB, an aligned source copies faster than one inside a packed template
+    memcpy(output->blob, PGP_BLOB, sizeof(output->blob));
 }
 
 void generate_chal_0(const uint8_t* mac,
     const uint8_t* the_challenge,
     const uint8_t* main_nonce,
     const uint8_t* main_key,
+    AES_Context* main_ctx,
     const uint8_t* outer_nonce,
     struct challenge_data* output) {
-    uint8_t revmac[6];
-    uint8_t tmp_hash[16];
-    AES_Context ctx;
+    chal_0_stamp_static(mac, output);
+    generate_chal_0_dynamic(mac, the_challenge, main_nonce, main_key, main_ctx, outer_nonce, output);
+}
 
-    struct main_challenge_data main_data;
-    // mac will be reversed
-    for (int i = 0; i < 6; i++) {
-        revmac[i] = mac[5 - i];
+void generate_chal_0_dynamic(const uint8_t* mac,
+    const uint8_t* the_challenge,
+    const uint8_t* main_nonce,
+    const uint8_t* main_key,
+    AES_Context* main_ctx,
+    const uint8_t* outer_nonce,
+    struct challenge_data* output) {
+    if (!device_key_ctx_ready) {
+        init_device_key_ctx();
     }
-    memcpy(main_data.bt_addr, revmac, 6);
-    memcpy(main_data.key, main_key, 16);
-    memcpy(main_data.nonce, main_nonce, 16);
-    memcpy(main_data.flash_data, flash_data, 10);
+    if (!chal_0_template_ready || memcmp(chal_0_template_mac, mac, 6) != 0) {
+        init_chal_0_template(mac);
+    }
+
+    // the inner plaintext is built right where its ciphertext goes and encrypted in place
+    struct main_challenge_data* main_data = (struct main_challenge_data*)output->encrypted_main_challenge;
+    memcpy(main_data, &main_data_template, sizeof(*main_data));
+    memcpy(main_data->key, main_key, 16);
+    memcpy(main_data->nonce, main_nonce, 16);
 
-    aes_setkey(&ctx, main_key);
-    aes_ctr(&ctx, main_data.nonce, the_challenge, 16, main_data.encrypted_challenge);
-    aes_hash(&ctx, main_data.nonce, the_challenge, 16, tmp_hash);
-    encrypt_block(&ctx, tmp_hash, main_data.nonce, main_data.encrypted_hash);
+    aes_ccm_encrypt(
+        main_ctx, main_data->nonce, the_challenge, 16, main_data->encrypted_challenge, main_data->encrypted_hash);
 
     // outer layer
     memset(output->state, 0, 4);
     memcpy(output->nonce, outer_nonce, 16);
-    memcpy(output->bt_addr, revmac, 6);
-    memcpy(output->blob, PGP_BLOB, 256);
 
-    aes_setkey(&ctx, PGP_DEVICE_KEY);
-    aes_hash(&ctx, output->nonce, (uint8_t*)&main_data, 80, tmp_hash);
-    encrypt_block(&ctx, tmp_hash, output->nonce, output->encrypted_hash);
-    aes_ctr(&ctx, output->nonce, (uint8_t*)&main_data, 80, output->encrypted_main_challenge);
+    aes_ccm_encrypt(&device_key_ctx,
+        output->nonce,
+        output->encrypted_main_challenge,
+        80,
+        output->encrypted_main_challenge,
+        output->encrypted_hash);
 }
 
-void generate_next_chal(const uint8_t* indata,
-    const uint8_t* key,
-    const uint8_t* nonce,
-    struct next_challenge* output) {
-    AES_Context ctx;
+void generate_next_chal(const uint8_t* indata, AES_Context* ctx, const uint8_t* nonce, struct next_challenge* output) {
     uint8_t data[16];
-    uint8_t tmp_hash[16];
 
     if (indata) {
         memcpy(data, indata, 16);
@@ -209,42 +337,25 @@ void generate_next_chal(const uint8_t* indata,
 
     memcpy(output->nonce, nonce, 16);
 
-    aes_setkey(&ctx, key);
-    aes_ctr(&ctx, output->nonce, data, 16, output->encrypted_challenge);
-
-    aes_hash(&ctx, output->nonce, data, 16, tmp_hash);
-    encrypt_block(&ctx, tmp_hash, output->nonce, output->encrypted_hash);
+    aes_ccm_encrypt(ctx, output->nonce, data, 16, output->encrypted_challenge, output->encrypted_hash);
 }
 
-int decrypt_next(const uint8_t* data, const uint8_t* key, uint8_t* output) {
-    AES_Context ctx;
-
+int decrypt_next(const uint8_t* data, AES_Context* ctx, uint8_t* output) {
     const struct next_challenge* chal;
-    aes_setkey(&ctx, key);
     chal = (const struct next_challenge*)data;
-    aes_ctr(&ctx, chal->nonce, chal->encrypted_challenge, 16, output);
 
-    hexdump("CHAL 2:", output, 16);  // this is sent to APP
+    uint8_t tag[16];
+    aes_ccm_decrypt(ctx, chal->nonce, chal->encrypted_challenge, 16, output, tag);
 
-    uint8_t enc_nonce[16];
-    memset(enc_nonce, 0, 16);
-    encrypt_block(&ctx, chal->encrypted_hash, chal->nonce, enc_nonce);
-
-    hexdump("Enc nonce:", enc_nonce, 16);
+    hexdump("CHAL 2:", output, 16);  // this is sent to APP
+    hexdump("Tag:", tag, 16);
 
-    uint8_t hash_1[16];
-    memset(hash_1, 0, 16);
     // test if hash is correct/same
-    aes_hash(&ctx, chal->nonce, output, 16, hash_1);
-
-    hexdump("Hash: ", hash_1, 16);
-    return memcmp(hash_1, enc_nonce, 16) == 0;
+    return memcmp(tag, chal->encrypted_hash, 16) == 0;
 }
 
-void generate_reconnect_response(const uint8_t* key, const uint8_t* challenge, uint8_t* output) {
-    AES_Context ctx;
-    aes_setkey(&ctx, key);
-    pgp_aes_encrypt(&ctx, challenge, output);
+void generate_reconnect_response(AES_Context* ctx, const uint8_t* challenge, uint8_t* output) {
+    pgp_aes_encrypt(ctx, challenge, output);
     for (int i = 0; i < 16; i++) {
         output[i] ^= challenge[i + 16];
     }
@@ -1,20 +1,19 @@
 #ifndef PGP_CERT_H
 #define PGP_CERT_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #ifdef ESP_PLATFORM
 #include "aes/esp_aes.h"
-#include "esp_random.h"
 #include "esp_system.h"
 
 #define AES_Context esp_aes_context
-#define GEN_RANDOM esp_random
 #else
-#include "pc/aes.h"
-#define AES_Context struct AES_ctx
-#define GEN_RANDOM rand
+// PC build: tiny-AES, T-table or AES-NI picked at runtime, see pc/aes_backend.h
+#include "pc/aes_backend.h"
+#define AES_Context struct aes_backend_ctx
 #endif
 
 struct main_challenge_data {
@@ -44,12 +43,29 @@ struct next_challenge {
 
 #ifndef ESP_PLATFORM
 void hexdump(const char* msg, const uint8_t* data, int len);
+
+// Enables/disables the intermediate dumps done by decrypt_next(), so that
+// benchmarks don't end up measuring printf.
+void set_cert_debug_dumps(bool enabled);
 #endif
 
+// fills buf from the entropy pool (see entropy.h)
 void randomize_buffer(uint8_t* buf, size_t len);
 
+// Expands a 128 bit key into ctx. Contexts are meant to be kept around (one per
+// session key, one for PGP_DEVICE_KEY) so the schedule is only built once.
 void aes_setkey(AES_Context* ctx, const uint8_t* key);
 
+// Encrypts one 16 byte block (ECB), esp_aes hardware on the target, the active pc/aes_backend on PC.
+void pgp_aes_encrypt(AES_Context* ctx, const uint8_t* inp, uint8_t* out);
+
+// Wipes a context set up by aes_setkey().
+void aes_freekey(AES_Context* ctx);
+
+// Expands the PGP_DEVICE_KEY schedule used by generate_chal_0(). Call once at boot,
+// after the secrets have been read.
+void init_device_key_ctx();
+
 void aes_hash(AES_Context* ctx, const uint8_t* nonce, const uint8_t* data, const int count, uint8_t* output);
 
 void aes_ctr(AES_Context* ctx, const uint8_t* nonce, const uint8_t* data, int count, uint8_t* output);
@@ -58,17 +74,50 @@ void encrypt_block(AES_Context* ctx, const uint8_t* nonce_iv, const uint8_t* non
 
 void aes_ctr(AES_Context* ctx, const uint8_t* nonce, const uint8_t* data, int count, uint8_t* output);
 
+// Single pass CCM over count bytes (multiple of 16): output gets the counter mode encryption of data and tag
+// the encrypted CBC-MAC, same bytes as aes_ctr() + encrypt_block(aes_hash()) but with one walk over the data.
+void aes_ccm_encrypt(
+    AES_Context* ctx, const uint8_t* nonce, const uint8_t* data, int count, uint8_t* output, uint8_t* tag);
+
+// Inverse of aes_ccm_encrypt(): decrypts data into output and computes the tag over the recovered plaintext,
+// which the caller compares with the received one.
+void aes_ccm_decrypt(
+    AES_Context* ctx, const uint8_t* nonce, const uint8_t* data, int count, uint8_t* output, uint8_t* tag);
+
+// Bytes at the start of struct challenge_data that change with every handshake (state, nonce, encrypted
+// main challenge and hash). bt_addr and blob after them only depend on the mac and PGP_BLOB.
+#define CHAL_0_DYNAMIC_LEN offsetof(struct challenge_data, bt_addr)
+
+// Builds the mac dependent parts of challenge 0 (reversed mac, inner plaintext prefix) once. Call at boot
+// after the secrets are read (generate_chal_0() builds it on first use otherwise).
+void init_chal_0_template(const uint8_t* mac);
+
+// Writes the static bt_addr + blob tail of challenge 0 into output.
+void chal_0_stamp_static(const uint8_t* mac, struct challenge_data* output);
+
+// Writes every field of output in place, main_ctx must already be keyed with main_key (see aes_setkey).
 void generate_chal_0(const uint8_t* mac,
     const uint8_t* the_challenge,
     const uint8_t* main_nonce,
     const uint8_t* main_key,
+    AES_Context* main_ctx,
+    const uint8_t* outer_nonce,
+    struct challenge_data* output);
+
+// Same as generate_chal_0() but only writes the first CHAL_0_DYNAMIC_LEN bytes of output, for buffers whose
+// tail was stamped by chal_0_stamp_static() before.
+void generate_chal_0_dynamic(const uint8_t* mac,
+    const uint8_t* the_challenge,
+    const uint8_t* main_nonce,
+    const uint8_t* main_key,
+    AES_Context* main_ctx,
     const uint8_t* outer_nonce,
     struct challenge_data* output);
 
-void generate_next_chal(const uint8_t* data, const uint8_t* key, const uint8_t* nonce, struct next_challenge* output);
+void generate_next_chal(const uint8_t* data, AES_Context* ctx, const uint8_t* nonce, struct next_challenge* output);
 
-void generate_reconnect_response(const uint8_t* key, const uint8_t* challenge, uint8_t* output);
+void generate_reconnect_response(AES_Context* ctx, const uint8_t* challenge, uint8_t* output);
 
-int decrypt_next(const uint8_t* data, const uint8_t* key, uint8_t* output);
+int decrypt_next(const uint8_t* data, AES_Context* ctx, uint8_t* output);
 
 #endif
@@ -0,0 +1,137 @@
+#include "pgp_cert_pool.h"
+
+#include "entropy.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "log_tags.h"
+#include "mutex_helpers.h"
+#include "pgp_bluetooth.h"
+
+#include <string.h>
+
+typedef struct {
+    uint8_t the_challenge[16];
+    uint8_t main_nonce[16];
+    uint8_t session_key[16];
+    uint8_t outer_nonce[16];
+    uint8_t chal_0[CHAL_0_DYNAMIC_LEN];  // bt_addr and blob are stamped by the handshake buffer's owner
+} cert_pool_entry_t;
+
+// ring buffer of ready certificates, guarded by pool_mutex
+static cert_pool_entry_t pool[CERT_POOL_SIZE];
+static int pool_head = 0;
+static int pool_count = 0;
+static SemaphoreHandle_t pool_mutex = NULL;
+
+static TaskHandle_t pool_task_handle = NULL;
+
+static void cert_pool_task(void* pvParameters);
+
+bool init_cert_pool() {
+    pool_mutex = xSemaphoreCreateMutex();
+    if (!pool_mutex) {
+        ESP_LOGE(CERT_TAG, "%s creating mutex failed", __func__);
+        return false;
+    }
+
+    // below every BLE/button task, certificates are only computed when nothing else wants the CPU
+    BaseType_t ret = xTaskCreate(cert_pool_task, "cert_pool_task", 3072, NULL, tskIDLE_PRIORITY + 1, &pool_task_handle);
+    if (ret != pdPASS) {
+        ESP_LOGE(CERT_TAG, "%s creating task failed", __func__);
+        vSemaphoreDelete(pool_mutex);
+        pool_mutex = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool cert_pool_take(uint8_t* the_challenge,
+    uint8_t* main_nonce,
+    uint8_t* session_key,
+    uint8_t* outer_nonce,
+    struct challenge_data* output) {
+    if (!mutex_acquire_blocking(pool_mutex)) {
+        return false;
+    }
+
+    if (pool_count == 0) {
+        mutex_release(pool_mutex);
+        return false;
+    }
+
+    const cert_pool_entry_t* entry = &pool[pool_head];
+    memcpy(the_challenge, entry->the_challenge, 16);
+    memcpy(main_nonce, entry->main_nonce, 16);
+    memcpy(session_key, entry->session_key, 16);
+    memcpy(outer_nonce, entry->outer_nonce, 16);
+    memcpy(output, entry->chal_0, CHAL_0_DYNAMIC_LEN);
+
+    pool_head = (pool_head + 1) % CERT_POOL_SIZE;
+    pool_count--;
+
+    mutex_release(pool_mutex);
+
+    // wake the task so it refills the slot we just used
+    xTaskNotifyGive(pool_task_handle);
+
+    return true;
+}
+
+static void cert_pool_task(void* __attribute__((unused)) pvParameters) {
+    // built outside the lock so cert_pool_take() never waits for AES work
+    static cert_pool_entry_t next;
+    AES_Context session_ctx;
+
+    ESP_LOGI(CERT_TAG, "cert pool task start");
+
+    while (1) {
+        bool full = true;
+        if (mutex_acquire_blocking(pool_mutex)) {
+            full = (pool_count == CERT_POOL_SIZE);
+            mutex_release(pool_mutex);
+        }
+
+        if (full) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // don't eat the deterministic stream of a seeded run, handshakes bypass the pool meanwhile
+        if (entropy_is_seeded()) {
+            ulTaskNotifyTake(pdTRUE, 1000 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        randomize_buffer(next.the_challenge, 16);
+        randomize_buffer(next.main_nonce, 16);
+        randomize_buffer(next.session_key, 16);
+        randomize_buffer(next.outer_nonce, 16);
+
+        aes_setkey(&session_ctx, next.session_key);
+        // only writes the CHAL_0_DYNAMIC_LEN prefix, which is all the entry has room for
+        generate_chal_0_dynamic(bt_mac,
+            next.the_challenge,
+            next.main_nonce,
+            next.session_key,
+            &session_ctx,
+            next.outer_nonce,
+            (struct challenge_data*)next.chal_0);
+        aes_freekey(&session_ctx);
+
+        if (mutex_acquire_blocking(pool_mutex)) {
+            // only this task adds entries, so there is still room
+            int tail = (pool_head + pool_count) % CERT_POOL_SIZE;
+            memcpy(&pool[tail], &next, sizeof(next));
+            pool_count++;
+            mutex_release(pool_mutex);
+        }
+        memset(&next, 0, sizeof(next));
+
+        ESP_LOGD(CERT_TAG, "cert pool refilled");
+    }
+
+    vTaskDelete(NULL);
+}
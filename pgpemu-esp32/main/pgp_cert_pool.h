@@ -0,0 +1,26 @@
+#ifndef PGP_CERT_POOL_H
+#define PGP_CERT_POOL_H
+
+#include "connection_limits.h"
+#include "pgp_cert.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// number of challenge 0 certificates kept ready (one per possible phone), each entry is ~180 bytes
+#define CERT_POOL_SIZE MAX_CONNECTIONS
+
+// starts the low priority task which keeps CERT_POOL_SIZE challenge 0 certificates precomputed,
+// call after init_bluetooth() because the certificates embed bt_mac
+bool init_cert_pool();
+
+// pops one precomputed certificate together with the random values it was built from (16 bytes each), only
+// its first CHAL_0_DYNAMIC_LEN bytes are written and the tail has to be stamped by chal_0_stamp_static();
+// returns false if the pool is empty and the caller has to run generate_chal_0_dynamic() itself
+bool cert_pool_take(uint8_t* the_challenge,
+    uint8_t* main_nonce,
+    uint8_t* session_key,
+    uint8_t* outer_nonce,
+    struct challenge_data* output);
+
+#endif /* PGP_CERT_POOL_H */
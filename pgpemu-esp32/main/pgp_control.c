@@ -2,6 +2,8 @@
 
 #include "config_secrets.h"  // reset_secrets()
 #include "config_storage.h"  // write_global_settings_to_nvs, write_devices_settings_to_nvs
+#include "device_directory.h"  // device_directory_set_capacity, device_directory_serialize
+#include "entropy.h"         // entropy_seed, entropy_unseed
 #include "esp_gap_ble_api.h"
 #include "esp_gatt_defs.h"
 #include "esp_log.h"
@@ -10,12 +12,16 @@
 #include "freertos/task.h"  // vTaskList
 #include "led_output.h"     // get_led_advertising
 #include "log_tags.h"
+#include "metrics.h"              // metrics_serialize, metrics_reset
+#include "nvs_helper.h"           // nvs_stats_serialize
 #include "pgp_gap.h"              // pgp_advertise, pgp_advertise_stop
 #include "pgp_gatts.h"            // MAX_VALUE_LENGTH
-#include "pgp_handshake_multi.h"  // dump_client_states_format, get_active_connections, reset_client_states
+#include "pgp_gatts_dispatch.h"   // gatts_dispatch_register
+#include "pgp_handshake.h"        // handshake_latency_serialize
+#include "pgp_handshake_multi.h"  // MAX_CONNECTIONS, dump_client_states_format, get_active_connections, ...
 #include "secrets.h"              // PGP_CLONE_NAME, PGP_MAC, PGP_DEVICE_KEY, PGP_BLOB
 #include "settings.h"             // global_settings, get_setting*, set_setting_uint8, cycle_log_level, toggle_device_*
-#include "stats.h"                // stats_format_runtime
+#include "stats.h"                // stats_format_runtime, stats_serialize, stats_get_for_conn
 
 #include <stdio.h>
 #include <string.h>
@@ -145,21 +151,6 @@ void pgp_control_create_attr_table(esp_gatt_if_t gatts_if) {
     }
 }
 
-bool pgp_control_handle_attr_tab_created(esp_ble_gatts_cb_param_t* param) {
-    if (param->add_attr_tab.svc_uuid.len != ESP_UUID_LEN_128
-        || memcmp(param->add_attr_tab.svc_uuid.uuid.uuid128, GATTS_SERVICE_UUID_CONTROL, ESP_UUID_LEN_128) != 0) {
-        return false;
-    }
-
-    memcpy(control_handle_table, param->add_attr_tab.handles, sizeof(control_handle_table));
-    esp_err_t err = esp_ble_gatts_start_service(control_handle_table[IDX_CONTROL_SVC]);
-    if (err != ESP_OK) {
-        ESP_LOGE(CONTROL_TAG, "failed starting service: %d", err);
-    }
-    ESP_LOGD(CONTROL_TAG, "create control attribute table success, handle = %d", param->add_attr_tab.num_handle);
-    return true;
-}
-
 static void pgp_control_send_response(esp_gatt_if_t gatts_if,
     uint16_t conn_id,
     control_status_t status,
@@ -232,13 +223,15 @@ static void pgp_control_handle_command_write(esp_gatt_if_t gatts_if,
             "- ba - stop advertising\n"
             "- bs - show client states\n"
             "- br - clear connections\n"
-            "- b[1,4] - set maximum client connections (e.g. 3 clients max. with 'b3', up to %d, currently %d)\n"
+            "- b[1,%d] - set maximum client connections (e.g. 3 clients max. with 'b3', currently %d)\n"
             "Device Settings:\n"
-            "- [1,4]s - toggle autospin\n"
-            "- [1,4]c - toggle autocatch\n",
+            "- [1,%d]s - toggle autospin\n"
+            "- [1,%d]c - toggle autocatch\n",
             PGP_CLONE_NAME,
-            CONFIG_BT_ACL_CONNECTIONS,
-            get_setting_uint8(&global_settings.target_active_connections));
+            MAX_CONNECTIONS,
+            get_setting_uint8(&global_settings.target_active_connections),
+            MAX_CONNECTIONS,
+            MAX_CONNECTIONS);
         resp_len = (n > 0) ? (size_t)n : 0;
         break;
     }
@@ -247,7 +240,8 @@ static void pgp_control_handle_command_write(esp_gatt_if_t gatts_if,
         resp[1] = get_setting(&global_settings.advertising_enabled) ? 1 : 0;
         resp[2] = (uint8_t)get_active_connections();
         resp[3] = get_setting_uint8(&global_settings.target_active_connections);
-        resp_len = 4;
+        resp[4] = MAX_CONNECTIONS;  // upper bound for SET_MAX_CONNECTIONS and the slot count of GET_CLIENT_SUMMARY
+        resp_len = 5;
         break;
     }
     case CONTROL_OP_SAVE_SETTINGS: {
@@ -330,7 +324,7 @@ static void pgp_control_handle_command_write(esp_gatt_if_t gatts_if,
         break;
     }
     case CONTROL_OP_SET_MAX_CONNECTIONS: {
-        if (payload_len < 1 || payload[0] < 1 || payload[0] > CONFIG_BT_ACL_CONNECTIONS) {
+        if (payload_len < 1 || payload[0] < 1 || payload[0] > MAX_CONNECTIONS) {
             status = CONTROL_STATUS_ERR_MALFORMED_PAYLOAD;
             break;
         }
@@ -340,7 +334,7 @@ static void pgp_control_handle_command_write(esp_gatt_if_t gatts_if,
         break;
     }
     case CONTROL_OP_TOGGLE_AUTOSPIN: {
-        if (payload_len < 1 || payload[0] > 3) {
+        if (payload_len < 1 || payload[0] >= MAX_CONNECTIONS) {
             status = CONTROL_STATUS_ERR_MALFORMED_PAYLOAD;
             break;
         }
@@ -349,7 +343,7 @@ static void pgp_control_handle_command_write(esp_gatt_if_t gatts_if,
         break;
     }
     case CONTROL_OP_TOGGLE_AUTOCATCH: {
-        if (payload_len < 1 || payload[0] > 3) {
+        if (payload_len < 1 || payload[0] >= MAX_CONNECTIONS) {
             status = CONTROL_STATUS_ERR_MALFORMED_PAYLOAD;
             break;
         }
@@ -358,8 +352,9 @@ static void pgp_control_handle_command_write(esp_gatt_if_t gatts_if,
         break;
     }
     case CONTROL_OP_GET_CLIENT_SUMMARY: {
+        // counts of the current session, saturated to u16; lifetime totals are in GET_DEVICE_STATS
         size_t offset = 0;
-        for (int i = 0; i < CONFIG_BT_ACL_CONNECTIONS; i++) {
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
             client_state_t* entry = get_client_state_entry_by_idx(i);
             uint16_t conn_id = entry ? entry->conn_id : 0xffff;
             uint8_t flags = 0;
@@ -383,16 +378,80 @@ static void pgp_control_handle_command_write(esp_gatt_if_t gatts_if,
             resp[offset++] = flags;
             resp[offset++] = autospin;
             resp[offset++] = autocatch;
-            resp[offset++] = (uint8_t)(stats.caught & 0xFF);
-            resp[offset++] = (uint8_t)(stats.caught >> 8);
-            resp[offset++] = (uint8_t)(stats.fled & 0xFF);
-            resp[offset++] = (uint8_t)(stats.fled >> 8);
-            resp[offset++] = (uint8_t)(stats.spin & 0xFF);
-            resp[offset++] = (uint8_t)(stats.spin >> 8);
+            uint16_t caught = stats.caught > 0xffff ? 0xffff : (uint16_t)stats.caught;
+            uint16_t fled = stats.fled > 0xffff ? 0xffff : (uint16_t)stats.fled;
+            uint16_t spin = stats.spin > 0xffff ? 0xffff : (uint16_t)stats.spin;
+            resp[offset++] = (uint8_t)(caught & 0xFF);
+            resp[offset++] = (uint8_t)(caught >> 8);
+            resp[offset++] = (uint8_t)(fled & 0xFF);
+            resp[offset++] = (uint8_t)(fled >> 8);
+            resp[offset++] = (uint8_t)(spin & 0xFF);
+            resp[offset++] = (uint8_t)(spin >> 8);
         }
         resp_len = offset;
         break;
     }
+#ifdef ENTROPY_SEEDABLE
+    // only with CONFIG_PGPEMU_DEBUG_ENTROPY, release firmware answers unknown opcode
+    case CONTROL_OP_SET_ENTROPY_SEED: {
+        // payload: u32 LE seed for reproducible nonces/keys, empty payload goes back to the hardware RNG
+        if (payload_len == 0) {
+            entropy_unseed();
+        } else if (payload_len == 4) {
+            entropy_seed((uint32_t)payload[0] | ((uint32_t)payload[1] << 8) | ((uint32_t)payload[2] << 16) |
+                         ((uint32_t)payload[3] << 24));
+        } else {
+            status = CONTROL_STATUS_ERR_MALFORMED_PAYLOAD;
+            break;
+        }
+        resp[0] = entropy_is_seeded() ? 1 : 0;
+        resp_len = 1;
+        break;
+    }
+#endif
+    case CONTROL_OP_GET_HANDSHAKE_LATENCY: {
+        // HANDSHAKE_LATENCY_RECORD_LEN bytes per handshake state, see pgp_handshake.h
+        resp_len = handshake_latency_serialize(resp, sizeof(resp));
+        break;
+    }
+    case CONTROL_OP_GET_NVS_STATS: {
+        // NVS_STATS_HEADER_LEN bytes of partition usage, then NVS_STATS_RECORD_LEN per namespace, see nvs_helper.h
+        resp_len = nvs_stats_serialize(resp, sizeof(resp));
+        status = resp_len > 0 ? CONTROL_STATUS_OK : CONTROL_STATUS_ERR_INTERNAL;
+        break;
+    }
+    case CONTROL_OP_DEVICE_STORE: {
+        // optional [capacity u8] sets max_stored_devices (saved by SAVE_SETTINGS), the response is
+        // DEVICE_STORE_STATS_LEN bytes, see device_directory.h
+        if (payload_len >= 1) {
+            if (payload[0] < 1 || payload[0] > DEVICE_DIRECTORY_SIZE) {
+                status = CONTROL_STATUS_ERR_MALFORMED_PAYLOAD;
+                break;
+            }
+            if (!set_setting_uint8(&global_settings.max_stored_devices, payload[0])) {
+                status = CONTROL_STATUS_ERR_INTERNAL;
+                break;
+            }
+            device_directory_set_capacity(payload[0]);
+        }
+        resp_len = device_directory_serialize(resp, sizeof(resp));
+        break;
+    }
+    case CONTROL_OP_GET_DEVICE_STATS: {
+        // optional [first u8] pages through the phones, STATS_HEADER_LEN bytes then STATS_RECORD_LEN per phone,
+        // see stats.h
+        resp_len = stats_serialize(payload_len >= 1 ? payload[0] : 0, resp, sizeof(resp));
+        break;
+    }
+    case CONTROL_OP_GET_METRICS: {
+        // METRICS_HEADER_LEN bytes then METRICS_RECORD_LEN per metric, see metrics.h;
+        // a non-zero [reset u8] starts the histograms over after they were read
+        resp_len = metrics_serialize(resp, sizeof(resp));
+        if (payload_len >= 1 && payload[0] != 0) {
+            metrics_reset();
+        }
+        break;
+    }
     default:
         status = CONTROL_STATUS_ERR_UNKNOWN_OPCODE;
         break;
@@ -401,16 +460,35 @@ static void pgp_control_handle_command_write(esp_gatt_if_t gatts_if,
     pgp_control_send_response(gatts_if, conn_id, status, opcode, resp, resp_len);
 }
 
-bool pgp_control_try_handle_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
-    if (control_handle_table[IDX_CHAR_CONTROL_COMMAND_VAL] == param->write.handle) {
-        pgp_control_handle_command_write(gatts_if, param->write.conn_id, param->write.value, param->write.len);
-        return true;
+static bool on_command_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
+    pgp_control_handle_command_write(gatts_if, param->write.conn_id, param->write.value, param->write.len);
+    return true;
+}
+
+static bool on_response_cfg_write(esp_gatt_if_t __attribute__((unused)) gatts_if, esp_ble_gatts_cb_param_t* param) {
+    // Client toggling indications on/off — no action needed beyond the
+    // CCCD write itself, which ESP_GATT_AUTO_RSP already handles.
+    ESP_LOGD(CONTROL_TAG, "[%d] control response indicate CCCD write", param->write.conn_id);
+    return true;
+}
+
+static const gatts_write_handler_t control_write_handlers[CONTROL_LAST_IDX] = {
+    [IDX_CHAR_CONTROL_COMMAND_VAL] = on_command_write,
+    [IDX_CHAR_CONTROL_RESPONSE_CFG] = on_response_cfg_write,
+};
+
+bool pgp_control_handle_attr_tab_created(esp_ble_gatts_cb_param_t* param) {
+    if (param->add_attr_tab.svc_uuid.len != ESP_UUID_LEN_128
+        || memcmp(param->add_attr_tab.svc_uuid.uuid.uuid128, GATTS_SERVICE_UUID_CONTROL, ESP_UUID_LEN_128) != 0) {
+        return false;
     }
-    if (control_handle_table[IDX_CHAR_CONTROL_RESPONSE_CFG] == param->write.handle) {
-        // Client toggling indications on/off — no action needed beyond the
-        // CCCD write itself, which ESP_GATT_AUTO_RSP already handles.
-        ESP_LOGD(CONTROL_TAG, "[%d] control response indicate CCCD write", param->write.conn_id);
-        return true;
+
+    memcpy(control_handle_table, param->add_attr_tab.handles, sizeof(control_handle_table));
+    gatts_dispatch_register(GATTS_SVC_CONTROL, control_handle_table, CONTROL_LAST_IDX, control_write_handlers);
+    esp_err_t err = esp_ble_gatts_start_service(control_handle_table[IDX_CONTROL_SVC]);
+    if (err != ESP_OK) {
+        ESP_LOGE(CONTROL_TAG, "failed starting service: %d", err);
     }
-    return false;
+    ESP_LOGD(CONTROL_TAG, "create control attribute table success, handle = %d", param->add_attr_tab.num_handle);
+    return true;
 }
@@ -42,6 +42,12 @@ typedef enum {
     CONTROL_OP_TOGGLE_AUTOSPIN = 0x10,
     CONTROL_OP_TOGGLE_AUTOCATCH = 0x11,
     CONTROL_OP_GET_CLIENT_SUMMARY = 0x12,
+    CONTROL_OP_SET_ENTROPY_SEED = 0x13,  // CONFIG_PGPEMU_DEBUG_ENTROPY builds only
+    CONTROL_OP_GET_HANDSHAKE_LATENCY = 0x14,
+    CONTROL_OP_GET_NVS_STATS = 0x15,
+    CONTROL_OP_DEVICE_STORE = 0x16,
+    CONTROL_OP_GET_DEVICE_STATS = 0x17,
+    CONTROL_OP_GET_METRICS = 0x18,
 } control_opcode_t;
 
 typedef enum {
@@ -60,12 +66,8 @@ void pgp_control_create_attr_table(esp_gatt_if_t gatts_if);
 // Called from pgp_gatts.c's ESP_GATTS_CREAT_ATTR_TAB_EVT after the existing
 // battery/led/cert checks find no match. Returns true (and finishes
 // starting the service) if this event was for the Control Service.
+// Also registers the Control write handlers with pgp_gatts_dispatch, which
+// ESP_GATTS_WRITE_EVT looks them up in.
 bool pgp_control_handle_attr_tab_created(esp_ble_gatts_cb_param_t* param);
 
-// Called from pgp_gatts.c's ESP_GATTS_WRITE_EVT handle-comparison chain,
-// same slot as handle_pgp_handshake_first/second. Returns true if the
-// write targeted a Control Service handle (and was handled); false lets
-// pgp_gatts.c fall through to its existing unknown-handle logging.
-bool pgp_control_try_handle_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param);
-
 #endif /* PGP_CONTROL_H */
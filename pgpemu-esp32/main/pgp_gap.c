@@ -27,16 +27,26 @@ static esp_ble_adv_params_t adv_params = {
 };
 
 void advertise_if_needed() {
+    advertise_for_connections(get_active_connections());
+}
+
+void advertise_for_connections(int active_connections) {
+    int target_active_connections = get_setting_uint8(&global_settings.target_active_connections);
+    if (active_connections >= target_active_connections) {
+        ESP_LOGI(BT_GAP_TAG,
+            "not advertising, %d/%d connections reached",
+            active_connections,
+            target_active_connections);
+        if (get_led_advertising()) {
+            pgp_advertise_stop();
+        }
+        return;
+    }
     if (!get_setting(&global_settings.advertising_enabled)) {
         ESP_LOGD(BT_GAP_TAG, "advertising disabled, not starting");
         return;
     }
-    int target_active_connections = get_setting_uint8(&global_settings.target_active_connections);
-    if (get_active_connections() < target_active_connections) {
-        pgp_advertise();
-    } else {
-        ESP_LOGI(BT_GAP_TAG, "not advertising again, %d connections reached", target_active_connections);
-    }
+    pgp_advertise();
 }
 
 void pgp_advertise() {
@@ -13,6 +13,10 @@ extern uint8_t adv_config_done;
 // start BT advertising if we have fewer connections than configured
 void advertise_if_needed();
 
+// same decision for a connection count the caller already has (e.g. right after counting a phone):
+// advertise below target_active_connections, stop advertising at or above it
+void advertise_for_connections(int active_connections);
+
 // close every connections
 void pgp_disconnect();
 
@@ -14,10 +14,12 @@
 #include "pgp_control.h"
 #include "pgp_gap.h"
 #include "pgp_gatts_debug.h"
+#include "pgp_gatts_dispatch.h"
 #include "pgp_handshake.h"
 #include "pgp_handshake_multi.h"
 #include "pgp_led_handler.h"
 #include "secrets.h"
+#include "session_prefetch.h"
 #include "settings.h"
 
 #include <stdlib.h>
@@ -141,7 +143,6 @@ static const uint8_t char_prop_write = ESP_GATT_CHAR_PROP_BIT_WRITE;
 static const uint8_t char_prop_read_notify = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
 static const uint8_t char_prop_notify = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
 static const uint8_t dummy_value[2] = { 0x00, 0x00 };
-static uint8_t cert_buffer[378] = { 0 };
 
 static const uint16_t GATTS_SERVICE_UUID_BATTERY = 0x180f;
 static const uint16_t GATTS_CHAR_UUID_BATTERY_LEVEL = 0x2a19;
@@ -520,8 +521,40 @@ static const esp_gatts_attr_db_t gatt_db_certificate[CERT_LAST_IDX] = {
             (uint8_t*)&GATTS_CHAR_UUID_SFIDA_TO_CENTRAL,
             ESP_GATT_PERM_READ,
             MAX_VALUE_LENGTH,
-            sizeof(cert_buffer),
-            (uint8_t*)cert_buffer } },
+            sizeof(dummy_value),
+            (uint8_t*)dummy_value } },
+};
+
+static bool on_led_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
+    handle_led_notify_from_app(gatts_if, param->write.conn_id, param->write.value);
+    return false;
+}
+
+static bool on_button_cfg_write(esp_gatt_if_t __attribute__((unused)) gatts_if,
+    esp_ble_gatts_cb_param_t* __attribute__((unused)) param) {
+    ESP_LOGW(BT_GATTS_TAG, "%s: unhandled CHAR_BUTTON_CFG", __func__);
+    return false;
+}
+
+static bool on_cert_commands_cfg_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
+    uint16_t descr_value = param->write.value[1] << 8 | param->write.value[0];
+    handle_pgp_handshake_first(gatts_if, descr_value, param->write.conn_id);
+    return true;
+}
+
+static bool on_cert_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
+    handle_pgp_handshake_second(gatts_if, param->write.value, param->write.len, param->write.conn_id);
+    return true;
+}
+
+static const gatts_write_handler_t led_button_write_handlers[LED_BUTTON_LAST_IDX] = {
+    [IDX_CHAR_LED_VAL] = on_led_write,
+    [IDX_CHAR_BUTTON_CFG] = on_button_cfg_write,
+};
+
+static const gatts_write_handler_t cert_write_handlers[CERT_LAST_IDX] = {
+    [IDX_CHAR_SFIDA_COMMANDS_CFG] = on_cert_commands_cfg_write,
+    [IDX_CHAR_CENTRAL_TO_SFIDA_VAL] = on_cert_write,
 };
 
 void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
@@ -573,7 +606,7 @@ void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
             "[%d] ESP_GATTS_READ_EVT: %s",
             param->read.conn_id,
             char_name_from_handle(param->read.handle));
-        if (pgp_get_handshake_state(param->read.conn_id) == 1) {
+        if (pgp_get_handshake_state(param->read.conn_id) == CERT_STATE_NEXT_CHAL) {
             if (esp_log_level_get(BT_GATTS_TAG) >= ESP_LOG_VERBOSE) {
                 ESP_LOGV(BT_GATTS_TAG, "DATA SENT TO APP");
                 if (gatt_db_certificate[IDX_CHAR_SFIDA_TO_CENTRAL_VAL].att_desc.value) {
@@ -596,49 +629,35 @@ void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
                 ESP_LOG_BUFFER_HEX(BT_GATTS_TAG, param->write.value, param->write.len);
             }
 
-            ESP_LOGD(BT_GATTS_TAG,
-                "idx %d tabl %d",
-                IDX_CHAR_SFIDA_COMMANDS_CFG,
-                certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_CFG]);
-            ESP_LOGD(BT_GATTS_TAG,
-                "idx %d tabl %d",
-                IDX_CHAR_CENTRAL_TO_SFIDA_VAL,
-                certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_CFG]);
-
-            if (certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_CFG] == param->write.handle) {
-                uint16_t descr_value = param->write.value[1] << 8 | param->write.value[0];
-                handle_pgp_handshake_first(gatts_if, descr_value, param->write.conn_id);
-            } else if (certificate_handle_table[IDX_CHAR_CENTRAL_TO_SFIDA_VAL] == param->write.handle) {
-                handle_pgp_handshake_second(gatts_if, param->write.value, param->write.len, param->write.conn_id);
-            } else if (led_button_handle_table[IDX_CHAR_LED_VAL] == param->write.handle) {
-                handle_led_notify_from_app(gatts_if, param->write.conn_id, param->write.value);
-                return;
-            } else if (led_button_handle_table[IDX_CHAR_BUTTON_CFG] == param->write.handle) {
-                ESP_LOGW(BT_GATTS_TAG, "%s: unhandled CHAR_BUTTON_CFG", __func__);
-                return;
-            } else if (pgp_control_try_handle_write(gatts_if, param)) {
-                // handled inside pgp_control.c
+            // one table lookup for every write, filled from ESP_GATTS_CREAT_ATTR_TAB_EVT
+            const gatts_attr_t* attr = gatts_dispatch_lookup(param->write.handle);
+            if (attr && attr->on_write) {
+                if (!attr->on_write(gatts_if, param)) {
+                    return;
+                }
+            } else if (attr) {
+                ESP_LOGW(BT_GATTS_TAG,
+                    "%s: unhandled write to %s",
+                    __func__,
+                    char_name_from_handle(param->write.handle));
             } else {
-                ESP_LOGW(BT_GATTS_TAG, "%s: unknown handle %d", __func__, param->write.handle);
-                // dump all tables
+                uint16_t base = gatts_dispatch_base();
+                if (param->write.handle < base || param->write.handle - base >= GATTS_DISPATCH_ATTRS) {
+                    ESP_LOGE(BT_GATTS_TAG,
+                        "%s: handle %d outside the dispatch table (%d-%d)",
+                        __func__,
+                        param->write.handle,
+                        base,
+                        base + GATTS_DISPATCH_ATTRS - 1);
+                } else {
+                    ESP_LOGW(BT_GATTS_TAG, "%s: unknown handle %d", __func__, param->write.handle);
+                }
+                // dump all handles
                 if (esp_log_level_get(BT_GATTS_TAG) >= ESP_LOG_DEBUG) {
-                    for (int i = 0; i < BATTERY_LAST_IDX; i++) {
-                        ESP_LOGD(BT_GATTS_TAG,
-                            "handle: batt %d=%s",
-                            battery_handle_table[i],
-                            char_name_from_handle(battery_handle_table[i]));
-                    }
-                    for (int i = 0; i < LED_BUTTON_LAST_IDX; i++) {
-                        ESP_LOGD(BT_GATTS_TAG,
-                            "handle: ledb %d=%s",
-                            led_button_handle_table[i],
-                            char_name_from_handle(led_button_handle_table[i]));
-                    }
-                    for (int i = 0; i < CERT_LAST_IDX; i++) {
-                        ESP_LOGD(BT_GATTS_TAG,
-                            "handle: cert %d=%s",
-                            certificate_handle_table[i],
-                            char_name_from_handle(certificate_handle_table[i]));
+                    for (int handle = base; handle < base + GATTS_DISPATCH_ATTRS; handle++) {
+                        if (gatts_dispatch_lookup(handle)) {
+                            ESP_LOGD(BT_GATTS_TAG, "handle: %d=%s", handle, char_name_from_handle(handle));
+                        }
                     }
                 }
             }
@@ -698,6 +717,9 @@ void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
 
         set_remote_bda(param->connect.conn_id, conn_params.bda);
 
+        // the phone subscribes (and we need its session keys) a few round trips later, read them meanwhile
+        session_prefetch_start(param->connect.conn_id, conn_params.bda);
+
         // Load device settings for this connection
         client_state_t* client_entry = get_client_state_entry(param->connect.conn_id);
         if (client_entry) {
@@ -738,7 +760,7 @@ void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
         // though active_connections only increments once (if ever) the PGP handshake finishes.
         // A connection that never runs the handshake (e.g. the companion app, which only talks
         // to the Control service) would otherwise leave advertising off with nothing left to
-        // turn it back on, since connection_start()'s advertise_if_needed() call never runs for
+        // turn it back on, since connection_start()'s advertising decision never runs for
         // it. Re-arm advertising here so any client type that stays under target_active_connections
         // keeps the device discoverable to others (e.g. Pokemon GO) after it connects.
         advertise_if_needed();
@@ -776,6 +798,7 @@ void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
         if (param->add_attr_tab.svc_uuid.len == ESP_UUID_LEN_16) {
             if (param->add_attr_tab.svc_uuid.uuid.uuid16 == GATTS_SERVICE_UUID_BATTERY) {
                 memcpy(battery_handle_table, param->add_attr_tab.handles, sizeof(battery_handle_table));
+                gatts_dispatch_register(GATTS_SVC_BATTERY, battery_handle_table, BATTERY_LAST_IDX, NULL);
                 esp_ble_gatts_start_service(battery_handle_table[IDX_BATTERY_SVC]);
                 ESP_LOGD(BT_GATTS_TAG,
                     "create battery attribute table success, handle = %d",
@@ -788,6 +811,8 @@ void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
             if (memcmp(param->add_attr_tab.svc_uuid.uuid.uuid128, GATTS_SERVICE_UUID_LED_BUTTON, ESP_UUID_LEN_128)
                 == 0) {
                 memcpy(led_button_handle_table, param->add_attr_tab.handles, sizeof(led_button_handle_table));
+                gatts_dispatch_register(
+                    GATTS_SVC_LED_BUTTON, led_button_handle_table, LED_BUTTON_LAST_IDX, led_button_write_handlers);
                 esp_err_t response_err = esp_ble_gatts_start_service(led_button_handle_table[IDX_LED_BUTTON_SVC]);
                 if (response_err != ESP_OK) {
                     ESP_LOGE(BT_GATTS_TAG, "failed starting service: %d", response_err);
@@ -800,6 +825,7 @@ void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
             if (memcmp(param->add_attr_tab.svc_uuid.uuid.uuid128, GATTS_SERVICE_UUID_CERTIFICATE, ESP_UUID_LEN_128)
                 == 0) {
                 memcpy(certificate_handle_table, param->add_attr_tab.handles, sizeof(certificate_handle_table));
+                gatts_dispatch_register(GATTS_SVC_CERT, certificate_handle_table, CERT_LAST_IDX, cert_write_handlers);
                 esp_err_t response_err = esp_ble_gatts_start_service(certificate_handle_table[IDX_CERT_SVC]);
                 if (response_err != ESP_OK) {
                     ESP_LOGE(BT_GATTS_TAG, "failed starting service: %d", response_err);
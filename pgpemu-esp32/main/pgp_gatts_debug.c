@@ -2,6 +2,7 @@
 
 #include "pgp_control.h"
 #include "pgp_gatts.h"
+#include "pgp_gatts_dispatch.h"
 
 #include <stdint.h>
 
@@ -43,31 +44,24 @@ static const char* control_char_names[] = { "CONTROL_SVC",
 
 static const char* UNKNOWN_HANDLE_NAME = "<UNKNOWN HANDLE NAME>";
 
-static int find_handle_index(uint16_t handle, uint16_t* handle_table, int count) {
-    for (int i = 0; i < count; i++) {
-        if (handle_table[i] == handle)
-            return i;
-    }
-    return -1;
-}
+#define CHAR_NAMES(names) { names, sizeof(names) / sizeof(names[0]) }
+
+// names of each service's attributes, indexed like gatts_service_t
+static const struct {
+    const char** names;
+    int count;
+} service_char_names[GATTS_SVC_COUNT] = {
+    [GATTS_SVC_BATTERY] = CHAR_NAMES(battery_char_names),
+    [GATTS_SVC_LED_BUTTON] = CHAR_NAMES(led_button_char_names),
+    [GATTS_SVC_CERT] = CHAR_NAMES(cert_char_names),
+    [GATTS_SVC_CONTROL] = CHAR_NAMES(control_char_names),
+};
 
 // for debugging
 const char* char_name_from_handle(uint16_t handle) {
-    int idx;
-    idx = find_handle_index(handle, battery_handle_table, BATTERY_LAST_IDX);
-    if (idx >= 0)
-        return battery_char_names[idx];
-    idx = find_handle_index(handle, led_button_handle_table, LED_BUTTON_LAST_IDX);
-    if (idx >= 0)
-        return led_button_char_names[idx];
-
-    idx = find_handle_index(handle, certificate_handle_table, CERT_LAST_IDX);
-    if (idx >= 0)
-        return cert_char_names[idx];
-
-    idx = find_handle_index(handle, control_handle_table, CONTROL_LAST_IDX);
-    if (idx >= 0)
-        return control_char_names[idx];
-
-    return UNKNOWN_HANDLE_NAME;
-}
\ No newline at end of file
+    const gatts_attr_t* attr = gatts_dispatch_lookup(handle);
+    if (!attr || attr->index >= service_char_names[attr->service].count) {
+        return UNKNOWN_HANDLE_NAME;
+    }
+    return service_char_names[attr->service].names[attr->index];
+}
@@ -0,0 +1,73 @@
+#include "pgp_gatts_dispatch.h"
+
+#include "esp_log.h"
+#include "log_tags.h"
+
+#include <string.h>
+
+// indexed by handle - base, only written while the services are created
+static gatts_attr_t attrs[GATTS_DISPATCH_ATTRS];
+static uint16_t base = 0;
+// one past the highest handle registered
+static uint16_t end = 0;
+
+// moves the table down to start at handle, if everything registered still fits
+static void rebase(uint16_t handle) {
+    if (base == 0) {
+        base = end = handle;
+        return;
+    }
+    if (handle >= base || end - handle > GATTS_DISPATCH_ATTRS) {
+        return;
+    }
+    int shift = base - handle;
+    memmove(&attrs[shift], &attrs[0], (end - base) * sizeof(gatts_attr_t));
+    memset(&attrs[0], 0, shift * sizeof(gatts_attr_t));
+    base = handle;
+}
+
+void gatts_dispatch_register(gatts_service_t service,
+    const uint16_t* handles,
+    int count,
+    const gatts_write_handler_t* handlers) {
+    uint16_t lowest = 0;
+    for (int i = 0; i < count; i++) {
+        if (handles[i] != 0 && (lowest == 0 || handles[i] < lowest)) {
+            lowest = handles[i];
+        }
+    }
+    if (lowest != 0) {
+        rebase(lowest);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (handles[i] == 0 || handles[i] < base || handles[i] - base >= GATTS_DISPATCH_ATTRS) {
+            ESP_LOGE(BT_GATTS_TAG,
+                "service %d attribute %d has handle %d outside the dispatch table (%d-%d), writes to it are ignored",
+                service,
+                i,
+                handles[i],
+                base,
+                base + GATTS_DISPATCH_ATTRS - 1);
+            continue;
+        }
+        gatts_attr_t* attr = &attrs[handles[i] - base];
+        attr->service = service;
+        attr->index = i;
+        attr->on_write = handlers ? handlers[i] : NULL;
+        if (handles[i] >= end) {
+            end = handles[i] + 1;
+        }
+    }
+}
+
+const gatts_attr_t* gatts_dispatch_lookup(uint16_t handle) {
+    if (handle < base || handle - base >= GATTS_DISPATCH_ATTRS || attrs[handle - base].service == GATTS_SVC_NONE) {
+        return NULL;
+    }
+    return &attrs[handle - base];
+}
+
+uint16_t gatts_dispatch_base() {
+    return base;
+}
@@ -0,0 +1,46 @@
+#ifndef PGP_GATTS_DISPATCH_H
+#define PGP_GATTS_DISPATCH_H
+
+#include "esp_gatts_api.h"
+#include "pgp_control.h"
+#include "pgp_gatts.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// one entry per attribute of our four services, indexed by handle - base; Bluedroid hands the handles out
+// consecutively, base is the lowest one registered
+#define GATTS_DISPATCH_ATTRS (BATTERY_LAST_IDX + LED_BUTTON_LAST_IDX + CERT_LAST_IDX + CONTROL_LAST_IDX)
+
+typedef enum {
+    GATTS_SVC_NONE,  // handles no service registered
+    GATTS_SVC_BATTERY,
+    GATTS_SVC_LED_BUTTON,
+    GATTS_SVC_CERT,
+    GATTS_SVC_CONTROL,
+    GATTS_SVC_COUNT,
+} gatts_service_t;
+
+// handles a non-prepared write to one attribute, returns false if the write must not be answered
+typedef bool (*gatts_write_handler_t)(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param);
+
+typedef struct {
+    uint8_t service;                 // gatts_service_t
+    uint8_t index;                   // IDX_* within the service's attribute table
+    gatts_write_handler_t on_write;  // NULL if writes to the attribute aren't expected
+} gatts_attr_t;
+
+// Adds the handles ESP_GATTS_CREAT_ATTR_TAB_EVT returned for service, handlers has count entries indexed like
+// handles (NULL for attributes without one), or is NULL. Called from the BT task, like every lookup.
+void gatts_dispatch_register(gatts_service_t service,
+    const uint16_t* handles,
+    int count,
+    const gatts_write_handler_t* handlers);
+
+// the attribute behind handle, NULL if no service registered it
+const gatts_attr_t* gatts_dispatch_lookup(uint16_t handle);
+
+// the table covers handles base to base + GATTS_DISPATCH_ATTRS - 1, 0 before a service registered
+uint16_t gatts_dispatch_base();
+
+#endif /* PGP_GATTS_DISPATCH_H */
@@ -1,20 +1,189 @@
 #include "pgp_handshake.h"
 
 #include "config_storage.h"
+#include "entropy.h"
 #include "esp_gatt_defs.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "log_tags.h"
+#include "metrics.h"
 #include "pgp_bluetooth.h"
 #include "pgp_cert.h"
+#include "pgp_cert_pool.h"
 #include "pgp_gap.h"
 #include "pgp_gatts.h"
 #include "pgp_handshake_multi.h"
+#include "session_cache.h"
+#include "session_prefetch.h"
 
 #include <stdint.h>
 #include <string.h>
 
-// disable using random values for the keys and nonces for debugging
-static const bool use_debug_buffer_values = false;
+// (re)expands the AES schedule of client_state->session_key, has to be called whenever session_key changes
+static void load_session_ctx(client_state_t* client_state) {
+    if (client_state->has_session_ctx) {
+        aes_freekey(&client_state->session_ctx);
+    }
+    aes_setkey(&client_state->session_ctx, client_state->session_key);
+    client_state->has_session_ctx = true;
+}
+
+// round trip latency per waiting state since boot, only touched from the BT task
+// (GATTS write events, both for the handshake and the Control Service reading it)
+#define LATENCY_BUCKETS 15
+// upper bounds in ms, the last bucket takes everything above 20 s
+static const uint32_t latency_bucket_ms[LATENCY_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000
+};
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t min_us, max_us;
+    uint32_t buckets[LATENCY_BUCKETS];
+} state_latency_t;
+
+static state_latency_t state_latency[CERT_STATE_COUNT];
+
+static void record_state_latency(cert_state_t state, uint32_t elapsed_us) {
+    state_latency_t* lat = &state_latency[state];
+    if (lat->count == 0 || elapsed_us < lat->min_us) {
+        lat->min_us = elapsed_us;
+    }
+    if (elapsed_us > lat->max_us) {
+        lat->max_us = elapsed_us;
+    }
+    lat->count++;
+    lat->sum_us += elapsed_us;
+
+    int b = 0;
+    while (b < LATENCY_BUCKETS - 1 && elapsed_us > latency_bucket_ms[b] * 1000) {
+        b++;
+    }
+    lat->buckets[b]++;
+}
+
+// upper bound of the bucket holding the 95th percentile, never above the largest sample
+static uint32_t state_latency_p95_ms(const state_latency_t* lat) {
+    uint32_t max_ms = lat->max_us / 1000;
+    uint32_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        seen += lat->buckets[b];
+        if ((uint64_t)seen * 100 >= (uint64_t)lat->count * 95) {
+            return latency_bucket_ms[b] < max_ms ? latency_bucket_ms[b] : max_ms;
+        }
+    }
+    return max_ms;
+}
+
+static void put_u16_ms(uint8_t* buf, uint64_t ms) {
+    if (ms > 0xffff) {
+        ms = 0xffff;
+    }
+    buf[0] = ms & 0xff;
+    buf[1] = (ms >> 8) & 0xff;
+}
+
+size_t handshake_latency_serialize(uint8_t* buf, size_t buf_len) {
+    size_t offset = 0;
+    for (int state = CERT_STATE_CHAL_0; state < CERT_STATE_ESTABLISHED; state++) {
+        if (offset + HANDSHAKE_LATENCY_RECORD_LEN > buf_len) {
+            break;
+        }
+        const state_latency_t* lat = &state_latency[state];
+        uint8_t* rec = buf + offset;
+        rec[0] = state;
+        rec[1] = lat->count & 0xff;
+        rec[2] = (lat->count >> 8) & 0xff;
+        rec[3] = (lat->count >> 16) & 0xff;
+        rec[4] = (lat->count >> 24) & 0xff;
+        put_u16_ms(rec + 5, lat->min_us / 1000);
+        put_u16_ms(rec + 7, lat->count ? lat->sum_us / lat->count / 1000 : 0);
+        put_u16_ms(rec + 9, lat->count ? state_latency_p95_ms(lat) : 0);
+        put_u16_ms(rec + 11, lat->max_us / 1000);
+        offset += HANDSHAKE_LATENCY_RECORD_LEN;
+    }
+    return offset;
+}
+
+// moves client_state to state, the time spent in the previous one is the app's round trip for that step
+static void enter_cert_state(client_state_t* client_state, cert_state_t state) {
+    int64_t now = esp_timer_get_time();
+
+    if (client_state->trace_len > 0) {
+        record_state_latency(client_state->cert_state, (uint32_t)(now - client_state->state_entered_us));
+    }
+
+    handshake_progress_lock();
+    if (client_state->trace_len < HANDSHAKE_TRACE_LEN) {
+        handshake_trace_entry_t* entry = &client_state->trace[client_state->trace_len++];
+        entry->state = state;
+        entry->offset_us = (uint32_t)(now - client_state->trace_start_us);
+    }
+    client_state->cert_state = state;
+    client_state->state_entered_us = now;
+    handshake_progress_unlock();
+
+    // the scratch buffers are only needed while pairing
+    if (state == CERT_STATE_ESTABLISHED) {
+        handshake_buffer_release(client_state);
+    }
+}
+
+// (re)starts the trace when the app subscribes, a new CCCD write restarts the handshake
+static void start_cert_trace(client_state_t* client_state, cert_state_t state) {
+    handshake_progress_lock();
+    client_state->trace_len = 0;
+    client_state->reaped_at_us = 0;
+    client_state->trace_start_us = esp_timer_get_time();
+    handshake_progress_unlock();
+    enter_cert_state(client_state, state);
+}
+
+// session keys persisted by an earlier handshake with this phone: from the RAM cache if it was seen since
+// boot, otherwise as read at connect time by the prefetch task; falls back to reading NVS here if that
+// didn't finish in time
+static bool load_cached_session(client_state_t* client_state) {
+    bool found = false;
+
+    if (session_cache_get_session(
+            client_state->remote_bda, client_state->session_key, client_state->reconnect_challenge)) {
+        ESP_LOGD(HANDSHAKE_TAG, "[%d] session keys cached in RAM", client_state->conn_id);
+        session_prefetch_cancel(client_state);
+        found = true;
+    } else {
+        switch (session_prefetch_take(client_state)) {
+        case SESSION_PREFETCH_HIT:
+            ESP_LOGD(HANDSHAKE_TAG, "[%d] session keys prefetched", client_state->conn_id);
+            found = true;
+            break;
+        case SESSION_PREFETCH_MISS:
+            break;
+        default:
+            found = retrieve_device_session_keys(
+                client_state->remote_bda, client_state->session_key, client_state->reconnect_challenge);
+            break;
+        }
+    }
+
+    if (found) {
+        load_session_ctx(client_state);
+        client_state->has_reconnect_key = true;
+        client_state->used_cached_session = true;
+    }
+    return found;
+}
+
+static void send_reconnect_challenge(client_state_t* client_state) {
+    memset(client_state->handshake->cert_buffer, 0, 36);
+    client_state->handshake->cert_buffer[0] = 3;
+    memcpy(client_state->handshake->cert_buffer + 4, client_state->reconnect_challenge, 32);
+
+    esp_ble_gatts_set_attr_value(
+        certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 36, client_state->handshake->cert_buffer);
+
+    start_cert_trace(client_state, CERT_STATE_RECONNECT);
+}
 
 void handle_pgp_handshake_first(esp_gatt_if_t gatts_if, uint16_t descr_value, uint16_t conn_id) {
     client_state_t* client_state = get_or_create_client_state_entry(conn_id);
@@ -26,6 +195,10 @@ void handle_pgp_handshake_first(esp_gatt_if_t gatts_if, uint16_t descr_value, ui
     if (descr_value == 0x0001) {
         client_state->notify = true;
 
+        if (!handshake_buffer_checkout(client_state)) {
+            return;
+        }
+
         uint8_t notify_data[4];
         memset(notify_data, 0, 4);
 
@@ -44,64 +217,50 @@ void handle_pgp_handshake_first(esp_gatt_if_t gatts_if, uint16_t descr_value, ui
             // reconnect challenge
             ESP_LOGI(HANDSHAKE_TAG, "[%d] Using in-memory reconnect key", conn_id);
             notify_data[0] = 3;
-
-            memset(client_state->cert_buffer, 0, 36);
-            client_state->cert_buffer[0] = 3;
-            memcpy(client_state->cert_buffer + 4, client_state->reconnect_challenge, 32);
-
-            esp_ble_gatts_set_attr_value(
-                certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 36, client_state->cert_buffer);
-
-            client_state->cert_state = 3;
-        } else if (has_cached_session(client_state->remote_bda)) {
-            // Try to use cached session keys for faster reconnection
-            if (retrieve_device_session_keys(
-                    client_state->remote_bda, client_state->session_key, client_state->reconnect_challenge)) {
-                client_state->has_reconnect_key = true;
-                ESP_LOGI(HANDSHAKE_TAG, "[%d] Using cached session keys for reconnection", conn_id);
-                client_state->used_cached_session = true;
-
-                // Send reconnect challenge
-                notify_data[0] = 3;
-                memset(client_state->cert_buffer, 0, 36);
-                client_state->cert_buffer[0] = 3;
-                memcpy(client_state->cert_buffer + 4, client_state->reconnect_challenge, 32);
-
-                esp_ble_gatts_set_attr_value(
-                    certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 36, client_state->cert_buffer);
-
-                client_state->cert_state = 3;
-            } else {
-                // Cache retrieval failed, fall through to full handshake
-                ESP_LOGW(
-                    HANDSHAKE_TAG, "[%d] Failed to retrieve cached session keys, starting full handshake", conn_id);
-                goto do_full_handshake;
-            }
+            send_reconnect_challenge(client_state);
+        } else if (load_cached_session(client_state)) {
+            // Use cached session keys for faster reconnection
+            ESP_LOGI(HANDSHAKE_TAG, "[%d] Using cached session keys for reconnection", conn_id);
+            notify_data[0] = 3;
+            send_reconnect_challenge(client_state);
         } else {
-        do_full_handshake:
-            if (use_debug_buffer_values) {
-                // use fixed key for easier debugging
-                memset(client_state->the_challenge, 0x41, 16);
-                memset(client_state->main_nonce, 0x42, 16);
-                memset(client_state->session_key, 0x43, 16);
-                memset(client_state->outer_nonce, 0x44, 16);
-                ESP_LOGW(HANDSHAKE_TAG, "using static nonces");
+            // bt_addr + blob only change with the mac, a pooled buffer keeps them from its last handshake
+            if (!client_state->handshake->chal_0_tail_ready) {
+                chal_0_stamp_static(bt_mac, (struct challenge_data*)client_state->handshake->cert_buffer);
+                client_state->handshake->chal_0_tail_ready = true;
+            }
+
+            // precomputed certificates come from the hardware RNG, a seeded run has to compute its own
+            if (!entropy_is_seeded() && cert_pool_take(client_state->handshake->the_challenge,
+                                            client_state->handshake->main_nonce,
+                                            client_state->session_key,
+                                            client_state->handshake->outer_nonce,
+                                            (struct challenge_data*)client_state->handshake->cert_buffer)) {
+                ESP_LOGD(HANDSHAKE_TAG, "[%d] using precomputed certificate", conn_id);
+                load_session_ctx(client_state);
             } else {
-                randomize_buffer(client_state->the_challenge, 16);
-                randomize_buffer(client_state->main_nonce, 16);
+                // pool is empty (several phones at once or right after boot) or seeded, compute it inline
+                if (entropy_is_seeded()) {
+                    ESP_LOGW(HANDSHAKE_TAG, "[%d] using seeded nonces", conn_id);
+                }
+                randomize_buffer(client_state->handshake->the_challenge, 16);
+                randomize_buffer(client_state->handshake->main_nonce, 16);
                 randomize_buffer(client_state->session_key, 16);
-                randomize_buffer(client_state->outer_nonce, 16);
+                randomize_buffer(client_state->handshake->outer_nonce, 16);
+                load_session_ctx(client_state);
+
+                generate_chal_0_dynamic(bt_mac,
+                    client_state->handshake->the_challenge,
+                    client_state->handshake->main_nonce,
+                    client_state->session_key,
+                    &client_state->session_ctx,
+                    client_state->handshake->outer_nonce,
+                    (struct challenge_data*)client_state->handshake->cert_buffer);
             }
 
-            generate_chal_0(bt_mac,
-                client_state->the_challenge,
-                client_state->main_nonce,
-                client_state->session_key,
-                client_state->outer_nonce,
-                (struct challenge_data*)client_state->cert_buffer);
-
             esp_ble_gatts_set_attr_value(
-                certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 378, client_state->cert_buffer);
+                certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 378, client_state->handshake->cert_buffer);
+            start_cert_trace(client_state, CERT_STATE_CHAL_0);
         }
 
         ESP_LOGD(HANDSHAKE_TAG, "[%d] start CERT PAIRING", conn_id);
@@ -120,208 +279,280 @@ void handle_pgp_handshake_first(esp_gatt_if_t gatts_if, uint16_t descr_value, ui
     }
 }
 
-void handle_pgp_handshake_second(esp_gatt_if_t gatts_if, const uint8_t* prepare_buf, int datalen, uint16_t conn_id) {
-    client_state_t* client_state = get_client_state_entry(conn_id);
-    if (!client_state) {
-        ESP_LOGE(HANDSHAKE_TAG, "[%d] couldn't get client state", conn_id);
-        return;
-    }
+// app wrote 20 bytes after chal_0, send the next challenge
+static bool handle_chal_0_reply(esp_gatt_if_t gatts_if,
+    client_state_t* client_state,
+    const uint8_t* __attribute__((unused)) prepare_buf,
+    int __attribute__((unused)) datalen) {
+    // just assume server responds correctly
+    uint8_t notify_data[4];
+    memset(notify_data, 0, 4);
+    notify_data[0] = 0x01;
+
+    randomize_buffer(client_state->handshake->state_0_nonce, 16);
+
+    // encrypted straight into the buffer the characteristic is served from
+    struct next_challenge* chal = (struct next_challenge*)client_state->handshake->cert_buffer;
+    memset(chal->state, 0, sizeof(chal->state));
+    chal->state[0] = 0x01;
+    generate_next_chal(0, &client_state->session_ctx, client_state->handshake->state_0_nonce, chal);
+
+    esp_ble_gatts_set_attr_value(
+        certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 52, client_state->handshake->cert_buffer);
+    esp_ble_gatts_send_indicate(gatts_if,
+        client_state->conn_id,
+        certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
+        sizeof(notify_data),
+        notify_data,
+        false);
+    return true;
+}
 
-    if (client_state->cert_state >= 1) {
-        ESP_LOGD(HANDSHAKE_TAG, "[%d] Handshake state=%d, received %d b", conn_id, client_state->cert_state, datalen);
+// we need to decrypt and send challenge data from APP
+static bool handle_next_chal(esp_gatt_if_t gatts_if,
+    client_state_t* client_state,
+    const uint8_t* prepare_buf,
+    int __attribute__((unused)) datalen) {
+    uint8_t* response = client_state->handshake->cert_buffer;
+    memset(response, 0, 4);
+    response[0] = 0x02;
+    decrypt_next(prepare_buf, &client_state->session_ctx, response + 4);
+
+    uint8_t notify_data[4];
+    memset(notify_data, 0, 4);
+    notify_data[0] = 0x02;
+
+    ESP_LOGD(HANDSHAKE_TAG, "Sending response");
+    if (esp_log_level_get(HANDSHAKE_TAG) >= ESP_LOG_DEBUG) {
+        ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, response, 20);
     }
 
-    switch (client_state->cert_state) {
-    case 0:  // normal challenge+response entry point
-    {
-        if (datalen == 20) {
-            // just assume server responds correctly
-            uint8_t notify_data[4];
-            memset(notify_data, 0, 4);
-            notify_data[0] = 0x01;
-
-            if (use_debug_buffer_values) {
-                memset(client_state->state_0_nonce, 0x42, 16);
-            } else {
-                randomize_buffer(client_state->state_0_nonce, 16);
-            }
+    esp_ble_gatts_set_attr_value(
+        certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 20, client_state->handshake->cert_buffer);
+    esp_ble_gatts_send_indicate(gatts_if,
+        client_state->conn_id,
+        certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
+        sizeof(notify_data),
+        notify_data,
+        false);
+    return true;
+}
 
-            uint8_t temp[52];
-            memset(temp, 0, sizeof(temp));
+static bool handle_app_response(esp_gatt_if_t gatts_if,
+    client_state_t* client_state,
+    const uint8_t* prepare_buf,
+    int __attribute__((unused)) datalen) {
+    ESP_LOGD(HANDSHAKE_TAG, "OK");
 
-            struct next_challenge* chal = (struct next_challenge*)temp;
-            generate_next_chal(0, client_state->session_key, client_state->state_0_nonce, chal);
+    // only logged, the certificate buffer is free to decrypt into by now
+    uint8_t* response = client_state->handshake->cert_buffer;
+    memset(response, 0, 4);
+    decrypt_next(prepare_buf, &client_state->session_ctx, response + 4);
 
-            temp[0] = 0x01;
-            memcpy(client_state->cert_buffer, temp, 52);
+    if (esp_log_level_get(HANDSHAKE_TAG) >= ESP_LOG_DEBUG) {
+        ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, response, 20);
+    }
 
-            // ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, temp, sizeof(temp));
-            // ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, cert_buffer, 52);
+    // generate reconnect key
+    client_state->has_reconnect_key = true;
+    randomize_buffer(client_state->reconnect_challenge, 32);
 
-            esp_ble_gatts_set_attr_value(
-                certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 52, client_state->cert_buffer);
-            esp_ble_gatts_send_indicate(gatts_if,
-                conn_id,
-                certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
-                sizeof(notify_data),
-                notify_data,
-                false);
+    // Persist session keys for reconnection
+    persist_device_session_keys(client_state->remote_bda, client_state->session_key, client_state->reconnect_challenge);
 
-            client_state->cert_state = 1;
-        } else {
-            ESP_LOGE(HANDSHAKE_TAG, "App sends incorrect len=%d", datalen);
-        }
-        break;
+    metrics_record_since(METRIC_HANDSHAKE, client_state->trace_start_us);
+
+    // over target_active_connections: the keys are stored, so it's a quick reconnect once a phone leaves
+    if (!connection_start(client_state->conn_id)) {
+        esp_ble_gap_disconnect(client_state->remote_bda);
+        return false;
     }
-    case 1: {
-        // we need to decrypt and send challenge data from APP
-        uint8_t temp[20];
-        memset(temp, 0, sizeof(temp));
-        decrypt_next(prepare_buf, client_state->session_key, temp + 4);
-        temp[0] = 0x02;
 
-        uint8_t notify_data[4];
-        memset(notify_data, 0, 4);
-        notify_data[0] = 0x02;
+    uint8_t notify_data[4] = { 0x04, 0x00, 0x23, 0x00 };
+    esp_ble_gatts_send_indicate(gatts_if,
+        client_state->conn_id,
+        certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
+        sizeof(notify_data),
+        notify_data,
+        false);
+    return true;
+}
 
-        ESP_LOGD(HANDSHAKE_TAG, "Sending response");
-        if (esp_log_level_get(HANDSHAKE_TAG) >= ESP_LOG_DEBUG) {
-            ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, temp, sizeof(temp));
-        }
+// reconnection #1: entry point
+static bool handle_reconnect(esp_gatt_if_t gatts_if,
+    client_state_t* client_state,
+    const uint8_t* prepare_buf,
+    int datalen) {
+    // just assume server responds correctly
+    ESP_LOGI(HANDSHAKE_TAG, "[%d] reconnection challenge received (state 3->4)", client_state->conn_id);
+    if (esp_log_level_get(HANDSHAKE_TAG) >= ESP_LOG_DEBUG) {
+        ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, prepare_buf, datalen);
+    }
 
-        memcpy(client_state->cert_buffer, temp, 20);
+    uint8_t notify_data[4] = { 0x04, 0x00, 0x01, 0x00 };
+    esp_ble_gatts_send_indicate(gatts_if,
+        client_state->conn_id,
+        certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
+        sizeof(notify_data),
+        notify_data,
+        false);
+    return true;
+}
 
-        esp_ble_gatts_set_attr_value(
-            certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 20, client_state->cert_buffer);
-        esp_ble_gatts_send_indicate(gatts_if,
-            conn_id,
-            certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
-            sizeof(notify_data),
-            notify_data,
-            false);
+// reconnection #2
+static bool handle_reconnect_chal(esp_gatt_if_t gatts_if,
+    client_state_t* client_state,
+    const uint8_t* prepare_buf,
+    int __attribute__((unused)) datalen) {
+    ESP_LOGI(HANDSHAKE_TAG, "[%d] reconnection response received (state 4->5)", client_state->conn_id);
 
-        client_state->cert_state = 2;
-        break;
-    }
-    case 2: {
-        ESP_LOGD(HANDSHAKE_TAG, "OK");
+    memset(client_state->handshake->cert_buffer, 0, 4);
+    generate_reconnect_response(&client_state->session_ctx, prepare_buf + 4, client_state->handshake->cert_buffer + 4);
+    client_state->handshake->cert_buffer[0] = 5;
 
-        uint8_t temp[20];
-        memset(temp, 0, sizeof(temp));
-        decrypt_next(prepare_buf, client_state->session_key, temp + 4);
+    if (esp_log_level_get(HANDSHAKE_TAG) >= ESP_LOG_DEBUG) {
+        ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, client_state->handshake->cert_buffer, 20);
+    }
 
-        if (esp_log_level_get(HANDSHAKE_TAG) >= ESP_LOG_DEBUG) {
-            ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, temp, sizeof(temp));
-        }
+    uint8_t notify_data[4];
+    memset(notify_data, 0, 4);
+    notify_data[0] = 0x05;
+
+    esp_ble_gatts_set_attr_value(
+        certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 20, client_state->handshake->cert_buffer);
+    esp_ble_gatts_send_indicate(gatts_if,
+        client_state->conn_id,
+        certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
+        sizeof(notify_data),
+        notify_data,
+        false);
+    return true;
+}
 
-        // generate reconnect key
-        client_state->has_reconnect_key = true;
-        if (use_debug_buffer_values) {
-            memset(client_state->reconnect_challenge, 0x46, 32);
-        } else {
-            randomize_buffer(client_state->reconnect_challenge, 32);
+// reconnection #3: established
+static bool handle_reconnect_ack(esp_gatt_if_t gatts_if,
+    client_state_t* client_state,
+    const uint8_t* __attribute__((unused)) prepare_buf,
+    int __attribute__((unused)) datalen) {
+    // just assume server responds correctly
+    ESP_LOGI(HANDSHAKE_TAG, "[%d] reconnection complete (state 5->6)", client_state->conn_id);
+    metrics_record_since(METRIC_RECONNECT, client_state->trace_start_us);
+
+    // For reconnections on a fresh entry (connection_start == 0), increment the counter.
+    // For reconnections on an existing entry (connection_start != 0), just update timestamp.
+    // This handles both scenarios: fresh slots vs reconnections within same slot.
+    if (client_state->connection_start == 0) {
+        if (!connection_start(client_state->conn_id)) {
+            esp_ble_gap_disconnect(client_state->remote_bda);
+            return false;
         }
+    } else {
+        connection_update(client_state->conn_id);
+        advertise_if_needed();
+    }
+    // nothing else is written on a reconnect, without this the record ages as if the phone was gone
+    persist_device_seen(client_state->remote_bda);
+
+    uint8_t notify_data[4] = { 0x04, 0x00, 0x02, 0x00 };
+    esp_ble_gatts_send_indicate(gatts_if,
+        client_state->conn_id,
+        certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
+        sizeof(notify_data),
+        notify_data,
+        false);
+    return true;
+}
 
-        // Persist session keys for reconnection
-        persist_device_session_keys(
-            client_state->remote_bda, client_state->session_key, client_state->reconnect_challenge);
-
-        uint8_t notify_data[4] = { 0x04, 0x00, 0x23, 0x00 };
-        esp_ble_gatts_send_indicate(gatts_if,
-            conn_id,
-            certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
-            sizeof(notify_data),
-            notify_data,
-            false);
+typedef bool (*cert_state_handler_t)(esp_gatt_if_t gatts_if,
+    client_state_t* client_state,
+    const uint8_t* prepare_buf,
+    int datalen);
+
+typedef struct {
+    const char* name;
+    int expected_len;  // -1 accepts any length
+    cert_state_handler_t handler;
+    cert_state_t next;
+    uint32_t timeout_ms;  // how long the app may take to answer, 0 = no limit
+} cert_transition_t;
+
+// what the app has to write in each state and where that takes us
+static const cert_transition_t cert_transitions[CERT_STATE_COUNT] = {
+    [CERT_STATE_CHAL_0] = { "chal_0", 20, handle_chal_0_reply, CERT_STATE_NEXT_CHAL, 15000 },
+    [CERT_STATE_NEXT_CHAL] = { "next_chal", -1, handle_next_chal, CERT_STATE_APP_RESPONSE, 5000 },
+    [CERT_STATE_APP_RESPONSE] = { "app_response", -1, handle_app_response, CERT_STATE_ESTABLISHED, 5000 },
+    [CERT_STATE_RECONNECT] = { "reconnect", 20, handle_reconnect, CERT_STATE_RECONNECT_CHAL, 5000 },
+    [CERT_STATE_RECONNECT_CHAL] = { "reconnect_chal", -1, handle_reconnect_chal, CERT_STATE_RECONNECT_ACK, 5000 },
+    [CERT_STATE_RECONNECT_ACK] = { "reconnect_ack", 5, handle_reconnect_ack, CERT_STATE_ESTABLISHED, 5000 },
+    [CERT_STATE_ESTABLISHED] = { "established", -1, NULL, CERT_STATE_ESTABLISHED, 0 },
+};
+
+uint32_t cert_state_timeout_ms(cert_state_t state) {
+    if (state >= CERT_STATE_COUNT) {
+        return 0;
+    }
+    return cert_transitions[state].timeout_ms;
+}
 
-        client_state->cert_state = 6;
-        connection_start(conn_id);
-        advertise_if_needed();
-        break;
+const char* cert_state_name(cert_state_t state) {
+    if (state >= CERT_STATE_COUNT) {
+        return "invalid";
     }
-    case 3:  // reconnection #1: entry point
-    {
-        if (datalen == 20) {
-            // just assume server responds correctly
-            ESP_LOGI(HANDSHAKE_TAG, "[%d] reconnection challenge received (state 3->4)", conn_id);
-            if (esp_log_level_get(HANDSHAKE_TAG) >= ESP_LOG_DEBUG) {
-                ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, prepare_buf, datalen);
-            }
+    return cert_transitions[state].name;
+}
 
-            uint8_t notify_data[4] = { 0x04, 0x00, 0x01, 0x00 };
-            esp_ble_gatts_send_indicate(gatts_if,
-                conn_id,
-                certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
-                sizeof(notify_data),
-                notify_data,
-                false);
+void handle_pgp_handshake_second(esp_gatt_if_t gatts_if, const uint8_t* prepare_buf, int datalen, uint16_t conn_id) {
+    client_state_t* client_state = get_client_state_entry(conn_id);
+    if (!client_state) {
+        ESP_LOGE(HANDSHAKE_TAG, "[%d] couldn't get client state", conn_id);
+        return;
+    }
 
-            client_state->cert_state = 4;
-        } else {
-            ESP_LOGW(HANDSHAKE_TAG, "[%d] reconnection #1 unexpected datalen=%d", conn_id, datalen);
-        }
-        break;
+    cert_state_t state = client_state->cert_state;
+    if (state >= 1) {
+        ESP_LOGD(HANDSHAKE_TAG, "[%d] Handshake state=%d, received %d b", conn_id, state, datalen);
     }
-    case 4:  // reconnection #2
-    {
-        ESP_LOGI(HANDSHAKE_TAG, "[%d] reconnection response received (state 4->5)", conn_id);
 
-        memset(client_state->cert_buffer, 0, 4);
-        generate_reconnect_response(client_state->session_key, prepare_buf + 4, client_state->cert_buffer + 4);
-        client_state->cert_buffer[0] = 5;
+    // only happens if the app skips the CCCD write, keep using whatever session_key holds like before
+    if (!client_state->has_session_ctx) {
+        load_session_ctx(client_state);
+    }
 
-        if (esp_log_level_get(HANDSHAKE_TAG) >= ESP_LOG_DEBUG) {
-            ESP_LOG_BUFFER_HEX(HANDSHAKE_TAG, client_state->cert_buffer, 20);
-        }
+    const cert_transition_t* transition = state < CERT_STATE_COUNT ? &cert_transitions[state] : NULL;
+    if (!transition || !transition->handler) {
+        ESP_LOGE(HANDSHAKE_TAG, "Unhandled state: %d", state);
+        return;
+    }
 
-        uint8_t notify_data[4];
-        memset(notify_data, 0, 4);
-        notify_data[0] = 0x05;
+    // same as above, or the app restarts a handshake without a new CCCD write
+    if (!handshake_buffer_checkout(client_state)) {
+        return;
+    }
 
-        esp_ble_gatts_set_attr_value(
-            certificate_handle_table[IDX_CHAR_SFIDA_TO_CENTRAL_VAL], 20, client_state->cert_buffer);
-        esp_ble_gatts_send_indicate(gatts_if,
+    if (transition->expected_len >= 0 && datalen != transition->expected_len) {
+        ESP_LOGW(HANDSHAKE_TAG,
+            "[%d] %s: unexpected datalen=%d (expected %d)",
             conn_id,
-            certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
-            sizeof(notify_data),
-            notify_data,
-            false);
-
-        client_state->cert_state = 5;
-        break;
+            transition->name,
+            datalen,
+            transition->expected_len);
+        return;
     }
-    case 5:  // reconnection #3: established
-    {
-        if (datalen == 5) {
-            // just assume server responds correctly
-            ESP_LOGI(HANDSHAKE_TAG, "[%d] reconnection complete (state 5->6)", conn_id);
-
-            uint8_t notify_data[4] = { 0x04, 0x00, 0x02, 0x00 };
-            esp_ble_gatts_send_indicate(gatts_if,
+
+    if (client_state->trace_len > 0 && transition->timeout_ms > 0) {
+        int64_t waited_ms = (esp_timer_get_time() - client_state->state_entered_us) / 1000;
+        if (waited_ms > transition->timeout_ms) {
+            ESP_LOGW(HANDSHAKE_TAG,
+                "[%d] %s: app took %lld ms (limit %lu ms)",
                 conn_id,
-                certificate_handle_table[IDX_CHAR_SFIDA_COMMANDS_VAL],
-                sizeof(notify_data),
-                notify_data,
-                false);
-
-            client_state->cert_state = 6;
-            // For reconnections on a fresh entry (connection_start == 0), increment the counter.
-            // For reconnections on an existing entry (connection_start != 0), just update timestamp.
-            // This handles both scenarios: fresh slots vs reconnections within same slot.
-            if (client_state->connection_start == 0) {
-                connection_start(conn_id);
-            } else {
-                connection_update(conn_id);
-            }
-            advertise_if_needed();
-        } else {
-            ESP_LOGW(HANDSHAKE_TAG, "[%d] reconnection #3 unexpected datalen=%d", conn_id, datalen);
+                transition->name,
+                waited_ms,
+                transition->timeout_ms);
         }
-        break;
     }
-    default:
-        ESP_LOGE(HANDSHAKE_TAG, "Unhandled state: %d", client_state->cert_state);
-        break;
+
+    if (transition->handler(gatts_if, client_state, prepare_buf, datalen)) {
+        enter_cert_state(client_state, transition->next);
     }
 }
 
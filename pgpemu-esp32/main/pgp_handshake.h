@@ -2,9 +2,15 @@
 #define PGP_HANDSHAKE_H
 
 #include "esp_gatt_defs.h"
+#include "pgp_handshake_multi.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
+// one GET_HANDSHAKE_LATENCY record per waiting state (CERT_STATE_CHAL_0..CERT_STATE_RECONNECT_ACK):
+// [state u8][count u32][min u16][avg u16][p95 u16][max u16], little-endian, times in ms
+#define HANDSHAKE_LATENCY_RECORD_LEN 13
+
 void handle_pgp_handshake_first(esp_gatt_if_t gatts_if, uint16_t descr_value, uint16_t conn_id);
 void handle_pgp_handshake_second(esp_gatt_if_t gatts_if, const uint8_t* prepare_buf, int datalen, uint16_t conn_id);
 
@@ -12,4 +18,11 @@ void pgp_handshake_disconnect(uint16_t conn_id, uint8_t reason);
 
 int pgp_get_handshake_state(uint16_t conn_id);
 
+// how long the app may take to answer while in state, 0 means no limit
+uint32_t cert_state_timeout_ms(cert_state_t state);
+const char* cert_state_name(cert_state_t state);
+
+// writes the per-state round trip latencies measured since boot, returns the number of bytes written
+size_t handshake_latency_serialize(uint8_t* buf, size_t buf_len);
+
 #endif /* PGP_HANDSHAKE_H */
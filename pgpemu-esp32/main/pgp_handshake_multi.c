@@ -2,21 +2,26 @@
 
 #include "buf_writer.h"
 #include "config_storage.h"
+#include "device_keys.h"
 #include "esp_bt_defs.h"
 #include "esp_gap_ble_api.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "log_tags.h"
 #include "mutex_helpers.h"
 #include "pgp_autobutton.h"
 #include "pgp_gap.h"
+#include "pgp_handshake.h"
+#include "session_cache.h"
+#include "session_prefetch.h"
+#include "stats.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
-static int active_connections = 0;
-static SemaphoreHandle_t active_connections_mutex = NULL;
-
-#define MAX_CONNECTIONS CONFIG_BT_ACL_CONNECTIONS
+// phones that finished the handshake, only changed through connection_reserve()/connection_release()
+static atomic_int active_connections = 0;
 
 // map which cert_states index corresponds to which conn_id
 static uint16_t conn_id_map[MAX_CONNECTIONS] = { 0 };
@@ -24,34 +29,356 @@ static uint16_t conn_id_map[MAX_CONNECTIONS] = { 0 };
 // keep track of handshake state per connection
 static client_state_t client_states[MAX_CONNECTIONS] = { 0 };
 
+// Lookup indexes over conn_id_map/client_states, rebuilt whenever a slot is taken, freed or gets its BDA
+// (a few times per connection) so the lookups on every GATTS event, button press and LED update are O(1).
+// - conn_index: direct mapped on the low bits of conn_id (Bluedroid hands out small ids), a colliding
+//   conn_id isn't indexed and falls back to scanning conn_id_map
+// - bda_index: open addressing with linear probing on a hash of the BDA
+// Both hold a slot number or -1 and are only touched inside index_lock, readers on other tasks
+// (autobutton, LED handler) see either the old or the new mapping, never a half updated one.
+#define CONN_INDEX_SIZE 32
+#define BDA_INDEX_SIZE 32
+_Static_assert(CONN_INDEX_SIZE >= 2 * MAX_CONNECTIONS, "conn_index too small for MAX_CONNECTIONS");
+_Static_assert(BDA_INDEX_SIZE >= 2 * MAX_CONNECTIONS, "bda_index too small for MAX_CONNECTIONS");
+
+static int8_t conn_index[CONN_INDEX_SIZE];
+static int8_t bda_index[BDA_INDEX_SIZE];
+static bool bda_known[MAX_CONNECTIONS];  // slot has been through set_remote_bda()
+static portMUX_TYPE index_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static unsigned bda_hash(const uint8_t* bda) {
+    // FNV-1a, the low bytes are the random part of a resolvable private address
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(esp_bd_addr_t); i++) {
+        h = (h ^ bda[i]) * 16777619u;
+    }
+    return h % BDA_INDEX_SIZE;
+}
+
+// call with index_lock held
+static void rebuild_indexes_locked() {
+    memset(conn_index, -1, sizeof(conn_index));
+    memset(bda_index, -1, sizeof(bda_index));
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conn_id_map[i] == 0xffff) {
+            continue;
+        }
+
+        int8_t* bucket = &conn_index[conn_id_map[i] % CONN_INDEX_SIZE];
+        if (*bucket < 0) {
+            *bucket = i;
+        }
+
+        if (bda_known[i]) {
+            unsigned h = bda_hash(client_states[i].remote_bda);
+            while (bda_index[h] >= 0) {
+                h = (h + 1) % BDA_INDEX_SIZE;
+            }
+            bda_index[h] = i;
+        }
+    }
+}
+
+// returns the slot of conn_id or -1, call with index_lock held
+static int find_slot_locked(uint16_t conn_id) {
+    int slot = conn_index[conn_id % CONN_INDEX_SIZE];
+    if (slot >= 0 && conn_id_map[slot] == conn_id) {
+        return slot;
+    }
+
+    // bucket shared with another conn_id
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conn_id_map[i] == conn_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// shared handshake buffers, checked out/returned under index_lock
+static handshake_buffer_t handshake_buffers[HANDSHAKE_BUFFER_POOL_SIZE];
+static bool handshake_buffer_used[HANDSHAKE_BUFFER_POOL_SIZE];
+static uint32_t handshake_buffer_exhausted = 0;  // checkouts that had to go to the heap
+static uint32_t handshake_buffer_failed = 0;     // ... and didn't get memory there either
+
+// clears what a handshake left in buffer; the challenge 0 tail is the same for every handshake (and sent to
+// every phone), so a stamped one is kept for the next handshake using the buffer
+static void handshake_buffer_wipe(handshake_buffer_t* buffer) {
+    if (!buffer->chal_0_tail_ready) {
+        memset(buffer, 0, sizeof(handshake_buffer_t));
+        return;
+    }
+    memset(buffer->cert_buffer, 0, CHAL_0_DYNAMIC_LEN);
+    memset(buffer->state_0_nonce, 0, sizeof(handshake_buffer_t) - offsetof(handshake_buffer_t, state_0_nonce));
+}
+
+bool handshake_buffer_checkout(client_state_t* client_state) {
+    if (client_state->handshake) {
+        return true;
+    }
+
+    handshake_buffer_t* buffer = NULL;
+    taskENTER_CRITICAL(&index_lock);
+    for (int i = 0; i < HANDSHAKE_BUFFER_POOL_SIZE; i++) {
+        if (!handshake_buffer_used[i]) {
+            handshake_buffer_used[i] = true;
+            buffer = &handshake_buffers[i];
+            break;
+        }
+    }
+    if (!buffer) {
+        handshake_buffer_exhausted++;
+    }
+    taskEXIT_CRITICAL(&index_lock);
+
+    if (!buffer) {
+        // more phones pairing at once than the pool was sized for
+        buffer = malloc(sizeof(handshake_buffer_t));
+        if (!buffer) {
+            taskENTER_CRITICAL(&index_lock);
+            handshake_buffer_failed++;
+            taskEXIT_CRITICAL(&index_lock);
+            ESP_LOGE(HANDSHAKE_TAG, "[%d] no memory for a handshake buffer", client_state->conn_id);
+            return false;
+        }
+        ESP_LOGW(HANDSHAKE_TAG, "[%d] handshake buffer pool exhausted, using heap", client_state->conn_id);
+        buffer->chal_0_tail_ready = false;
+    }
+
+    handshake_buffer_wipe(buffer);
+    client_state->handshake = buffer;
+    return true;
+}
+
+void handshake_buffer_release(client_state_t* client_state) {
+    handshake_buffer_t* buffer = client_state->handshake;
+    if (!buffer) {
+        return;
+    }
+    client_state->handshake = NULL;
+
+    int i = buffer - handshake_buffers;
+    if (i >= 0 && i < HANDSHAKE_BUFFER_POOL_SIZE) {
+        handshake_buffer_wipe(buffer);
+        taskENTER_CRITICAL(&index_lock);
+        handshake_buffer_used[i] = false;
+        taskEXIT_CRITICAL(&index_lock);
+    } else {
+        memset(buffer, 0, sizeof(handshake_buffer_t));
+        free(buffer);
+    }
+}
+
+// conn_id whose slot the reaper task should free, 0xffff for none; under index_lock
+static uint16_t reap_requested[MAX_CONNECTIONS];
+
 void init_handshake_multi() {
+    taskENTER_CRITICAL(&index_lock);
     memset(conn_id_map, 0xff, sizeof(conn_id_map));
-    if (active_connections_mutex == NULL) {
-        active_connections_mutex = xSemaphoreCreateMutex();
-    }
+    memset(reap_requested, 0xff, sizeof(reap_requested));
+    memset(bda_known, 0, sizeof(bda_known));
+    rebuild_indexes_locked();
+    taskEXIT_CRITICAL(&index_lock);
 }
 
 int get_active_connections() {
-    int count = 0;
-    if (mutex_acquire_timeout(active_connections_mutex, 100)) {
-        count = active_connections;
-        mutex_release(active_connections_mutex);
-    }
-    return count;
+    return atomic_load(&active_connections);
+}
+
+// takes one of target connections, false (and nothing counted) once target are active;
+// *active_out gets the count this decision was made on, including our own reservation
+static bool connection_reserve(int target, int* active_out) {
+    int current = atomic_load(&active_connections);
+    do {
+        if (current >= target) {
+            *active_out = current;
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&active_connections, &current, current + 1));
+
+    *active_out = current + 1;
+    return true;
+}
+
+static void connection_release() {
+    int current = atomic_load(&active_connections);
+    do {
+        if (current <= 0) {
+            // I'm not entirely sure that we covered all paths so try to save something in case of mistakes
+            ESP_LOGE(HANDSHAKE_TAG, "we counted connections wrong!");
+            return;
+        }
+    } while (!atomic_compare_exchange_weak(&active_connections, &current, current - 1));
 }
 
 int get_max_connections() {
     return MAX_CONNECTIONS;
 }
 
-client_state_t* get_client_state_entry(uint16_t conn_id) {
+#define HANDSHAKE_REAPER_PERIOD_MS 1000
+// the per-state timeouts only warn about slow apps, a handshake is given up at this multiple of them
+#define HANDSHAKE_REAP_FACTOR 2
+// a reaped phone gets this long to show up as disconnected before its slot is freed anyway
+#define HANDSHAKE_REAP_GRACE_MS 3000
+
+static esp_timer_handle_t reaper_timer = NULL;
+static TaskHandle_t reaper_task_handle = NULL;
+static uint32_t reaped_by_state[CERT_STATE_COUNT];
+
+void handshake_progress_lock() {
+    taskENTER_CRITICAL(&index_lock);
+}
+
+void handshake_progress_unlock() {
+    taskEXIT_CRITICAL(&index_lock);
+}
+
+// Runs on the esp_timer task and only detects stalls: it snapshots each slot under index_lock, asks the
+// phone to disconnect and hands slots that stay connected to handshake_reaper_task() through reap_requested.
+static void handshake_reaper(void* __attribute__((unused)) arg) {
+    int64_t now = esp_timer_get_time();
+    bool collect = false;
+
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (conn_id_map[i] == conn_id) {
-            return &client_states[i];
+        client_state_t* entry = &client_states[i];
+        esp_bd_addr_t bda;
+
+        taskENTER_CRITICAL(&index_lock);
+        uint16_t conn_id = conn_id_map[i];
+        cert_state_t state = entry->cert_state;
+        bool started = entry->trace_len > 0;
+        int64_t entered_us = entry->state_entered_us;
+        int64_t reaped_at_us = entry->reaped_at_us;
+        memcpy(bda, entry->remote_bda, sizeof(bda));
+        taskEXIT_CRITICAL(&index_lock);
+
+        // no handshake started (e.g. the companion app only talks to the control service) or it finished
+        if (conn_id == 0xffff || !started || state == CERT_STATE_ESTABLISHED) {
+            continue;
+        }
+
+        if (reaped_at_us != 0) {
+            if ((now - reaped_at_us) / 1000 > HANDSHAKE_REAP_GRACE_MS) {
+                // no DISCONNECT_EVT, the link is gone without the controller noticing yet
+                taskENTER_CRITICAL(&index_lock);
+                if (conn_id_map[i] == conn_id) {
+                    reap_requested[i] = conn_id;
+                    collect = true;
+                }
+                taskEXIT_CRITICAL(&index_lock);
+            }
+            continue;
         }
+
+        uint32_t timeout_ms = cert_state_timeout_ms(state);
+        int64_t waited_ms = (now - entered_us) / 1000;
+        if (timeout_ms == 0 || waited_ms <= (int64_t)timeout_ms * HANDSHAKE_REAP_FACTOR) {
+            continue;
+        }
+
+        // unless the app moved on or the slot changed hands since the snapshot
+        bool reap = false;
+        taskENTER_CRITICAL(&index_lock);
+        if (conn_id_map[i] == conn_id && entry->state_entered_us == entered_us) {
+            entry->reaped_at_us = now;
+            reaped_by_state[state]++;
+            reap = true;
+        }
+        taskEXIT_CRITICAL(&index_lock);
+        if (!reap) {
+            continue;
+        }
+
+        ESP_LOGW(HANDSHAKE_TAG,
+            "[%d] handshake stuck in %s for %lld ms, disconnecting",
+            conn_id,
+            cert_state_name(state),
+            waited_ms);
+        // DISCONNECT_EVT frees the slot and re-arms advertising
+        esp_ble_gap_disconnect(bda);
     }
 
-    return NULL;
+    if (collect) {
+        // repeated every period until the slot is freed
+        xTaskNotifyGive(reaper_task_handle);
+    }
+}
+
+// frees the slots of reaped handshakes that never got a DISCONNECT_EVT
+static void handshake_reaper_collect() {
+    bool freed = false;
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        taskENTER_CRITICAL(&index_lock);
+        uint16_t conn_id = reap_requested[i];
+        reap_requested[i] = 0xffff;
+        // the phone may have disconnected or restarted the handshake since it was requested
+        bool stuck = conn_id != 0xffff && conn_id_map[i] == conn_id && client_states[i].reaped_at_us != 0;
+        taskEXIT_CRITICAL(&index_lock);
+        if (!stuck) {
+            continue;
+        }
+
+        ESP_LOGW(HANDSHAKE_TAG, "[%d] reaped handshake didn't disconnect, freeing slot", conn_id);
+        connection_stop(conn_id, ESP_GATT_CONN_TIMEOUT);
+        freed = true;
+    }
+
+    if (freed) {
+        advertise_if_needed();
+    }
+}
+
+static void handshake_reaper_task(void* __attribute__((unused)) pvParameters) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        handshake_reaper_collect();
+    }
+}
+
+bool init_handshake_reaper() {
+    // below the BT tasks, freeing a slot the controller still holds isn't urgent
+    BaseType_t ret = xTaskCreate(handshake_reaper_task, "handshake_reaper", 3072, NULL, 10, &reaper_task_handle);
+    if (ret != pdPASS) {
+        ESP_LOGE(HANDSHAKE_TAG, "%s creating task failed", __func__);
+        return false;
+    }
+
+    const esp_timer_create_args_t args = {
+        .callback = handshake_reaper,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "handshake_reaper",
+        .skip_unhandled_events = true,
+    };
+    esp_err_t err = esp_timer_create(&args, &reaper_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(HANDSHAKE_TAG, "%s creating timer failed: %s", __func__, esp_err_to_name(err));
+        vTaskDelete(reaper_task_handle);
+        reaper_task_handle = NULL;
+        return false;
+    }
+
+    err = esp_timer_start_periodic(reaper_timer, HANDSHAKE_REAPER_PERIOD_MS * 1000);
+    if (err != ESP_OK) {
+        ESP_LOGE(HANDSHAKE_TAG, "%s starting timer failed: %s", __func__, esp_err_to_name(err));
+        esp_timer_delete(reaper_timer);
+        reaper_timer = NULL;
+        vTaskDelete(reaper_task_handle);
+        reaper_task_handle = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+client_state_t* get_client_state_entry(uint16_t conn_id) {
+    taskENTER_CRITICAL(&index_lock);
+    int slot = find_slot_locked(conn_id);
+    taskEXIT_CRITICAL(&index_lock);
+
+    return slot >= 0 ? &client_states[slot] : NULL;
 }
 
 client_state_t* get_client_state_entry_by_idx(int i) {
@@ -67,33 +394,44 @@ bool is_connection_active(uint16_t conn_id) {
 }
 
 client_state_t* get_client_state_entry_by_bda(esp_bd_addr_t bda) {
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    int slot = -1;
+
+    taskENTER_CRITICAL(&index_lock);
+    unsigned h = bda_hash(bda);
+    for (int probe = 0; probe < BDA_INDEX_SIZE && bda_index[h] >= 0; probe++) {
+        int i = bda_index[h];
         if (conn_id_map[i] != 0xffff && memcmp(client_states[i].remote_bda, bda, sizeof(esp_bd_addr_t)) == 0) {
-            return &client_states[i];
+            slot = i;
+            break;
         }
+        h = (h + 1) % BDA_INDEX_SIZE;
     }
+    taskEXIT_CRITICAL(&index_lock);
 
-    return NULL;
+    return slot >= 0 ? &client_states[slot] : NULL;
 }
 
 client_state_t* get_or_create_client_state_entry(uint16_t conn_id) {
     // check if it exists
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (conn_id_map[i] == conn_id) {
-            return &client_states[i];
-        }
+    client_state_t* entry = get_client_state_entry(conn_id);
+    if (entry) {
+        return entry;
     }
 
-    // look for an empty slot
+    // look for an empty slot, only the BT task creates entries so it stays empty until we publish it
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         if (conn_id_map[i] == 0xffff) {
-            conn_id_map[i] = conn_id;
-
             // set default values
             memset(&client_states[i], 0, sizeof(client_state_t));
             client_states[i].conn_id = conn_id;
             client_states[i].handshake_start = xTaskGetTickCount();
 
+            taskENTER_CRITICAL(&index_lock);
+            conn_id_map[i] = conn_id;
+            bda_known[i] = false;
+            rebuild_indexes_locked();
+            taskEXIT_CRITICAL(&index_lock);
+
             return &client_states[i];
         }
     }
@@ -112,12 +450,26 @@ static void delete_client_state_entry(client_state_t* entry) {
         entry->settings = NULL;
     }
 
+    if (entry->has_session_ctx) {
+        aes_freekey(&entry->session_ctx);
+        entry->has_session_ctx = false;
+    }
+
+    // a lookup still in flight must not write into the slot once it's reused
+    session_prefetch_cancel(entry);
+
+    handshake_buffer_release(entry);
+
     // delete mapping
+    taskENTER_CRITICAL(&index_lock);
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         if (conn_id_map[i] == entry->conn_id) {
             conn_id_map[i] = 0xffff;
+            bda_known[i] = false;
         }
     }
+    rebuild_indexes_locked();
+    taskEXIT_CRITICAL(&index_lock);
 
     // zero out entry
     memset(entry, 0, sizeof(client_state_t));
@@ -139,41 +491,52 @@ void set_remote_bda(uint16_t conn_id, esp_bd_addr_t remote_bda) {
         return;
     }
     memcpy(entry->remote_bda, remote_bda, sizeof(esp_bd_addr_t));
+
+    taskENTER_CRITICAL(&index_lock);
+    bda_known[entry - client_states] = true;
+    rebuild_indexes_locked();
+    taskEXIT_CRITICAL(&index_lock);
+
+    // the settings read and the session lookup of this connection find its NVS keys hashed already
+    prime_device_keys(remote_bda);
 }
 
-void connection_start(uint16_t conn_id) {
+bool connection_start(uint16_t conn_id) {
     client_state_t* entry = get_client_state_entry(conn_id);
     if (!entry) {
         ESP_LOGE(HANDSHAKE_TAG, "connection_start: conn_id %d unknown", conn_id);
-        return;
+        return false;
     }
 
-    // Safely increment active connections count
-    if (mutex_acquire_blocking(active_connections_mutex)) {
-        active_connections++;
-        mutex_release(active_connections_mutex);
+    int target = get_setting_uint8(&global_settings.target_active_connections);
+    int active = 0;
+    if (!entry->counted_as_active) {
+        if (!connection_reserve(target, &active)) {
+            // two phones finished their handshakes at once, or the target was lowered meanwhile
+            ESP_LOGW(HANDSHAKE_TAG, "[%d] refused, target connections reached (%d/%d)", conn_id, active, target);
+            advertise_for_connections(active);
+            return false;
+        }
+        entry->counted_as_active = true;
+    } else {
+        active = get_active_connections();
     }
-    entry->counted_as_active = true;
 
-    entry->conn_id = conn_id;
     entry->connection_start = xTaskGetTickCount();
 
     ESP_LOGI(HANDSHAKE_TAG,
         "[%d] connected, active_connections=%d, handshake_duration=%lu ms",
         conn_id,
-        get_active_connections(),
+        active,
         pdTICKS_TO_MS(entry->connection_start - entry->handshake_start));
 
-    // After incrementing active_connections, stop advertising if we've reached target
-    // This must happen AFTER the counter increment, not in ESP_GATTS_CONNECT_EVT
-    // where active_connections hasn't been updated yet.
-    int target = get_setting_uint8(&global_settings.target_active_connections);
-    int current = get_active_connections();
-    if (current >= target) {
-        ESP_LOGI(
-            HANDSHAKE_TAG, "[%d] reached target connections (%d/%d), stopping advertising", conn_id, current, target);
-        pgp_advertise_stop();
-    }
+    // counts from here on go to this phone, not to whoever had conn_id before
+    stats_session_start(entry->remote_bda, conn_id);
+
+    // decided on the count our reservation returned, not on a second read another connect/disconnect
+    // could have changed meanwhile
+    advertise_for_connections(active);
+    return true;
 }
 
 void connection_update(uint16_t conn_id) {
@@ -196,21 +559,24 @@ void connection_stop(uint16_t conn_id, uint8_t reason) {
     // connection_start() ran for it. A handshake that never completed never
     // incremented the counter, so stopping it must not decrement it either.
     if (entry->counted_as_active) {
-        if (mutex_acquire_blocking(active_connections_mutex)) {
-            active_connections--;
-            if (active_connections < 0) {
-                // I'm not entirely sure that we covered all paths so try to save something in case of
-                // mistakes
-                ESP_LOGE(HANDSHAKE_TAG, "we counted connections wrong!");
-                active_connections = 0;
-            }
-            mutex_release(active_connections_mutex);
-        }
+        connection_release();
         entry->counted_as_active = false;
     }
 
     entry->connection_end = xTaskGetTickCount();
-    entry->cert_state = 0;
+    handshake_progress_lock();
+    entry->cert_state = CERT_STATE_CHAL_0;
+    handshake_progress_unlock();
+    stats_session_end(conn_id);
+
+    // keep what this phone needs to come back in RAM, the slot is zeroed below
+    if (entry->has_reconnect_key) {
+        session_cache_put_session(entry->remote_bda, entry->session_key, entry->reconnect_challenge);
+    }
+    if (entry->settings && mutex_acquire_blocking(entry->settings->mutex)) {
+        session_cache_put_settings(entry->remote_bda, entry->settings->autocatch, entry->settings->autospin);
+        mutex_release(entry->settings->mutex);
+    }
 
     // Detect early disconnect with cached session (potential stale cache)
     uint32_t conn_duration_ms = pdTICKS_TO_MS(entry->connection_end - entry->connection_start);
@@ -238,11 +604,28 @@ size_t dump_client_states_format(char* buf, size_t buf_len) {
     buf_writer_t writer;
     buf_writer_init(&writer, buf, buf_len);
 
-    buf_writer_appendf(&writer, "active_connections: %d\nconn_id_map:\n", active_connections);
+    buf_writer_appendf(&writer, "active_connections: %d\nconn_id_map:\n", get_active_connections());
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         buf_writer_appendf(&writer, "%d: %04x\n", i, conn_id_map[i]);
     }
 
+    int buffers_used = 0;
+    for (int i = 0; i < HANDSHAKE_BUFFER_POOL_SIZE; i++) {
+        buffers_used += handshake_buffer_used[i];
+    }
+    buf_writer_appendf(&writer,
+        "handshake_buffers: %d/%d used, exhausted=%lu failed=%lu\n",
+        buffers_used,
+        HANDSHAKE_BUFFER_POOL_SIZE,
+        (unsigned long)handshake_buffer_exhausted,
+        (unsigned long)handshake_buffer_failed);
+
+    buf_writer_appendf(&writer, "reaped:");
+    for (int s = 0; s < CERT_STATE_ESTABLISHED; s++) {
+        buf_writer_appendf(&writer, " %s=%lu", cert_state_name(s), (unsigned long)reaped_by_state[s]);
+    }
+    buf_writer_appendf(&writer, "\n");
+
     buf_writer_appendf(&writer, "client_states:\n");
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         client_state_t* entry = &client_states[i];
@@ -258,16 +641,27 @@ size_t dump_client_states_format(char* buf, size_t buf_len) {
             entry->reconnection_at,
             entry->connection_start,
             entry->connection_end);
+        if (entry->trace_len > 0) {
+            buf_writer_appendf(&writer, "  trace:");
+            for (int t = 0; t < entry->trace_len; t++) {
+                buf_writer_appendf(
+                    &writer, " %d@%lums", entry->trace[t].state, (unsigned long)(entry->trace[t].offset_us / 1000));
+            }
+            buf_writer_appendf(&writer, "\n");
+        }
         if (entry->settings != NULL) {
             buf_writer_appendf(&writer,
                 "  autospin=%s autocatch=%s\n",
                 get_setting_log_value(&entry->settings->autospin),
                 get_setting_log_value(&entry->settings->autocatch));
         }
-        buf_writer_append_hex(&writer, "state_0_nonce", entry->state_0_nonce, sizeof(entry->state_0_nonce));
-        buf_writer_append_hex(&writer, "the_challenge", entry->the_challenge, sizeof(entry->the_challenge));
-        buf_writer_append_hex(&writer, "main_nonce", entry->main_nonce, sizeof(entry->main_nonce));
-        buf_writer_append_hex(&writer, "outer_nonce", entry->outer_nonce, sizeof(entry->outer_nonce));
+        handshake_buffer_t* hs = entry->handshake;
+        if (hs != NULL) {
+            buf_writer_append_hex(&writer, "state_0_nonce", hs->state_0_nonce, sizeof(hs->state_0_nonce));
+            buf_writer_append_hex(&writer, "the_challenge", hs->the_challenge, sizeof(hs->the_challenge));
+            buf_writer_append_hex(&writer, "main_nonce", hs->main_nonce, sizeof(hs->main_nonce));
+            buf_writer_append_hex(&writer, "outer_nonce", hs->outer_nonce, sizeof(hs->outer_nonce));
+        }
         buf_writer_append_hex(&writer, "session_key", entry->session_key, sizeof(entry->session_key));
         buf_writer_append_hex(
             &writer, "reconnect_challenge", entry->reconnect_challenge, sizeof(entry->reconnect_challenge));
@@ -286,7 +680,7 @@ void dump_client_states() {
 // https://github.com/espressif/esp-idf/blob/master/examples/bluetooth/bluedroid/ble/gatt_security_server/main/example_ble_sec_gatts_demo.c
 // instead
 void reset_client_states() {
-    ESP_LOGI(HANDSHAKE_TAG, "active_connections: %d", active_connections);
+    ESP_LOGI(HANDSHAKE_TAG, "active_connections: %d", get_active_connections());
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         // make sure it's not an empty slot
         if (conn_id_map[i] != 0xffff) {
@@ -1,10 +1,12 @@
 #ifndef PGP_HANDSHAKE_MULTI_H
 #define PGP_HANDSHAKE_MULTI_H
 
+#include "connection_limits.h"
 #include "esp_bt_defs.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/FreeRTOSConfig.h"
 #include "freertos/task.h"
+#include "pgp_cert.h"
 #include "settings.h"
 
 #include <portmacro.h>
@@ -14,19 +16,40 @@
 
 static const size_t CERT_BUFFER_LEN = 378;
 
+// handshake steps, the values are the ones the app sees in the first byte of our notifications
+typedef enum {
+    CERT_STATE_CHAL_0 = 0,          // full handshake: chal_0 sent, waiting for the app's 20 byte reply
+    CERT_STATE_NEXT_CHAL = 1,       // next challenge sent, waiting for the app's challenge
+    CERT_STATE_APP_RESPONSE = 2,    // response sent, waiting for the app to confirm
+    CERT_STATE_RECONNECT = 3,       // reconnect challenge sent, waiting for the app's 20 byte reply
+    CERT_STATE_RECONNECT_CHAL = 4,  // waiting for the app's reconnect challenge
+    CERT_STATE_RECONNECT_ACK = 5,   // reconnect response sent, waiting for the app's 5 byte ack
+    CERT_STATE_ESTABLISHED = 6,
+    CERT_STATE_COUNT
+} cert_state_t;
+
+// cached session keys read at connect time by session_prefetch.c
+typedef enum {
+    SESSION_PREFETCH_NONE = 0,  // not started, or already taken/cancelled
+    SESSION_PREFETCH_PENDING,   // queued, the task hasn't read NVS yet
+    SESSION_PREFETCH_HIT,       // prefetched_* hold the keys
+    SESSION_PREFETCH_MISS,      // no cached session for this phone
+} session_prefetch_state_t;
+
+// states entered by one handshake, 0/3 -> ... -> 6 is at most 4 but the app may restart it
+#define HANDSHAKE_TRACE_LEN 8
+
 typedef struct {
-    // connection informations
-    uint16_t conn_id;
-    esp_bd_addr_t remote_bda;
-    DeviceSettings* settings;
+    uint8_t state;       // cert_state_t entered
+    uint32_t offset_us;  // since trace_start_us
+} handshake_trace_entry_t;
 
-    // cert informations
-    int cert_state;
-    // TODO: we probably need to save the remote mac address so that we associate a reconnecting
-    // client with its previous client state
-    bool has_reconnect_key;
-    bool notify;
+// scratch space of a handshake in progress, only needed until CERT_STATE_ESTABLISHED so the few of them
+// are shared by all connections, see handshake_buffer_checkout()
+#define HANDSHAKE_BUFFER_POOL_SIZE 2
 
+typedef struct {
+    bool chal_0_tail_ready;  // cert_buffer past CHAL_0_DYNAMIC_LEN holds chal_0_stamp_static()'s bytes
     uint8_t cert_buffer[378];
 
     uint8_t state_0_nonce[16];
@@ -34,11 +57,15 @@ typedef struct {
     uint8_t the_challenge[16];
     uint8_t main_nonce[16];
     uint8_t outer_nonce[16];
+} handshake_buffer_t;
 
-    uint8_t session_key[16];
-    uint8_t reconnect_challenge[32];
-
-    TickType_t handshake_start, reconnection_at, connection_start, connection_end;
+typedef struct {
+    // looked at on every GATTS event, button press and LED update
+    uint16_t conn_id;
+    cert_state_t cert_state;
+    bool has_reconnect_key;
+    bool notify;
+    bool has_session_ctx;
     bool used_cached_session;
     // Set by connection_start() once this entry has been counted in the global
     // active_connections total. connection_stop() only decrements when this is
@@ -48,10 +75,50 @@ typedef struct {
     // Lets pgp_gap.c tell a fresh pairing's auth failure apart from a transient auth
     // hiccup on a link that already authenticated once and is still live.
     bool auth_succeeded;
+    DeviceSettings* settings;
+    // NULL unless a handshake is in progress
+    handshake_buffer_t* handshake;
+
+    // connection informations
+    esp_bd_addr_t remote_bda;
+
+    // key material, kept for reconnects
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+    // AES schedule for session_key, expanded once when the key is generated or loaded
+    // so the handshake steps don't re-key on every call. Freed in delete_client_state_entry().
+    AES_Context session_ctx;
+
+    // filled by the session prefetch task, guarded by its mutex, see session_prefetch_take()
+    session_prefetch_state_t prefetch_state;
+    uint8_t prefetched_session_key[16];
+    uint8_t prefetched_reconnect_challenge[32];
+
+    // esp_timer_get_time() when the handshake started and when cert_state was entered,
+    // plus every state entered since, see enter_cert_state() in pgp_handshake.c; cert_state,
+    // state_entered_us, trace_len and reaped_at_us only change under handshake_progress_lock()
+    int64_t trace_start_us, state_entered_us;
+    handshake_trace_entry_t trace[HANDSHAKE_TRACE_LEN];
+    uint8_t trace_len;
+    // set when the reaper disconnected this stalled handshake, see init_handshake_reaper()
+    int64_t reaped_at_us;
+
+    TickType_t handshake_start, reconnection_at, connection_start, connection_end;
 } client_state_t;
 
 void init_handshake_multi();
 
+// starts a periodic esp_timer that disconnects handshakes stuck in one state for twice as long as
+// cert_state_timeout_ms() allows, so a vanished phone or a buggy app can't hold a slot until the
+// link supervision timeout, and the task that frees the slot if no DISCONNECT_EVT follows; call after
+// init_bluetooth()
+bool init_handshake_reaper();
+
+// the handshake reaper reads a slot's progress from the esp_timer task, the BT task changes it inside
+// this short critical section
+void handshake_progress_lock();
+void handshake_progress_unlock();
+
 int get_active_connections();
 int get_max_connections();
 
@@ -77,7 +144,15 @@ size_t dump_client_states_format(char* buf, size_t buf_len);
 void reset_client_states();
 
 
-void connection_start(uint16_t conn_id);
+// hands client_state a handshake buffer (zeroed) if it doesn't hold one yet. Falls back to the heap
+// when the pool is exhausted, returns false only if that fails too.
+bool handshake_buffer_checkout(client_state_t* client_state);
+// gives the buffer back (wiping the nonces in it), no-op without one
+void handshake_buffer_release(client_state_t* client_state);
+
+// handshake finished: counts conn_id as active and starts/stops advertising for the new count,
+// returns false without counting it when target_active_connections phones are already active
+bool connection_start(uint16_t conn_id);
 void connection_update(uint16_t conn_id);
 void connection_stop(uint16_t conn_id, uint8_t reason);
 
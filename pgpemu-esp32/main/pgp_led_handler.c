@@ -1,6 +1,7 @@
+#include "entropy.h"
 #include "esp_gatt_defs.h"
 #include "esp_log.h"
-#include "esp_random.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
@@ -162,7 +163,7 @@ void handle_led_notify_from_app(esp_gatt_if_t gatts_if, uint16_t conn_id, const
         int pattern_ms = pattern_duration * 50;
 
         // random button press delay between 1000 and 2500 ms
-        int delay = 1000 + esp_random() % 1501;
+        int delay = 1000 + entropy_word() % 1501;
         if (delay < pattern_ms) {
             ESP_LOGD(LEDHANDLER_TAG, "[%d] queueing push button after %d ms", conn_id, delay);
 
@@ -170,6 +171,7 @@ void handle_led_notify_from_app(esp_gatt_if_t gatts_if, uint16_t conn_id, const
             item.gatts_if = gatts_if;
             item.conn_id = conn_id;
             item.delay = delay;
+            item.queued_us = esp_timer_get_time();
             xQueueSend(button_queue, &item, portMAX_DELAY);
         }
     }
@@ -1,16 +1,24 @@
 #include "button_input.h"
 #include "config_secrets.h"
 #include "config_storage.h"
+#include "device_directory.h"
+#include "entropy.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "led_output.h"
 #include "log_tags.h"
+#include "nvs_writer.h"
 #include "pgp_autobutton.h"
 #include "pgp_bluetooth.h"
+#include "pgp_cert.h"
+#include "pgp_cert_pool.h"
 #include "pgp_gap.h"
 #include "secrets.h"
+#include "session_cache.h"
+#include "session_prefetch.h"
 #include "settings.h"
 #include "setup_button.h"
+#include "stats.h"
 
 void app_main() {
     // set log levels which let init msgs through
@@ -25,11 +33,29 @@ void app_main() {
         vTaskDelay(60000 / portTICK_PERIOD_MS);
     }
 
+    // before any task asks for nonces
+    init_entropy();
+
     init_settings_nvs_partition();
 
+    // RAM copy of per-phone NVS data, used from the first connection on
+    init_session_cache();
+
+    // session keys are written to NVS in the background, changes are written synchronously without it
+    if (!init_nvs_writer()) {
+        ESP_LOGW(PGPEMU_TAG, "creating nvs writer task failed");
+    }
+    // lifetime catch/spin counts per phone, committed every few minutes
+    if (!init_stats()) {
+        ESP_LOGW(PGPEMU_TAG, "creating stats task failed");
+    }
+
     init_global_settings();
     read_stored_global_settings(false);
 
+    // which phones have a record at all, so unknown ones skip NVS; trims the store to its capacity
+    init_device_directory(global_settings.max_stored_devices);
+
     // restore log levels
     if (global_settings.log_level == 3) {
         ESP_LOGI(PGPEMU_TAG, "log levels verbose");
@@ -52,6 +78,9 @@ void app_main() {
         return;
     }
 
+    // the device key is fixed from now on, expand its AES schedule once
+    init_device_key_ctx();
+
     if (setup_button_pressed_on_boot()) {
         global_settings_ready();  // release mutex
         ESP_LOGI(PGPEMU_TAG, "setup button pressed on boot; continuing startup");
@@ -67,12 +96,30 @@ void app_main() {
         return;
     }
 
+    // read cached session keys as soon as a phone connects, handshakes fall back to reading NVS without it
+    if (!init_session_prefetch()) {
+        ESP_LOGW(PGPEMU_TAG, "creating session prefetch task failed");
+    }
+
     // set clone mac and start bluetooth
     if (!init_bluetooth()) {
         ESP_LOGI(PGPEMU_TAG, "bluetooth init failed");
         return;
     }
 
+    // the mac is final now, stamp the static parts of challenge 0 once
+    init_chal_0_template(bt_mac);
+
+    // precompute challenge 0 certificates in the background, handshakes fall back to inline generation without it
+    if (!init_cert_pool()) {
+        ESP_LOGW(PGPEMU_TAG, "creating cert pool task failed");
+    }
+
+    // free slots of handshakes that stall, otherwise they are only freed by the link supervision timeout
+    if (!init_handshake_reaper()) {
+        ESP_LOGW(PGPEMU_TAG, "creating handshake reaper timer failed");
+    }
+
     // done
     ESP_LOGI(PGPEMU_TAG, "Device: %s", PGP_CLONE_NAME);
     ESP_LOGI(PGPEMU_TAG,
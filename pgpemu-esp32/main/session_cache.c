@@ -0,0 +1,155 @@
+#include "session_cache.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "log_tags.h"
+#include "mutex_helpers.h"
+
+#include <string.h>
+
+typedef struct {
+    bool used;
+    uint32_t last_used;  // value of use_clock at the last put/get, smallest is evicted first
+    esp_bd_addr_t bda;
+
+    bool has_session;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+
+    bool has_settings;
+    bool autocatch, autospin;
+} session_cache_entry_t;
+
+static session_cache_entry_t cache[SESSION_CACHE_SIZE];
+static uint32_t use_clock = 0;
+static SemaphoreHandle_t cache_mutex = NULL;
+
+void init_session_cache() {
+    if (!cache_mutex) {
+        cache_mutex = xSemaphoreCreateMutex();
+    }
+}
+
+// call with cache_mutex held
+static session_cache_entry_t* find_entry(const esp_bd_addr_t bda) {
+    for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+        if (cache[i].used && memcmp(cache[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            cache[i].last_used = ++use_clock;
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// returns the entry for bda, taking a free or the least recently used one if bda isn't cached yet.
+// call with cache_mutex held
+static session_cache_entry_t* find_or_evict_entry(const esp_bd_addr_t bda) {
+    session_cache_entry_t* entry = find_entry(bda);
+    if (entry) {
+        return entry;
+    }
+
+    entry = &cache[0];
+    for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+        if (!cache[i].used) {
+            entry = &cache[i];
+            break;
+        }
+        if (cache[i].last_used < entry->last_used) {
+            entry = &cache[i];
+        }
+    }
+
+    if (entry->used) {
+        ESP_LOGD(CONFIG_STORAGE_TAG,
+            "session cache evicting %02x:%02x:%02x:%02x:%02x:%02x",
+            entry->bda[0],
+            entry->bda[1],
+            entry->bda[2],
+            entry->bda[3],
+            entry->bda[4],
+            entry->bda[5]);
+    }
+
+    memset(entry, 0, sizeof(session_cache_entry_t));
+    entry->used = true;
+    entry->last_used = ++use_clock;
+    memcpy(entry->bda, bda, sizeof(esp_bd_addr_t));
+    return entry;
+}
+
+void session_cache_put_session(const esp_bd_addr_t bda,
+    const uint8_t* session_key,
+    const uint8_t* reconnect_challenge) {
+    if (!mutex_acquire_blocking(cache_mutex)) {
+        return;
+    }
+
+    session_cache_entry_t* entry = find_or_evict_entry(bda);
+    memcpy(entry->session_key, session_key, sizeof(entry->session_key));
+    memcpy(entry->reconnect_challenge, reconnect_challenge, sizeof(entry->reconnect_challenge));
+    entry->has_session = true;
+
+    mutex_release(cache_mutex);
+}
+
+bool session_cache_get_session(const esp_bd_addr_t bda, uint8_t* session_key_out, uint8_t* reconnect_challenge_out) {
+    if (!mutex_acquire_blocking(cache_mutex)) {
+        return false;
+    }
+
+    session_cache_entry_t* entry = find_entry(bda);
+    bool found = entry && entry->has_session;
+    if (found) {
+        memcpy(session_key_out, entry->session_key, sizeof(entry->session_key));
+        memcpy(reconnect_challenge_out, entry->reconnect_challenge, sizeof(entry->reconnect_challenge));
+    }
+
+    mutex_release(cache_mutex);
+    return found;
+}
+
+void session_cache_invalidate(const esp_bd_addr_t bda) {
+    if (!mutex_acquire_blocking(cache_mutex)) {
+        return;
+    }
+
+    session_cache_entry_t* entry = find_entry(bda);
+    if (entry) {
+        entry->has_session = false;
+        memset(entry->session_key, 0, sizeof(entry->session_key));
+        memset(entry->reconnect_challenge, 0, sizeof(entry->reconnect_challenge));
+    }
+
+    mutex_release(cache_mutex);
+}
+
+void session_cache_put_settings(const esp_bd_addr_t bda, bool autocatch, bool autospin) {
+    if (!mutex_acquire_blocking(cache_mutex)) {
+        return;
+    }
+
+    session_cache_entry_t* entry = find_or_evict_entry(bda);
+    entry->autocatch = autocatch;
+    entry->autospin = autospin;
+    entry->has_settings = true;
+
+    mutex_release(cache_mutex);
+}
+
+bool session_cache_get_settings(const esp_bd_addr_t bda, bool* autocatch_out, bool* autospin_out) {
+    if (!mutex_acquire_blocking(cache_mutex)) {
+        return false;
+    }
+
+    session_cache_entry_t* entry = find_entry(bda);
+    bool found = entry && entry->has_settings;
+    if (found) {
+        *autocatch_out = entry->autocatch;
+        *autospin_out = entry->autospin;
+    }
+
+    mutex_release(cache_mutex);
+    return found;
+}
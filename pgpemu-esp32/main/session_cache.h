@@ -0,0 +1,29 @@
+#ifndef SESSION_CACHE_H
+#define SESSION_CACHE_H
+
+#include "connection_limits.h"
+#include "esp_bt_defs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// phones seen recently, twice the connection count so a full set of phones cycling through
+// reconnects never evicts each other
+#define SESSION_CACHE_SIZE (2 * MAX_CONNECTIONS)
+
+// RAM copy of what NVS holds per phone (session keys and device settings), kept across disconnects
+// so a phone that drops and comes back within the same boot doesn't touch flash. Least recently
+// used entries are evicted when full.
+void init_session_cache();
+
+void session_cache_put_session(const esp_bd_addr_t bda, const uint8_t* session_key, const uint8_t* reconnect_challenge);
+// returns false if there is no session cached for bda
+bool session_cache_get_session(const esp_bd_addr_t bda, uint8_t* session_key_out, uint8_t* reconnect_challenge_out);
+// forgets the session keys of bda, its settings stay cached
+void session_cache_invalidate(const esp_bd_addr_t bda);
+
+void session_cache_put_settings(const esp_bd_addr_t bda, bool autocatch, bool autospin);
+// returns false if there are no settings cached for bda
+bool session_cache_get_settings(const esp_bd_addr_t bda, bool* autocatch_out, bool* autospin_out);
+
+#endif /* SESSION_CACHE_H */
@@ -0,0 +1,152 @@
+#include "session_prefetch.h"
+
+#include "config_storage.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "log_tags.h"
+#include "mutex_helpers.h"
+#include "session_cache.h"
+
+#include <string.h>
+
+typedef struct {
+    uint16_t conn_id;
+    esp_bd_addr_t bda;
+} prefetch_request_t;
+
+static QueueHandle_t prefetch_queue = NULL;
+// guards prefetch_state and the prefetched_* fields of every client state
+static SemaphoreHandle_t prefetch_mutex = NULL;
+
+static void session_prefetch_task(void* pvParameters);
+
+bool init_session_prefetch() {
+    prefetch_mutex = xSemaphoreCreateMutex();
+    if (!prefetch_mutex) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "%s creating mutex failed", __func__);
+        return false;
+    }
+
+    prefetch_queue = xQueueCreate(2 * MAX_CONNECTIONS, sizeof(prefetch_request_t));
+    if (!prefetch_queue) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "%s creating queue failed", __func__);
+        vSemaphoreDelete(prefetch_mutex);
+        prefetch_mutex = NULL;
+        return false;
+    }
+
+    // below autobutton, NVS reads must not delay button presses of established connections
+    BaseType_t ret = xTaskCreate(session_prefetch_task, "session_prefetch", 3072, NULL, 10, NULL);
+    if (ret != pdPASS) {
+        ESP_LOGE(CONFIG_STORAGE_TAG, "%s creating task failed", __func__);
+        vQueueDelete(prefetch_queue);
+        prefetch_queue = NULL;
+        vSemaphoreDelete(prefetch_mutex);
+        prefetch_mutex = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void session_prefetch_start(uint16_t conn_id, esp_bd_addr_t bda) {
+    client_state_t* client_state = get_client_state_entry(conn_id);
+    if (!client_state || !prefetch_queue) {
+        return;
+    }
+
+    prefetch_request_t request = { .conn_id = conn_id };
+    memcpy(request.bda, bda, sizeof(esp_bd_addr_t));
+
+    if (!mutex_acquire_blocking(prefetch_mutex)) {
+        return;
+    }
+    // seen since boot, no need to read flash
+    if (session_cache_get_session(
+            bda, client_state->prefetched_session_key, client_state->prefetched_reconnect_challenge)) {
+        client_state->prefetch_state = SESSION_PREFETCH_HIT;
+        mutex_release(prefetch_mutex);
+        return;
+    }
+    client_state->prefetch_state = SESSION_PREFETCH_PENDING;
+    mutex_release(prefetch_mutex);
+
+    if (xQueueSend(prefetch_queue, &request, 0) != pdTRUE) {
+        // the handshake falls back to reading NVS itself
+        ESP_LOGW(CONFIG_STORAGE_TAG, "[%d] session prefetch queue full", conn_id);
+        session_prefetch_cancel(client_state);
+    }
+}
+
+session_prefetch_state_t session_prefetch_take(client_state_t* client_state) {
+    if (!mutex_acquire_blocking(prefetch_mutex)) {
+        return SESSION_PREFETCH_NONE;
+    }
+
+    session_prefetch_state_t state = client_state->prefetch_state;
+    if (state == SESSION_PREFETCH_HIT) {
+        memcpy(client_state->session_key, client_state->prefetched_session_key, sizeof(client_state->session_key));
+        memcpy(client_state->reconnect_challenge,
+            client_state->prefetched_reconnect_challenge,
+            sizeof(client_state->reconnect_challenge));
+    }
+    memset(client_state->prefetched_session_key, 0, sizeof(client_state->prefetched_session_key));
+    memset(client_state->prefetched_reconnect_challenge, 0, sizeof(client_state->prefetched_reconnect_challenge));
+    client_state->prefetch_state = SESSION_PREFETCH_NONE;
+
+    mutex_release(prefetch_mutex);
+    return state;
+}
+
+void session_prefetch_cancel(client_state_t* client_state) {
+    if (!mutex_acquire_blocking(prefetch_mutex)) {
+        return;
+    }
+    client_state->prefetch_state = SESSION_PREFETCH_NONE;
+    memset(client_state->prefetched_session_key, 0, sizeof(client_state->prefetched_session_key));
+    memset(client_state->prefetched_reconnect_challenge, 0, sizeof(client_state->prefetched_reconnect_challenge));
+    mutex_release(prefetch_mutex);
+}
+
+static void session_prefetch_task(void* __attribute__((unused)) pvParameters) {
+    prefetch_request_t request;
+    uint8_t session_key[16];
+    uint8_t reconnect_challenge[32];
+
+    ESP_LOGI(CONFIG_STORAGE_TAG, "session prefetch task start");
+
+    while (1) {
+        if (!xQueueReceive(prefetch_queue, &request, portMAX_DELAY)) {
+            continue;
+        }
+
+        // one record read: pending writes, the directory and phones without a session are handled inside
+        bool found = retrieve_device_session_keys(request.bda, session_key, reconnect_challenge);
+
+        if (mutex_acquire_blocking(prefetch_mutex)) {
+            // the phone may have disconnected (or the handshake given up waiting) meanwhile,
+            // a slot freed or reused since then isn't PENDING for this bda anymore
+            client_state_t* client_state = get_client_state_entry(request.conn_id);
+            if (client_state && client_state->prefetch_state == SESSION_PREFETCH_PENDING &&
+                memcmp(client_state->remote_bda, request.bda, sizeof(esp_bd_addr_t)) == 0) {
+                if (found) {
+                    memcpy(client_state->prefetched_session_key, session_key, sizeof(session_key));
+                    memcpy(client_state->prefetched_reconnect_challenge,
+                        reconnect_challenge,
+                        sizeof(reconnect_challenge));
+                }
+                client_state->prefetch_state = found ? SESSION_PREFETCH_HIT : SESSION_PREFETCH_MISS;
+                ESP_LOGD(CONFIG_STORAGE_TAG, "[%d] session prefetch done, found=%d", request.conn_id, found);
+            }
+            mutex_release(prefetch_mutex);
+        }
+
+        memset(session_key, 0, sizeof(session_key));
+        memset(reconnect_challenge, 0, sizeof(reconnect_challenge));
+    }
+
+    vTaskDelete(NULL);
+}
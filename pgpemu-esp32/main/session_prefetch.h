@@ -0,0 +1,26 @@
+#ifndef SESSION_PREFETCH_H
+#define SESSION_PREFETCH_H
+
+#include "esp_bt_defs.h"
+#include "pgp_handshake_multi.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// starts the task which reads cached session keys from NVS as soon as a phone connects,
+// so the CCCD write that starts the handshake only has to look at RAM
+bool init_session_prefetch();
+
+// queues the NVS lookup for bda, call from ESP_GATTS_CONNECT_EVT after set_remote_bda()
+void session_prefetch_start(uint16_t conn_id, esp_bd_addr_t bda);
+
+// hands over the prefetched keys into client_state->session_key/reconnect_challenge,
+// returns SESSION_PREFETCH_HIT or SESSION_PREFETCH_MISS when the lookup finished, otherwise
+// SESSION_PREFETCH_PENDING (or NONE if none was started) and the caller has to read NVS itself.
+// Either way a late result is discarded afterwards.
+session_prefetch_state_t session_prefetch_take(client_state_t* client_state);
+
+// drops a pending lookup, called before the client state slot is freed
+void session_prefetch_cancel(client_state_t* client_state);
+
+#endif /* SESSION_PREFETCH_H */
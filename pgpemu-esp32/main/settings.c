@@ -1,6 +1,7 @@
 #include "settings.h"
 
 #include "config_secrets.h"
+#include "device_directory.h"
 #include "esp_log.h"
 #include "esp_random.h"
 #include "log_tags.h"
@@ -15,6 +16,7 @@ GlobalSettings global_settings = {
     .target_active_connections = 1,
     .log_level = 1,
     .advertising_enabled = true,
+    .max_stored_devices = DEVICE_STORE_DEFAULT_CAPACITY,
 };
 
 void init_global_settings() {
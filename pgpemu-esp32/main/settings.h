@@ -21,6 +21,9 @@ typedef struct {
 
     // enable/disable BLE advertising to save power
     bool advertising_enabled;
+
+    // phones with a record in NVS, the least recently seen one is evicted for a new one
+    uint8_t max_stored_devices;
 } GlobalSettings;
 
 extern GlobalSettings global_settings;
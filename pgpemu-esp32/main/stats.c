@@ -1,119 +1,604 @@
 #include "stats.h"
 
 #include "buf_writer.h"
+#include "device_keys.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "log_tags.h"
+#include "mutex_helpers.h"
 #include "nvs.h"
+#include "nvs_helper.h"
 
-#include <stdint.h>
+#include <string.h>
 
-#define MAX_CONNECTIONS CONFIG_BT_ACL_CONNECTIONS
+#define STATS_NAMESPACE "device_stats"
+#define STATS_RECORD_VERSION 1
+#define STATS_NO_CONN 0xffff
 
-static StatsForConn stats[MAX_CONNECTIONS];
-static size_t stats_len = 0;
+typedef struct {
+    bool used;
+    bool loaded;    // stored holds what NVS had
+    bool dirty;     // unsaved has something to commit
+    bool flushing;  // taken by a flush, kept until it put the counts into stored or back into unsaved
+    uint16_t conn_id;
+    uint32_t last_used;  // value of use_clock at the last session start, smallest is evicted first
+    esp_bd_addr_t bda;
+    TickType_t session_start;
+    TickType_t accounted_at;   // connected time up to here is in unsaved.seconds
+    uint32_t session_seconds;  // of the last session once offline
+    Stats session;
+    stats_record_t stored;
+    stats_record_t unsaved;  // counted since the last flush, moved into NVS by the next one
+} stats_entry_t;
 
-StatsForConn* get_conn_entry(uint16_t conn_id) {
-    for (size_t i = 0; i < stats_len; i++) {
-        if (stats[i].conn_id == conn_id) {
-            return &stats[i];
-        }
+// guarded by stats_lock, held only for a few increments so the LED handler never waits on the flash
+static stats_entry_t entries[STATS_SLOTS];
+static uint32_t use_clock = 0;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// only one flush at a time (stats task, a full table or shutdown)
+static SemaphoreHandle_t flush_mutex = NULL;
+static TaskHandle_t stats_task_handle = NULL;
+
+static void stats_task(void* pvParameters);
+
+static void stats_shutdown() {
+    stats_flush();
+}
+
+bool init_stats() {
+    flush_mutex = xSemaphoreCreateMutex();
+    if (!flush_mutex) {
+        ESP_LOGE(STATS_TAG, "%s creating mutex failed", __func__);
+        return false;
     }
-    if (stats_len < MAX_CONNECTIONS) {
-        stats[stats_len].conn_id = conn_id;
-        stats[stats_len].stats = (Stats){ 0 };
-        stats_len++;
 
-        ESP_LOGI(STATS_TAG, "new entry for conn_id %d added, current len %d", conn_id, stats_len);
+    esp_err_t err = esp_register_shutdown_handler(stats_shutdown);
+    if (err != ESP_OK) {
+        ESP_LOGW(STATS_TAG, "%s registering shutdown handler failed: %s", __func__, esp_err_to_name(err));
+    }
 
-        return &stats[stats_len - 1];
+    // below nvs_writer, losing a few minutes of counts on a crash is fine, a late session key is not
+    BaseType_t ret = xTaskCreate(stats_task, "stats", 3072, NULL, 4, &stats_task_handle);
+    if (ret != pdPASS) {
+        ESP_LOGE(STATS_TAG, "%s creating task failed", __func__);
+        stats_task_handle = NULL;
+        return false;
     }
 
-    ESP_LOGE(STATS_TAG, "no stat found for conn_id %d or impossible to store a new entry", conn_id);
+    return true;
+}
+
+static void kick_flush() {
+    if (stats_task_handle) {
+        xTaskNotifyGive(stats_task_handle);
+    }
+}
+
+static void add_stats(Stats* to, const Stats* from) {
+    to->caught += from->caught;
+    to->fled += from->fled;
+    to->spin += from->spin;
+}
+
+static void add_record(stats_record_t* to, const stats_record_t* from) {
+    add_stats(&to->stats, &from->stats);
+    to->sessions += from->sessions;
+    to->seconds += from->seconds;
+}
+
+// moves the connected time since accounted_at into unsaved, whole seconds only so nothing is counted twice
+// call with stats_lock held
+static void account_time_locked(stats_entry_t* entry, TickType_t now) {
+    if (entry->conn_id == STATS_NO_CONN) {
+        return;
+    }
+    uint32_t seconds = pdTICKS_TO_MS(now - entry->accounted_at) / 1000;
+    if (seconds > 0) {
+        entry->unsaved.seconds += seconds;
+        entry->accounted_at += pdMS_TO_TICKS(seconds * 1000);
+        entry->dirty = true;
+    }
+}
 
+// call with stats_lock held
+static stats_entry_t* find_by_conn_locked(uint16_t conn_id) {
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (entries[i].used && entries[i].conn_id == conn_id) {
+            return &entries[i];
+        }
+    }
     return NULL;
 }
 
-bool stats_get_for_conn(uint16_t conn_id, Stats* out) {
-    for (size_t i = 0; i < stats_len; i++) {
-        if (stats[i].conn_id == conn_id) {
-            *out = stats[i].stats;
-            return true;
+// call with stats_lock held
+static stats_entry_t* find_by_bda_locked(const esp_bd_addr_t bda) {
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (entries[i].used && memcmp(entries[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return &entries[i];
         }
     }
-    return false;
+    return NULL;
+}
+
+// call with stats_lock held
+static void end_session_locked(stats_entry_t* entry, TickType_t now) {
+    account_time_locked(entry, now);
+    entry->session_seconds = pdTICKS_TO_MS(now - entry->session_start) / 1000;
+    entry->conn_id = STATS_NO_CONN;
 }
 
-void delete_conn_entry(uint16_t conn_id) {
-    for (size_t i = 0; i < stats_len; i++) {
-        if (stats[i].conn_id == conn_id) {
-            stats[i] = stats[stats_len - 1];
-            stats_len--;
+// a free entry or the least recently used offline one with nothing left to commit, NULL if there is none
+// call with stats_lock held
+static stats_entry_t* take_entry_locked(const esp_bd_addr_t bda) {
+    stats_entry_t* entry = find_by_bda_locked(bda);
+    if (entry) {
+        return entry;
+    }
+
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (!entries[i].used) {
+            entry = &entries[i];
+            break;
+        }
+        if (entries[i].conn_id != STATS_NO_CONN || entries[i].dirty || entries[i].flushing) {
+            continue;
+        }
+        if (!entry || entries[i].last_used < entry->last_used) {
+            entry = &entries[i];
         }
     }
+    if (entry) {
+        memset(entry, 0, sizeof(stats_entry_t));
+        entry->used = true;
+        entry->conn_id = STATS_NO_CONN;
+        memcpy(entry->bda, bda, sizeof(esp_bd_addr_t));
+    }
+    return entry;
 }
 
-void increment_caught(uint16_t conn_id) {
-    StatsForConn* s = get_conn_entry(conn_id);
-    if (s) {
-        s->stats.caught++;
+void stats_session_start(const esp_bd_addr_t bda, uint16_t conn_id) {
+    TickType_t now = xTaskGetTickCount();
+    stats_entry_t* entry = NULL;
+
+    for (int attempt = 0; attempt < 2 && !entry; attempt++) {
+        taskENTER_CRITICAL(&stats_lock);
+        // conn_id belonged to another phone whose disconnect was missed
+        stats_entry_t* stale = find_by_conn_locked(conn_id);
+        if (stale) {
+            end_session_locked(stale, now);
+        }
+        entry = take_entry_locked(bda);
+        if (entry) {
+            if (entry->conn_id != STATS_NO_CONN) {
+                end_session_locked(entry, now);
+            }
+            entry->conn_id = conn_id;
+            entry->last_used = ++use_clock;
+            entry->session_start = now;
+            entry->accounted_at = now;
+            entry->session_seconds = 0;
+            entry->session = (Stats){ 0 };
+            entry->unsaved.sessions++;
+            entry->dirty = true;
+        }
+        taskEXIT_CRITICAL(&stats_lock);
+
+        if (!entry && attempt == 0) {
+            // every offline phone still waits for its flush, make room in this context
+            ESP_LOGW(STATS_TAG, "stats table full, flushing synchronously");
+            stats_flush();
+        }
     }
+
+    if (!entry) {
+        ESP_LOGE(STATS_TAG, "[%d] no stats entry available, this session is not counted", conn_id);
+        return;
+    }
+    // loads the lifetime totals of a phone seen first since boot
+    kick_flush();
 }
 
-void increment_fled(uint16_t conn_id) {
-    StatsForConn* s = get_conn_entry(conn_id);
-    if (s) {
-        s->stats.fled++;
+void stats_session_end(uint16_t conn_id) {
+    taskENTER_CRITICAL(&stats_lock);
+    stats_entry_t* entry = find_by_conn_locked(conn_id);
+    if (entry) {
+        end_session_locked(entry, xTaskGetTickCount());
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (entry) {
+        kick_flush();
     }
 }
 
+typedef enum {
+    STATS_CAUGHT,
+    STATS_FLED,
+    STATS_SPIN,
+} stats_counter_t;
+
+static void increment(uint16_t conn_id, stats_counter_t counter) {
+    taskENTER_CRITICAL(&stats_lock);
+    stats_entry_t* entry = find_by_conn_locked(conn_id);
+    if (entry) {
+        switch (counter) {
+        case STATS_CAUGHT:
+            entry->session.caught++;
+            entry->unsaved.stats.caught++;
+            break;
+        case STATS_FLED:
+            entry->session.fled++;
+            entry->unsaved.stats.fled++;
+            break;
+        case STATS_SPIN:
+            entry->session.spin++;
+            entry->unsaved.stats.spin++;
+            break;
+        }
+        entry->dirty = true;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (!entry) {
+        ESP_LOGW(STATS_TAG, "[%d] no session, count dropped", conn_id);
+    }
+}
+
+void increment_caught(uint16_t conn_id) {
+    increment(conn_id, STATS_CAUGHT);
+}
+
+void increment_fled(uint16_t conn_id) {
+    increment(conn_id, STATS_FLED);
+}
+
 void increment_spin(uint16_t conn_id) {
-    StatsForConn* s = get_conn_entry(conn_id);
-    if (s) {
-        s->stats.spin++;
+    increment(conn_id, STATS_SPIN);
+}
+
+bool stats_get_for_conn(uint16_t conn_id, Stats* out) {
+    taskENTER_CRITICAL(&stats_lock);
+    stats_entry_t* entry = find_by_conn_locked(conn_id);
+    if (entry) {
+        *out = entry->session;
     }
+    taskEXIT_CRITICAL(&stats_lock);
+    return entry != NULL;
 }
 
-void stats_get_runtime() {
-    if (stats_len == 0) {
-        ESP_LOGI(STATS_TAG, "no stats found");
+// reads the stored totals of key, false if they couldn't be read and must not be overwritten
+static bool read_stored(nvs_handle_t handle, const char* key, stats_record_t* out) {
+    memset(out, 0, sizeof(stats_record_t));
 
-        return;
+    size_t size = sizeof(stats_record_t);
+    esp_err_t err = nvs_get_blob(handle, key, out, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return true;
+    }
+    if (err == ESP_ERR_NVS_INVALID_LENGTH || (err == ESP_OK && size != sizeof(stats_record_t))) {
+        ESP_LOGW(STATS_TAG, "stats %s has an unknown size, starting over", key);
+        memset(out, 0, sizeof(stats_record_t));
+        return true;
     }
+    if (err != ESP_OK) {
+        ESP_LOGE(STATS_TAG, "nvs error reading stats %s: %s", key, esp_err_to_name(err));
+        return false;
+    }
+    if (out->version != STATS_RECORD_VERSION) {
+        ESP_LOGW(STATS_TAG, "stats %s has version %d, starting over", key, out->version);
+        memset(out, 0, sizeof(stats_record_t));
+    }
+    return true;
+}
+
+typedef struct {
+    esp_bd_addr_t bda;
+    bool write;
+    bool ok;
+    stats_record_t delta;
+    stats_record_t total;
+} stats_flush_item_t;
 
-    for (size_t i = 0; i < stats_len; i++) {
-        ESP_LOGI(STATS_TAG,
-            "---STATS---\n"
-            "Connection %d:\n"
-            "- Caught: %d\n"
-            "- Fled: %d\n"
-            "- Spin: %d",
-            stats[i].conn_id,
-            stats[i].stats.caught,
-            stats[i].stats.fled,
-            stats[i].stats.spin);
+bool stats_flush() {
+    // guarded by flush_mutex, too big for the stack of the calling task
+    static stats_flush_item_t batch[STATS_SLOTS];
+
+    if (!flush_mutex || !mutex_acquire_blocking(flush_mutex)) {
+        return false;
+    }
+
+    // take what was counted so far, increments meanwhile go into a fresh unsaved
+    int count = 0;
+    TickType_t now = xTaskGetTickCount();
+    taskENTER_CRITICAL(&stats_lock);
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        stats_entry_t* entry = &entries[i];
+        if (!entry->used) {
+            continue;
+        }
+        account_time_locked(entry, now);
+        if (!entry->dirty && entry->loaded) {
+            continue;
+        }
+        stats_flush_item_t* item = &batch[count++];
+        memcpy(item->bda, entry->bda, sizeof(esp_bd_addr_t));
+        item->write = entry->dirty;
+        item->ok = false;
+        item->delta = entry->unsaved;
+        entry->unsaved = (stats_record_t){ 0 };
+        entry->dirty = false;
+        entry->flushing = true;
     }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (count == 0) {
+        mutex_release(flush_mutex);
+        return true;
+    }
+
+    // read-modify-write of every phone, committed together
+    int written = 0;
+    bool committed = false;
+    nvs_handle_t handle = {};
+    if (nvs_open_readwrite(STATS_TAG, STATS_NAMESPACE, &handle)) {
+        device_keys_t keys;
+        for (int i = 0; i < count; i++) {
+            stats_flush_item_t* item = &batch[i];
+            get_device_keys(item->bda, &keys);
+            const char* key = keys.key[DEVICE_KEY_RECORD];
+            if (!read_stored(handle, key, &item->total)) {
+                continue;
+            }
+            add_record(&item->total, &item->delta);
+            item->total.version = STATS_RECORD_VERSION;
+            if (item->write) {
+                esp_err_t err = nvs_set_blob(handle, key, &item->total, sizeof(stats_record_t));
+                if (!nvs_handle_write_check(STATS_TAG, handle, err, key)) {
+                    continue;
+                }
+                written++;
+            }
+            item->ok = true;
+        }
+
+        if (written > 0) {
+            committed = nvs_commit_and_close(STATS_TAG, handle, STATS_NAMESPACE);
+        } else {
+            nvs_safe_close(handle);
+            committed = true;
+        }
+    }
+
+    int failed = 0;
+    taskENTER_CRITICAL(&stats_lock);
+    for (int i = 0; i < count; i++) {
+        stats_flush_item_t* item = &batch[i];
+        stats_entry_t* entry = find_by_bda_locked(item->bda);
+        entry->flushing = false;
+        if (committed && item->ok) {
+            entry->stored = item->total;
+            entry->loaded = true;
+        } else {
+            // kept for the next flush
+            add_record(&entry->unsaved, &item->delta);
+            entry->dirty = entry->dirty || item->write;
+            failed++;
+        }
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    mutex_release(flush_mutex);
+
+    if (failed > 0) {
+        ESP_LOGE(STATS_TAG, "stats flush failed for %d of %d phones, kept for retry", failed, count);
+        return false;
+    }
+    ESP_LOGD(STATS_TAG, "stats flushed, %d phones, %d written", count, written);
+    return true;
 }
 
-size_t stats_format_runtime(char* buf, size_t buf_len) {
-    if (stats_len == 0) {
+void stats_erase_stored(const char* record_key) {
+    nvs_handle_t handle = {};
+    if (!nvs_open_readwrite(STATS_TAG, STATS_NAMESPACE, &handle)) {
+        return;
+    }
+    esp_err_t err = nvs_erase_key(handle, record_key);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        nvs_safe_close(handle);
+        return;
+    }
+    if (!nvs_handle_write_check(STATS_TAG, handle, err, record_key)) {
+        nvs_safe_close(handle);
+        return;
+    }
+    nvs_commit_and_close(STATS_TAG, handle, STATS_NAMESPACE);
+}
+
+uint16_t stats_rate_per_hour_x10(uint32_t count, uint32_t seconds) {
+    if (seconds == 0) {
         return 0;
     }
+    uint64_t rate = (uint64_t)count * 36000 / seconds;
+    return rate > 0xffff ? 0xffff : (uint16_t)rate;
+}
+
+// one phone as reported, taken under stats_lock so session and lifetime agree
+typedef struct {
+    esp_bd_addr_t bda;
+    uint16_t conn_id;
+    uint8_t flags;
+    Stats session;
+    uint32_t session_seconds;
+    stats_record_t lifetime;
+} stats_view_t;
+
+// copies the index-th used entry, false once there are no more
+static bool get_view(int index, stats_view_t* out) {
+    TickType_t now = xTaskGetTickCount();
+    bool found = false;
+
+    taskENTER_CRITICAL(&stats_lock);
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        const stats_entry_t* entry = &entries[i];
+        if (!entry->used || index-- > 0) {
+            continue;
+        }
+
+        memcpy(out->bda, entry->bda, sizeof(esp_bd_addr_t));
+        out->conn_id = entry->conn_id;
+        out->flags = (entry->loaded ? STATS_FLAG_LOADED : 0) | (entry->dirty ? STATS_FLAG_DIRTY : 0);
+        out->session = entry->session;
+        out->session_seconds = entry->session_seconds;
+        out->lifetime = entry->stored;
+        add_record(&out->lifetime, &entry->unsaved);
+        if (entry->conn_id != STATS_NO_CONN) {
+            out->flags |= STATS_FLAG_CONNECTED;
+            out->session_seconds = pdTICKS_TO_MS(now - entry->session_start) / 1000;
+            out->lifetime.seconds += pdTICKS_TO_MS(now - entry->accounted_at) / 1000;
+        }
+        found = true;
+        break;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
 
+    return found;
+}
+
+static void format_view(buf_writer_t* writer, const stats_view_t* view) {
+    buf_writer_appendf(writer,
+        "---STATS---\n"
+        "Phone %02x:%02x:%02x:%02x:%02x:%02x",
+        view->bda[0],
+        view->bda[1],
+        view->bda[2],
+        view->bda[3],
+        view->bda[4],
+        view->bda[5]);
+    if (view->flags & STATS_FLAG_CONNECTED) {
+        buf_writer_appendf(writer, " (connection %d)", view->conn_id);
+    }
+    buf_writer_appendf(writer,
+        "\nSession (%lu s):\n"
+        "- Caught: %lu\n"
+        "- Fled: %lu\n"
+        "- Spin: %lu\n"
+        "- Catches/h: %u.%u, Spins/h: %u.%u\n",
+        (unsigned long)view->session_seconds,
+        (unsigned long)view->session.caught,
+        (unsigned long)view->session.fled,
+        (unsigned long)view->session.spin,
+        stats_rate_per_hour_x10(view->session.caught, view->session_seconds) / 10,
+        stats_rate_per_hour_x10(view->session.caught, view->session_seconds) % 10,
+        stats_rate_per_hour_x10(view->session.spin, view->session_seconds) / 10,
+        stats_rate_per_hour_x10(view->session.spin, view->session_seconds) % 10);
+    buf_writer_appendf(writer,
+        "Lifetime (%lu sessions, %lu s%s):\n"
+        "- Caught: %lu\n"
+        "- Fled: %lu\n"
+        "- Spin: %lu\n"
+        "- Catches/h: %u.%u, Spins/h: %u.%u\n",
+        (unsigned long)view->lifetime.sessions,
+        (unsigned long)view->lifetime.seconds,
+        (view->flags & STATS_FLAG_LOADED) ? "" : ", not loaded yet",
+        (unsigned long)view->lifetime.stats.caught,
+        (unsigned long)view->lifetime.stats.fled,
+        (unsigned long)view->lifetime.stats.spin,
+        stats_rate_per_hour_x10(view->lifetime.stats.caught, view->lifetime.seconds) / 10,
+        stats_rate_per_hour_x10(view->lifetime.stats.caught, view->lifetime.seconds) % 10,
+        stats_rate_per_hour_x10(view->lifetime.stats.spin, view->lifetime.seconds) / 10,
+        stats_rate_per_hour_x10(view->lifetime.stats.spin, view->lifetime.seconds) % 10);
+}
+
+void stats_get_runtime() {
+    char buf[512];
+    stats_view_t view;
+    int index = 0;
+    while (get_view(index++, &view)) {
+        buf_writer_t writer;
+        buf_writer_init(&writer, buf, sizeof(buf));
+        format_view(&writer, &view);
+        ESP_LOGI(STATS_TAG, "%s", buf);
+    }
+    if (index == 1) {
+        ESP_LOGI(STATS_TAG, "no stats found");
+    }
+}
+
+size_t stats_format_runtime(char* buf, size_t buf_len) {
     buf_writer_t writer;
     buf_writer_init(&writer, buf, buf_len);
-    for (size_t i = 0; i < stats_len; i++) {
-        buf_writer_appendf(&writer,
-            "---STATS---\n"
-            "Connection %d:\n"
-            "- Caught: %d\n"
-            "- Fled: %d\n"
-            "- Spin: %d\n",
-            stats[i].conn_id,
-            stats[i].stats.caught,
-            stats[i].stats.fled,
-            stats[i].stats.spin);
+
+    stats_view_t view;
+    for (int index = 0; get_view(index, &view); index++) {
+        format_view(&writer, &view);
     }
     return buf_writer_len(&writer);
 }
+
+static size_t put_u16(uint8_t* buf, uint16_t value) {
+    buf[0] = (uint8_t)(value & 0xFF);
+    buf[1] = (uint8_t)(value >> 8);
+    return 2;
+}
+
+static size_t put_u32(uint8_t* buf, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+    return 4;
+}
+
+size_t stats_serialize(uint8_t first, uint8_t* buf, size_t buf_len) {
+    if (buf_len < STATS_HEADER_LEN) {
+        return 0;
+    }
+
+    size_t offset = STATS_HEADER_LEN;
+    int phones = 0;
+    stats_view_t view;
+    for (int index = 0; get_view(index, &view); index++) {
+        phones++;
+        if (index < first || offset + STATS_RECORD_LEN > buf_len) {
+            continue;
+        }
+
+        uint8_t* record = buf + offset;
+        size_t n = 0;
+        memcpy(record, view.bda, sizeof(esp_bd_addr_t));
+        n += sizeof(esp_bd_addr_t);
+        n += put_u16(record + n, view.conn_id);
+        record[n++] = view.flags;
+        n += put_u32(record + n, view.session.caught);
+        n += put_u32(record + n, view.session.fled);
+        n += put_u32(record + n, view.session.spin);
+        n += put_u32(record + n, view.session_seconds);
+        n += put_u32(record + n, view.lifetime.stats.caught);
+        n += put_u32(record + n, view.lifetime.stats.fled);
+        n += put_u32(record + n, view.lifetime.stats.spin);
+        n += put_u32(record + n, view.lifetime.seconds);
+        n += put_u32(record + n, view.lifetime.sessions);
+        n += put_u16(record + n, stats_rate_per_hour_x10(view.session.caught, view.session_seconds));
+        n += put_u16(record + n, stats_rate_per_hour_x10(view.session.spin, view.session_seconds));
+        n += put_u16(record + n, stats_rate_per_hour_x10(view.lifetime.stats.caught, view.lifetime.seconds));
+        n += put_u16(record + n, stats_rate_per_hour_x10(view.lifetime.stats.spin, view.lifetime.seconds));
+        offset += n;
+    }
+
+    buf[0] = (uint8_t)phones;
+    buf[1] = first;
+    return offset;
+}
+
+static void stats_task(void* __attribute__((unused)) pvParameters) {
+    ESP_LOGI(STATS_TAG, "stats task start");
+
+    while (1) {
+        // woken early by session starts and ends, otherwise commits what connected phones counted
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STATS_FLUSH_INTERVAL_MS));
+        stats_flush();
+    }
+}
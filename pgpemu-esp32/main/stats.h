@@ -1,33 +1,77 @@
 #ifndef STATS_H
 #define STATS_H
 
+#include "connection_limits.h"
+#include "esp_bt_defs.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
-void stats_get_runtime();
+// phones whose stats are kept in RAM, like the session cache twice the connection count
+#define STATS_SLOTS (2 * MAX_CONNECTIONS)
+// lifetime totals are committed this often while phones are connected, and after every session
+#define STATS_FLUSH_INTERVAL_MS (5 * 60 * 1000)
 
-// Formats the same runtime stats as stats_get_runtime() into buf.
-// Returns the number of bytes written (excluding the null terminator).
-size_t stats_format_runtime(char* buf, size_t buf_len);
-
-void increment_caught(uint16_t conn_id);
-void increment_fled(uint16_t conn_id);
-void increment_spin(uint16_t conn_id);
+// GET_DEVICE_STATS response, little-endian: [phones u8][first u8] then per phone from first on, as many as fit
+// [bda 6][conn_id u16, 0xffff offline][flags u8]
+// [session caught u32][fled u32][spin u32][seconds u32]
+// [lifetime caught u32][fled u32][spin u32][seconds u32][sessions u32]
+// [session catches/h u16][spins/h u16][lifetime catches/h u16][spins/h u16], rates in tenths
+#define STATS_HEADER_LEN 2
+#define STATS_RECORD_LEN 53
+// flags of a record
+#define STATS_FLAG_CONNECTED 0x01
+#define STATS_FLAG_LOADED 0x02  // lifetime includes what NVS held at boot
+#define STATS_FLAG_DIRTY 0x04   // lifetime has counts not committed yet
 
 typedef struct {
-    uint16_t caught;
-    uint16_t fled;
-    uint16_t spin;
+    uint32_t caught;
+    uint32_t fled;
+    uint32_t spin;
 } Stats;
 
+// lifetime totals of a phone, stored as a blob in the device_stats namespace under its record key
 typedef struct {
-    uint16_t conn_id;
+    uint8_t version;
+    uint8_t reserved[3];
     Stats stats;
-} StatsForConn;
+    uint32_t sessions;
+    uint32_t seconds;  // connected time, rates are counts per connected hour
+} stats_record_t;
+
+// Counters are kept in RAM per BDA, the LED handler only increments them. A low priority task loads the
+// lifetime totals of new phones and commits what was counted in one NVS transaction per flush.
+bool init_stats();
 
-// Returns true and fills *out if a stats entry exists for conn_id.
-// Unlike the internal get_conn_entry(), never creates a new entry.
+// a phone finished its handshake on conn_id, counts for conn_id go to bda until stats_session_end()
+void stats_session_start(const esp_bd_addr_t bda, uint16_t conn_id);
+// conn_id disconnected, its connected time is added and a flush is scheduled
+void stats_session_end(uint16_t conn_id);
+
+void increment_caught(uint16_t conn_id);
+void increment_fled(uint16_t conn_id);
+void increment_spin(uint16_t conn_id);
+
+// commits all counts not yet in NVS, also loads lifetime totals not loaded yet
+bool stats_flush();
+
+// counts of the current session of conn_id, false if no phone is bound to it
 bool stats_get_for_conn(uint16_t conn_id, Stats* out);
 
+// erases the lifetime totals stored under a phone's record key, when its device record is evicted
+void stats_erase_stored(const char* record_key);
+
+// per hour in tenths, saturated to u16
+uint16_t stats_rate_per_hour_x10(uint32_t count, uint32_t seconds);
+
+void stats_get_runtime();
+
+// Formats the same runtime stats as stats_get_runtime() into buf.
+// Returns the number of bytes written (excluding the null terminator).
+size_t stats_format_runtime(char* buf, size_t buf_len);
+
+// writes the GET_DEVICE_STATS response starting with the first-th phone, returns its length
+size_t stats_serialize(uint8_t first, uint8_t* buf, size_t buf_len);
+
 #endif /* STATS_H */
@@ -66,6 +66,16 @@ for test_file in $TEST_FILES; do
 done
 echo ""
 
+# Firmware modules a test links instead of mirroring them, with the flags they need on the host shims
+# (paths relative to $TEST_DIR)
+ACL_CONNECTIONS=$(sed -n 's/^CONFIG_BT_ACL_CONNECTIONS=//p' pgpemu-esp32/sdkconfig)
+test_sources() {
+	case "$1" in
+	test_histogram) echo "../histogram.c" ;;
+	test_device_keys) echo "-Ihost -DCONFIG_BT_ACL_CONNECTIONS=$ACL_CONNECTIONS ../device_keys.c host/esp_host.c" ;;
+	esac
+}
+
 # Run each test
 test_count=0
 for test_file in $TEST_FILES; do
@@ -75,7 +85,7 @@ for test_file in $TEST_FILES; do
 	print_header "Running: $test_name"
 
 	# Compile
-	compile_output=$(cd "$TEST_DIR" && gcc -o "$test_name" "$test_name.c" -std=c99 2>&1)
+	compile_output=$(cd "$TEST_DIR" && gcc -o "$test_name" "$test_name.c" $(test_sources "$test_name") -std=c99 2>&1)
 	compile_status=$?
 
 	if [ $compile_status -ne 0 ]; then